@@ -0,0 +1,115 @@
+// Block codec throughput: utils::compressStream and decompressBlocks on a
+// file (e.g. a .cooked model or a .glb) or, without one, on the vertices and
+// indices of a generated grid mesh, for 1 and `threads` threads.
+//
+//   block_compress_bench [file | -] [block KiB = 128] [threads = 4]
+//                        [repetitions = 5]
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "block_compress.hpp"
+#include "mapped_file.hpp"
+#include "thread_pool.hpp"
+
+namespace {
+
+// 32-byte position, normal, uv records of a gently rolling grid, then its
+// triangle list: roughly what a cooked model stores.
+std::vector<unsigned char> gridMesh(int size) {
+  std::vector<float> vertices;
+  for (int y = 0; y < size; ++y) {
+    for (int x = 0; x < size; ++x) {
+      const float u = static_cast<float>(x) / (size - 1);
+      const float v = static_cast<float>(y) / (size - 1);
+      const float h = 0.1f * std::sin(u * 12.0f) * std::cos(v * 9.0f);
+      const float n = 1.0f / std::sqrt(1.0f + h * h);
+      const float record[8] = {u, h, v, 0.0f, n, 0.0f, u, v};
+      vertices.insert(vertices.end(), record, record + 8);
+    }
+  }
+  std::vector<std::uint32_t> indices;
+  for (int y = 0; y + 1 < size; ++y) {
+    for (int x = 0; x + 1 < size; ++x) {
+      const std::uint32_t i = static_cast<std::uint32_t>(y * size + x);
+      const std::uint32_t quad[6] = {i, i + size, i + 1,
+                                     i + 1, i + size, i + size + 1};
+      indices.insert(indices.end(), quad, quad + 6);
+    }
+  }
+  std::vector<unsigned char> bytes(vertices.size() * sizeof(float) +
+                                   indices.size() * sizeof(std::uint32_t));
+  std::memcpy(bytes.data(), vertices.data(), vertices.size() * sizeof(float));
+  std::memcpy(bytes.data() + vertices.size() * sizeof(float), indices.data(),
+              indices.size() * sizeof(std::uint32_t));
+  return bytes;
+}
+
+double seconds(std::chrono::steady_clock::time_point t0) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - t0)
+      .count();
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  const std::string path = argc > 1 ? argv[1] : "-";
+  const int blockKiB = argc > 2 ? std::max(1, std::atoi(argv[2])) : 128;
+  const std::size_t blockSize = static_cast<std::size_t>(blockKiB) << 10;
+  const unsigned threads =
+      argc > 3 ? static_cast<unsigned>(std::max(1, std::atoi(argv[3]))) : 4;
+  const int repetitions = argc > 4 ? std::max(1, std::atoi(argv[4])) : 5;
+
+  std::vector<unsigned char> input;
+  if (path == "-") {
+    input = gridMesh(1024);
+  } else {
+    const utils::MappedFile file(path);
+    const auto* data = reinterpret_cast<const unsigned char*>(file.data());
+    input.assign(data, data + file.size());
+  }
+  const double mb = static_cast<double>(input.size()) / (1 << 20);
+
+  const std::vector<unsigned char> stream = utils::compressStream(
+      input.data(), input.size(), blockSize, nullptr);
+  std::vector<unsigned char> output(input.size());
+  std::vector<utils::CompressedBlock> blocks;
+  utils::appendStreamBlocks(stream.data(), stream.size(), output.data(),
+                            output.size(), blocks);
+  utils::decompressBlocks(blocks, nullptr);
+  if (output != input) {
+    std::fprintf(stderr, "round trip mismatch\n");
+    return 1;
+  }
+
+  std::printf("%s: %.1f MB in %zu blocks of %zu KiB, compressed to %.1f%%\n",
+              path == "-" ? "grid mesh" : path.c_str(), mb, blocks.size(),
+              blockSize >> 10, 100.0 * stream.size() / input.size());
+  std::printf("%-8s %16s %16s\n", "threads", "compress MB/s",
+              "decompress MB/s");
+  for (unsigned t : {1u, threads}) {
+    // The calling thread works too, so t - 1 workers.
+    utils::ThreadPool pool(std::max(1u, t - 1));
+    utils::ThreadPool* poolArg = t > 1 ? &pool : nullptr;
+    double compress = 1e30, decompress = 1e30;
+    for (int r = 0; r < repetitions; ++r) {
+      auto t0 = std::chrono::steady_clock::now();
+      const std::vector<unsigned char> packed = utils::compressStream(
+          input.data(), input.size(), blockSize, poolArg);
+      compress = std::min(compress, seconds(t0));
+      t0 = std::chrono::steady_clock::now();
+      utils::decompressBlocks(blocks, poolArg);
+      decompress = std::min(decompress, seconds(t0));
+    }
+    std::printf("%-8u %16.1f %16.1f\n", t, mb / std::max(compress, 1e-9),
+                mb / std::max(decompress, 1e-9));
+    if (t == threads) break;
+  }
+  return 0;
+}
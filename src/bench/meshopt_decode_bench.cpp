@@ -0,0 +1,138 @@
+// Decode throughput of the EXT_meshopt_compression codecs on a synthetic
+// grid, scalar against the SIMD kernels this CPU supports.
+//
+//   meshopt_decode_bench [grid size = 512] [repetitions = 20]
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "cpu_features.hpp"
+#include "meshopt_decode.hpp"
+#include "meshopt_encode.hpp"
+
+namespace {
+
+struct Case {
+  const char* name;
+  utils::MeshoptMode mode;
+  utils::MeshoptFilter filter;
+  std::size_t count;
+  std::size_t stride;
+  std::vector<unsigned char> encoded;
+};
+
+// Best of `repetitions`, in decoded MB/s.
+double measure(const Case& c, int repetitions) {
+  std::vector<unsigned char> out(c.count * c.stride);
+  double best = 1e30;
+  for (int r = 0; r < repetitions; ++r) {
+    const auto t0 = std::chrono::steady_clock::now();
+    utils::decodeMeshoptBuffer(c.mode, c.filter, out.data(), c.count,
+                               c.stride, c.encoded.data(), c.encoded.size());
+    const double s = std::chrono::duration<double>(
+                         std::chrono::steady_clock::now() - t0)
+                         .count();
+    best = std::min(best, s);
+  }
+  return static_cast<double>(out.size()) / 1.0e6 / std::max(best, 1e-9);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  const int grid = argc > 1 ? std::max(2, std::atoi(argv[1])) : 512;
+  const int repetitions = argc > 2 ? std::max(1, std::atoi(argv[2])) : 20;
+  const auto n = static_cast<std::size_t>(grid + 1);
+  const std::size_t vertices = n * n;
+
+  // A wavy height field: quantized positions, unit normals, float uvs and
+  // per-vertex rotations.
+  std::vector<std::uint16_t> positions(vertices * 4, 0);
+  std::vector<float> normals(vertices * 4), uvs(vertices * 2);
+  std::vector<float> rotations(vertices * 4);
+  for (std::size_t y = 0; y < n; ++y) {
+    for (std::size_t x = 0; x < n; ++x) {
+      const std::size_t i = y * n + x;
+      const float u = static_cast<float>(x) / grid;
+      const float v = static_cast<float>(y) / grid;
+      const float h = 0.5f + 0.25f * std::sin(u * 12.0f) * std::cos(v * 9.0f);
+      positions[i * 4 + 0] = static_cast<std::uint16_t>(u * 65535.0f);
+      positions[i * 4 + 1] = static_cast<std::uint16_t>(h * 65535.0f);
+      positions[i * 4 + 2] = static_cast<std::uint16_t>(v * 65535.0f);
+      const float dx = -3.0f * std::cos(u * 12.0f) * std::cos(v * 9.0f);
+      const float dz = 2.25f * std::sin(u * 12.0f) * std::sin(v * 9.0f);
+      const float len = std::sqrt(dx * dx + 1.0f + dz * dz);
+      normals[i * 4 + 0] = dx / len;
+      normals[i * 4 + 1] = 1.0f / len;
+      normals[i * 4 + 2] = dz / len;
+      normals[i * 4 + 3] = 1.0f;
+      uvs[i * 2 + 0] = u * 4.0f;
+      uvs[i * 2 + 1] = v * 4.0f;
+      const float angle = h * 3.0f;
+      rotations[i * 4 + 0] = 0.0f;
+      rotations[i * 4 + 1] = std::sin(angle);
+      rotations[i * 4 + 2] = 0.0f;
+      rotations[i * 4 + 3] = std::cos(angle);
+    }
+  }
+  std::vector<std::uint32_t> indices;
+  indices.reserve(static_cast<std::size_t>(grid) * grid * 6);
+  for (std::size_t y = 0; y + 1 < n; ++y) {
+    for (std::size_t x = 0; x + 1 < n; ++x) {
+      const auto a = static_cast<std::uint32_t>(y * n + x);
+      const auto c = static_cast<std::uint32_t>(a + n);
+      indices.insert(indices.end(), {a, c, a + 1, a + 1, c, c + 1});
+    }
+  }
+
+  std::vector<std::int8_t> octNormals(vertices * 4);
+  bench::encodeOctahedral(octNormals.data(), vertices, 4, 8, normals.data());
+  std::vector<std::uint32_t> expUvs(vertices * 2);
+  bench::encodeExponential(expUvs.data(), expUvs.size(), uvs.data());
+  std::vector<std::int16_t> quats(vertices * 4);
+  bench::encodeQuaternion(quats.data(), vertices, 12, rotations.data());
+
+  using utils::MeshoptFilter;
+  using utils::MeshoptMode;
+  std::vector<Case> cases;
+  cases.push_back({"positions u16x4", MeshoptMode::Attributes,
+                   MeshoptFilter::None, vertices, 8,
+                   bench::encodeVertices(positions.data(), vertices, 8)});
+  cases.push_back({"normals oct8", MeshoptMode::Attributes,
+                   MeshoptFilter::Octahedral, vertices, 4,
+                   bench::encodeVertices(octNormals.data(), vertices, 4)});
+  cases.push_back({"uvs exp", MeshoptMode::Attributes,
+                   MeshoptFilter::Exponential, vertices, 8,
+                   bench::encodeVertices(expUvs.data(), vertices, 8)});
+  cases.push_back({"rotations quat16", MeshoptMode::Attributes,
+                   MeshoptFilter::Quaternion, vertices, 8,
+                   bench::encodeVertices(quats.data(), vertices, 8)});
+  cases.push_back({"triangles u32", MeshoptMode::Triangles,
+                   MeshoptFilter::None, indices.size(), 4,
+                   bench::encodeTriangles(indices)});
+  cases.push_back({"index sequence u32", MeshoptMode::Indices,
+                   MeshoptFilter::None, indices.size(), 4,
+                   bench::encodeIndexSequence(indices)});
+
+  const utils::CpuFeatures& cpu = utils::detectedCpuFeatures();
+  std::printf("%zu vertices, %zu triangles; SSSE3 %s, AVX2 %s\n", vertices,
+              indices.size() / 3, cpu.ssse3 ? "yes" : "no",
+              cpu.avx2 ? "yes" : "no");
+  std::printf("%-20s %10s %10s %12s %12s\n", "stream", "raw KB", "packed KB",
+              "scalar MB/s", "SIMD MB/s");
+  for (const Case& c : cases) {
+    utils::setSimdLevel(utils::SimdLevel::Scalar);
+    const double scalar = measure(c, repetitions);
+    utils::setSimdLevel(utils::SimdLevel::AVX2);
+    const double simd = measure(c, repetitions);
+    std::printf("%-20s %10.1f %10.1f %12.0f %12.0f\n", c.name,
+                c.count * c.stride / 1024.0, c.encoded.size() / 1024.0,
+                scalar, simd);
+  }
+  return 0;
+}
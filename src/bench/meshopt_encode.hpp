@@ -0,0 +1,329 @@
+#ifndef MESHOPT_ENCODE_HPP
+#define MESHOPT_ENCODE_HPP
+
+// Reference encoders for the EXT_meshopt_compression bitstreams, producing
+// input for the decode benchmark. They follow meshoptimizer's encoders
+// (vertex codec v0, index codec v1) but skip its tuning; files shipped to
+// the engine should still come from gltfpack.
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+namespace bench {
+
+namespace detail {
+
+constexpr std::size_t kByteGroupSize = 16;
+
+inline unsigned char zigzag8(unsigned char v) {
+  return static_cast<unsigned char>((static_cast<signed char>(v) >> 7) ^
+                                    (v << 1));
+}
+
+inline std::size_t measureGroup(const unsigned char* g, int bits) {
+  if (bits == 0) {
+    for (std::size_t i = 0; i < kByteGroupSize; ++i)
+      if (g[i] != 0) return ~std::size_t(0);
+    return 0;
+  }
+  if (bits == 8) return kByteGroupSize;
+  std::size_t size = kByteGroupSize * bits / 8;
+  const unsigned sentinel = (1u << bits) - 1;
+  for (std::size_t i = 0; i < kByteGroupSize; ++i) size += g[i] >= sentinel;
+  return size;
+}
+
+inline void encodeGroup(std::vector<unsigned char>& out,
+                        const unsigned char* g, int bits) {
+  if (bits == 0) return;
+  if (bits == 8) {
+    out.insert(out.end(), g, g + kByteGroupSize);
+    return;
+  }
+  const unsigned sentinel = (1u << bits) - 1;
+  const std::size_t perByte = 8 / bits;
+  for (std::size_t i = 0; i < kByteGroupSize; i += perByte) {
+    unsigned byte = 0;
+    for (std::size_t k = 0; k < perByte; ++k)
+      byte = (byte << bits) | (g[i + k] >= sentinel ? sentinel : g[i + k]);
+    out.push_back(static_cast<unsigned char>(byte));
+  }
+  for (std::size_t i = 0; i < kByteGroupSize; ++i)
+    if (g[i] >= sentinel) out.push_back(g[i]);
+}
+
+inline void encodeBytes(std::vector<unsigned char>& out,
+                        const unsigned char* buffer, std::size_t size) {
+  const std::size_t groups = size / kByteGroupSize;
+  const std::size_t header = out.size();
+  out.resize(out.size() + (groups + 3) / 4, 0);
+  static const int kBits[4] = {0, 2, 4, 8};
+  for (std::size_t g = 0; g < groups; ++g) {
+    const unsigned char* group = buffer + g * kByteGroupSize;
+    int best = 3;
+    std::size_t bestSize = measureGroup(group, 8);
+    for (int mode = 0; mode < 3; ++mode) {
+      const std::size_t s = measureGroup(group, kBits[mode]);
+      if (s < bestSize) best = mode, bestSize = s;
+    }
+    out[header + g / 4] |= static_cast<unsigned char>(best << ((g % 4) * 2));
+    encodeGroup(out, group, kBits[best]);
+  }
+}
+
+inline void encodeVByte(std::vector<unsigned char>& out, std::uint32_t v) {
+  do {
+    out.push_back(static_cast<unsigned char>((v & 127) | (v > 127 ? 128 : 0)));
+    v >>= 7;
+  } while (v);
+}
+
+inline std::uint32_t zigzag32(std::uint32_t d) {
+  return (d << 1) ^ static_cast<std::uint32_t>(static_cast<std::int32_t>(d) >>
+                                               31);
+}
+
+inline int quantizeSnorm(float v, int bits) {
+  const float scale = static_cast<float>((1 << (bits - 1)) - 1);
+  v = v < -1.0f ? -1.0f : (v > 1.0f ? 1.0f : v);
+  return static_cast<int>(v * scale + (v >= 0.0f ? 0.5f : -0.5f));
+}
+
+}  // namespace detail
+
+// `stride` must be a multiple of 4 up to 256.
+inline std::vector<unsigned char> encodeVertices(const void* vertices,
+                                                 std::size_t count,
+                                                 std::size_t stride) {
+  using namespace detail;
+  const auto* src = static_cast<const unsigned char*>(vertices);
+  std::vector<unsigned char> out{0xa0};
+  std::size_t blockSize = (8192 / stride) & ~(kByteGroupSize - 1);
+  if (blockSize > 256) blockSize = 256;
+
+  unsigned char last[256] = {};
+  if (count > 0) std::memcpy(last, src, stride);
+  unsigned char buffer[256];
+  for (std::size_t offset = 0; offset < count; offset += blockSize) {
+    const std::size_t n =
+        count - offset < blockSize ? count - offset : blockSize;
+    const std::size_t aligned =
+        (n + kByteGroupSize - 1) & ~(kByteGroupSize - 1);
+    const unsigned char* block = src + offset * stride;
+    for (std::size_t k = 0; k < stride; ++k) {
+      std::memset(buffer, 0, sizeof(buffer));
+      unsigned char p = last[k];
+      for (std::size_t i = 0; i < n; ++i) {
+        const unsigned char v = block[i * stride + k];
+        buffer[i] = zigzag8(static_cast<unsigned char>(v - p));
+        p = v;
+      }
+      encodeBytes(out, buffer, aligned);
+    }
+    std::memcpy(last, block + (n - 1) * stride, stride);
+  }
+
+  // Padding, then the first vertex as the decoder's initial prediction.
+  const std::size_t tail = stride < 32 ? 32 : stride;
+  out.resize(out.size() + tail - stride, 0);
+  if (count > 0)
+    out.insert(out.end(), src, src + stride);
+  else
+    out.resize(out.size() + stride, 0);
+  return out;
+}
+
+// Triangle list codec (version 1).
+inline std::vector<unsigned char> encodeTriangles(
+    const std::vector<std::uint32_t>& indices) {
+  using namespace detail;
+  static const unsigned char kCodeAux[16] = {
+      0x00, 0x76, 0x87, 0x56, 0x67, 0x78, 0xa9, 0x86,
+      0x65, 0x89, 0x68, 0x98, 0x01, 0x69, 0x00, 0x00};
+  static const int kOrder[3][3] = {{0, 1, 2}, {1, 2, 0}, {2, 0, 1}};
+
+  std::uint32_t edges[16][2];
+  std::uint32_t fifo[16];
+  std::memset(edges, 0xff, sizeof(edges));
+  std::memset(fifo, 0xff, sizeof(fifo));
+  std::size_t edgeOffset = 0, fifoOffset = 0;
+  std::uint32_t next = 0, last = 0;
+  const int fecmax = 13;
+
+  auto pushEdge = [&](std::uint32_t a, std::uint32_t b) {
+    edges[edgeOffset][0] = a;
+    edges[edgeOffset][1] = b;
+    edgeOffset = (edgeOffset + 1) & 15;
+  };
+  auto pushVertex = [&](std::uint32_t v) {
+    fifo[fifoOffset] = v;
+    fifoOffset = (fifoOffset + 1) & 15;
+  };
+  auto findVertex = [&](std::uint32_t v) {
+    for (int i = 0; i < 16; ++i)
+      if (fifo[(fifoOffset - 1 - i) & 15] == v) return i;
+    return -1;
+  };
+  auto findEdge = [&](std::uint32_t a, std::uint32_t b, std::uint32_t c) {
+    for (int i = 0; i < 16; ++i) {
+      const auto* e = edges[(edgeOffset - 1 - i) & 15];
+      if (e[0] == a && e[1] == b) return (i << 2) | 0;
+      if (e[0] == b && e[1] == c) return (i << 2) | 1;
+      if (e[0] == c && e[1] == a) return (i << 2) | 2;
+    }
+    return -1;
+  };
+  auto encodeIndex = [&](std::vector<unsigned char>& out, std::uint32_t v) {
+    encodeVByte(out, zigzag32(v - last));
+    last = v;
+  };
+
+  std::vector<unsigned char> codes;
+  std::vector<unsigned char> data;
+  for (std::size_t i = 0; i + 2 < indices.size(); i += 3) {
+    const std::uint32_t* t = &indices[i];
+    const int fer = findEdge(t[0], t[1], t[2]);
+    if (fer >= 0 && (fer >> 2) < 15) {
+      const int* order = kOrder[fer & 3];
+      const std::uint32_t a = t[order[0]], b = t[order[1]], c = t[order[2]];
+      const int fc = findVertex(c);
+      int fec = (fc >= 1 && fc < fecmax) ? fc : (c == next ? (next++, 0) : 15);
+      if (fec == 15 && c + 1 == last) fec = 13;
+      if (fec == 15 && c == last + 1) fec = 14;
+      codes.push_back(static_cast<unsigned char>(((fer >> 2) << 4) | fec));
+      if (fec == 15)
+        encodeIndex(data, c);
+      else if (fec >= 13)
+        last = c;
+      if (fec == 0 || fec >= fecmax) pushVertex(c);
+      pushEdge(c, b);
+      pushEdge(a, c);
+      continue;
+    }
+
+    const int rotation = t[1] == next ? 1 : (t[2] == next ? 2 : 0);
+    const int* order = kOrder[rotation];
+    const std::uint32_t a = t[order[0]], b = t[order[1]], c = t[order[2]];
+    bool reset = false;
+    if (a == 0 && b == 1 && c == 2 && next > 0) {
+      reset = true;
+      next = 0;
+      std::memset(fifo, 0xff, sizeof(fifo));
+    }
+    const int fb = findVertex(b);
+    const int fc = findVertex(c);
+    const int fea = a == next ? (next++, 0) : 15;
+    // b before c: either may take `next`.
+    const int feb =
+        (fb >= 0 && fb < 14) ? fb + 1 : (b == next ? (next++, 0) : 15);
+    const int fec =
+        (fc >= 0 && fc < 14) ? fc + 1 : (c == next ? (next++, 0) : 15);
+    const auto codeaux = static_cast<unsigned char>((feb << 4) | fec);
+    int table = -1;
+    for (int k = 0; k < 14 && table < 0; ++k)
+      if (kCodeAux[k] == codeaux) table = k;
+    if (fea == 0 && table >= 0 && !reset) {
+      codes.push_back(static_cast<unsigned char>(0xf0 | table));
+    } else {
+      codes.push_back(static_cast<unsigned char>(0xf0 | 14 | fea));
+      data.push_back(codeaux);
+    }
+    if (fea == 15) encodeIndex(data, a);
+    if (feb == 15) encodeIndex(data, b);
+    if (fec == 15) encodeIndex(data, c);
+    if (fea == 0 || fea == 15) pushVertex(a);
+    if (feb == 0 || feb == 15) pushVertex(b);
+    if (fec == 0 || fec == 15) pushVertex(c);
+    pushEdge(b, a);
+    pushEdge(c, b);
+    pushEdge(a, c);
+  }
+
+  std::vector<unsigned char> out{0xe1};
+  out.insert(out.end(), codes.begin(), codes.end());
+  out.insert(out.end(), data.begin(), data.end());
+  out.insert(out.end(), kCodeAux, kCodeAux + 16);
+  return out;
+}
+
+// Index sequence codec (version 1).
+inline std::vector<unsigned char> encodeIndexSequence(
+    const std::vector<std::uint32_t>& indices) {
+  using namespace detail;
+  std::vector<unsigned char> out{0xd1};
+  std::uint32_t last[2] = {0, 0};
+  unsigned current = 0;
+  for (std::uint32_t index : indices) {
+    const auto cd = static_cast<std::int32_t>(index - last[current]);
+    current ^= (cd < 0 ? -cd : cd) >= 30 ? 1u : 0u;
+    const std::uint32_t v = zigzag32(index - last[current]);
+    encodeVByte(out, (v << 1) | current);
+    last[current] = index;
+  }
+  out.resize(out.size() + 4, 0);
+  return out;
+}
+
+// Filter encoders: `data` holds 4 floats per element.
+inline void encodeOctahedral(void* dst, std::size_t count, std::size_t stride,
+                             int bits, const float* data) {
+  using namespace detail;
+  for (std::size_t i = 0; i < count; ++i) {
+    const float* n = data + i * 4;
+    const float l = std::fabs(n[0]) + std::fabs(n[1]) + std::fabs(n[2]);
+    const float s = l == 0.0f ? 0.0f : 1.0f / l;
+    const float nx = n[0] * s, ny = n[1] * s;
+    const float u =
+        n[2] >= 0.0f ? nx : (1 - std::fabs(ny)) * (nx >= 0.0f ? 1.0f : -1.0f);
+    const float v =
+        n[2] >= 0.0f ? ny : (1 - std::fabs(nx)) * (ny >= 0.0f ? 1.0f : -1.0f);
+    const int e[4] = {quantizeSnorm(u, bits), quantizeSnorm(v, bits),
+                      quantizeSnorm(1.0f, bits),
+                      quantizeSnorm(n[3], static_cast<int>(stride * 2))};
+    for (int k = 0; k < 4; ++k) {
+      if (stride == 4)
+        static_cast<std::int8_t*>(dst)[i * 4 + k] =
+            static_cast<std::int8_t>(e[k]);
+      else
+        static_cast<std::int16_t*>(dst)[i * 4 + k] =
+            static_cast<std::int16_t>(e[k]);
+    }
+  }
+}
+
+inline void encodeQuaternion(std::int16_t* dst, std::size_t count, int bits,
+                             const float* data) {
+  using namespace detail;
+  const float scaler = std::sqrt(2.0f);
+  for (std::size_t i = 0; i < count; ++i) {
+    const float* q = data + i * 4;
+    int qc = 0;
+    for (int k = 1; k < 4; ++k)
+      if (std::fabs(q[k]) > std::fabs(q[qc])) qc = k;
+    const float sign = q[qc] < 0.0f ? -1.0f : 1.0f;
+    std::int16_t* e = dst + i * 4;
+    for (int k = 0; k < 3; ++k)
+      e[k] = static_cast<std::int16_t>(
+          quantizeSnorm(q[(qc + 1 + k) & 3] * scaler * sign, bits));
+    e[3] = static_cast<std::int16_t>((quantizeSnorm(1.0f, bits) & ~3) | qc);
+  }
+}
+
+inline void encodeExponential(std::uint32_t* dst, std::size_t count,
+                              const float* data) {
+  for (std::size_t i = 0; i < count; ++i) {
+    int exponent = 0;
+    std::frexp(data[i], &exponent);
+    exponent -= 22;  // |mantissa| <= 2^22 fits the signed 24-bit field
+    const auto m = static_cast<std::int32_t>(
+        std::lround(std::ldexp(static_cast<double>(data[i]), -exponent)));
+    dst[i] = (static_cast<std::uint32_t>(exponent) << 24) |
+             (static_cast<std::uint32_t>(m) & 0xffffff);
+  }
+}
+
+}  // namespace bench
+
+#endif
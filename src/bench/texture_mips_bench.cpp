@@ -0,0 +1,145 @@
+// Mip chain generation throughput: utils::generateMipChain with the box and
+// Kaiser filters at each SIMD level, for linear and sRGB RGBA8 images. When a
+// GL context can be created, also the GL thread's side: uploading the chain
+// against uploading the base level for glGenerateMipmap.
+//
+//   texture_mips_bench [size = 2048] [repetitions = 5] [threads = 1]
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+#include "cpu_features.hpp"
+#include "texture.hpp"
+#include "texture_mips.hpp"
+#include "thread_pool.hpp"
+
+namespace {
+
+// Best of `repetitions`, in million source texels per second.
+double measure(const utils::TextureImage& source, utils::MipFilter filter,
+               utils::ThreadPool* pool, int repetitions) {
+  double best = 1e30;
+  for (int r = 0; r < repetitions; ++r) {
+    utils::TextureImage image = source;
+    const auto t0 = std::chrono::steady_clock::now();
+    utils::generateMipChain(image, filter, pool);
+    const double s = std::chrono::duration<double>(
+                         std::chrono::steady_clock::now() - t0)
+                         .count();
+    best = std::min(best, s);
+  }
+  const double texels = static_cast<double>(source.width) * source.height;
+  return texels / 1.0e6 / std::max(best, 1e-9);
+}
+
+// Best of `repetitions` of utils::createTexture on `image`, in milliseconds of
+// the GL thread; glFinish counts the driver and GPU work it queued.
+double measureUpload(const utils::TextureImage& image, int repetitions) {
+  double best = 1e30;
+  for (int r = 0; r < repetitions; ++r) {
+    glFinish();
+    const auto t0 = std::chrono::steady_clock::now();
+    GLuint tex = utils::createTexture(image);
+    glFinish();
+    best = std::min(best, std::chrono::duration<double, std::milli>(
+                              std::chrono::steady_clock::now() - t0)
+                              .count());
+    glDeleteTextures(1, &tex);
+  }
+  return best;
+}
+
+// Hidden window for a GL 3.3 core context; false when there is no display.
+bool createContext() {
+  if (!glfwInit()) return false;
+  glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+  glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+  glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+  glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+#ifdef __APPLE__
+  glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+#endif
+  GLFWwindow* window = glfwCreateWindow(64, 64, "bench", nullptr, nullptr);
+  if (!window) {
+    glfwTerminate();
+    return false;
+  }
+  glfwMakeContextCurrent(window);
+  return gladLoadGLLoader((GLADloadproc)glfwGetProcAddress) != 0;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  const int size = argc > 1 ? std::max(2, std::atoi(argv[1])) : 2048;
+  const int repetitions = argc > 2 ? std::max(1, std::atoi(argv[2])) : 5;
+  const unsigned threads =
+      argc > 3 ? static_cast<unsigned>(std::max(1, std::atoi(argv[3]))) : 1;
+
+  utils::TextureImage source;
+  source.width = source.height = size;
+  source.components = 4;
+  source.levels.emplace_back(static_cast<std::size_t>(size) * size * 4);
+  std::mt19937 rng(7);
+  for (unsigned char& v : source.levels[0])
+    v = static_cast<unsigned char>(rng());
+
+  // The calling thread works too, so threads - 1 workers.
+  utils::ThreadPool pool(std::max(1u, threads - 1));
+  utils::ThreadPool* poolArg = threads > 1 ? &pool : nullptr;
+
+  const utils::CpuFeatures& cpu = utils::detectedCpuFeatures();
+  std::printf("%dx%d RGBA8, %u thread(s); SSE2 %s, AVX2 %s; "
+              "million texels/s\n",
+              size, size, threads, cpu.sse2 ? "yes" : "no",
+              cpu.avx2 ? "yes" : "no");
+  std::printf("%-14s %10s %10s %10s\n", "filter", "scalar", "SSE2", "AVX2");
+  const struct {
+    const char* name;
+    utils::MipFilter filter;
+    bool srgb;
+  } cases[] = {{"box", utils::MipFilter::Box, false},
+               {"box sRGB", utils::MipFilter::Box, true},
+               {"kaiser", utils::MipFilter::Kaiser, false},
+               {"kaiser sRGB", utils::MipFilter::Kaiser, true}};
+  for (const auto& c : cases) {
+    source.srgb = c.srgb;
+    double rates[3];
+    const utils::SimdLevel levels[3] = {utils::SimdLevel::Scalar,
+                                        utils::SimdLevel::SSE,
+                                        utils::SimdLevel::AVX2};
+    for (int l = 0; l < 3; ++l) {
+      utils::setSimdLevel(levels[l]);
+      rates[l] = measure(source, c.filter, poolArg, repetitions);
+    }
+    std::printf("%-14s %10.1f %10.1f %10.1f\n", c.name, rates[0], rates[1],
+                rates[2]);
+  }
+
+  if (!createContext()) {
+    std::printf("GL upload: no GL context, skipped\n");
+    return 0;
+  }
+  // The default box filter's chain, as the loader threads hand it over.
+  utils::setSimdLevel(utils::SimdLevel::AVX2);
+  std::printf("\nGL thread, ms per texture (%s)\n",
+              reinterpret_cast<const char*>(glGetString(GL_RENDERER)));
+  std::printf("%-14s %16s %16s\n", "", "glGenerateMipmap", "upload chain");
+  for (const bool srgb : {false, true}) {
+    source.srgb = srgb;
+    utils::TextureImage chain = source;
+    utils::generateMipChain(chain, utils::MipFilter::Box, poolArg);
+    std::printf("%-14s %16.2f %16.2f\n", srgb ? "sRGB" : "linear",
+                measureUpload(source, repetitions),
+                measureUpload(chain, repetitions));
+  }
+  glfwTerminate();
+  return 0;
+}
@@ -0,0 +1,133 @@
+// Vertex transform throughput: the per-vertex glm loop DecodeGLB used to
+// run against utils::transformVertices at each SIMD level, for separate
+// (tightly packed) and interleaved float streams.
+//
+//   vertex_transform_bench [vertices = 4000000] [repetitions = 5]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <random>
+#include <vector>
+
+#include "cpu_features.hpp"
+#include "mesh.hpp"
+#include "vertex_transform.hpp"
+
+namespace {
+
+glm::vec3 loadVec3(const std::byte* base, std::size_t stride, std::size_t i) {
+  glm::vec3 v;
+  std::memcpy(&v, base + stride * i, sizeof(v));
+  return v;
+}
+
+glm::vec2 loadVec2(const std::byte* base, std::size_t stride, std::size_t i) {
+  glm::vec2 v;
+  std::memcpy(&v, base + stride * i, sizeof(v));
+  return v;
+}
+
+// The loop decodeVertices ran before the kernels.
+void glmLoop(const utils::VertexStreams& in, std::size_t count,
+             const glm::mat4& world, const glm::mat3& normalMat,
+             utils::VertexPU* dst) {
+  for (std::size_t i = 0; i < count; ++i) {
+    const glm::vec3 p = loadVec3(in.positions, in.positionStride, i);
+    const glm::vec3 n = loadVec3(in.normals, in.normalStride, i);
+    const glm::vec2 uv = loadVec2(in.uvs, in.uvStride, i);
+    dst[i] = {glm::vec3(world * glm::vec4(p, 1.0f)), uv,
+              glm::normalize(normalMat * n)};
+  }
+}
+
+// Best of `repetitions`, in million vertices per second.
+double measure(const std::function<void()>& run, std::size_t count,
+               int repetitions) {
+  double best = 1e30;
+  for (int r = 0; r < repetitions; ++r) {
+    const auto t0 = std::chrono::steady_clock::now();
+    run();
+    const double s = std::chrono::duration<double>(
+                         std::chrono::steady_clock::now() - t0)
+                         .count();
+    best = std::min(best, s);
+  }
+  return static_cast<double>(count) / 1.0e6 / std::max(best, 1e-9);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  const std::size_t count =
+      argc > 1 ? std::max(1L, std::atol(argv[1])) : 4000000;
+  const int repetitions = argc > 2 ? std::max(1, std::atoi(argv[2])) : 5;
+
+  std::mt19937 rng(7);
+  std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+  // Separate streams, and the same data interleaved as pos/normal/uv.
+  std::vector<float> positions(count * 3), normals(count * 3), uvs(count * 2);
+  for (float& v : positions) v = dist(rng) * 100.0f;
+  for (float& v : normals) v = dist(rng);
+  for (float& v : uvs) v = dist(rng);
+  std::vector<float> interleaved(count * 8);
+  for (std::size_t i = 0; i < count; ++i) {
+    std::memcpy(&interleaved[i * 8], &positions[i * 3], 12);
+    std::memcpy(&interleaved[i * 8 + 3], &normals[i * 3], 12);
+    std::memcpy(&interleaved[i * 8 + 6], &uvs[i * 2], 8);
+  }
+
+  utils::VertexStreams packed;
+  packed.positions = reinterpret_cast<const std::byte*>(positions.data());
+  packed.normals = reinterpret_cast<const std::byte*>(normals.data());
+  packed.uvs = reinterpret_cast<const std::byte*>(uvs.data());
+  const auto* base = reinterpret_cast<const std::byte*>(interleaved.data());
+  utils::VertexStreams strided;
+  strided.positions = base;
+  strided.normals = base + 12;
+  strided.uvs = base + 24;
+  strided.positionStride = strided.normalStride = strided.uvStride = 32;
+
+  const glm::mat4 world =
+      glm::translate(glm::mat4(1.0f), glm::vec3(1.0f, 2.0f, 3.0f)) *
+      glm::rotate(glm::mat4(1.0f), 0.5f, glm::vec3(0.0f, 1.0f, 0.0f)) *
+      glm::scale(glm::mat4(1.0f), glm::vec3(2.0f));
+  const glm::mat3 normalMat = glm::mat3(glm::transpose(glm::inverse(world)));
+  std::vector<utils::VertexPU> out(count);
+
+  const utils::CpuFeatures& cpu = utils::detectedCpuFeatures();
+  std::printf("%zu vertices; SSE2 %s, AVX2 %s; million vertices/s\n", count,
+              cpu.sse2 ? "yes" : "no", cpu.avx2 ? "yes" : "no");
+  std::printf("%-12s %10s %10s %10s %10s\n", "layout", "glm loop", "scalar",
+              "SSE2", "AVX2");
+  const struct {
+    const char* name;
+    const utils::VertexStreams* streams;
+  } layouts[] = {{"packed", &packed}, {"interleaved", &strided}};
+  for (const auto& layout : layouts) {
+    const utils::VertexStreams& in = *layout.streams;
+    const double glmRate = measure(
+        [&] { glmLoop(in, count, world, normalMat, out.data()); }, count,
+        repetitions);
+    double rates[3];
+    const utils::SimdLevel levels[3] = {utils::SimdLevel::Scalar,
+                                        utils::SimdLevel::SSE,
+                                        utils::SimdLevel::AVX2};
+    for (int l = 0; l < 3; ++l) {
+      utils::setSimdLevel(levels[l]);
+      rates[l] = measure(
+          [&] {
+            utils::transformVertices(in, count, world, normalMat, out.data());
+          },
+          count, repetitions);
+    }
+    std::printf("%-12s %10.1f %10.1f %10.1f %10.1f\n", layout.name, glmRate,
+                rates[0], rates[1], rates[2]);
+  }
+  return 0;
+}
@@ -5,22 +5,83 @@
 
 #include <array>
 #include <chrono>
+#include <cstdlib>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 #include <iostream>
 #include <memory>
+#include <string>
 #include <vector>
 
+#include "obj_loader/asyncModelLoader.hpp"
 #include "obj_loader/gltfLoaderTiny.hpp"
 #include "utils/primitives/cube.hpp"
 #include "utils/primitives/sphere.hpp"
 #include "utils/render_object.hpp"
 #include "utils/shader.hpp"
+#include "utils/texture.hpp"
+#include "utils/texture_streamer.hpp"
+#include "utils/vfs.hpp"
+#include "utils/virtual_texture.hpp"
 
 #define LOG(msg) std::cout << "[INFO] " << msg << std::endl
 #define LOG_ERROR(msg) std::cerr << "[ERROR] " << msg << std::endl
 
+namespace {
+unsigned envUnsigned(const char* name, unsigned fallback) {
+  const char* value = std::getenv(name);
+  if (!value || !*value) return fallback;
+  return static_cast<unsigned>(std::strtoul(value, nullptr, 10));
+}
+
+float envFloat(const char* name, float fallback) {
+  const char* value = std::getenv(name);
+  if (!value || !*value) return fallback;
+  return std::strtof(value, nullptr);
+}
+
+// The best block format the context samples in sRGB: BC7, else BC1/BC3,
+// else None. Needs the GL context.
+utils::TextureCompression bestTextureCompression() {
+  using utils::TextureCompression;
+  if (utils::textureCompressionSupported(TextureCompression::BC7, true))
+    return TextureCompression::BC7;
+  if (utils::textureCompressionSupported(TextureCompression::BC1, true))
+    return TextureCompression::BC1;
+  return TextureCompression::None;
+}
+
+// MGE_TEXTURE_COMPRESSION: bc1, bc3, bc7, or auto for
+// bestTextureCompression().
+utils::TextureCompression envTextureCompression() {
+  using utils::TextureCompression;
+  const char* value = std::getenv("MGE_TEXTURE_COMPRESSION");
+  const std::string name = value ? value : "";
+  if (name == "bc1") return TextureCompression::BC1;
+  if (name == "bc3") return TextureCompression::BC3;
+  if (name == "bc7") return TextureCompression::BC7;
+  if (name == "auto") return bestTextureCompression();
+  return TextureCompression::None;
+}
+
+// MGE_PAK: comma-separated archives (see make_pak) shaders and assets are
+// read from, later ones first. MGE_LOOSE_FILES=1 lets files on disk win.
+void mountPaks() {
+  utils::Vfs& vfs = utils::Vfs::instance();
+  vfs.setLooseOverrides(envUnsigned("MGE_LOOSE_FILES", 0) != 0);
+  const char* value = std::getenv("MGE_PAK");
+  const std::string list = value ? value : "";
+  for (std::size_t begin = 0; begin < list.size();) {
+    std::size_t end = list.find(',', begin);
+    if (end == std::string::npos) end = list.size();
+    if (end > begin) vfs.mount(list.substr(begin, end - begin));
+    begin = end + 1;
+  }
+  if (!list.empty()) LOG("Mounted " << vfs.mountedFiles() << " packed files");
+}
+}  // namespace
+
 class OpenGLCubeApp {
  public:
   void run() {
@@ -51,6 +112,10 @@ class OpenGLCubeApp {
   const int WIDTH = 1280;
   const int HEIGHT = 800;
 
+  static constexpr std::size_t kUploadBytesPerFrame = 8u << 20;
+  static constexpr double kUploadMsPerFrame = 2.0;
+  static constexpr double kFrameStatsSeconds = 5.0;
+
   void initWindow() {
     LOG("Initializing GLFW window...");
     if (!glfwInit()) {
@@ -89,6 +154,9 @@ class OpenGLCubeApp {
     shader = std::make_shared<Shader>("shaders/lit.vert", "shaders/lit.frag");
 
     glEnable(GL_DEPTH_TEST);
+    // GL_CULL_FACE itself is enabled by the draws that cull meshlets.
+    glCullFace(GL_BACK);
+    glFrontFace(GL_CCW);
 
     LOG("OpenGL initialization complete!");
   }
@@ -179,22 +247,89 @@ class OpenGLCubeApp {
     // cube1->color = {1, 0, 0, 1};
     // scene.push_back(std::move(cube1));
 
-    const auto data = std::make_shared<utils::ModelData>(
-        loader::LoadGLB_ToCPU("assets/power_armor.glb"));
-    const auto objectMesh = std::make_shared<utils::Mesh>();
-    objectMesh->upload(data->vertices, data->indices);
-
-    auto loadedObject =
-        std::make_unique<utils::RenderObject>(objectMesh, shader, data);
-    loadedObject->transform.scale = loadedObject->transform.scale * 0.01f;
-    loadedObject->transform.dirty = true;
+    loader::LoadOptions loadOptions;
+    loadOptions.threadCount = envUnsigned("MGE_LOADER_THREADS", 0);
+    if (const char* cacheDir = std::getenv("MGE_CACHE_DIR"))
+      loadOptions.cacheDir = cacheDir;
+    loadOptions.compressCooked = envUnsigned("MGE_COMPRESS_COOKED", 0) != 0;
+    loadOptions.instancing = envUnsigned("MGE_INSTANCING", 0) != 0;
+    loadOptions.keepQuantized = envUnsigned("MGE_KEEP_QUANTIZED", 1) != 0;
+    loadOptions.normalOptions.creaseAngle = envFloat("MGE_NORMAL_CREASE", 0.0f);
+    loadOptions.weld = envUnsigned("MGE_WELD", 0) != 0;
+    loadOptions.optimize = envUnsigned("MGE_OPTIMIZE", 0) != 0;
+    loadOptions.buildLods = envUnsigned("MGE_LODS", 0) != 0;
+    loadOptions.buildMeshlets = envUnsigned("MGE_MESHLETS", 0) != 0;
+    if (envUnsigned("MGE_PACKED_VERTICES", 0) != 0)
+      loadOptions.vertexFormat = utils::VertexFormat::Packed16;
+    loadOptions.textureCompression = envTextureCompression();
+    loadOptions.basisuTarget = bestTextureCompression();
+    loadOptions.textureArrays = envUnsigned("MGE_TEXTURE_ARRAYS", 0) != 0;
+    loadOptions.shareGpuObjects = envUnsigned("MGE_SHARE_GPU_OBJECTS", 1) != 0;
+    if (const char* filter = std::getenv("MGE_MIP_FILTER");
+        filter && std::string(filter) == "kaiser")
+      loadOptions.mipFilter = utils::MipFilter::Kaiser;
+
+    // Textures start with their small mips; the rest stream in as the
+    // camera needs them.
+    const bool textureStreaming =
+        envUnsigned("MGE_TEXTURE_STREAMING", 0) != 0;
+    utils::TextureStreamingOptions streamingOptions;
+    streamingOptions.budgetBytes =
+        std::size_t{envUnsigned("MGE_TEXTURE_BUDGET_MB", 256)} << 20;
+    utils::TextureStreamer textureStreamer(streamingOptions);
+    if (textureStreaming)
+      loadOptions.streamResidentSize = streamingOptions.residentSize;
+
+    // Base colors are cooked into page files; a feedback pass finds the
+    // pages on screen and only those are kept in the page cache.
+    std::unique_ptr<utils::VirtualTextureSystem> virtualTextures;
+    std::unique_ptr<Shader> feedbackShader;
+    if (envUnsigned("MGE_VIRTUAL_TEXTURES", 0) != 0) {
+      utils::VirtualTextureOptions vtOptions;
+      vtOptions.cachePages =
+          static_cast<int>(envUnsigned("MGE_VT_CACHE_PAGES", 16));
+      virtualTextures =
+          std::make_unique<utils::VirtualTextureSystem>(vtOptions);
+      feedbackShader = std::make_unique<Shader>("shaders/lit.vert",
+                                                "shaders/vt_feedback.frag");
+      loadOptions.virtualTextures = true;
+      loadOptions.virtualTextureLayout = vtOptions.layout;
+    }
 
-    scene.push_back(std::move(loadedObject));
+    // Decoding runs in the background; GL uploads are spread over frames and
+    // the object joins the scene once everything is on the GPU.
+    // MGE_MODEL: a .glb or .gltf to show instead of the default asset.
+    const char* modelPath = std::getenv("MGE_MODEL");
+    if (!modelPath || !*modelPath) modelPath = "assets/power_armor.glb";
+    loader::AsyncModelLoader modelLoader;
+    const double requestedAt = glfwGetTime();
+    modelLoader.load(
+        modelPath, loadOptions,
+        [&scene, &textureStreamer, textureStreaming, &virtualTextures, this,
+         requestedAt](std::shared_ptr<utils::ModelData> data,
+                      std::shared_ptr<utils::Mesh> mesh) {
+          if (textureStreaming) textureStreamer.track(data);
+          if (virtualTextures) virtualTextures->track(*data);
+          auto loadedObject =
+              std::make_unique<utils::RenderObject>(mesh, shader, data);
+          loadedObject->transform.scale = loadedObject->transform.scale * 0.01f;
+          loadedObject->transform.dirty = true;
+          scene.push_back(std::move(loadedObject));
+          LOG("Model ready after " << (glfwGetTime() - requestedAt) * 1000.0
+                                   << " ms, " << mesh->gpuBytes()
+                                   << " bytes of GPU geometry");
+        });
 
     float lastFrame = static_cast<float>(glfwGetTime());
+    double statsStart = glfwGetTime();
+    int statsFrames = 0;
+    utils::RenderStats renderStats;
+    const float lodPixelError = envFloat("MGE_LOD_PIXEL_ERROR", 1.0f);
+    const bool meshletCulling = envUnsigned("MGE_MESHLET_CULLING", 1) != 0;
 
     while (!glfwWindowShouldClose(window)) {
       glfwPollEvents();
+      modelLoader.update(kUploadBytesPerFrame, kUploadMsPerFrame);
 
       float now = static_cast<float>(glfwGetTime());
       float dt = now - lastFrame;
@@ -234,16 +369,85 @@ class OpenGLCubeApp {
       shader->setMat4("view", view);
       shader->setMat4("proj", proj);
 
+      utils::FrameContext frame;
+      frame.viewProj = proj * view;
+      frame.cameraPos = cameraPos;
+      frame.projScale = proj[1][1];
+      frame.viewportHeight = static_cast<float>(HEIGHT);
+      frame.lodPixelError = lodPixelError;
+      frame.meshletCulling = meshletCulling;
+      frame.stats = &renderStats;
+      if (textureStreaming) frame.textureStreamer = &textureStreamer;
+
       float angle = time * glm::radians(3.0f);
 
       for (auto& obj : scene) {
         obj->transform.rotation = glm::angleAxis(angle, glm::vec3(0, 1, 0));
         obj->transform.dirty = true;
+      }
 
-        obj->draw(proj * view);
+      if (virtualTextures) {
+        utils::FrameContext feedback = frame;
+        feedback.stats = nullptr;
+        feedback.textureStreamer = nullptr;
+        feedback.virtualTextures = virtualTextures.get();
+        feedback.shader = feedbackShader.get();
+        virtualTextures->beginFeedback(WIDTH, HEIGHT);
+        for (auto& obj : scene) obj->draw(feedback);
+        virtualTextures->endFeedback();
+        frame.virtualTextures = virtualTextures.get();
       }
 
+      for (auto& obj : scene) obj->draw(frame);
+      if (textureStreaming) textureStreamer.update();
+      if (virtualTextures) virtualTextures->update();
+
       glfwSwapBuffers(window);
+
+      ++statsFrames;
+      const double statsElapsed = glfwGetTime() - statsStart;
+      if (statsElapsed >= kFrameStatsSeconds) {
+        LOG("Frame time: " << statsElapsed * 1000.0 / statsFrames
+                           << " ms avg over " << statsFrames << " frames");
+        std::string lods;
+        for (std::size_t count : renderStats.submeshesPerLod)
+          lods += (lods.empty() ? "" : " / ") + std::to_string(count);
+        LOG("Per frame: " << renderStats.triangles / statsFrames
+                          << " triangles, " << renderStats.drawCalls /
+                                                   statsFrames
+                          << " draws, "
+                          << renderStats.textureBinds / statsFrames
+                          << " texture binds; submesh draws per LOD " << lods);
+        if (renderStats.meshlets > 0) {
+          const double culled = 100.0 * renderStats.meshletsCulled /
+                                static_cast<double>(renderStats.meshlets);
+          LOG("Meshlets culled: " << culled << "% of "
+                                  << renderStats.meshlets / statsFrames
+                                  << " per frame");
+        }
+        if (textureStreaming) {
+          const utils::TextureStreamer::Stats& streaming =
+              textureStreamer.stats();
+          LOG("Texture streaming: " << streaming.residentBytes / 1024
+                                    << " of " << streaming.fullBytes / 1024
+                                    << " KiB resident, "
+                                    << streaming.levelsLoaded << " levels "
+                                    << "loaded, " << streaming.levelsEvicted
+                                    << " evicted");
+        }
+        if (virtualTextures) {
+          const utils::VirtualTextureSystem::Stats& vt =
+              virtualTextures->stats();
+          LOG("Virtual textures: " << vt.residentPages << " of "
+                                   << vt.cachePages << " cache pages, "
+                                   << vt.pagesLoaded << " loaded, "
+                                   << vt.pagesEvicted << " evicted, "
+                                   << vt.readbacks << " readbacks");
+        }
+        statsStart = glfwGetTime();
+        statsFrames = 0;
+        renderStats = {};
+      }
     }
 
     LOG("Exiting main loop");
@@ -262,6 +466,7 @@ int main() {
   OpenGLCubeApp app;
 
   try {
+    mountPaks();
     app.run();
   } catch (const std::exception& e) {
     LOG_ERROR(e.what());
@@ -7,16 +7,73 @@ uniform vec3 uLightDirW;
 uniform vec4 uBaseColorFactor;
 uniform sampler2D uBaseColorTex;
 uniform bool uHasBaseColorTex;
+// >= 0: the texture is this layer of uBaseColorArray instead.
+uniform sampler2DArray uBaseColorArray;
+uniform int uBaseColorLayer;
+
+// Virtual base color (VirtualTextureSystem::bind); uVtSize = 0 turns it off.
+// The page table has a texel per page of every level, levels stacked by
+// rows: (cache slot x, slot y, level of the resident page, 1).
+uniform usampler2D uVtPageTable;
+uniform sampler2D uVtCache;
+uniform vec2 uVtSize;  // level-0 texels
+uniform int uVtMaxLevel;
+uniform int uVtPageSize;
+uniform int uVtBorder;
+uniform vec2 uVtClamp;  // 1 per clamped axis, else repeat
+uniform float uVtLodBias;
 
 out vec4 FragColor;
 
+ivec2 vtLevelSize(int level) {
+  return max(ivec2(uVtSize) >> level, ivec2(1));
+}
+
+ivec2 vtLevelPages(int level) {
+  return (vtLevelSize(level) + uVtPageSize - 1) / uVtPageSize;
+}
+
+vec4 sampleVirtual(vec2 uv) {
+  // The lod comes from the unwrapped coordinates, so seams do not spike it.
+  vec2 dx = dFdx(uv * uVtSize), dy = dFdy(uv * uVtSize);
+  float lod = 0.5 * log2(max(max(dot(dx, dx), dot(dy, dy)), 1e-8));
+  int level = clamp(int(floor(lod + uVtLodBias + 0.5)), 0, uVtMaxLevel);
+  uv = mix(fract(uv), clamp(uv, 0.0, 1.0), uVtClamp);
+
+  ivec2 size = vtLevelSize(level);
+  ivec2 page = min(ivec2(uv * vec2(size)) / uVtPageSize,
+                   vtLevelPages(level) - 1);
+  int row = 0;
+  for (int l = 0; l < level; ++l) row += vtLevelPages(l).y;
+  uvec4 entry = texelFetch(uVtPageTable, ivec2(page.x, row + page.y), 0);
+
+  // Until the page arrives the entry names a coarser ancestor.
+  int resident = int(entry.z);
+  vec2 texel = uv * vec2(vtLevelSize(resident));
+  ivec2 rpage = min(page >> (resident - level), vtLevelPages(resident) - 1);
+  // Odd level sizes can put the texel just outside the ancestor's page; its
+  // border covers that.
+  vec2 inPage = clamp(texel - vec2(rpage * uVtPageSize), vec2(-uVtBorder),
+                      vec2(uVtPageSize + uVtBorder));
+  float tile = float(uVtPageSize + 2 * uVtBorder);
+  vec2 cacheTexel = vec2(entry.xy) * tile + float(uVtBorder) + inPage;
+  return textureLod(uVtCache, cacheTexel / vec2(textureSize(uVtCache, 0)),
+                    0.0);
+}
+
 void main() {
   vec3 N = normalize(vNormalW);
   vec3 L = normalize(-uLightDirW);
   float diff = max(dot(N, L), 0.0);
   float ambient = 0.4;
 
-  vec4 texCol = uHasBaseColorTex ? texture(uBaseColorTex, vUV) : vec4(1.0);
+  vec4 texCol = vec4(1.0);
+  if (uVtSize.x > 0.0)
+    texCol = sampleVirtual(vUV);
+  else if (uHasBaseColorTex)
+    texCol = uBaseColorLayer >= 0
+                 ? texture(uBaseColorArray, vec3(vUV, float(uBaseColorLayer)))
+                 : texture(uBaseColorTex, vUV);
   vec4 base = uBaseColorFactor * texCol;
 
   vec3 lit = base.rgb * (ambient + (1.0 - ambient) * diff);
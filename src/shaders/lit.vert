@@ -2,20 +2,40 @@
 layout(location = 0) in vec3 aPos;
 layout(location = 1) in vec2 aUV;
 layout(location = 2) in vec3 aNormal;
+// Per-instance transform (divisor 1), used when uInstanced is set.
+layout(location = 3) in mat4 aInstance;
 
 uniform mat4 uModel;
+uniform bool uInstanced;
 uniform mat4 uViewProj;
 
+// Packed meshes: position = uPosOffset + uPosScale * aPos, and aNormal.xy
+// holds an octahedral-encoded normal.
+uniform vec3 uPosOffset;
+uniform vec3 uPosScale;
+uniform bool uOctNormal;
+
 out vec3 vNormalW;
 out vec3 vPosW;
 out vec2 vUV;
 
+vec3 octDecode(vec2 e) {
+  vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+  float t = max(-n.z, 0.0);
+  n.xy += mix(vec2(t), vec2(-t), greaterThanEqual(n.xy, vec2(0.0)));
+  return normalize(n);
+}
+
 void main() {
-  vec4 posW = uModel * vec4(aPos, 1.0);
+  vec3 pos = uPosOffset + uPosScale * aPos;
+  vec3 normal = uOctNormal ? octDecode(aNormal.xy) : aNormal;
+
+  mat4 model = uInstanced ? uModel * aInstance : uModel;
+  vec4 posW = model * vec4(pos, 1.0);
   vPosW = posW.xyz;
 
-  mat3 normalMat = mat3(transpose(inverse(uModel)));
-  vNormalW = normalize(normalMat * aNormal);
+  mat3 normalMat = mat3(transpose(inverse(model)));
+  vNormalW = normalize(normalMat * normal);
 
   vUV = aUV;
 
@@ -0,0 +1,34 @@
+#version 330 core
+in vec2 vUV;
+
+// Same uniforms as lit.frag's virtual path; uVtLodBias compensates for the
+// smaller target.
+uniform vec2 uVtSize;
+uniform int uVtMaxLevel;
+uniform int uVtPageSize;
+uniform vec2 uVtClamp;
+uniform float uVtLodBias;
+uniform int uVtId;
+
+// (page x, page y, level, texture id + 1); 0 = no virtual texture.
+out uvec4 FragColor;
+
+ivec2 vtLevelSize(int level) {
+  return max(ivec2(uVtSize) >> level, ivec2(1));
+}
+
+void main() {
+  if (uVtSize.x <= 0.0) {
+    FragColor = uvec4(0u);
+    return;
+  }
+  vec2 dx = dFdx(vUV * uVtSize), dy = dFdy(vUV * uVtSize);
+  float lod = 0.5 * log2(max(max(dot(dx, dx), dot(dy, dy)), 1e-8));
+  int level = clamp(int(floor(lod + uVtLodBias + 0.5)), 0, uVtMaxLevel);
+  vec2 uv = mix(fract(vUV), clamp(vUV, 0.0, 1.0), uVtClamp);
+
+  ivec2 size = vtLevelSize(level);
+  ivec2 pages = (size + uVtPageSize - 1) / uVtPageSize;
+  ivec2 page = min(ivec2(uv * vec2(size)) / uVtPageSize, pages - 1);
+  FragColor = uvec4(page, level, uVtId + 1);
+}
@@ -0,0 +1,34 @@
+// Packs directories into a pak archive for utils::Vfs. Entries are named by
+// their path relative to <root>, as the engine opens them
+// ("shaders/lit.vert").
+//
+//   make_pak <out.pak> <root> <dir>...
+
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <vector>
+
+#include "vfs.hpp"
+
+int main(int argc, char** argv) {
+  if (argc < 4) {
+    std::cerr << "usage: make_pak <out.pak> <root> <dir>..." << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  try {
+    std::vector<utils::PakSource> sources;
+    for (int i = 3; i < argc; ++i) {
+      const auto dir = utils::pakSourcesUnder(argv[2], argv[i]);
+      sources.insert(sources.end(), dir.begin(), dir.end());
+    }
+    utils::writePak(argv[1], sources);
+    std::cout << "Packed " << sources.size() << " files into " << argv[1]
+              << std::endl;
+  } catch (const std::exception& e) {
+    std::cerr << "[ERROR] " << e.what() << std::endl;
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
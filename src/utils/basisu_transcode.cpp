@@ -0,0 +1,462 @@
+#include "basisu_transcode.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+namespace utils {
+namespace {
+
+constexpr int kMaxCodeLength = 16;
+constexpr int kFastBits = 10;
+
+// Code length codes of read_huffman_table: 17/18 are runs of zeros, 19/20
+// repeat the previous length. Their lengths are sent in this order.
+constexpr int kCodeLengthCodes = 21;
+constexpr unsigned char kCodeLengthOrder[kCodeLengthCodes] = {
+    17, 18, 19, 20, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15, 16};
+
+// Endpoint prediction symbols pack four 2-bit predictions (one per block of
+// a 2x2 group); this one repeats the previous symbol instead.
+constexpr std::uint32_t kPredRepeatLast = 256;
+constexpr std::uint32_t kPredRepeatMin = 3;
+constexpr int kPredRepeatVlcBits = 4;
+constexpr std::uint32_t kSelectorRunMin = 3;
+constexpr std::uint32_t kSelectorRunSymbols = 64;
+constexpr int kSelectorRunVlcBits = 7;
+
+constexpr std::size_t kGlobalHeaderSize = 20;
+constexpr std::size_t kImageDescSize = 20;
+constexpr std::uint32_t kPFrame = 0x2;
+
+// ETC1 intensity modifiers in selector order.
+constexpr int kModifiers[8][4] = {
+    {-8, -2, 2, 8},       {-17, -5, 5, 17},    {-29, -9, 9, 29},
+    {-42, -13, 13, 42},   {-60, -18, 18, 60},  {-80, -24, 24, 80},
+    {-106, -33, 33, 106}, {-183, -47, 47, 183}};
+
+[[noreturn]] void malformed(const char* what) {
+  throw std::runtime_error(std::string("BasisLZ: ") + what);
+}
+
+std::uint32_t readU16(const unsigned char* p) { return p[0] | (p[1] << 8); }
+
+std::uint32_t readU32(const unsigned char* p) {
+  std::uint32_t v = 0;
+  std::memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+// LSB-first bit stream; reads past the end return zeros.
+class BitReader {
+ public:
+  BitReader(const unsigned char* data, std::size_t size)
+      : data_(data), size_(size) {}
+
+  std::uint32_t peek(int count) {
+    while (bits_ < count) {
+      const std::uint64_t byte = at_ < size_ ? data_[at_] : 0;
+      ++at_;
+      buffer_ |= byte << bits_;
+      bits_ += 8;
+    }
+    return static_cast<std::uint32_t>(buffer_ &
+                                      ((std::uint64_t{1} << count) - 1));
+  }
+  void skip(int count) {
+    buffer_ >>= count;
+    bits_ -= count;
+  }
+  std::uint32_t read(int count) {
+    if (count == 0) return 0;
+    const std::uint32_t v = peek(count);
+    skip(count);
+    return v;
+  }
+
+  // Variable-length count: `chunkBits`-bit chunks, each followed by a
+  // continuation bit.
+  std::uint32_t readVlc(int chunkBits) {
+    std::uint32_t v = 0;
+    for (int shift = 0;; shift += chunkBits) {
+      if (shift >= 32) malformed("bad variable-length count");
+      const std::uint32_t chunk = read(chunkBits + 1);
+      v += (chunk & ((1u << chunkBits) - 1)) << shift;
+      if (!(chunk >> chunkBits)) return v;
+    }
+  }
+
+  std::uint32_t decode(const Etc1sHuffman& code);
+
+ private:
+  const unsigned char* data_;
+  std::size_t size_;
+  std::size_t at_ = 0;
+  std::uint64_t buffer_ = 0;
+  int bits_ = 0;
+};
+
+// Codes are sent most significant bit first, so the fast table is indexed by
+// the bit-reversed code; longer ones are walked one bit at a time.
+std::uint32_t BitReader::decode(const Etc1sHuffman& code) {
+  if (code.symbols.empty()) malformed("symbol from an empty table");
+  const std::uint32_t entry = code.fast[peek(kFastBits)];
+  if (entry != 0) {
+    skip(static_cast<int>(entry & 0xFF));
+    return entry >> 8;
+  }
+  std::int32_t value = 0, first = 0, index = 0;
+  for (int length = 1; length <= kMaxCodeLength; ++length) {
+    value |= static_cast<std::int32_t>(read(1));
+    const std::int32_t count = code.counts[length];
+    if (value - first < count) return code.symbols[index + value - first];
+    index += count;
+    first = (first + count) << 1;
+    value <<= 1;
+  }
+  malformed("invalid Huffman code");
+}
+
+// Canonical code from per-symbol lengths (0 = unused). Incomplete codes are
+// allowed, oversubscribed ones are not.
+Etc1sHuffman buildHuffman(const std::vector<unsigned char>& lengths) {
+  Etc1sHuffman code;
+  for (unsigned char length : lengths) ++code.counts[length];
+  code.counts[0] = 0;
+  int left = 1;
+  for (int length = 1; length <= kMaxCodeLength; ++length) {
+    left = (left << 1) - code.counts[length];
+    if (left < 0) malformed("oversubscribed Huffman table");
+  }
+
+  std::uint16_t offsets[kMaxCodeLength + 2] = {};
+  for (int length = 1; length <= kMaxCodeLength; ++length)
+    offsets[length + 1] = offsets[length] + code.counts[length];
+  code.symbols.resize(offsets[kMaxCodeLength + 1]);
+  for (std::size_t s = 0; s < lengths.size(); ++s)
+    if (lengths[s])
+      code.symbols[offsets[lengths[s]]++] = static_cast<std::uint16_t>(s);
+
+  code.fast.assign(std::size_t{1} << kFastBits, 0);
+  std::uint32_t next = 0;
+  std::size_t index = 0;
+  for (int length = 1; length <= kFastBits; ++length) {
+    for (int i = 0; i < code.counts[length]; ++i, ++next, ++index) {
+      std::uint32_t reversed = 0;
+      for (int b = 0; b < length; ++b)
+        reversed |= ((next >> b) & 1u) << (length - 1 - b);
+      const std::uint32_t entry =
+          static_cast<std::uint32_t>(code.symbols[index]) << 8 |
+          static_cast<std::uint32_t>(length);
+      for (std::uint32_t fill = reversed; fill < code.fast.size();
+           fill += 1u << length)
+        code.fast[fill] = entry;
+    }
+    next <<= 1;
+  }
+  return code;
+}
+
+// read_huffman_table: the symbol count, a small code for the code lengths,
+// then the run-length coded lengths themselves.
+Etc1sHuffman readHuffman(BitReader& bits) {
+  const std::uint32_t symbolCount = bits.read(14);
+  if (symbolCount == 0) return {};
+
+  std::vector<unsigned char> lengthLengths(kCodeLengthCodes, 0);
+  const std::uint32_t lengthCodeCount = bits.read(5);
+  if (lengthCodeCount < 1 || lengthCodeCount > kCodeLengthCodes)
+    malformed("bad Huffman table");
+  for (std::uint32_t i = 0; i < lengthCodeCount; ++i)
+    lengthLengths[kCodeLengthOrder[i]] =
+        static_cast<unsigned char>(bits.read(3));
+  const Etc1sHuffman lengthCode = buildHuffman(lengthLengths);
+
+  std::vector<unsigned char> lengths(symbolCount, 0);
+  std::uint32_t at = 0;
+  while (at < symbolCount) {
+    const std::uint32_t symbol = bits.decode(lengthCode);
+    if (symbol <= kMaxCodeLength) {
+      lengths[at++] = static_cast<unsigned char>(symbol);
+      continue;
+    }
+    std::uint32_t run = 0;
+    unsigned char value = 0;
+    if (symbol == 17) {
+      run = bits.read(3) + 3;
+    } else if (symbol == 18) {
+      run = bits.read(7) + 11;
+    } else {
+      if (at == 0 || lengths[at - 1] == 0) malformed("bad Huffman table");
+      run = symbol == 19 ? bits.read(2) + 3 : bits.read(6) + 7;
+      value = lengths[at - 1];
+    }
+    if (run > symbolCount - at) malformed("bad Huffman table");
+    std::fill_n(lengths.begin() + at, run, value);
+    at += run;
+  }
+  return buildHuffman(lengths);
+}
+
+// approx_move_to_front: recently used selectors, new ones written from the
+// middle on and used ones bubbled halfway to the front.
+class SelectorHistory {
+ public:
+  explicit SelectorHistory(std::uint32_t size)
+      : values_(size, 0), rover_(size / 2) {}
+
+  std::uint32_t size() const {
+    return static_cast<std::uint32_t>(values_.size());
+  }
+  std::uint32_t operator[](std::uint32_t i) const { return values_[i]; }
+  void add(std::uint32_t value) {
+    values_[rover_++] = value;
+    if (rover_ == values_.size()) rover_ = size() / 2;
+  }
+  void use(std::uint32_t i) { std::swap(values_[i / 2], values_[i]); }
+
+ private:
+  std::vector<std::uint32_t> values_;
+  std::uint32_t rover_;
+};
+
+}  // namespace
+
+Etc1sDecoder::Etc1sDecoder(const unsigned char* sgd, std::size_t size,
+                           std::uint32_t imageCount) {
+  if (size < kGlobalHeaderSize) malformed("truncated global data");
+  const std::uint32_t endpointCount = readU16(sgd);
+  const std::uint32_t selectorCount = readU16(sgd + 2);
+  const std::size_t endpointBytes = readU32(sgd + 4);
+  const std::size_t selectorBytes = readU32(sgd + 8);
+  const std::size_t tableBytes = readU32(sgd + 12);
+  const std::size_t extendedBytes = readU32(sgd + 16);
+  const std::size_t descBytes = std::size_t{imageCount} * kImageDescSize;
+  if (endpointCount == 0 || selectorCount == 0 ||
+      kGlobalHeaderSize + descBytes + endpointBytes + selectorBytes +
+              tableBytes + extendedBytes > size)
+    malformed("bad global data");
+
+  const unsigned char* p = sgd + kGlobalHeaderSize;
+  for (std::uint32_t i = 0; i < imageCount; ++i, p += kImageDescSize)
+    images_.push_back({readU32(p), readU32(p + 4), readU32(p + 8),
+                       readU32(p + 12), readU32(p + 16)});
+
+  // Endpoint codebook: 5-bit colours and 3-bit intensities, each coded as a
+  // delta from the previous entry.
+  {
+    BitReader bits(p, endpointBytes);
+    const Etc1sHuffman colorCodes[3] = {readHuffman(bits), readHuffman(bits),
+                                        readHuffman(bits)};
+    const Etc1sHuffman intenCode = readHuffman(bits);
+    const bool grayscale = bits.read(1) != 0;
+    unsigned char prev[3] = {16, 16, 16};
+    unsigned char prevInten = 0;
+    endpoints_.resize(endpointCount);
+    for (Endpoint& e : endpoints_) {
+      prevInten = static_cast<unsigned char>(
+          (prevInten + bits.decode(intenCode)) & 7);
+      e.inten = prevInten;
+      for (int c = 0; c < (grayscale ? 1 : 3); ++c) {
+        const Etc1sHuffman& code =
+            colorCodes[prev[c] <= 9 ? 0 : prev[c] <= 21 ? 1 : 2];
+        prev[c] =
+            static_cast<unsigned char>((prev[c] + bits.decode(code)) & 31);
+        e.color[c] = prev[c];
+      }
+      if (grayscale) e.color[1] = e.color[2] = e.color[0];
+    }
+    p += endpointBytes;
+  }
+
+  // Selector codebook: a byte per row, either raw or XORed with the
+  // previous entry's.
+  {
+    BitReader bits(p, selectorBytes);
+    if (bits.read(1) || bits.read(1))
+      malformed("global or hybrid selector codebooks are not supported");
+    const bool raw = bits.read(1) != 0;
+    Etc1sHuffman deltaCode;
+    if (!raw) deltaCode = readHuffman(bits);
+    unsigned char prev[4] = {};
+    selectors_.resize(selectorCount);
+    for (std::uint32_t i = 0; i < selectorCount; ++i) {
+      std::uint32_t selector = 0;
+      for (int row = 0; row < 4; ++row) {
+        if (raw || i == 0) {
+          prev[row] = static_cast<unsigned char>(bits.read(8));
+        } else {
+          const std::uint32_t delta = bits.decode(deltaCode);
+          if (delta > 255) malformed("bad selector delta");
+          prev[row] ^= static_cast<unsigned char>(delta);
+        }
+        selector |= static_cast<std::uint32_t>(prev[row]) << (8 * row);
+      }
+      selectors_[i] = selector;
+    }
+    p += selectorBytes;
+  }
+
+  BitReader bits(p, tableBytes);
+  endpointPred_ = readHuffman(bits);
+  deltaEndpoint_ = readHuffman(bits);
+  selector_ = readHuffman(bits);
+  selectorHistoryRle_ = readHuffman(bits);
+  selectorHistorySize_ = bits.read(13);
+}
+
+bool Etc1sDecoder::hasAlpha() const {
+  return std::any_of(images_.begin(), images_.end(),
+                     [](const Image& image) { return image.alphaLength > 0; });
+}
+
+void Etc1sDecoder::decodeImage(std::uint32_t index, const unsigned char* level,
+                               std::size_t levelSize, int width, int height,
+                               unsigned char* rgba) const {
+  if (index >= images_.size()) malformed("missing image descriptor");
+  const Image& image = images_[index];
+  if (image.flags & kPFrame) malformed("video P-frames are not supported");
+  const auto slice = [&](std::uint32_t offset, std::uint32_t length) {
+    if (length == 0 || offset > levelSize || length > levelSize - offset)
+      malformed("bad slice range");
+    return level + offset;
+  };
+  decodeSlice(slice(image.rgbOffset, image.rgbLength), image.rgbLength, width,
+              height, false, rgba);
+  if (image.alphaLength > 0)
+    decodeSlice(slice(image.alphaOffset, image.alphaLength), image.alphaLength,
+                width, height, true, rgba);
+}
+
+// transcode_slice: per block an endpoint, predicted from the left, upper or
+// upper-left block or delta coded, and a selector, coded directly, through
+// the history buffer or as a run of the most recent one.
+void Etc1sDecoder::decodeSlice(const unsigned char* data, std::size_t size,
+                               int width, int height, bool alpha,
+                               unsigned char* rgba) const {
+  const std::uint32_t blocksX = static_cast<std::uint32_t>(width + 3) / 4;
+  const std::uint32_t blocksY = static_cast<std::uint32_t>(height + 3) / 4;
+  const std::uint32_t totalBlocks = blocksX * blocksY;
+  const std::uint32_t endpointCount =
+      static_cast<std::uint32_t>(endpoints_.size());
+  const std::uint32_t selectorCount =
+      static_cast<std::uint32_t>(selectors_.size());
+  const std::uint32_t runSymbol = selectorCount + selectorHistorySize_;
+
+  BitReader bits(data, size);
+  SelectorHistory history(selectorHistorySize_);
+  // Endpoint indices of the previous and current block rows, and the
+  // prediction bits an even row leaves for the odd row below it.
+  std::vector<std::uint32_t> upper(blocksX), current(blocksX);
+  std::vector<unsigned char> belowBits(blocksX);
+  std::uint32_t predBits = 0, prevPredSymbol = 0, predRepeat = 0;
+  std::uint32_t prevEndpoint = 0, selectorRun = 0;
+
+  for (std::uint32_t by = 0; by < blocksY; ++by) {
+    for (std::uint32_t bx = 0; bx < blocksX; ++bx) {
+      if ((bx & 1) == 0) {
+        if ((by & 1) == 0) {
+          if (predRepeat > 0) {
+            --predRepeat;
+            predBits = prevPredSymbol;
+          } else {
+            predBits = bits.decode(endpointPred_);
+            if (predBits == kPredRepeatLast) {
+              predRepeat =
+                  bits.readVlc(kPredRepeatVlcBits) + kPredRepeatMin - 1;
+              predBits = prevPredSymbol;
+            } else if (predBits > kPredRepeatLast) {
+              malformed("bad endpoint prediction");
+            } else {
+              prevPredSymbol = predBits;
+            }
+          }
+          belowBits[bx] = static_cast<unsigned char>(predBits >> 4);
+        } else {
+          predBits = belowBits[bx];
+        }
+      }
+
+      std::uint32_t endpoint = 0;
+      const std::uint32_t pred = predBits & 3;
+      predBits >>= 2;
+      if (pred == 0) {
+        if (bx == 0) malformed("left prediction at the left edge");
+        endpoint = prevEndpoint;
+      } else if (pred == 1) {
+        if (by == 0) malformed("upper prediction at the top edge");
+        endpoint = upper[bx];
+      } else if (pred == 2) {
+        if (bx == 0 || by == 0) malformed("upper-left prediction at an edge");
+        endpoint = upper[bx - 1];
+      } else {
+        endpoint = bits.decode(deltaEndpoint_) + prevEndpoint;
+        if (endpoint >= endpointCount) endpoint -= endpointCount;
+      }
+      if (endpoint >= endpointCount) malformed("bad endpoint index");
+      prevEndpoint = endpoint;
+      current[bx] = endpoint;
+
+      std::uint32_t symbol = 0;
+      if (selectorRun > 0) {
+        --selectorRun;
+        symbol = selectorCount;
+      } else {
+        symbol = bits.decode(selector_);
+        if (symbol == runSymbol) {
+          const std::uint32_t run = bits.decode(selectorHistoryRle_);
+          selectorRun = run == kSelectorRunSymbols - 1
+                            ? bits.readVlc(kSelectorRunVlcBits) +
+                                  kSelectorRunMin
+                            : run + kSelectorRunMin;
+          if (selectorRun > totalBlocks) malformed("bad selector run");
+          symbol = selectorCount;
+          --selectorRun;
+        }
+      }
+      std::uint32_t selector = 0;
+      if (symbol >= selectorCount) {
+        const std::uint32_t i = symbol - selectorCount;
+        if (i >= history.size()) malformed("bad selector history index");
+        selector = history[i];
+        if (i != 0) history.use(i);
+      } else {
+        selector = symbol;
+        if (selectorHistorySize_ > 0) history.add(symbol);
+      }
+      if (selector >= selectorCount) malformed("bad selector index");
+
+      // The block's four colours, then its texels clipped to the image.
+      const Endpoint& e = endpoints_[endpoint];
+      unsigned char colors[4][3];
+      for (int c = 0; c < 3; ++c) {
+        const int base = (e.color[c] << 3) | (e.color[c] >> 2);
+        for (int s = 0; s < 4; ++s)
+          colors[s][c] = static_cast<unsigned char>(
+              std::clamp(base + kModifiers[e.inten][s], 0, 255));
+      }
+      const std::uint32_t texels = selectors_[selector];
+      const int x0 = static_cast<int>(bx) * 4;
+      const int y0 = static_cast<int>(by) * 4;
+      for (int y = 0; y < 4 && y0 + y < height; ++y) {
+        unsigned char* row =
+            rgba + (static_cast<std::size_t>(y0 + y) * width + x0) * 4;
+        for (int x = 0; x < 4 && x0 + x < width; ++x, row += 4) {
+          const unsigned char* color = colors[(texels >> (8 * y + 2 * x)) & 3];
+          if (alpha) {
+            row[3] = color[1];
+          } else {
+            row[0] = color[0];
+            row[1] = color[1];
+            row[2] = color[2];
+            row[3] = 255;
+          }
+        }
+      }
+    }
+    upper.swap(current);
+  }
+}
+
+}  // namespace utils
@@ -0,0 +1,65 @@
+#ifndef BASISU_TRANSCODE_HPP
+#define BASISU_TRANSCODE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "texture.hpp"
+
+namespace utils {
+
+// Canonical Huffman code of a BasisLZ bit stream.
+struct Etc1sHuffman {
+  std::uint16_t counts[17] = {};      // codes per length 1..16
+  std::vector<std::uint16_t> symbols;  // ordered by code
+  std::vector<std::uint32_t> fast;     // symbol << 8 | length, by next bits
+};
+
+// Decoder of BasisLZ-supercompressed ETC1S, the Basis Universal codec KTX2
+// files use with supercompression scheme 1. The codebooks and Huffman tables
+// live in the file's supercompression global data and are shared by every
+// image; each image is one RGB slice plus an optional alpha slice of
+// Huffman-coded ETC1 block references. Throws std::runtime_error on
+// malformed or truncated input.
+class Etc1sDecoder {
+ public:
+  // `sgd` holds the global data of a file with `imageCount` images (one per
+  // mip level for a single 2D texture).
+  Etc1sDecoder(const unsigned char* sgd, std::size_t size,
+               std::uint32_t imageCount);
+
+  // Whether any image carries an alpha slice.
+  bool hasAlpha() const;
+
+  // Decodes image `index` of `width` x `height` texels to tightly packed
+  // RGBA8; its slices are byte ranges of `level`, the image's mip level
+  // data. Alpha is 255 without an alpha slice.
+  void decodeImage(std::uint32_t index, const unsigned char* level,
+                   std::size_t levelSize, int width, int height,
+                   unsigned char* rgba) const;
+
+ private:
+  struct Endpoint {
+    unsigned char color[3];  // 5 bits per channel
+    unsigned char inten;     // 0..7
+  };
+  struct Image {
+    std::uint32_t flags;
+    std::uint32_t rgbOffset, rgbLength;
+    std::uint32_t alphaOffset, alphaLength;
+  };
+
+  void decodeSlice(const unsigned char* data, std::size_t size, int width,
+                   int height, bool alpha, unsigned char* rgba) const;
+
+  std::vector<Endpoint> endpoints_;
+  std::vector<std::uint32_t> selectors_;  // 2 bits per texel, row-major
+  std::vector<Image> images_;
+  Etc1sHuffman endpointPred_, deltaEndpoint_, selector_, selectorHistoryRle_;
+  std::uint32_t selectorHistorySize_ = 0;
+};
+
+}  // namespace utils
+
+#endif
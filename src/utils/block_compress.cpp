@@ -0,0 +1,265 @@
+#include "block_compress.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#include "thread_pool.hpp"
+
+namespace utils {
+namespace {
+
+constexpr char kStreamMagic[4] = {'M', 'G', 'L', 'Z'};
+constexpr std::uint32_t kStoredBit = 0x80000000u;
+constexpr std::size_t kMaxBlockSize = std::size_t{1} << 24;
+
+struct StreamHeader {
+  char magic[4];
+  std::uint32_t blockSize;
+  std::uint64_t rawSize;
+};
+
+static_assert(sizeof(StreamHeader) == 16, "StreamHeader layout");
+
+constexpr int kHashBits = 14;
+constexpr std::size_t kMinMatch = 4;
+constexpr std::size_t kMaxOffset = 65535;
+// LZ4 ends every block with literals: the last match starts at least 12
+// bytes and ends at least 5 bytes before the end.
+constexpr std::size_t kMatchStartLimit = 12;
+constexpr std::size_t kLastLiterals = 5;
+
+inline std::uint32_t read32(const unsigned char* p) {
+  std::uint32_t v;
+  std::memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+inline std::uint32_t hashSequence(std::uint32_t sequence) {
+  return (sequence * 2654435761u) >> (32 - kHashBits);
+}
+
+// The part of a literal or match length that does not fit its token nibble.
+unsigned char* writeLength(unsigned char* op, std::size_t length) {
+  for (; length >= 255; length -= 255) *op++ = 255;
+  *op++ = static_cast<unsigned char>(length);
+  return op;
+}
+
+// matchLength 0 writes the closing literals-only sequence.
+unsigned char* writeSequence(unsigned char* op, const unsigned char* literals,
+                             std::size_t literalLength, std::size_t offset,
+                             std::size_t matchLength) {
+  unsigned char* token = op++;
+  const std::size_t literalNibble = std::min<std::size_t>(literalLength, 15);
+  if (literalLength >= 15) op = writeLength(op, literalLength - 15);
+  std::memcpy(op, literals, literalLength);
+  op += literalLength;
+  *token = static_cast<unsigned char>(literalNibble << 4);
+  if (matchLength == 0) return op;
+
+  *op++ = static_cast<unsigned char>(offset);
+  *op++ = static_cast<unsigned char>(offset >> 8);
+  const std::size_t extra = matchLength - kMinMatch;
+  const std::size_t matchNibble = std::min<std::size_t>(extra, 15);
+  if (extra >= 15) op = writeLength(op, extra - 15);
+  *token |= static_cast<unsigned char>(matchNibble);
+  return op;
+}
+
+// Adds 255-continued length bytes to `length`; false if they run past end.
+bool readLength(const unsigned char*& ip, const unsigned char* end,
+                std::size_t& length) {
+  unsigned char byte;
+  do {
+    if (ip == end) return false;
+    byte = *ip++;
+    length += byte;
+  } while (byte == 255);
+  return true;
+}
+
+}  // namespace
+
+std::size_t compressBound(std::size_t size) { return size + size / 255 + 16; }
+
+std::size_t compressBlock(const unsigned char* src, std::size_t size,
+                          unsigned char* dst) {
+  unsigned char* op = dst;
+  std::size_t anchor = 0;
+  if (size > kMatchStartLimit) {
+    std::vector<std::uint32_t> table(std::size_t{1} << kHashBits, 0);
+    const std::size_t matchStartLimit = size - kMatchStartLimit;
+    const std::size_t matchEndLimit = size - kLastLiterals;
+    std::size_t ip = 1, misses = 0;
+    while (ip < matchStartLimit) {
+      const std::uint32_t sequence = read32(src + ip);
+      const std::uint32_t h = hashSequence(sequence);
+      std::size_t ref = table[h];
+      table[h] = static_cast<std::uint32_t>(ip);
+      if (ip - ref > kMaxOffset || read32(src + ref) != sequence) {
+        // Step faster through data that keeps failing to match.
+        ip += 1 + (++misses >> 6);
+        continue;
+      }
+      misses = 0;
+      while (ip > anchor && ref > 0 && src[ip - 1] == src[ref - 1]) {
+        --ip;
+        --ref;
+      }
+      std::size_t length = kMinMatch;
+      while (ip + length < matchEndLimit &&
+             src[ip + length] == src[ref + length])
+        ++length;
+      op = writeSequence(op, src + anchor, ip - anchor, ip - ref, length);
+      ip += length;
+      anchor = ip;
+      if (ip < matchStartLimit)
+        table[hashSequence(read32(src + ip - 2))] =
+            static_cast<std::uint32_t>(ip - 2);
+    }
+  }
+  return static_cast<std::size_t>(
+      writeSequence(op, src + anchor, size - anchor, 0, 0) - dst);
+}
+
+bool decompressBlock(const unsigned char* src, std::size_t srcSize,
+                     unsigned char* dst, std::size_t dstSize) {
+  const unsigned char* ip = src;
+  const unsigned char* const srcEnd = src + srcSize;
+  unsigned char* op = dst;
+  unsigned char* const dstEnd = dst + dstSize;
+  for (;;) {
+    if (ip == srcEnd) return false;
+    const unsigned token = *ip++;
+
+    std::size_t literalLength = token >> 4;
+    if (literalLength == 15 && !readLength(ip, srcEnd, literalLength))
+      return false;
+    if (literalLength > static_cast<std::size_t>(srcEnd - ip) ||
+        literalLength > static_cast<std::size_t>(dstEnd - op))
+      return false;
+    if (literalLength) std::memcpy(op, ip, literalLength);
+    ip += literalLength;
+    op += literalLength;
+    if (ip == srcEnd) return op == dstEnd;
+
+    if (srcEnd - ip < 2) return false;
+    const std::size_t offset = ip[0] | (std::size_t{ip[1]} << 8);
+    ip += 2;
+    if (offset == 0 || offset > static_cast<std::size_t>(op - dst))
+      return false;
+    std::size_t matchLength = token & 15;
+    if (matchLength == 15 && !readLength(ip, srcEnd, matchLength))
+      return false;
+    matchLength += kMinMatch;
+    if (matchLength > static_cast<std::size_t>(dstEnd - op)) return false;
+
+    const unsigned char* match = op - offset;
+    if (offset >= matchLength) {
+      std::memcpy(op, match, matchLength);
+      op += matchLength;
+    } else {
+      // Overlapping: the match repeats the last `offset` bytes.
+      for (std::size_t i = 0; i < matchLength; ++i) *op++ = match[i];
+    }
+  }
+}
+
+std::vector<unsigned char> compressStream(const void* data, std::size_t size,
+                                          std::size_t blockSize,
+                                          ThreadPool* pool) {
+  if (blockSize == 0 || blockSize > kMaxBlockSize)
+    throw std::runtime_error("compressStream: bad block size");
+  const auto* src = static_cast<const unsigned char*>(data);
+  const std::size_t count = (size + blockSize - 1) / blockSize;
+
+  std::vector<std::vector<unsigned char>> blocks(count);
+  std::vector<std::uint32_t> sizes(count);
+  parallelFor(pool, count, [&](std::size_t b) {
+    const std::size_t begin = b * blockSize;
+    const std::size_t n = std::min(blockSize, size - begin);
+    std::vector<unsigned char>& block = blocks[b];
+    block.resize(compressBound(n));
+    const std::size_t packed = compressBlock(src + begin, n, block.data());
+    if (packed < n) {
+      block.resize(packed);
+      sizes[b] = static_cast<std::uint32_t>(packed);
+    } else {
+      block.assign(src + begin, src + begin + n);
+      sizes[b] = static_cast<std::uint32_t>(n) | kStoredBit;
+    }
+  });
+
+  StreamHeader header{};
+  std::memcpy(header.magic, kStreamMagic, sizeof(kStreamMagic));
+  header.blockSize = static_cast<std::uint32_t>(blockSize);
+  header.rawSize = size;
+  std::size_t total = sizeof(header) + count * sizeof(std::uint32_t);
+  for (const auto& block : blocks) total += block.size();
+
+  std::vector<unsigned char> out(total);
+  unsigned char* op = out.data();
+  std::memcpy(op, &header, sizeof(header));
+  op += sizeof(header);
+  if (count) std::memcpy(op, sizes.data(), count * sizeof(std::uint32_t));
+  op += count * sizeof(std::uint32_t);
+  for (const auto& block : blocks) {
+    std::memcpy(op, block.data(), block.size());
+    op += block.size();
+  }
+  return out;
+}
+
+std::size_t appendStreamBlocks(const unsigned char* data,
+                               std::size_t available, unsigned char* dst,
+                               std::size_t dstSize,
+                               std::vector<CompressedBlock>& blocks) {
+  StreamHeader header;
+  if (available < sizeof(header))
+    throw std::runtime_error("Truncated compressed stream");
+  std::memcpy(&header, data, sizeof(header));
+  if (std::memcmp(header.magic, kStreamMagic, sizeof(kStreamMagic)) != 0 ||
+      header.blockSize == 0 || header.blockSize > kMaxBlockSize)
+    throw std::runtime_error("Not a compressed stream");
+  if (header.rawSize != dstSize)
+    throw std::runtime_error("Compressed stream of unexpected size");
+
+  const std::size_t blockSize = header.blockSize;
+  const std::size_t count = (dstSize + blockSize - 1) / blockSize;
+  std::size_t at = sizeof(header);
+  if (count > (available - at) / sizeof(std::uint32_t))
+    throw std::runtime_error("Truncated compressed stream");
+  const unsigned char* table = data + at;
+  at += count * sizeof(std::uint32_t);
+
+  for (std::size_t b = 0; b < count; ++b) {
+    const std::uint32_t word = read32(table + b * sizeof(std::uint32_t));
+    const std::size_t size = word & ~kStoredBit;
+    const bool stored = (word & kStoredBit) != 0;
+    const std::size_t begin = b * blockSize;
+    const std::size_t raw = std::min(blockSize, dstSize - begin);
+    if (size > available - at)
+      throw std::runtime_error("Truncated compressed stream");
+    if (stored && size != raw)
+      throw std::runtime_error("Bad stored block in compressed stream");
+    blocks.push_back({data + at, size, dst + begin, raw, stored});
+    at += size;
+  }
+  return at;
+}
+
+void decompressBlocks(const std::vector<CompressedBlock>& blocks,
+                      ThreadPool* pool) {
+  parallelFor(pool, blocks.size(), [&](std::size_t i) {
+    const CompressedBlock& block = blocks[i];
+    if (block.stored) {
+      std::memcpy(block.dst, block.src, block.dstSize);
+    } else if (!decompressBlock(block.src, block.srcSize, block.dst,
+                                block.dstSize)) {
+      throw std::runtime_error("Corrupt compressed block");
+    }
+  });
+}
+
+}  // namespace utils
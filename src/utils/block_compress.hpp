@@ -0,0 +1,64 @@
+#ifndef BLOCK_COMPRESS_HPP
+#define BLOCK_COMPRESS_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace utils {
+
+class ThreadPool;
+
+// Default block size of compressStream: small enough that a model's streams
+// split into many blocks for the decode threads, large enough to keep the
+// per-block overhead and lost matches at block edges negligible.
+constexpr std::size_t kCompressedBlockSize = std::size_t{128} << 10;
+
+// Largest output of compressBlock for `size` input bytes.
+std::size_t compressBound(std::size_t size);
+
+// LZ4 block format: greedy single-probe hash matching, 64 KiB window. Fast
+// rather than tight; meant for data read far more often than written.
+// `dst` must hold compressBound(size) bytes; returns the bytes written.
+std::size_t compressBlock(const unsigned char* src, std::size_t size,
+                          unsigned char* dst);
+
+// False if `src` is malformed or does not decode to exactly `dstSize`
+// bytes. Never reads or writes outside the given ranges.
+bool decompressBlock(const unsigned char* src, std::size_t srcSize,
+                     unsigned char* dst, std::size_t dstSize);
+
+// Self-delimiting stream of `size` bytes cut into `blockSize` blocks, each
+// compressed on its own (or stored when that does not shrink it): a 16-byte
+// header, a table of block sizes, then the blocks. Blocks are compressed
+// across `pool` when given.
+std::vector<unsigned char> compressStream(
+    const void* data, std::size_t size,
+    std::size_t blockSize = kCompressedBlockSize, ThreadPool* pool = nullptr);
+
+// One block of a stream and where it decodes to.
+struct CompressedBlock {
+  const unsigned char* src;
+  std::size_t srcSize;
+  unsigned char* dst;
+  std::size_t dstSize;
+  bool stored;
+};
+
+// Appends the blocks of the stream at `data` (at most `available` bytes)
+// that decode into dst[0, dstSize), so several streams can be decoded in
+// one decompressBlocks call. Returns the stream's size in bytes. Throws
+// std::runtime_error if it is truncated, malformed or of another raw size.
+std::size_t appendStreamBlocks(const unsigned char* data,
+                               std::size_t available, unsigned char* dst,
+                               std::size_t dstSize,
+                               std::vector<CompressedBlock>& blocks);
+
+// Decodes `blocks` across `pool` (inline when null); throws
+// std::runtime_error on a corrupt block.
+void decompressBlocks(const std::vector<CompressedBlock>& blocks,
+                      ThreadPool* pool);
+
+}  // namespace utils
+
+#endif
@@ -0,0 +1,73 @@
+#include "cpu_features.hpp"
+
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(MGE_X86) && defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace utils {
+namespace {
+
+CpuFeatures detect() {
+  CpuFeatures f;
+#if defined(MGE_X86) && defined(__GNUC__)
+  __builtin_cpu_init();
+  f.sse2 = __builtin_cpu_supports("sse2");
+  f.ssse3 = __builtin_cpu_supports("ssse3");
+  f.sse41 = __builtin_cpu_supports("sse4.1");
+  f.avx = __builtin_cpu_supports("avx");
+  f.avx2 = __builtin_cpu_supports("avx2");
+  f.fma = __builtin_cpu_supports("fma");
+#elif defined(MGE_X86) && defined(_MSC_VER)
+  int regs[4];
+  __cpuid(regs, 0);
+  const int maxLeaf = regs[0];
+  __cpuid(regs, 1);
+  f.sse2 = (regs[3] & (1 << 26)) != 0;
+  f.ssse3 = (regs[2] & (1 << 9)) != 0;
+  f.sse41 = (regs[2] & (1 << 19)) != 0;
+  f.fma = (regs[2] & (1 << 12)) != 0;
+  // AVX also needs the OS to save the YMM state.
+  const bool osxsave = (regs[2] & (1 << 27)) != 0;
+  f.avx = osxsave && (regs[2] & (1 << 28)) != 0 &&
+          (_xgetbv(0) & 6) == 6;
+  f.fma = f.fma && f.avx;
+  if (maxLeaf >= 7) {
+    __cpuidex(regs, 7, 0);
+    f.avx2 = f.avx && (regs[1] & (1 << 5)) != 0;
+  }
+#endif
+  return f;
+}
+
+SimdLevel levelFromEnv() {
+  const char* value = std::getenv("MGE_NO_SIMD");
+  const bool disabled = value && std::strcmp(value, "0") != 0;
+  return disabled ? SimdLevel::Scalar : SimdLevel::AVX2;
+}
+
+std::atomic<SimdLevel> simdLevel{levelFromEnv()};
+
+}  // namespace
+
+const CpuFeatures& detectedCpuFeatures() {
+  static const CpuFeatures features = detect();
+  return features;
+}
+
+CpuFeatures cpuFeatures() {
+  const SimdLevel level = simdLevel.load(std::memory_order_relaxed);
+  if (level == SimdLevel::Scalar) return {};
+  CpuFeatures f = detectedCpuFeatures();
+  if (level == SimdLevel::SSE) f.avx = f.avx2 = f.fma = false;
+  return f;
+}
+
+void setSimdLevel(SimdLevel level) {
+  simdLevel.store(level, std::memory_order_relaxed);
+}
+
+}  // namespace utils
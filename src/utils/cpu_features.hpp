@@ -0,0 +1,42 @@
+#ifndef CPU_FEATURES_HPP
+#define CPU_FEATURES_HPP
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || \
+    defined(_M_IX86)
+#define MGE_X86 1
+#endif
+
+// Marks a function that uses intrinsics beyond the baseline target; callers
+// check cpuFeatures() first. MSVC compiles any intrinsic without it.
+#if defined(MGE_X86) && defined(__GNUC__)
+#define MGE_TARGET(features) __attribute__((target(features)))
+#else
+#define MGE_TARGET(features)
+#endif
+
+namespace utils {
+
+struct CpuFeatures {
+  bool sse2 = false;
+  bool ssse3 = false;
+  bool sse41 = false;
+  bool avx = false;
+  bool avx2 = false;
+  bool fma = false;
+};
+
+// What the CPU supports, detected once.
+const CpuFeatures& detectedCpuFeatures();
+
+// Widest kernels cpuFeatures() lets through; benchmarks and comparisons
+// lower it to reach the narrower paths.
+enum class SimdLevel { Scalar, SSE, AVX2 };
+
+// What SIMD kernels may use: detectedCpuFeatures() capped at the current
+// SimdLevel. MGE_NO_SIMD=1 in the environment starts at Scalar.
+CpuFeatures cpuFeatures();
+void setSimdLevel(SimdLevel level);
+
+}  // namespace utils
+
+#endif
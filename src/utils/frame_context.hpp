@@ -0,0 +1,54 @@
+#ifndef FRAME_CONTEXT_HPP
+#define FRAME_CONTEXT_HPP
+
+#include <array>
+#include <cstddef>
+#include <glm/glm.hpp>
+
+class Shader;
+
+namespace utils {
+
+class TextureStreamer;
+class VirtualTextureSystem;
+
+constexpr std::size_t kMaxLods = 8;
+
+// Counters RenderObject::draw adds to; the caller resets them.
+struct RenderStats {
+  std::array<std::size_t, kMaxLods> submeshesPerLod{};  // LOD 0 = full mesh
+  std::size_t triangles = 0;
+  std::size_t drawCalls = 0;
+  std::size_t textureBinds = 0;
+  std::size_t meshlets = 0;        // tested against the view
+  std::size_t meshletsCulled = 0;  // out of frustum or back-facing
+};
+
+// Per-frame view state shared by every RenderObject::draw call.
+struct FrameContext {
+  glm::mat4 viewProj{1.0f};
+  glm::vec3 cameraPos{0.0f};
+  // proj[1][1] = 1 / tan(fovy / 2); with viewportHeight it converts a
+  // world-space error at distance d into pixels.
+  float projScale = 1.0f;
+  float viewportHeight = 0.0f;
+  // Largest LOD error allowed on screen, in pixels; <= 0 always draws LOD 0.
+  float lodPixelError = 0.0f;
+  // Draw LOD 0 submeshes that have meshlets cluster by cluster, skipping
+  // clusters outside the frustum or facing away from the camera. Single-sided
+  // submeshes of such models are drawn with GL_CULL_FACE on.
+  bool meshletCulling = false;
+  RenderStats* stats = nullptr;
+  // Receives, for each submesh in the frustum, the texel density its base
+  // color texture is drawn at.
+  TextureStreamer* textureStreamer = nullptr;
+  // Binds virtual base color textures for materials that have one.
+  VirtualTextureSystem* virtualTextures = nullptr;
+  // Draws with this program instead of the object's own (e.g. the virtual
+  // texture feedback pass).
+  const Shader* shader = nullptr;
+};
+
+}  // namespace utils
+
+#endif
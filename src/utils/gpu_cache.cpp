@@ -0,0 +1,61 @@
+#include "gpu_cache.hpp"
+
+#include <algorithm>
+#include <iterator>
+
+namespace utils {
+
+SharedGpuObject::~SharedGpuObject() {
+  if (name_ == 0) return;
+  if (kind_ == GpuObjectKind::Texture)
+    glDeleteTextures(1, &name_);
+  else
+    glDeleteBuffers(1, &name_);
+}
+
+GpuObjectCache& GpuObjectCache::instance() {
+  static GpuObjectCache cache;
+  return cache;
+}
+
+GpuObjectRef GpuObjectCache::acquire(GpuObjectKind kind, const Hash128& key,
+                                     std::size_t bytes, bool& created) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  Table& table = kind == GpuObjectKind::Texture ? textures_ : buffers_;
+  std::weak_ptr<SharedGpuObject>& slot = table[key];
+  if (GpuObjectRef object = slot.lock()) {
+    created = false;
+    ++hits_;
+    savedBytes_ += object->bytes();
+    return object;
+  }
+  auto object = std::make_shared<SharedGpuObject>(kind, bytes);
+  slot = object;
+  created = true;
+  if (textures_.size() + buffers_.size() >= pruneAt_) pruneExpired();
+  return object;
+}
+
+void GpuObjectCache::pruneExpired() {
+  for (Table* table : {&textures_, &buffers_})
+    for (auto it = table->begin(); it != table->end();)
+      it = it->second.expired() ? table->erase(it) : std::next(it);
+  pruneAt_ =
+      std::max<std::size_t>(64, 2 * (textures_.size() + buffers_.size()));
+}
+
+GpuObjectCache::Stats GpuObjectCache::stats() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  Stats stats;
+  for (const Table* table : {&textures_, &buffers_})
+    for (const auto& entry : *table)
+      if (GpuObjectRef object = entry.second.lock()) {
+        ++stats.objects;
+        stats.bytes += object->bytes();
+      }
+  stats.hits = hits_;
+  stats.savedBytes = savedBytes_;
+  return stats;
+}
+
+}  // namespace utils
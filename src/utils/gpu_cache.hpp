@@ -0,0 +1,89 @@
+#ifndef GPU_CACHE_HPP
+#define GPU_CACHE_HPP
+
+#include <glad/glad.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+#include "hash.hpp"
+
+namespace utils {
+
+enum class GpuObjectKind : std::uint8_t { Texture, Buffer };
+
+// A GL texture or buffer shared by every model whose payload hashes to the
+// same key. The name is 0 until the reference that created the entry fills
+// it in; the object is deleted with its last reference, which must be
+// dropped on the GL thread.
+class SharedGpuObject {
+ public:
+  SharedGpuObject(GpuObjectKind kind, std::size_t bytes)
+      : kind_(kind), bytes_(bytes) {}
+  ~SharedGpuObject();
+
+  SharedGpuObject(const SharedGpuObject&) = delete;
+  SharedGpuObject& operator=(const SharedGpuObject&) = delete;
+
+  GLuint name() const { return name_; }
+  void setName(GLuint name) { name_ = name; }
+  GpuObjectKind kind() const { return kind_; }
+  std::size_t bytes() const { return bytes_; }
+
+ private:
+  GpuObjectKind kind_;
+  std::size_t bytes_;
+  GLuint name_ = 0;
+};
+
+using GpuObjectRef = std::shared_ptr<SharedGpuObject>;
+
+// Process-wide content-addressed table of GL objects: textures keyed by
+// their levels and sampler state, vertex and index buffers by their bytes.
+// Models loading the same payload get the same object instead of another
+// upload. Entries hold no reference themselves, so an object lives exactly
+// as long as some model uses it. Thread-safe; GL calls stay with the
+// callers (and ~SharedGpuObject).
+class GpuObjectCache {
+ public:
+  struct Stats {
+    std::size_t objects = 0;  // alive
+    std::size_t bytes = 0;    // of those
+    std::size_t hits = 0;
+    std::size_t savedBytes = 0;  // not uploaded thanks to hits
+  };
+
+  static GpuObjectCache& instance();
+
+  // The object stored under `key`, or a new one with no GL name yet, in
+  // which case `created` is set and the caller creates and uploads it.
+  GpuObjectRef acquire(GpuObjectKind kind, const Hash128& key,
+                       std::size_t bytes, bool& created);
+
+  Stats stats() const;
+
+ private:
+  struct KeyHash {
+    std::size_t operator()(const Hash128& key) const {
+      return static_cast<std::size_t>(key.lo);
+    }
+  };
+  using Table = std::unordered_map<Hash128, std::weak_ptr<SharedGpuObject>,
+                                   KeyHash>;
+
+  void pruneExpired();
+
+  mutable std::mutex mutex_;
+  Table textures_;
+  Table buffers_;
+  std::size_t pruneAt_ = 64;
+  std::size_t hits_ = 0;
+  std::size_t savedBytes_ = 0;
+};
+
+}  // namespace utils
+
+#endif
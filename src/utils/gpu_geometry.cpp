@@ -0,0 +1,218 @@
+#include "gpu_geometry.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace utils {
+namespace {
+
+std::uint16_t toUnorm16(float v) {
+  return static_cast<std::uint16_t>(
+      std::lround(std::clamp(v, 0.0f, 1.0f) * 65535.0f));
+}
+
+std::int16_t toSnorm16(float v) {
+  return static_cast<std::int16_t>(
+      std::lround(std::clamp(v, -1.0f, 1.0f) * 32767.0f));
+}
+
+void packVertices(const VertexPU* vertices, std::size_t vertexCount,
+                  GpuGeometry& out) {
+  glm::vec3 lo(0.0f), hi(0.0f);
+  if (vertexCount > 0) lo = hi = vertices[0].pos;
+  for (std::size_t i = 1; i < vertexCount; ++i) {
+    lo = glm::min(lo, vertices[i].pos);
+    hi = glm::max(hi, vertices[i].pos);
+  }
+  const glm::vec3 extent = hi - lo;
+  out.posOffset = lo;
+  out.posScale = extent;  // unorm16 reads back as [0, 1]
+
+  out.vertexBytes.resize(vertexCount * sizeof(VertexPacked));
+  auto* dst = reinterpret_cast<VertexPacked*>(out.vertexBytes.data());
+  for (std::size_t i = 0; i < vertexCount; ++i) {
+    const VertexPU& v = vertices[i];
+    VertexPacked p{};
+    for (int c = 0; c < 3; ++c)
+      p.pos[c] = extent[c] > 0.0f ? toUnorm16((v.pos[c] - lo[c]) / extent[c])
+                                  : 0;
+    p.uv[0] = floatToHalf(v.uv.x);
+    p.uv[1] = floatToHalf(v.uv.y);
+    const glm::vec2 oct = octEncode(v.normal);
+    p.normal[0] = toSnorm16(oct.x);
+    p.normal[1] = toSnorm16(oct.y);
+    dst[i] = p;
+  }
+}
+
+void appendSegment(const std::uint32_t* indices, std::uint32_t first,
+                   std::uint32_t count, bool narrow, GpuGeometry& out) {
+  if (count == 0) return;
+  const auto [lo, hi] =
+      std::minmax_element(indices + first, indices + first + count);
+
+  IndexSegment seg;
+  seg.first = first;
+  seg.count = count;
+  if (narrow && *hi - *lo <= 0xFFFFu) {
+    seg.type = GL_UNSIGNED_SHORT;
+    seg.baseVertex = static_cast<GLint>(*lo);
+    seg.byteOffset = out.indexBytes.size();
+    out.indexBytes.resize(seg.byteOffset + count * sizeof(std::uint16_t));
+    auto* dst = reinterpret_cast<std::uint16_t*>(out.indexBytes.data() +
+                                                 seg.byteOffset);
+    for (std::uint32_t i = 0; i < count; ++i)
+      dst[i] = static_cast<std::uint16_t>(indices[first + i] - *lo);
+  } else {
+    seg.type = GL_UNSIGNED_INT;
+    seg.byteOffset = (out.indexBytes.size() + 3) & ~std::size_t(3);
+    out.indexBytes.resize(seg.byteOffset + count * sizeof(std::uint32_t));
+    std::memcpy(out.indexBytes.data() + seg.byteOffset, indices + first,
+                count * sizeof(std::uint32_t));
+  }
+  out.segments.push_back(seg);
+}
+
+}  // namespace
+
+GpuGeometry buildGpuGeometry(const ModelData& model, VertexFormat format,
+                             bool narrowIndices) {
+  // LOD ranges get segments of their own so they can narrow independently.
+  std::vector<Submesh> ranges = model.submeshes;
+  for (const Submesh& sm : model.submeshes) {
+    for (const SubmeshLod& lod : sm.lods) {
+      Submesh range;
+      range.indexOffset = lod.indexOffset;
+      range.indexCount = lod.indexCount;
+      ranges.push_back(range);
+    }
+  }
+  if (!model.compact())
+    return buildGpuGeometry(model.vertexData(), model.vertexCount(),
+                            model.indexData(), model.indexCount(), ranges,
+                            format, narrowIndices);
+
+  // Compact records go to the GPU as they are, whatever `format` asks for.
+  GpuGeometry out = buildGpuGeometry(nullptr, 0, model.indexData(),
+                                     model.indexCount(), ranges,
+                                     VertexFormat::Compact, narrowIndices);
+  out.layout = model.compactLayout;
+  out.vertexCount = model.vertexCount();
+  const unsigned char* bytes = model.compactVertexData();
+  out.vertexBytes.assign(bytes,
+                         bytes + out.vertexCount * model.compactLayout.stride);
+  return out;
+}
+
+GpuGeometry buildGpuGeometry(const VertexPU* vertices,
+                             std::size_t vertexCount,
+                             const std::uint32_t* indices,
+                             std::size_t indexCount,
+                             const std::vector<Submesh>& ranges,
+                             VertexFormat format, bool narrowIndices) {
+  GpuGeometry out;
+  out.format = format;
+  out.layout = vertexLayout(format);
+  out.vertexCount = vertexCount;
+  out.indexCount = indexCount;
+
+  if (format == VertexFormat::Packed16) {
+    packVertices(vertices, vertexCount, out);
+  } else if (vertexCount > 0) {
+    const auto* bytes = reinterpret_cast<const unsigned char*>(vertices);
+    out.vertexBytes.assign(bytes, bytes + vertexCount * sizeof(VertexPU));
+  }
+
+  std::vector<Submesh> sorted = ranges;
+  std::sort(sorted.begin(), sorted.end(),
+            [](const Submesh& a, const Submesh& b) {
+              return a.indexOffset < b.indexOffset;
+            });
+  const auto total = static_cast<std::uint32_t>(indexCount);
+  std::uint32_t cursor = 0;
+  for (const Submesh& sm : sorted) {
+    const std::uint32_t begin = std::clamp(sm.indexOffset, cursor, total);
+    const std::uint32_t end =
+        std::clamp(sm.indexOffset + sm.indexCount, begin, total);
+    appendSegment(indices, cursor, begin - cursor, narrowIndices, out);
+    appendSegment(indices, begin, end - begin, narrowIndices, out);
+    cursor = end;
+  }
+  appendSegment(indices, cursor, total - cursor, narrowIndices, out);
+  return out;
+}
+
+std::uint16_t floatToHalf(float value) {
+  std::uint32_t bits = 0;
+  std::memcpy(&bits, &value, sizeof(bits));
+  const std::uint32_t sign = (bits >> 16) & 0x8000u;
+  const std::uint32_t absBits = bits & 0x7FFFFFFFu;
+
+  if (absBits >= 0x7F800000u)  // inf / nan
+    return static_cast<std::uint16_t>(sign | 0x7C00u |
+                                      (absBits > 0x7F800000u ? 0x200u : 0));
+  if (absBits >= 0x477FF000u)  // rounds past the largest half
+    return static_cast<std::uint16_t>(sign | 0x7C00u);
+  if (absBits < 0x38800000u) {  // subnormal or zero
+    const std::uint32_t mantissa = (absBits & 0x007FFFFFu) | 0x00800000u;
+    const int shift = 113 - static_cast<int>(absBits >> 23) + 13;
+    if (shift > 24) return static_cast<std::uint16_t>(sign);
+    std::uint32_t half = mantissa >> shift;
+    const std::uint32_t rest = mantissa & ((1u << shift) - 1);
+    const std::uint32_t halfway = 1u << (shift - 1);
+    if (rest > halfway || (rest == halfway && (half & 1u))) half++;
+    return static_cast<std::uint16_t>(sign | half);
+  }
+  std::uint32_t half = ((absBits - 0x38000000u) >> 13);
+  const std::uint32_t rest = absBits & 0x1FFFu;
+  if (rest > 0x1000u || (rest == 0x1000u && (half & 1u))) half++;
+  return static_cast<std::uint16_t>(sign | half);
+}
+
+float halfToFloat(std::uint16_t value) {
+  const std::uint32_t sign = static_cast<std::uint32_t>(value & 0x8000u) << 16;
+  const std::uint32_t exponent = (value >> 10) & 0x1Fu;
+  std::uint32_t mantissa = value & 0x3FFu;
+  std::uint32_t bits;
+  if (exponent == 0x1F) {
+    bits = sign | 0x7F800000u | (mantissa << 13);
+  } else if (exponent != 0) {
+    bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+  } else if (mantissa == 0) {
+    bits = sign;
+  } else {
+    int e = 113;
+    while (!(mantissa & 0x400u)) {
+      mantissa <<= 1;
+      --e;
+    }
+    bits = sign | (static_cast<std::uint32_t>(e) << 23) |
+           ((mantissa & 0x3FFu) << 13);
+  }
+  float out;
+  std::memcpy(&out, &bits, sizeof(out));
+  return out;
+}
+
+glm::vec2 octEncode(const glm::vec3& n) {
+  const float l1 = std::fabs(n.x) + std::fabs(n.y) + std::fabs(n.z);
+  if (l1 <= 0.0f) return glm::vec2(0.0f);
+  glm::vec2 e(n.x / l1, n.y / l1);
+  if (n.z < 0.0f) {
+    const glm::vec2 folded(1.0f - std::fabs(e.y), 1.0f - std::fabs(e.x));
+    e.x = e.x >= 0.0f ? folded.x : -folded.x;
+    e.y = e.y >= 0.0f ? folded.y : -folded.y;
+  }
+  return e;
+}
+
+glm::vec3 octDecode(const glm::vec2& e) {
+  glm::vec3 n(e.x, e.y, 1.0f - std::fabs(e.x) - std::fabs(e.y));
+  const float t = std::max(-n.z, 0.0f);
+  n.x += n.x >= 0.0f ? -t : t;
+  n.y += n.y >= 0.0f ? -t : t;
+  return glm::normalize(n);
+}
+
+}  // namespace utils
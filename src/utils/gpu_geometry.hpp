@@ -0,0 +1,35 @@
+#ifndef GPU_GEOMETRY_HPP
+#define GPU_GEOMETRY_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "mesh.hpp"
+
+namespace utils {
+
+// CPU stage of Mesh::upload(const GpuGeometry&): converts the vertices to
+// `format` and packs the index buffer per submesh range, as uint16 relative
+// to the range's lowest vertex whenever its vertex span fits in 16 bits.
+// Indices outside every submesh (or LOD) range get segments of their own.
+// Compact models keep their own vertex layout regardless of `format`.
+GpuGeometry buildGpuGeometry(const ModelData& model, VertexFormat format,
+                             bool narrowIndices = true);
+GpuGeometry buildGpuGeometry(const VertexPU* vertices,
+                             std::size_t vertexCount,
+                             const std::uint32_t* indices,
+                             std::size_t indexCount,
+                             const std::vector<Submesh>& ranges,
+                             VertexFormat format, bool narrowIndices = true);
+
+std::uint16_t floatToHalf(float value);
+float halfToFloat(std::uint16_t value);
+
+// Octahedral mapping of a unit vector onto [-1, 1]^2.
+glm::vec2 octEncode(const glm::vec3& n);
+glm::vec3 octDecode(const glm::vec2& e);
+
+}  // namespace utils
+
+#endif
@@ -0,0 +1,141 @@
+#include "hash.hpp"
+
+#include <cstring>
+
+#include "vfs.hpp"
+
+namespace utils {
+namespace {
+
+constexpr std::uint64_t kPrime1 = 0x9E3779B185EBCA87ull;
+constexpr std::uint64_t kPrime2 = 0xC2B2AE3D27D4EB4Full;
+constexpr std::uint64_t kPrime3 = 0x165667B19E3779F9ull;
+constexpr std::uint64_t kPrime4 = 0x85EBCA77C2B2AE63ull;
+constexpr std::uint64_t kPrime5 = 0x27D4EB2F165667C5ull;
+
+inline std::uint64_t rotl(std::uint64_t x, int r) {
+  return (x << r) | (x >> (64 - r));
+}
+
+inline std::uint64_t read64(const unsigned char* p) {
+  std::uint64_t v;
+  std::memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+inline std::uint32_t read32(const unsigned char* p) {
+  std::uint32_t v;
+  std::memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+inline std::uint64_t round(std::uint64_t acc, std::uint64_t input) {
+  acc += input * kPrime2;
+  acc = rotl(acc, 31);
+  return acc * kPrime1;
+}
+
+inline std::uint64_t mergeRound(std::uint64_t acc, std::uint64_t val) {
+  acc ^= round(0, val);
+  return acc * kPrime1 + kPrime4;
+}
+
+// Stripe accumulators of one XXH64 lane.
+struct Lanes {
+  std::uint64_t v1, v2, v3, v4;
+};
+
+inline Lanes startLanes(std::uint64_t seed) {
+  return {seed + kPrime1 + kPrime2, seed + kPrime2, seed, seed - kPrime1};
+}
+
+inline void consumeStripe(Lanes& l, const unsigned char* p) {
+  l.v1 = round(l.v1, read64(p));
+  l.v2 = round(l.v2, read64(p + 8));
+  l.v3 = round(l.v3, read64(p + 16));
+  l.v4 = round(l.v4, read64(p + 24));
+}
+
+inline std::uint64_t mergeLanes(const Lanes& l) {
+  std::uint64_t h =
+      rotl(l.v1, 1) + rotl(l.v2, 7) + rotl(l.v3, 12) + rotl(l.v4, 18);
+  h = mergeRound(h, l.v1);
+  h = mergeRound(h, l.v2);
+  h = mergeRound(h, l.v3);
+  return mergeRound(h, l.v4);
+}
+
+// The bytes after the last whole stripe, then the avalanche.
+std::uint64_t finish(std::uint64_t h, const unsigned char* p,
+                     const unsigned char* end, std::size_t size) {
+  h += static_cast<std::uint64_t>(size);
+
+  for (; p + 8 <= end; p += 8) {
+    h ^= round(0, read64(p));
+    h = rotl(h, 27) * kPrime1 + kPrime4;
+  }
+  if (p + 4 <= end) {
+    h ^= static_cast<std::uint64_t>(read32(p)) * kPrime1;
+    h = rotl(h, 23) * kPrime2 + kPrime3;
+    p += 4;
+  }
+  for (; p < end; ++p) {
+    h ^= (*p) * kPrime5;
+    h = rotl(h, 11) * kPrime1;
+  }
+
+  h ^= h >> 33;
+  h *= kPrime2;
+  h ^= h >> 29;
+  h *= kPrime3;
+  h ^= h >> 32;
+  return h;
+}
+
+// Seed offset of Hash128::hi, so its lane differs from `lo` for equal seeds.
+constexpr std::uint64_t kHighSeed = 0x6A09E667F3BCC908ull;
+
+}  // namespace
+
+std::uint64_t hash64(const void* data, std::size_t size, std::uint64_t seed) {
+  const auto* p = static_cast<const unsigned char*>(data);
+  const unsigned char* const end = p + size;
+  if (size < 32) return finish(seed + kPrime5, p, end, size);
+
+  Lanes lanes = startLanes(seed);
+  const unsigned char* const limit = end - 32;
+  do {
+    consumeStripe(lanes, p);
+    p += 32;
+  } while (p <= limit);
+  return finish(mergeLanes(lanes), p, end, size);
+}
+
+Hash128 hash128(const void* data, std::size_t size, const Hash128& seed) {
+  const auto* p = static_cast<const unsigned char*>(data);
+  const unsigned char* const end = p + size;
+  const std::uint64_t highSeed = seed.hi + kHighSeed;
+  if (size < 32)
+    return {finish(seed.lo + kPrime5, p, end, size),
+            finish(highSeed + kPrime5, p, end, size)};
+
+  // Both lanes per stripe: one pass over the data, eight independent
+  // accumulators.
+  Lanes lo = startLanes(seed.lo);
+  Lanes hi = startLanes(highSeed);
+  const unsigned char* const limit = end - 32;
+  do {
+    consumeStripe(lo, p);
+    consumeStripe(hi, p);
+    p += 32;
+  } while (p <= limit);
+  return {finish(mergeLanes(lo), p, end, size),
+          finish(mergeLanes(hi), p, end, size)};
+}
+
+std::uint64_t hashFile(const std::string& path) {
+  const VfsFile file = Vfs::instance().open(path);
+  return hash64(file.data(), file.size());
+}
+
+}  // namespace utils
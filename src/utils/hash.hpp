@@ -0,0 +1,33 @@
+#ifndef HASH_HPP
+#define HASH_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace utils {
+
+// XXH64 of a byte range.
+std::uint64_t hash64(const void* data, std::size_t size,
+                     std::uint64_t seed = 0);
+
+// 128-bit content key: two XXH64 lanes with different seeds, computed in
+// one pass. For a default seed, `lo` is hash64(data, size).
+struct Hash128 {
+  std::uint64_t lo = 0;
+  std::uint64_t hi = 0;
+
+  bool operator==(const Hash128& o) const { return lo == o.lo && hi == o.hi; }
+  bool operator!=(const Hash128& o) const { return !(*this == o); }
+};
+
+// Chain several ranges by passing the previous result as `seed`.
+Hash128 hash128(const void* data, std::size_t size, const Hash128& seed = {});
+
+// XXH64 of a file's contents, read through the Vfs; throws
+// std::runtime_error if it can't be read.
+std::uint64_t hashFile(const std::string& path);
+
+}  // namespace utils
+
+#endif
@@ -0,0 +1,226 @@
+#include "ktx2.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "basisu_transcode.hpp"
+#include "texture_compress.hpp"
+#include "zstd.h"
+
+namespace utils {
+namespace {
+
+constexpr unsigned char kIdentifier[12] = {0xAB, 'K',  'T',  'X',
+                                           ' ',  '2',  '0',  0xBB,
+                                           '\r', '\n', 0x1A, '\n'};
+
+// Byte offsets of the header fields and the level index.
+constexpr std::size_t kVkFormat = 12;
+constexpr std::size_t kPixelWidth = 20;
+constexpr std::size_t kPixelHeight = 24;
+constexpr std::size_t kPixelDepth = 28;
+constexpr std::size_t kLayerCount = 32;
+constexpr std::size_t kFaceCount = 36;
+constexpr std::size_t kLevelCount = 40;
+constexpr std::size_t kSupercompression = 44;
+constexpr std::size_t kDfdOffset = 48;
+constexpr std::size_t kDfdLength = 52;
+constexpr std::size_t kSgdOffset = 64;
+constexpr std::size_t kSgdLength = 72;
+constexpr std::size_t kLevelIndex = 80;
+constexpr std::size_t kLevelEntrySize = 24;
+
+constexpr std::uint32_t kBasisLz = 1;
+constexpr std::uint32_t kZstd = 2;
+
+// Data format descriptor: the basic block's colour model and transfer
+// function.
+constexpr std::size_t kDfdModel = 12;
+constexpr std::size_t kDfdTransfer = 14;
+constexpr std::size_t kDfdMinSize = 44;
+constexpr std::uint32_t kModelEtc1s = 163;
+constexpr std::uint32_t kModelUastc = 166;
+constexpr std::uint32_t kTransferSrgb = 2;
+
+std::uint32_t readU32(const unsigned char* p) {
+  std::uint32_t v = 0;
+  std::memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+std::uint64_t readU64(const unsigned char* p) {
+  std::uint64_t v = 0;
+  std::memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+struct Format {
+  TextureCompression compression;
+  int components;
+  bool srgb;
+};
+
+// The VkFormats TextureImage can hold as stored.
+bool lookupFormat(std::uint32_t vkFormat, Format& out) {
+  switch (vkFormat) {
+    case 9:  // R8_UNORM
+    case 15:  // R8_SRGB
+      out = {TextureCompression::None, 1, vkFormat == 15};
+      return true;
+    case 16:  // R8G8_UNORM
+    case 22:  // R8G8_SRGB
+      out = {TextureCompression::None, 2, vkFormat == 22};
+      return true;
+    case 23:  // R8G8B8_UNORM
+    case 29:  // R8G8B8_SRGB
+      out = {TextureCompression::None, 3, vkFormat == 29};
+      return true;
+    case 37:  // R8G8B8A8_UNORM
+    case 43:  // R8G8B8A8_SRGB
+      out = {TextureCompression::None, 4, vkFormat == 43};
+      return true;
+    case 131:  // BC1_RGB_UNORM_BLOCK
+    case 132:  // BC1_RGB_SRGB_BLOCK
+    case 133:  // BC1_RGBA_UNORM_BLOCK
+    case 134:  // BC1_RGBA_SRGB_BLOCK
+      out = {TextureCompression::BC1, 4, vkFormat % 2 == 0};
+      return true;
+    case 137:  // BC3_UNORM_BLOCK
+    case 138:  // BC3_SRGB_BLOCK
+      out = {TextureCompression::BC3, 4, vkFormat == 138};
+      return true;
+    case 145:  // BC7_UNORM_BLOCK
+    case 146:  // BC7_SRGB_BLOCK
+      out = {TextureCompression::BC7, 4, vkFormat == 146};
+      return true;
+    default:
+      return false;
+  }
+}
+
+[[noreturn]] void unsupported(const std::string& what) {
+  throw std::runtime_error("KTX2: " + what);
+}
+
+}  // namespace
+
+bool isKtx2(const unsigned char* data, std::size_t size) {
+  return size >= sizeof(kIdentifier) &&
+         std::memcmp(data, kIdentifier, sizeof(kIdentifier)) == 0;
+}
+
+TextureImage decodeKtx2(const unsigned char* data, std::size_t size,
+                        TextureCompression basisTarget) {
+  if (!isKtx2(data, size) || size < kLevelIndex)
+    throw std::runtime_error("KTX2: not a KTX 2.0 file");
+
+  const std::uint32_t vkFormat = readU32(data + kVkFormat);
+  const std::uint32_t supercompression = readU32(data + kSupercompression);
+  if (supercompression > kZstd)
+    unsupported("supercompression scheme " + std::to_string(supercompression));
+
+  TextureImage image;
+  image.width = static_cast<int>(readU32(data + kPixelWidth));
+  image.height = static_cast<int>(readU32(data + kPixelHeight));
+  if (image.width <= 0 || image.height <= 0 ||
+      readU32(data + kPixelDepth) != 0 || readU32(data + kLayerCount) > 1 ||
+      readU32(data + kFaceCount) != 1)
+    unsupported("only single 2D images are supported");
+
+  // 0 levels: only the base level is stored.
+  const std::uint32_t levelCount =
+      std::max<std::uint32_t>(1, readU32(data + kLevelCount));
+  const int maxLevels = mipLevelCount(image.width, image.height);
+  if (levelCount > static_cast<std::uint32_t>(maxLevels) ||
+      kLevelIndex + std::size_t{levelCount} * kLevelEntrySize > size)
+    throw std::runtime_error("KTX2: bad level index");
+  for (std::uint32_t level = 0; level < levelCount; ++level) {
+    const unsigned char* entry = data + kLevelIndex + level * kLevelEntrySize;
+    const std::uint64_t offset = readU64(entry);
+    const std::uint64_t length = readU64(entry + 8);
+    if (offset > size || length > size - offset)
+      throw std::runtime_error("KTX2: bad level " + std::to_string(level));
+  }
+  const auto levelEntry = [&](std::uint32_t level) {
+    return data + kLevelIndex + level * kLevelEntrySize;
+  };
+
+  // A level's bytes as stored, inflated first under Zstandard; `expected`
+  // is the size they must have.
+  std::vector<unsigned char> inflated;
+  const auto levelBytes = [&](std::uint32_t level, std::size_t expected) {
+    const unsigned char* entry = levelEntry(level);
+    const unsigned char* bytes = data + readU64(entry);
+    const std::uint64_t length = readU64(entry + 8);
+    const std::uint64_t rawLength =
+        supercompression == kZstd ? readU64(entry + 16) : length;
+    if (rawLength != expected)
+      throw std::runtime_error("KTX2: bad level " + std::to_string(level));
+    if (supercompression != kZstd) return bytes;
+    inflated.resize(expected);
+    const std::size_t written =
+        ZSTD_decompress(inflated.data(), inflated.size(), bytes, length);
+    if (ZSTD_isError(written) || written != expected)
+      throw std::runtime_error("KTX2: corrupt Zstandard level " +
+                               std::to_string(level));
+    return static_cast<const unsigned char*>(inflated.data());
+  };
+
+  Format format{};
+  if (lookupFormat(vkFormat, format)) {
+    if (supercompression == kBasisLz)
+      throw std::runtime_error("KTX2: BasisLZ without ETC1S data");
+    image.components = format.components;
+    image.srgb = format.srgb;
+    image.compression = format.compression;
+    for (std::uint32_t level = 0; level < levelCount; ++level) {
+      const std::size_t length = mipLevelSize(image, static_cast<int>(level));
+      const unsigned char* bytes = levelBytes(level, length);
+      image.levels.emplace_back(bytes, bytes + length);
+    }
+    return image;
+  }
+
+  // VK_FORMAT_UNDEFINED: the data format descriptor says what it is.
+  const std::uint64_t dfd = readU32(data + kDfdOffset);
+  if (vkFormat != 0 || readU32(data + kDfdLength) < kDfdMinSize ||
+      dfd + kDfdMinSize > size)
+    unsupported("vkFormat " + std::to_string(vkFormat));
+  const std::uint32_t model = data[dfd + kDfdModel];
+  image.srgb = data[dfd + kDfdTransfer] == kTransferSrgb;
+  image.components = 4;
+
+  if (model == kModelEtc1s) {
+    if (supercompression != kBasisLz)
+      throw std::runtime_error("KTX2: ETC1S without BasisLZ");
+    const std::uint64_t sgd = readU64(data + kSgdOffset);
+    const std::uint64_t sgdLength = readU64(data + kSgdLength);
+    if (sgd > size || sgdLength > size - sgd)
+      throw std::runtime_error("KTX2: bad supercompression global data");
+    const Etc1sDecoder decoder(data + sgd, sgdLength, levelCount);
+    for (std::uint32_t level = 0; level < levelCount; ++level) {
+      const int w = std::max(1, image.width >> level);
+      const int h = std::max(1, image.height >> level);
+      const unsigned char* entry = levelEntry(level);
+      image.levels.emplace_back(static_cast<std::size_t>(w) * h * 4);
+      decoder.decodeImage(level, data + readU64(entry), readU64(entry + 8), w,
+                          h, image.levels.back().data());
+    }
+    // compressTexture turns BC1 into BC3 where there is alpha.
+    if (basisTarget == TextureCompression::BC3)
+      basisTarget = TextureCompression::BC1;
+    compressTexture(image, basisTarget);
+    return image;
+  }
+
+  // Transcoding UASTC needs the Basis Universal transcoder, which is not
+  // part of the tree.
+  if (model == kModelUastc) unsupported("UASTC");
+  unsupported("colour model " + std::to_string(model));
+}
+
+}  // namespace utils
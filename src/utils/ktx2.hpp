@@ -0,0 +1,26 @@
+#ifndef KTX2_HPP
+#define KTX2_HPP
+
+#include <cstddef>
+
+#include "texture.hpp"
+
+namespace utils {
+
+// True when `data` starts with the KTX 2.0 file identifier.
+bool isKtx2(const unsigned char* data, std::size_t size);
+
+// Reads a 2D KTX 2.0 texture, mip levels included. Levels stored as
+// R8/RG8/RGB8/RGBA8 or BC1/BC3/BC7 blocks, optionally Zstandard
+// supercompressed, are kept as they are, the sRGB flag following the
+// vkFormat. Basis Universal payloads are transcoded to `basisTarget`, or to
+// RGBA8 for None (BC1 and BC3 both give BC3 with alpha, BC1 without); only
+// BasisLZ/ETC1S is, UASTC is not. Throws std::runtime_error for anything
+// else.
+TextureImage decodeKtx2(
+    const unsigned char* data, std::size_t size,
+    TextureCompression basisTarget = TextureCompression::None);
+
+}  // namespace utils
+
+#endif
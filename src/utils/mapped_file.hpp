@@ -0,0 +1,43 @@
+#ifndef MAPPED_FILE_HPP
+#define MAPPED_FILE_HPP
+
+#include <cstddef>
+#include <string>
+
+namespace utils {
+
+// Read-only memory mapping of a whole file. Throws std::runtime_error if the
+// file cannot be opened or mapped.
+class MappedFile {
+ public:
+  MappedFile() = default;
+  explicit MappedFile(const std::string& path);
+  ~MappedFile();
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+  MappedFile(MappedFile&& other) noexcept;
+  MappedFile& operator=(MappedFile&& other) noexcept;
+
+  const std::byte* data() const { return data_; }
+  std::size_t size() const { return size_; }
+  bool valid() const { return data_ != nullptr; }
+
+  // Hint to start reading [offset, offset + size) from disk in the
+  // background, ahead of the accesses that would otherwise fault it in.
+  void prefetch(std::size_t offset, std::size_t size) const;
+
+ private:
+  void close();
+
+  const std::byte* data_ = nullptr;
+  std::size_t size_ = 0;
+#ifdef _WIN32
+  void* file_ = nullptr;
+  void* mapping_ = nullptr;
+#endif
+};
+
+}  // namespace utils
+
+#endif
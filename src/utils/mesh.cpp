@@ -1,8 +1,32 @@
 #include "mesh.hpp"
 
+#include <algorithm>
+
 #include "gl_debug.hpp"
 
 namespace utils {
+namespace {
+
+// The buffer of a shared entry, created and sized on first use, or a new
+// buffer of the mesh's own. Leaves it bound to `target`.
+GLuint bindBuffer(GLenum target, const GpuObjectRef& shared, const void* data,
+                  std::size_t size, const char* what) {
+  GLuint buffer = shared ? shared->name() : 0;
+  if (buffer != 0) {
+    LOG_INFO("Mesh::upload - " << what << " shared: " << buffer);
+    GL_CHECK(glBindBuffer(target, buffer));
+    return buffer;
+  }
+  GL_CHECK(glGenBuffers(1, &buffer));
+  LOG_INFO("Mesh::upload - " << what << " created: " << buffer);
+  GL_CHECK(glBindBuffer(target, buffer));
+  LOG_INFO("Mesh::upload - " << what << " size: " << size << " bytes");
+  GL_CHECK(glBufferData(target, size, data, GL_STATIC_DRAW));
+  if (shared) shared->setName(buffer);
+  return buffer;
+}
+
+}  // namespace
 
 VertexPU::VertexPU(glm::vec3 pos, glm::vec2 uv)
     : pos(pos), uv(uv), normal(glm::vec3{}) {}
@@ -10,98 +34,326 @@ VertexPU::VertexPU(glm::vec3 pos, glm::vec2 uv)
 VertexPU::VertexPU(glm::vec3 pos, glm::vec2 uv, glm::vec3 normal)
     : pos(pos), uv(uv), normal(normal) {}
 
+VertexLayout vertexLayout(VertexFormat format) {
+  VertexLayout layout;
+  if (format == VertexFormat::Packed16) {
+    layout.stride = sizeof(VertexPacked);
+    layout.position = {GL_UNSIGNED_SHORT, 3, GL_TRUE,
+                       offsetof(VertexPacked, pos)};
+    layout.uv = {GL_HALF_FLOAT, 2, GL_FALSE, offsetof(VertexPacked, uv)};
+    layout.normal = {GL_SHORT, 2, GL_TRUE, offsetof(VertexPacked, normal)};
+  } else if (format == VertexFormat::Float32) {
+    layout.stride = sizeof(VertexPU);
+    layout.position = {GL_FLOAT, 3, GL_FALSE, offsetof(VertexPU, pos)};
+    layout.uv = {GL_FLOAT, 2, GL_FALSE, offsetof(VertexPU, uv)};
+    layout.normal = {GL_FLOAT, 3, GL_FALSE, offsetof(VertexPU, normal)};
+  }
+  return layout;
+}
+
 Mesh::~Mesh() { destroy(); }
 
 Mesh::Mesh(Mesh&& other) noexcept { moveFrom(std::move(other)); }
 
 void Mesh::destroy() {
-  if (ebo_) glDeleteBuffers(1, &ebo_);
-  if (vbo_) glDeleteBuffers(1, &vbo_);
+  if (instanceVbo_) glDeleteBuffers(1, &instanceVbo_);
+  if (ebo_ && !sharedEbo_) glDeleteBuffers(1, &ebo_);
+  if (vbo_ && !sharedVbo_) glDeleteBuffers(1, &vbo_);
   if (vao_) glDeleteVertexArrays(1, &vao_);
-  vao_ = vbo_ = ebo_ = 0;
+  vao_ = vbo_ = ebo_ = instanceVbo_ = 0;
+  sharedVbo_.reset();
+  sharedEbo_.reset();
   vertexCount_ = indexCount_ = 0;
   indexed_ = false;
+  format_ = VertexFormat::Float32;
+  posOffset_ = glm::vec3(0.0f);
+  posScale_ = glm::vec3(1.0f);
+  segments_.clear();
+  vertexBytes_ = indexBytes_ = 0;
+  instanceCount_ = 0;
 }
 
 void Mesh::moveFrom(Mesh&& mesh) {
   vao_ = mesh.vao_;
   vbo_ = mesh.vbo_;
   ebo_ = mesh.ebo_;
+  instanceVbo_ = mesh.instanceVbo_;
+  sharedVbo_ = std::move(mesh.sharedVbo_);
+  sharedEbo_ = std::move(mesh.sharedEbo_);
   vertexCount_ = mesh.vertexCount_;
   indexCount_ = mesh.indexCount_;
   indexed_ = mesh.indexed_;
-  mesh.vao_ = mesh.vbo_ = mesh.ebo_ = 0;
+  format_ = mesh.format_;
+  posOffset_ = mesh.posOffset_;
+  posScale_ = mesh.posScale_;
+  segments_ = std::move(mesh.segments_);
+  vertexBytes_ = mesh.vertexBytes_;
+  indexBytes_ = mesh.indexBytes_;
+  instanceCount_ = mesh.instanceCount_;
+  mesh.vao_ = mesh.vbo_ = mesh.ebo_ = mesh.instanceVbo_ = 0;
+  mesh.instanceCount_ = 0;
   mesh.vertexCount_ = mesh.indexCount_ = 0;
   mesh.indexed_ = false;
+  mesh.vertexBytes_ = mesh.indexBytes_ = 0;
 }
 
 void Mesh::upload(const std::vector<VertexPU>& vertices,
                   const std::vector<uint32_t>& indices) {
-  LOG_INFO("Mesh::upload - vertices: " << vertices.size()
-                                       << ", indices: " << indices.size());
+  upload(vertices.data(), vertices.size(), indices.data(), indices.size());
+}
+
+void Mesh::upload(const VertexPU* vertices, std::size_t vertexCount,
+                  const std::uint32_t* indices, std::size_t indexCount) {
+  LOG_INFO("Mesh::upload - vertices: " << vertexCount
+                                       << ", indices: " << indexCount);
 
-  if (vertices.empty()) {
+  if (vertexCount == 0) {
     LOG_ERROR("Mesh::upload - vertices array is empty!");
     return;
   }
 
   destroy();
-  vertexCount_ = static_cast<GLsizei>(vertices.size());
-  indexCount_ = static_cast<GLsizei>(indices.size());
-  indexed_ = !indices.empty();
+  vertexCount_ = static_cast<GLsizei>(vertexCount);
+  indexCount_ = static_cast<GLsizei>(indexCount);
+  indexed_ = indexCount != 0;
+  if (indexed_)
+    segments_.push_back({0, static_cast<std::uint32_t>(indexCount), 0,
+                         GL_UNSIGNED_INT, 0});
+  createBuffers(vertexLayout(VertexFormat::Float32), vertices,
+                vertexCount * sizeof(VertexPU), indices,
+                indexCount * sizeof(std::uint32_t));
+}
+
+void Mesh::upload(const GpuGeometry& geometry) {
+  LOG_INFO("Mesh::upload - vertices: " << geometry.vertexCount
+                                       << ", indices: " << geometry.indexCount);
+  allocate(geometry, geometry.vertexBytes.data(), geometry.indexBytes.data());
+}
+
+void Mesh::allocate(const GpuGeometry& geometry) {
+  allocate(geometry, nullptr, nullptr);
+}
+
+void Mesh::allocate(const GpuGeometry& geometry, GpuObjectRef vertexBuffer,
+                    GpuObjectRef indexBuffer) {
+  allocate(geometry, nullptr, nullptr, std::move(vertexBuffer),
+           std::move(indexBuffer));
+}
+
+void Mesh::allocate(const GpuGeometry& geometry, const void* vertexData,
+                    const void* indexData, GpuObjectRef vertexBuffer,
+                    GpuObjectRef indexBuffer) {
+  if (geometry.vertexCount == 0) {
+    LOG_ERROR("Mesh::upload - vertices array is empty!");
+    return;
+  }
+
+  destroy();
+  sharedVbo_ = std::move(vertexBuffer);
+  sharedEbo_ = std::move(indexBuffer);
+  vertexCount_ = static_cast<GLsizei>(geometry.vertexCount);
+  indexCount_ = static_cast<GLsizei>(geometry.indexCount);
+  indexed_ = geometry.indexCount != 0;
+  format_ = geometry.format;
+  posOffset_ = geometry.posOffset;
+  posScale_ = geometry.posScale;
+  segments_ = geometry.segments;
+  createBuffers(geometry.layout, vertexData, geometry.vertexBytes.size(),
+                indexData, geometry.indexBytes.size());
+
+  const std::size_t floatBytes =
+      geometry.vertexCount * sizeof(VertexPU) +
+      geometry.indexCount * sizeof(std::uint32_t);
+  LOG_INFO("Mesh::upload - GPU geometry: " << gpuBytes() << " bytes ("
+                                           << floatBytes
+                                           << " as float32/uint32)");
+}
+
+void Mesh::createBuffers(const VertexLayout& layout, const void* vertexData,
+                         std::size_t vboSize, const void* indexData,
+                         std::size_t eboSize) {
+  vertexBytes_ = vboSize;
+  indexBytes_ = indexed_ ? eboSize : 0;
 
   GL_CHECK(glGenVertexArrays(1, &vao_));
   LOG_INFO("Mesh::upload - VAO created: " << vao_);
   GL_CHECK(glBindVertexArray(vao_));
 
-  GL_CHECK(glGenBuffers(1, &vbo_));
-  LOG_INFO("Mesh::upload - VBO created: " << vbo_);
-  GL_CHECK(glBindBuffer(GL_ARRAY_BUFFER, vbo_));
-
-  const size_t vboSize = vertices.size() * sizeof(VertexPU);
-  LOG_INFO("Mesh::upload - VBO size: " << vboSize << " bytes");
-  GL_CHECK(
-      glBufferData(GL_ARRAY_BUFFER, vboSize, vertices.data(), GL_STATIC_DRAW));
+  vbo_ = bindBuffer(GL_ARRAY_BUFFER, sharedVbo_, vertexData, vboSize, "VBO");
 
   if (indexed_) {
-    GL_CHECK(glGenBuffers(1, &ebo_));
-    LOG_INFO("Mesh::upload - EBO created: " << ebo_);
-    GL_CHECK(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo_));
-
-    const size_t eboSize = indices.size() * sizeof(uint32_t);
-    LOG_INFO("Mesh::upload - EBO size: " << eboSize << " bytes (uint32_t size: "
-                                         << sizeof(uint32_t) << ")");
-    GL_CHECK(glBufferData(GL_ELEMENT_ARRAY_BUFFER, eboSize, indices.data(),
-                          GL_STATIC_DRAW));
+    ebo_ = bindBuffer(GL_ELEMENT_ARRAY_BUFFER, sharedEbo_, indexData, eboSize,
+                      "EBO");
+    LOG_INFO("Mesh::upload - EBO in " << segments_.size() << " segment(s)");
   }
 
-  GL_CHECK(glEnableVertexAttribArray(0));
-  GL_CHECK(glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(VertexPU),
-                                 (void*)offsetof(VertexPU, pos)));
+  const VertexAttribute* attributes[3] = {&layout.position, &layout.uv,
+                                          &layout.normal};
+  for (GLuint location = 0; location < 3; ++location) {
+    const VertexAttribute& a = *attributes[location];
+    if (a.components == 0) continue;
+    GL_CHECK(glEnableVertexAttribArray(location));
+    GL_CHECK(glVertexAttribPointer(
+        location, a.components, a.type, a.normalized,
+        static_cast<GLsizei>(layout.stride),
+        reinterpret_cast<void*>(static_cast<std::uintptr_t>(a.offset))));
+  }
 
-  GL_CHECK(glEnableVertexAttribArray(1));
-  GL_CHECK(glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(VertexPU),
-                                 (void*)offsetof(VertexPU, uv)));
+  GL_CHECK(glBindVertexArray(0));
+  LOG_INFO("Mesh::upload - completed successfully");
+}
 
-  GL_CHECK(glEnableVertexAttribArray(2));
-  GL_CHECK(glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(VertexPU),
-                                 (void*)offsetof(VertexPU, normal)));
+void Mesh::uploadVertexBytes(std::size_t offset, const void* data,
+                             std::size_t size) {
+  if (vbo_ == 0 || offset + size > vertexBytes_) {
+    LOG_ERROR("Mesh::uploadVertexBytes - range outside allocated storage");
+    return;
+  }
+  // COPY_WRITE keeps the VAO's element binding untouched.
+  GL_CHECK(glBindBuffer(GL_COPY_WRITE_BUFFER, vbo_));
+  GL_CHECK(glBufferSubData(GL_COPY_WRITE_BUFFER, offset, size, data));
+  GL_CHECK(glBindBuffer(GL_COPY_WRITE_BUFFER, 0));
+}
+
+void Mesh::uploadIndexBytes(std::size_t offset, const void* data,
+                            std::size_t size) {
+  if (ebo_ == 0 || offset + size > indexBytes_) {
+    LOG_ERROR("Mesh::uploadIndexBytes - range outside allocated storage");
+    return;
+  }
+  GL_CHECK(glBindBuffer(GL_COPY_WRITE_BUFFER, ebo_));
+  GL_CHECK(glBufferSubData(GL_COPY_WRITE_BUFFER, offset, size, data));
+  GL_CHECK(glBindBuffer(GL_COPY_WRITE_BUFFER, 0));
+}
 
+void Mesh::uploadInstances(const glm::mat4* transforms, std::size_t count) {
+  if (vao_ == 0) {
+    LOG_ERROR("Mesh::uploadInstances - mesh not uploaded");
+    return;
+  }
+  if (instanceVbo_ == 0) GL_CHECK(glGenBuffers(1, &instanceVbo_));
+  GL_CHECK(glBindVertexArray(vao_));
+  GL_CHECK(glBindBuffer(GL_ARRAY_BUFFER, instanceVbo_));
+  GL_CHECK(glBufferData(GL_ARRAY_BUFFER, count * sizeof(glm::mat4), transforms,
+                        GL_STATIC_DRAW));
+  for (GLuint column = 0; column < 4; ++column) {
+    GL_CHECK(glEnableVertexAttribArray(3 + column));
+    GL_CHECK(glVertexAttribPointer(
+        3 + column, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4),
+        reinterpret_cast<void*>(column * sizeof(glm::vec4))));
+    GL_CHECK(glVertexAttribDivisor(3 + column, 1));
+  }
   GL_CHECK(glBindVertexArray(0));
-  LOG_INFO("Mesh::upload - completed successfully");
+  GL_CHECK(glBindBuffer(GL_ARRAY_BUFFER, 0));
+  instanceCount_ = count;
+}
+
+void Mesh::drawRangeInstanced(std::uint32_t indexOffset,
+                              std::uint32_t indexCount,
+                              std::uint32_t firstInstance,
+                              std::uint32_t instanceCount, GLenum prim) const {
+  if (!indexed_ || vao_ == 0 || instanceVbo_ == 0 || instanceCount == 0 ||
+      firstInstance + instanceCount > instanceCount_)
+    return;
+  GL_CHECK(glBindVertexArray(vao_));
+  GL_CHECK(glBindBuffer(GL_ARRAY_BUFFER, instanceVbo_));
+  const std::size_t base = firstInstance * sizeof(glm::mat4);
+  for (GLuint column = 0; column < 4; ++column)
+    GL_CHECK(glVertexAttribPointer(
+        3 + column, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4),
+        reinterpret_cast<void*>(base + column * sizeof(glm::vec4))));
+  drawSegments(indexOffset, indexCount, prim,
+               static_cast<GLsizei>(instanceCount));
+  GL_CHECK(glBindVertexArray(0));
+  GL_CHECK(glBindBuffer(GL_ARRAY_BUFFER, 0));
 }
 
 void Mesh::drawRange(std::uint32_t indexOffset, std::uint32_t indexCount,
                      GLenum prim) const {
   if (!indexed_ || vao_ == 0) return;
   GL_CHECK(glBindVertexArray(vao_));
-  GL_CHECK(glDrawElements(
-      prim, static_cast<GLsizei>(indexCount), GL_UNSIGNED_INT,
-      reinterpret_cast<void*>(static_cast<std::uintptr_t>(indexOffset) *
-                              sizeof(std::uint32_t))));
+  drawSegments(indexOffset, indexCount, prim);
   GL_CHECK(glBindVertexArray(0));
 }
 
+std::size_t Mesh::drawRanges(const std::uint32_t* indexOffsets,
+                             const std::uint32_t* indexCounts,
+                             std::size_t count, GLenum prim) const {
+  if (!indexed_ || vao_ == 0 || count == 0) return 0;
+
+  std::vector<GLsizei> counts;
+  std::vector<const void*> offsets;
+  std::vector<GLint> baseVertices;
+  GLenum type = 0;
+  std::size_t calls = 0;
+  auto flush = [&] {
+    if (counts.empty()) return;
+    GL_CHECK(glMultiDrawElementsBaseVertex(
+        prim, counts.data(), type, offsets.data(),
+        static_cast<GLsizei>(counts.size()), baseVertices.data()));
+    counts.clear();
+    offsets.clear();
+    baseVertices.clear();
+    calls++;
+  };
+
+  GL_CHECK(glBindVertexArray(vao_));
+  for (std::size_t r = 0; r < count; ++r) {
+    const std::uint32_t begin = indexOffsets[r];
+    const std::uint32_t end = begin + indexCounts[r];
+    auto it = std::upper_bound(
+        segments_.begin(), segments_.end(), begin,
+        [](std::uint32_t v, const IndexSegment& s) { return v < s.first; });
+    if (it != segments_.begin()) --it;
+
+    for (; it != segments_.end() && it->first < end; ++it) {
+      const std::uint32_t from = std::max(begin, it->first);
+      const std::uint32_t to = std::min(end, it->first + it->count);
+      if (from >= to) continue;
+      if (it->type != type) flush();
+      type = it->type;
+      const std::size_t width = it->type == GL_UNSIGNED_SHORT ? 2 : 4;
+      counts.push_back(static_cast<GLsizei>(to - from));
+      const std::size_t byteOffset =
+          it->byteOffset + (from - it->first) * width;
+      offsets.push_back(reinterpret_cast<const void*>(byteOffset));
+      baseVertices.push_back(it->baseVertex);
+    }
+  }
+  flush();
+  GL_CHECK(glBindVertexArray(0));
+  return calls;
+}
+
+void Mesh::drawSegments(std::uint32_t indexOffset, std::uint32_t indexCount,
+                        GLenum prim, GLsizei instanceCount) const {
+  const std::uint32_t end = indexOffset + indexCount;
+  auto it = std::upper_bound(
+      segments_.begin(), segments_.end(), indexOffset,
+      [](std::uint32_t v, const IndexSegment& s) { return v < s.first; });
+  if (it != segments_.begin()) --it;
+
+  for (; it != segments_.end() && it->first < end; ++it) {
+    const std::uint32_t from = std::max(indexOffset, it->first);
+    const std::uint32_t to = std::min(end, it->first + it->count);
+    if (from >= to) continue;
+    const std::size_t width = it->type == GL_UNSIGNED_SHORT ? 2 : 4;
+    void* offset = reinterpret_cast<void*>(static_cast<std::uintptr_t>(
+        it->byteOffset + (from - it->first) * width));
+    if (instanceCount > 0) {
+      GL_CHECK(glDrawElementsInstancedBaseVertex(
+          prim, static_cast<GLsizei>(to - from), it->type, offset,
+          instanceCount, it->baseVertex));
+    } else if (it->baseVertex != 0) {
+      GL_CHECK(glDrawElementsBaseVertex(prim, static_cast<GLsizei>(to - from),
+                                        it->type, offset, it->baseVertex));
+    } else {
+      GL_CHECK(glDrawElements(prim, static_cast<GLsizei>(to - from), it->type,
+                              offset));
+    }
+  }
+}
+
 void Mesh::draw(GLenum prim) const {
   if (vao_ == 0) {
     LOG_ERROR("Mesh::draw - VAO is 0, mesh not uploaded!");
@@ -110,7 +362,7 @@ void Mesh::draw(GLenum prim) const {
 
   GL_CHECK(glBindVertexArray(vao_));
   if (indexed_) {
-    GL_CHECK(glDrawElements(prim, indexCount_, GL_UNSIGNED_INT, nullptr));
+    drawSegments(0, static_cast<std::uint32_t>(indexCount_), prim);
   } else {
     GL_CHECK(glDrawArrays(prim, 0, vertexCount_));
   }
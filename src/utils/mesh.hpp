@@ -3,9 +3,16 @@
 
 #include <glad/glad.h>
 
+#include <cstddef>
+#include <cstdint>
 #include <glm/glm.hpp>
+#include <memory>
+#include <string>
 #include <vector>
 
+#include "gpu_cache.hpp"
+#include "texture.hpp"
+
 namespace utils {
 
 struct VertexPU {
@@ -18,23 +25,175 @@ struct VertexPU {
   VertexPU(glm::vec3 pos, glm::vec2 uv, glm::vec3 normal);
 };
 
+enum class VertexFormat {
+  Float32,   // VertexPU, 32 bytes
+  Packed16,  // VertexPacked, 16 bytes
+  Compact    // attributes in their source types (ModelData::compactLayout)
+};
+
+// One attribute of an interleaved vertex record, as glVertexAttribPointer
+// reads it. components == 0 leaves the attribute disabled, so the shader sees
+// its default value.
+struct VertexAttribute {
+  GLenum type = GL_FLOAT;
+  GLint components = 0;
+  GLboolean normalized = GL_FALSE;
+  std::uint32_t offset = 0;
+};
+
+// Vertex record layout for locations 0-2 of lit.vert.
+struct VertexLayout {
+  std::uint32_t stride = 0;
+  VertexAttribute position;
+  VertexAttribute uv;
+  VertexAttribute normal;
+};
+
+// Layout of the Float32 and Packed16 records; Compact layouts come with the
+// model.
+VertexLayout vertexLayout(VertexFormat format);
+
+// Compact vertex: unorm16 position inside the mesh bounds (dequantized with
+// GpuGeometry::posOffset/posScale), half-float UV and an octahedral snorm16
+// normal.
+struct VertexPacked {
+  std::uint16_t pos[4];  // xyz + padding
+  std::uint16_t uv[2];
+  std::int16_t normal[2];
+};
+
+// A run [first, first + count) of the logical (uint32) index buffer, stored
+// at byteOffset with its own index type. GL_UNSIGNED_SHORT segments hold
+// indices relative to baseVertex.
+struct IndexSegment {
+  std::uint32_t first = 0;
+  std::uint32_t count = 0;
+  std::size_t byteOffset = 0;
+  GLenum type = GL_UNSIGNED_INT;
+  GLint baseVertex = 0;
+};
+
+// Vertex and index bytes in their GPU layout (see buildGpuGeometry).
+struct GpuGeometry {
+  VertexFormat format = VertexFormat::Float32;
+  VertexLayout layout = vertexLayout(VertexFormat::Float32);
+  glm::vec3 posOffset{0.0f};  // position = posOffset + posScale * stored
+  glm::vec3 posScale{1.0f};
+  std::size_t vertexCount = 0;
+  std::size_t indexCount = 0;
+  std::vector<unsigned char> vertexBytes;
+  std::vector<unsigned char> indexBytes;
+  std::vector<IndexSegment> segments;  // sorted by `first`
+};
+
 struct MaterialGL {
   glm::vec4 baseColorFactor{1, 1, 1, 1};
   GLuint baseColorTex = 0;
   bool hasBaseColorTex = false;
+  int baseColorImage = -1;  // index into ModelData::images when kept
+  // >= 0: baseColorTex is a GL_TEXTURE_2D_ARRAY shared with other materials
+  // and this is the material's layer.
+  int baseColorLayer = -1;
+  // >= 0: the base color is ModelData::virtualTextures[baseColorVirtual]
+  // and baseColorTex is unused.
+  int baseColorVirtual = -1;
+  // glTF doubleSided: back faces are drawn and never culled.
+  bool doubleSided = false;
+};
+
+// Tiled page file of a virtually textured image; `id` is assigned by
+// VirtualTextureSystem::track.
+struct VirtualTextureRef {
+  std::string path;
+  int id = -1;
+};
+
+// Coarser version of a submesh, stored as another range of the same index
+// buffer. `error` bounds its deviation from LOD 0 in model units: the sum of
+// the errors of the simplification steps leading to it.
+struct SubmeshLod {
+  std::uint32_t indexOffset = 0;
+  std::uint32_t indexCount = 0;
+  float error = 0.0f;
+};
+
+// Cluster of a submesh's triangles: a contiguous index run with a bounding
+// sphere and a normal cone (coneCutoff >= 1 disables the cone test).
+struct Meshlet {
+  std::uint32_t indexOffset = 0;
+  std::uint32_t indexCount = 0;
+  glm::vec3 center{0.0f};
+  float radius = 0.0f;
+  glm::vec3 coneAxis{0.0f, 0.0f, 1.0f};
+  float coneCutoff = 1.0f;
 };
 
 struct Submesh {
   std::uint32_t indexOffset = 0;
   std::uint32_t indexCount = 0;
   int materialIndex = -1;
+  // Model-space bounding sphere; radius < 0 when not computed.
+  glm::vec3 center{0.0f};
+  float radius = -1.0f;
+  // UV units per model unit (sqrt of UV area over surface area); 0 when
+  // not computed. Drives texture streaming.
+  float uvDensity = 0.0f;
+  std::vector<SubmeshLod> lods;  // LOD 1..N, coarsest last
+  // Range of ModelData::meshlets covering LOD 0; empty when not built.
+  std::uint32_t meshletOffset = 0;
+  std::uint32_t meshletCount = 0;
+  // Range of ModelData::instances this submesh is drawn with; 0 instances =
+  // drawn once, vertices already in model space.
+  std::uint32_t instanceOffset = 0;
+  std::uint32_t instanceCount = 0;
 };
 
 struct ModelData {
   std::vector<VertexPU> vertices;
+  // Models that keep KHR_mesh_quantization attributes in their stored types
+  // hold compactLayout.stride-byte records here instead of `vertices`.
+  VertexLayout compactLayout;
+  std::vector<unsigned char> compactVertices;
   std::vector<std::uint32_t> indices;
   std::vector<MaterialGL> materials;
   std::vector<Submesh> submeshes;
+  std::vector<Meshlet> meshlets;
+  std::vector<glm::mat4> instances;  // see Submesh::instanceOffset
+  std::vector<TextureImage> images;
+  std::vector<VirtualTextureRef> virtualTextures;
+  // GpuObjectCache entries behind the materials' base color textures, when
+  // shared; those textures are released with these, not deleted directly.
+  std::vector<GpuObjectRef> sharedTextures;
+
+  // Read-only geometry borrowed from `backing` (e.g. a mapped cooked file)
+  // instead of being owned by `vertices`/`indices`.
+  std::shared_ptr<const void> backing;
+  const VertexPU* borrowedVertices = nullptr;
+  const unsigned char* borrowedCompactVertices = nullptr;
+  std::size_t borrowedVertexCount = 0;  // of whichever stream is borrowed
+  const std::uint32_t* borrowedIndices = nullptr;
+  std::size_t borrowedIndexCount = 0;
+
+  bool compact() const { return compactLayout.stride != 0; }
+  const VertexPU* vertexData() const {
+    return borrowedVertices ? borrowedVertices : vertices.data();
+  }
+  const unsigned char* compactVertexData() const {
+    return borrowedCompactVertices ? borrowedCompactVertices
+                                   : compactVertices.data();
+  }
+  std::size_t vertexCount() const {
+    if (borrowedVertices || borrowedCompactVertices)
+      return borrowedVertexCount;
+    return compact() ? compactVertices.size() / compactLayout.stride
+                     : vertices.size();
+  }
+  const std::uint32_t* indexData() const {
+    return borrowedIndices ? borrowedIndices : indices.data();
+  }
+  std::size_t indexCount() const {
+    return borrowedIndices ? borrowedIndexCount : indices.size();
+  }
 };
 
 class Mesh {
@@ -50,19 +209,80 @@ class Mesh {
 
   void upload(const std::vector<VertexPU>& vertices,
               const std::vector<uint32_t>& indices = {});
+  void upload(const VertexPU* vertices, std::size_t vertexCount,
+              const std::uint32_t* indices, std::size_t indexCount);
+  void upload(const GpuGeometry& geometry);
+
+  // Incremental upload: allocate storage for the geometry's layout once,
+  // then fill it in pieces (e.g. from an UploadQueue spread over several
+  // frames).
+  void allocate(const GpuGeometry& geometry);
+  void uploadVertexBytes(std::size_t offset, const void* data,
+                         std::size_t size);
+  void uploadIndexBytes(std::size_t offset, const void* data,
+                        std::size_t size);
+  // allocate() with the vertex and index buffers of GpuObjectCache entries:
+  // an entry without a GL buffer yet gets one for the caller to fill, the
+  // others are only bound. A null entry gives the mesh its own buffer.
+  void allocate(const GpuGeometry& geometry, GpuObjectRef vertexBuffer,
+                GpuObjectRef indexBuffer);
+
   void draw(GLenum prim = GL_TRIANGLES) const;
+  // indexOffset/indexCount are in the logical index space; ranges spanning
+  // several index segments are drawn piecewise.
   void drawRange(std::uint32_t indexOffset, std::uint32_t indexCount,
                  GLenum prim = GL_TRIANGLES) const;
+  // Per-instance model matrices, read by attributes 3-6 (one mat4 column
+  // each, divisor 1) of this mesh's VAO.
+  void uploadInstances(const glm::mat4* transforms, std::size_t count);
+  // glDrawElementsInstanced over instances [firstInstance, firstInstance +
+  // instanceCount) of the instance buffer. GL 3.3 has no base instance, so
+  // the attribute pointers are re-based for every call.
+  void drawRangeInstanced(std::uint32_t indexOffset, std::uint32_t indexCount,
+                          std::uint32_t firstInstance,
+                          std::uint32_t instanceCount,
+                          GLenum prim = GL_TRIANGLES) const;
+  // Several ranges with as few glMultiDrawElementsBaseVertex calls as the
+  // index segments allow. Returns the number of GL draw calls issued.
+  std::size_t drawRanges(const std::uint32_t* indexOffsets,
+                         const std::uint32_t* indexCounts, std::size_t count,
+                         GLenum prim = GL_TRIANGLES) const;
+
+  VertexFormat format() const { return format_; }
+  const glm::vec3& posOffset() const { return posOffset_; }
+  const glm::vec3& posScale() const { return posScale_; }
+  std::size_t instanceCount() const { return instanceCount_; }
+  std::size_t gpuBytes() const {
+    return vertexBytes_ + indexBytes_ + instanceCount_ * sizeof(glm::mat4);
+  }
 
  private:
   void destroy();
+  void allocate(const GpuGeometry& geometry, const void* vertexData,
+                const void* indexData, GpuObjectRef vertexBuffer = {},
+                GpuObjectRef indexBuffer = {});
+  void createBuffers(const VertexLayout& layout, const void* vertexData,
+                     std::size_t vboSize, const void* indexData,
+                     std::size_t eboSize);
+  // instanceCount 0 issues plain (non-instanced) draws.
+  void drawSegments(std::uint32_t indexOffset, std::uint32_t indexCount,
+                    GLenum prim, GLsizei instanceCount = 0) const;
 
   void moveFrom(Mesh&& o);
 
-  GLuint vao_ = 0, vbo_ = 0, ebo_ = 0;
+  GLuint vao_ = 0, vbo_ = 0, ebo_ = 0, instanceVbo_ = 0;
+  GpuObjectRef sharedVbo_, sharedEbo_;  // owners of vbo_/ebo_ when shared
   GLsizei vertexCount_ = 0;
   GLsizei indexCount_ = 0;
   bool indexed_ = false;
+
+  VertexFormat format_ = VertexFormat::Float32;
+  glm::vec3 posOffset_{0.0f};
+  glm::vec3 posScale_{1.0f};
+  std::vector<IndexSegment> segments_;
+  std::size_t vertexBytes_ = 0;
+  std::size_t indexBytes_ = 0;
+  std::size_t instanceCount_ = 0;
 };
 
 }  // namespace utils
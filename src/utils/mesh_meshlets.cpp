@@ -0,0 +1,305 @@
+#include "mesh_meshlets.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+
+#include "thread_pool.hpp"
+
+namespace utils {
+namespace {
+
+constexpr std::uint32_t kNone = std::numeric_limits<std::uint32_t>::max();
+
+struct RangeMeshlets {
+  std::vector<std::uint32_t> indices;  // regrouped copy of the range
+  std::vector<Meshlet> meshlets;       // offsets relative to the range
+};
+
+RangeMeshlets buildRange(const VertexPU* vertices,
+                         const std::uint32_t* indices, std::size_t indexCount,
+                         const MeshletOptions& options) {
+  const std::size_t triCount = indexCount / 3;
+
+  // Vertex budget counts distinct indices, but triangles are adjacent when
+  // they share a position, so flat-shaded and seamed surfaces still grow
+  // into compact clusters.
+  std::unordered_map<std::uint32_t, std::uint32_t> toLocal;
+  std::vector<std::uint32_t> toGlobal;
+  std::vector<std::uint32_t> tris(triCount * 3);
+  for (std::size_t i = 0; i < tris.size(); ++i) {
+    auto [it, inserted] = toLocal.try_emplace(
+        indices[i], static_cast<std::uint32_t>(toGlobal.size()));
+    if (inserted) toGlobal.push_back(indices[i]);
+    tris[i] = it->second;
+  }
+  const std::size_t vertexCount = toGlobal.size();
+
+  // Position ids: sort the local vertices by position, number the runs.
+  struct Keyed {
+    glm::vec3 pos;
+    std::uint32_t vertex;
+  };
+  std::vector<Keyed> order(vertexCount);
+  for (std::size_t v = 0; v < vertexCount; ++v)
+    order[v] = {vertices[toGlobal[v]].pos, static_cast<std::uint32_t>(v)};
+  std::sort(order.begin(), order.end(), [](const Keyed& a, const Keyed& b) {
+    if (a.pos.x != b.pos.x) return a.pos.x < b.pos.x;
+    if (a.pos.y != b.pos.y) return a.pos.y < b.pos.y;
+    if (a.pos.z != b.pos.z) return a.pos.z < b.pos.z;
+    return a.vertex < b.vertex;
+  });
+  std::vector<std::uint32_t> positionOf(vertexCount);
+  std::size_t positionCount = 0;
+  for (std::size_t k = 0; k < vertexCount; ++k) {
+    if (k > 0 && order[k].pos != order[k - 1].pos) positionCount++;
+    positionOf[order[k].vertex] = static_cast<std::uint32_t>(positionCount);
+  }
+  if (vertexCount > 0) positionCount++;
+  std::vector<std::uint32_t> corners(tris.size());
+  for (std::size_t i = 0; i < tris.size(); ++i)
+    corners[i] = positionOf[tris[i]];
+
+  std::vector<std::uint32_t> adjStart(positionCount + 1, 0), adj(tris.size());
+  for (std::uint32_t p : corners) adjStart[p + 1]++;
+  for (std::size_t p = 0; p < positionCount; ++p)
+    adjStart[p + 1] += adjStart[p];
+  {
+    std::vector<std::uint32_t> cursor(adjStart.begin(), adjStart.end() - 1);
+    for (std::size_t i = 0; i < corners.size(); ++i)
+      adj[cursor[corners[i]]++] = static_cast<std::uint32_t>(i / 3);
+  }
+
+  RangeMeshlets out;
+  out.indices.reserve(triCount * 3);
+  std::vector<std::uint8_t> emitted(triCount, 0);
+  // Last meshlet that used a vertex / listed a triangle as a candidate.
+  std::vector<std::uint32_t> vertexOwner(vertexCount, kNone);
+  std::vector<std::uint32_t> positionOwner(positionCount, kNone);
+  std::vector<std::uint32_t> candidateOwner(triCount, kNone);
+  std::vector<std::uint32_t> candidates;
+  std::size_t seed = 0;
+
+  auto newVertices = [&](std::uint32_t t, std::uint32_t id) {
+    unsigned n = 0;
+    for (int k = 0; k < 3; ++k) n += vertexOwner[tris[t * 3 + k]] != id;
+    return n;
+  };
+
+  while (true) {
+    while (seed < triCount && emitted[seed]) ++seed;
+    if (seed == triCount) break;
+
+    const auto id = static_cast<std::uint32_t>(out.meshlets.size());
+    Meshlet meshlet;
+    meshlet.indexOffset = static_cast<std::uint32_t>(out.indices.size());
+    unsigned used = 0, triangles = 0;
+    candidates.clear();
+
+    auto add = [&](std::uint32_t t) {
+      emitted[t] = 1;
+      triangles++;
+      for (int k = 0; k < 3; ++k) {
+        const std::uint32_t v = tris[t * 3 + k];
+        out.indices.push_back(indices[t * 3 + k]);
+        if (vertexOwner[v] != id) {
+          vertexOwner[v] = id;
+          used++;
+        }
+        const std::uint32_t p = corners[t * 3 + k];
+        if (positionOwner[p] == id) continue;
+        positionOwner[p] = id;
+        for (std::uint32_t a = adjStart[p]; a < adjStart[p + 1]; ++a) {
+          const std::uint32_t other = adj[a];
+          if (emitted[other] || candidateOwner[other] == id) continue;
+          candidateOwner[other] = id;
+          candidates.push_back(other);
+        }
+      }
+    };
+
+    add(static_cast<std::uint32_t>(seed));
+    while (triangles < options.maxTriangles) {
+      // Prefer the candidate adding the fewest vertices; drop the ones that
+      // were emitted or no longer fit.
+      std::size_t best = kNone;
+      unsigned bestCost = 4;
+      for (std::size_t c = 0; c < candidates.size();) {
+        const std::uint32_t t = candidates[c];
+        const unsigned cost = emitted[t] ? 4 : newVertices(t, id);
+        if (cost == 4 || used + cost > options.maxVertices) {
+          candidates[c] = candidates.back();
+          candidates.pop_back();
+          continue;
+        }
+        if (cost < bestCost) {
+          best = c;
+          bestCost = cost;
+          if (cost == 0) break;
+        }
+        ++c;
+      }
+      if (best == kNone) break;
+      const std::uint32_t t = candidates[best];
+      candidates[best] = candidates.back();
+      candidates.pop_back();
+      add(t);
+    }
+
+    meshlet.indexCount = triangles * 3;
+    out.meshlets.push_back(meshlet);
+  }
+  return out;
+}
+
+}  // namespace
+
+void computeMeshletBounds(const VertexPU* vertices,
+                          const std::uint32_t* indices, Meshlet& meshlet) {
+  const std::uint32_t* range = indices + meshlet.indexOffset;
+  if (meshlet.indexCount == 0) return;
+
+  glm::vec3 lo = vertices[range[0]].pos, hi = lo;
+  for (std::uint32_t i = 1; i < meshlet.indexCount; ++i) {
+    lo = glm::min(lo, vertices[range[i]].pos);
+    hi = glm::max(hi, vertices[range[i]].pos);
+  }
+  meshlet.center = (lo + hi) * 0.5f;
+  float r2 = 0.0f;
+  for (std::uint32_t i = 0; i < meshlet.indexCount; ++i) {
+    const glm::vec3 d = vertices[range[i]].pos - meshlet.center;
+    r2 = std::max(r2, glm::dot(d, d));
+  }
+  meshlet.radius = std::sqrt(r2);
+
+  std::vector<glm::vec3> normals;
+  normals.reserve(meshlet.indexCount / 3);
+  glm::vec3 sum(0.0f);
+  for (std::uint32_t i = 0; i + 2 < meshlet.indexCount; i += 3) {
+    const glm::vec3& a = vertices[range[i]].pos;
+    const glm::vec3 n = glm::cross(vertices[range[i + 1]].pos - a,
+                                   vertices[range[i + 2]].pos - a);
+    const float len = glm::length(n);
+    if (len <= 0.0f) continue;
+    normals.push_back(n / len);
+    sum += normals.back();
+  }
+  meshlet.coneAxis = glm::vec3(0.0f, 0.0f, 1.0f);
+  meshlet.coneCutoff = 1.0f;
+  const float sumLength = glm::length(sum);
+  if (normals.empty() || sumLength <= 0.0f) return;
+
+  meshlet.coneAxis = sum / sumLength;
+  float minDot = 1.0f;
+  for (const glm::vec3& n : normals)
+    minDot = std::min(minDot, glm::dot(n, meshlet.coneAxis));
+  // Cones wider than ~84 degrees half-angle almost never cull; skip them.
+  if (minDot > 0.1f) meshlet.coneCutoff = std::sqrt(1.0f - minDot * minDot);
+}
+
+MeshletStats buildMeshlets(ModelData& model, const MeshletOptions& options) {
+  if (model.borrowedVertices || model.borrowedIndices)
+    throw std::runtime_error("buildMeshlets needs owned geometry");
+  if (options.maxVertices < 3 || options.maxTriangles < 1)
+    throw std::runtime_error("buildMeshlets: meshlet limits too small");
+
+  const auto t0 = std::chrono::steady_clock::now();
+  const unsigned threads = ThreadPool::resolveThreadCount(options.threadCount);
+  std::unique_ptr<ThreadPool> pool;
+  if (threads > 1) pool = std::make_unique<ThreadPool>(threads - 1);
+
+  std::vector<RangeMeshlets> ranges(model.submeshes.size());
+  parallelFor(pool.get(), model.submeshes.size(), [&](std::size_t s) {
+    const Submesh& sm = model.submeshes[s];
+    ranges[s] = buildRange(model.vertices.data(),
+                           model.indices.data() + sm.indexOffset,
+                           sm.indexCount, options);
+  });
+
+  MeshletStats stats;
+  std::size_t triangles = 0, vertices = 0;
+  model.meshlets.clear();
+  for (std::size_t s = 0; s < model.submeshes.size(); ++s) {
+    Submesh& sm = model.submeshes[s];
+    RangeMeshlets& range = ranges[s];
+    std::copy(range.indices.begin(), range.indices.end(),
+              model.indices.begin() + sm.indexOffset);
+    sm.meshletOffset = static_cast<std::uint32_t>(model.meshlets.size());
+    sm.meshletCount = static_cast<std::uint32_t>(range.meshlets.size());
+    for (Meshlet& meshlet : range.meshlets) {
+      meshlet.indexOffset += sm.indexOffset;
+      triangles += meshlet.indexCount / 3;
+      model.meshlets.push_back(meshlet);
+    }
+  }
+
+  parallelFor(pool.get(), model.meshlets.size(), [&](std::size_t m) {
+    computeMeshletBounds(model.vertices.data(), model.indices.data(),
+                         model.meshlets[m]);
+  });
+  for (const Submesh& sm : model.submeshes) {
+    std::vector<std::uint32_t> seen;
+    for (std::uint32_t m = 0; m < sm.meshletCount; ++m) {
+      const Meshlet& meshlet = model.meshlets[sm.meshletOffset + m];
+      seen.assign(model.indices.begin() + meshlet.indexOffset,
+                  model.indices.begin() + meshlet.indexOffset +
+                      meshlet.indexCount);
+      std::sort(seen.begin(), seen.end());
+      vertices += static_cast<std::size_t>(
+          std::unique(seen.begin(), seen.end()) - seen.begin());
+    }
+  }
+
+  stats.meshlets = model.meshlets.size();
+  if (stats.meshlets > 0) {
+    stats.averageVertices = static_cast<float>(vertices) / stats.meshlets;
+    stats.averageTriangles = static_cast<float>(triangles) / stats.meshlets;
+  }
+  stats.milliseconds = std::chrono::duration<double, std::milli>(
+                           std::chrono::steady_clock::now() - t0)
+                           .count();
+  return stats;
+}
+
+void extractFrustumPlanes(const glm::mat4& clip, glm::vec4 planes[6]) {
+  const glm::vec4 row0(clip[0][0], clip[1][0], clip[2][0], clip[3][0]);
+  const glm::vec4 row1(clip[0][1], clip[1][1], clip[2][1], clip[3][1]);
+  const glm::vec4 row2(clip[0][2], clip[1][2], clip[2][2], clip[3][2]);
+  const glm::vec4 row3(clip[0][3], clip[1][3], clip[2][3], clip[3][3]);
+  planes[0] = row3 + row0;  // left
+  planes[1] = row3 - row0;  // right
+  planes[2] = row3 + row1;  // bottom
+  planes[3] = row3 - row1;  // top
+  planes[4] = row3 + row2;  // near
+  planes[5] = row3 - row2;  // far
+  for (int i = 0; i < 6; ++i) {
+    const float len = glm::length(glm::vec3(planes[i]));
+    if (len > 0.0f) planes[i] /= len;
+  }
+}
+
+bool sphereInFrustum(const glm::vec3& center, float radius,
+                     const glm::vec4 planes[6]) {
+  for (int i = 0; i < 6; ++i)
+    if (glm::dot(glm::vec3(planes[i]), center) + planes[i].w < -radius)
+      return false;
+  return true;
+}
+
+bool meshletInFrustum(const Meshlet& meshlet, const glm::vec4 planes[6]) {
+  return sphereInFrustum(meshlet.center, meshlet.radius, planes);
+}
+
+bool meshletBackfacing(const Meshlet& meshlet, const glm::vec3& camera) {
+  if (meshlet.coneCutoff >= 1.0f) return false;
+  const glm::vec3 toCenter = meshlet.center - camera;
+  return glm::dot(toCenter, meshlet.coneAxis) >=
+         meshlet.coneCutoff * glm::length(toCenter) + meshlet.radius;
+}
+
+}  // namespace utils
@@ -0,0 +1,50 @@
+#ifndef MESH_MESHLETS_HPP
+#define MESH_MESHLETS_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <glm/glm.hpp>
+
+#include "mesh.hpp"
+
+namespace utils {
+
+struct MeshletOptions {
+  unsigned maxVertices = 64;
+  unsigned maxTriangles = 124;
+  // 0 = hardware concurrency, 1 = calling thread only.
+  unsigned threadCount = 0;
+};
+
+struct MeshletStats {
+  std::size_t meshlets = 0;
+  float averageVertices = 0.0f;
+  float averageTriangles = 0.0f;
+  double milliseconds = 0.0;
+};
+
+// Splits every submesh's LOD 0 range into meshlets: triangles are regrouped
+// in place (the range keeps its offset and count) so that each meshlet is a
+// contiguous run of model.indices, grown greedily over shared vertices.
+// Meshlets are stored in model.meshlets; LOD ranges are left alone.
+MeshletStats buildMeshlets(ModelData& model,
+                           const MeshletOptions& options = {});
+
+// Bounding sphere and normal cone of one meshlet's triangles.
+void computeMeshletBounds(const VertexPU* vertices,
+                          const std::uint32_t* indices, Meshlet& meshlet);
+
+// Plane i of the frustum of `clip` (e.g. viewProj * model, so the planes are
+// in model space), normalized, inside where dot(plane, (p, 1)) >= 0.
+void extractFrustumPlanes(const glm::mat4& clip, glm::vec4 planes[6]);
+
+bool sphereInFrustum(const glm::vec3& center, float radius,
+                     const glm::vec4 planes[6]);
+bool meshletInFrustum(const Meshlet& meshlet, const glm::vec4 planes[6]);
+// True when every triangle faces away from `camera` (same space as the
+// meshlet).
+bool meshletBackfacing(const Meshlet& meshlet, const glm::vec3& camera);
+
+}  // namespace utils
+
+#endif
@@ -0,0 +1,465 @@
+#include "mesh_normals.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <numeric>
+#include <stdexcept>
+#include <vector>
+
+#include "cpu_features.hpp"
+#include "thread_pool.hpp"
+
+#ifdef MGE_X86
+#include <immintrin.h>
+#endif
+
+namespace utils {
+namespace {
+
+constexpr std::size_t kBlock = 256;  // triangles per face pass task
+constexpr std::size_t kCornerChunk = 1u << 16;
+constexpr std::size_t kVertexChunk = 1u << 14;
+constexpr float kPi = 3.14159265358979f;
+
+// acos(x) = sqrt(1 - x) * poly(x) on [0, 1], Abramowitz & Stegun 4.4.46
+// (|error| <= 2e-8). Every path evaluates it in this order, without FMA.
+constexpr float kAcos[8] = {1.5707963050f,  -0.2145988016f, 0.0889789874f,
+                            -0.0501743046f, 0.0308918810f,  -0.0170881256f,
+                            0.0066700901f,  -0.0012624911f};
+
+// A block of triangles as structure of arrays: ax, ay, az, bx, ..., cz.
+struct Corners {
+  float p[9][kBlock];
+};
+
+// Per triangle: unit normal (zero when degenerate) and one weight per
+// corner, so corner k adds w[k] * n to its vertex.
+struct FaceOut {
+  float* n[3];
+  float* w[3];
+};
+
+float cornerAngle(float dot, float l1, float l2) {
+  const float d = std::sqrt(l1 * l2);
+  if (!(d > 0.0f)) return 0.0f;
+  const float x = std::min(std::max(dot / d, -1.0f), 1.0f);
+  const float ax = std::fabs(x);
+  float p = kAcos[7];
+  for (int k = 6; k >= 0; --k) p = p * ax + kAcos[k];
+  const float r = std::sqrt(1.0f - ax) * p;
+  return x < 0.0f ? kPi - r : r;
+}
+
+void facesScalar(const Corners& t, std::size_t begin, std::size_t count,
+                 bool area, bool angle, const FaceOut& out) {
+  for (std::size_t i = begin; i < count; ++i) {
+    float ab[3], ac[3], bc[3];
+    for (int k = 0; k < 3; ++k) {
+      ab[k] = t.p[3 + k][i] - t.p[k][i];
+      ac[k] = t.p[6 + k][i] - t.p[k][i];
+      bc[k] = t.p[6 + k][i] - t.p[3 + k][i];
+    }
+    const float c[3] = {ab[1] * ac[2] - ab[2] * ac[1],
+                        ab[2] * ac[0] - ab[0] * ac[2],
+                        ab[0] * ac[1] - ab[1] * ac[0]};
+    const float len = std::sqrt((c[0] * c[0] + c[1] * c[1]) + c[2] * c[2]);
+    const float inv = len > 0.0f ? 1.0f / len : 0.0f;
+    for (int k = 0; k < 3; ++k) out.n[k][i] = c[k] * inv;
+
+    const float base = area ? len : 1.0f;
+    if (!angle) {
+      for (int k = 0; k < 3; ++k) out.w[k][i] = base;
+      continue;
+    }
+    auto dot = [](const float* u, const float* v) {
+      return (u[0] * v[0] + u[1] * v[1]) + u[2] * v[2];
+    };
+    const float lab = dot(ab, ab), lac = dot(ac, ac), lbc = dot(bc, bc);
+    out.w[0][i] = base * cornerAngle(dot(ab, ac), lab, lac);
+    out.w[1][i] = base * cornerAngle(-dot(ab, bc), lab, lbc);
+    out.w[2][i] = base * cornerAngle(dot(ac, bc), lac, lbc);
+  }
+}
+
+#ifdef MGE_X86
+// The scalar code four triangles at a time; the min/max operand order
+// matches std::min/std::max.
+MGE_TARGET("sse2")
+__m128 dotSse2(const __m128* u, const __m128* v) {
+  return _mm_add_ps(
+      _mm_add_ps(_mm_mul_ps(u[0], v[0]), _mm_mul_ps(u[1], v[1])),
+      _mm_mul_ps(u[2], v[2]));
+}
+
+MGE_TARGET("sse2")
+__m128 cornerAngleSse2(__m128 dot, __m128 l1, __m128 l2) {
+  const __m128 zero = _mm_setzero_ps();
+  const __m128 d = _mm_sqrt_ps(_mm_mul_ps(l1, l2));
+  const __m128 x =
+      _mm_min_ps(_mm_set1_ps(1.0f),
+                 _mm_max_ps(_mm_set1_ps(-1.0f), _mm_div_ps(dot, d)));
+  const __m128 ax = _mm_andnot_ps(_mm_set1_ps(-0.0f), x);
+  __m128 p = _mm_set1_ps(kAcos[7]);
+  for (int k = 6; k >= 0; --k)
+    p = _mm_add_ps(_mm_mul_ps(p, ax), _mm_set1_ps(kAcos[k]));
+  const __m128 r =
+      _mm_mul_ps(_mm_sqrt_ps(_mm_sub_ps(_mm_set1_ps(1.0f), ax)), p);
+  const __m128 negative = _mm_cmplt_ps(x, zero);
+  const __m128 a = _mm_or_ps(
+      _mm_and_ps(negative, _mm_sub_ps(_mm_set1_ps(kPi), r)),
+      _mm_andnot_ps(negative, r));
+  return _mm_and_ps(_mm_cmpgt_ps(d, zero), a);
+}
+
+MGE_TARGET("sse2")
+std::size_t facesSse2(const Corners& t, std::size_t count, bool area,
+                      bool angle, const FaceOut& out) {
+  const __m128 zero = _mm_setzero_ps();
+  std::size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    __m128 ab[3], ac[3], bc[3];
+    for (int k = 0; k < 3; ++k) {
+      const __m128 a = _mm_loadu_ps(&t.p[k][i]);
+      const __m128 b = _mm_loadu_ps(&t.p[3 + k][i]);
+      const __m128 c = _mm_loadu_ps(&t.p[6 + k][i]);
+      ab[k] = _mm_sub_ps(b, a);
+      ac[k] = _mm_sub_ps(c, a);
+      bc[k] = _mm_sub_ps(c, b);
+    }
+    const __m128 c[3] = {
+        _mm_sub_ps(_mm_mul_ps(ab[1], ac[2]), _mm_mul_ps(ab[2], ac[1])),
+        _mm_sub_ps(_mm_mul_ps(ab[2], ac[0]), _mm_mul_ps(ab[0], ac[2])),
+        _mm_sub_ps(_mm_mul_ps(ab[0], ac[1]), _mm_mul_ps(ab[1], ac[0]))};
+    const __m128 len = _mm_sqrt_ps(dotSse2(c, c));
+    const __m128 inv = _mm_and_ps(_mm_cmpgt_ps(len, zero),
+                                  _mm_div_ps(_mm_set1_ps(1.0f), len));
+    for (int k = 0; k < 3; ++k)
+      _mm_storeu_ps(out.n[k] + i, _mm_mul_ps(c[k], inv));
+
+    const __m128 base = area ? len : _mm_set1_ps(1.0f);
+    if (!angle) {
+      for (int k = 0; k < 3; ++k) _mm_storeu_ps(out.w[k] + i, base);
+      continue;
+    }
+    const __m128 lab = dotSse2(ab, ab), lac = dotSse2(ac, ac),
+                 lbc = dotSse2(bc, bc);
+    const __m128 negB = _mm_xor_ps(_mm_set1_ps(-0.0f), dotSse2(ab, bc));
+    _mm_storeu_ps(out.w[0] + i,
+                  _mm_mul_ps(base, cornerAngleSse2(dotSse2(ab, ac), lab,
+                                                   lac)));
+    _mm_storeu_ps(out.w[1] + i,
+                  _mm_mul_ps(base, cornerAngleSse2(negB, lab, lbc)));
+    _mm_storeu_ps(out.w[2] + i,
+                  _mm_mul_ps(base, cornerAngleSse2(dotSse2(ac, bc), lac,
+                                                   lbc)));
+  }
+  return i;
+}
+
+// facesSse2 eight triangles at a time.
+MGE_TARGET("avx2")
+__m256 dotAvx2(const __m256* u, const __m256* v) {
+  return _mm256_add_ps(
+      _mm256_add_ps(_mm256_mul_ps(u[0], v[0]), _mm256_mul_ps(u[1], v[1])),
+      _mm256_mul_ps(u[2], v[2]));
+}
+
+MGE_TARGET("avx2")
+__m256 cornerAngleAvx2(__m256 dot, __m256 l1, __m256 l2) {
+  const __m256 zero = _mm256_setzero_ps();
+  const __m256 d = _mm256_sqrt_ps(_mm256_mul_ps(l1, l2));
+  const __m256 x =
+      _mm256_min_ps(_mm256_set1_ps(1.0f),
+                    _mm256_max_ps(_mm256_set1_ps(-1.0f),
+                                  _mm256_div_ps(dot, d)));
+  const __m256 ax = _mm256_andnot_ps(_mm256_set1_ps(-0.0f), x);
+  __m256 p = _mm256_set1_ps(kAcos[7]);
+  for (int k = 6; k >= 0; --k)
+    p = _mm256_add_ps(_mm256_mul_ps(p, ax), _mm256_set1_ps(kAcos[k]));
+  const __m256 r = _mm256_mul_ps(
+      _mm256_sqrt_ps(_mm256_sub_ps(_mm256_set1_ps(1.0f), ax)), p);
+  const __m256 a = _mm256_blendv_ps(
+      r, _mm256_sub_ps(_mm256_set1_ps(kPi), r),
+      _mm256_cmp_ps(x, zero, _CMP_LT_OQ));
+  return _mm256_and_ps(_mm256_cmp_ps(d, zero, _CMP_GT_OQ), a);
+}
+
+MGE_TARGET("avx2")
+std::size_t facesAvx2(const Corners& t, std::size_t count, bool area,
+                      bool angle, const FaceOut& out) {
+  const __m256 zero = _mm256_setzero_ps();
+  std::size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    __m256 ab[3], ac[3], bc[3];
+    for (int k = 0; k < 3; ++k) {
+      const __m256 a = _mm256_loadu_ps(&t.p[k][i]);
+      const __m256 b = _mm256_loadu_ps(&t.p[3 + k][i]);
+      const __m256 c = _mm256_loadu_ps(&t.p[6 + k][i]);
+      ab[k] = _mm256_sub_ps(b, a);
+      ac[k] = _mm256_sub_ps(c, a);
+      bc[k] = _mm256_sub_ps(c, b);
+    }
+    const __m256 c[3] = {
+        _mm256_sub_ps(_mm256_mul_ps(ab[1], ac[2]),
+                      _mm256_mul_ps(ab[2], ac[1])),
+        _mm256_sub_ps(_mm256_mul_ps(ab[2], ac[0]),
+                      _mm256_mul_ps(ab[0], ac[2])),
+        _mm256_sub_ps(_mm256_mul_ps(ab[0], ac[1]),
+                      _mm256_mul_ps(ab[1], ac[0]))};
+    const __m256 len = _mm256_sqrt_ps(dotAvx2(c, c));
+    const __m256 inv =
+        _mm256_and_ps(_mm256_cmp_ps(len, zero, _CMP_GT_OQ),
+                      _mm256_div_ps(_mm256_set1_ps(1.0f), len));
+    for (int k = 0; k < 3; ++k)
+      _mm256_storeu_ps(out.n[k] + i, _mm256_mul_ps(c[k], inv));
+
+    const __m256 base = area ? len : _mm256_set1_ps(1.0f);
+    if (!angle) {
+      for (int k = 0; k < 3; ++k) _mm256_storeu_ps(out.w[k] + i, base);
+      continue;
+    }
+    const __m256 lab = dotAvx2(ab, ab), lac = dotAvx2(ac, ac),
+                 lbc = dotAvx2(bc, bc);
+    const __m256 negB =
+        _mm256_xor_ps(_mm256_set1_ps(-0.0f), dotAvx2(ab, bc));
+    _mm256_storeu_ps(out.w[0] + i,
+                     _mm256_mul_ps(base, cornerAngleAvx2(dotAvx2(ab, ac),
+                                                         lab, lac)));
+    _mm256_storeu_ps(out.w[1] + i,
+                     _mm256_mul_ps(base, cornerAngleAvx2(negB, lab, lbc)));
+    _mm256_storeu_ps(out.w[2] + i,
+                     _mm256_mul_ps(base, cornerAngleAvx2(dotAvx2(ac, bc),
+                                                         lac, lbc)));
+  }
+  return i;
+}
+#endif
+
+// Unit normal and corner weights of triangles [first, first + count), one
+// array per component as in FaceOut.
+void computeFaces(const NormalInput& in, std::size_t first, std::size_t count,
+                  bool area, bool angle, float (&faces)[6][kBlock]) {
+  Corners t;
+  for (std::size_t i = 0; i < count; ++i) {
+    for (int k = 0; k < 3; ++k) {
+      const std::uint32_t v = in.indices[(first + i) * 3 + k] - in.indexBase;
+      if (v >= in.vertexCount)
+        throw std::runtime_error("generateNormals: index out of range");
+      float p[3];
+      std::memcpy(p, in.positions + v * in.positionStride, sizeof(p));
+      for (int a = 0; a < 3; ++a) t.p[3 * k + a][i] = p[a];
+    }
+  }
+  const FaceOut out = {{faces[0], faces[1], faces[2]},
+                       {faces[3], faces[4], faces[5]}};
+  std::size_t done = 0;
+#ifdef MGE_X86
+  const CpuFeatures features = cpuFeatures();
+  if (features.avx2)
+    done = facesAvx2(t, count, area, angle, out);
+  else if (features.sse2)
+    done = facesSse2(t, count, area, angle, out);
+#endif
+  facesScalar(t, done, count, area, angle, out);
+}
+
+float length(const float* v) {
+  return std::sqrt((v[0] * v[0] + v[1] * v[1]) + v[2] * v[2]);
+}
+
+void writeNormal(const float* sum, std::byte* dst) {
+  const float len = length(sum);
+  float n[3] = {0.0f, 1.0f, 0.0f};
+  if (len > 1e-8f)
+    for (int a = 0; a < 3; ++a) n[a] = sum[a] / len;
+  std::memcpy(dst, n, sizeof(n));
+}
+
+// Ids shared by vertices whose positions are bit-identical (+0 and -0
+// match); returns the number of ids.
+std::size_t positionGroups(const NormalInput& in,
+                           std::vector<std::uint32_t>& group) {
+  const std::size_t n = in.vertexCount;
+  std::vector<std::array<std::uint32_t, 3>> keys(n);
+  for (std::size_t v = 0; v < n; ++v) {
+    std::memcpy(keys[v].data(), in.positions + v * in.positionStride, 12);
+    for (std::uint32_t& bits : keys[v])
+      if (bits == 0x80000000u) bits = 0;
+  }
+  std::vector<std::uint32_t> order(n);
+  std::iota(order.begin(), order.end(), 0u);
+  std::sort(order.begin(), order.end(), [&](std::uint32_t a, std::uint32_t b) {
+    return keys[a] < keys[b];
+  });
+  group.assign(n, 0);
+  std::uint32_t id = 0;
+  for (std::size_t i = 0; i < n; ++i) {
+    if (i > 0 && keys[order[i]] != keys[order[i - 1]]) ++id;
+    group[order[i]] = id;
+  }
+  return n == 0 ? 0 : id + 1;
+}
+
+}  // namespace
+
+void generateNormals(const NormalInput& in, std::byte* normals,
+                     std::size_t normalStride, const NormalOptions& options,
+                     ThreadPool* pool) {
+  const std::size_t vertexCount = in.vertexCount;
+  const std::size_t triangleCount = in.indexCount / 3;
+  const std::size_t cornerCount = triangleCount * 3;
+  if (cornerCount > UINT32_MAX)
+    throw std::runtime_error("generateNormals: too many indices");
+  const bool area = options.weighting == NormalWeighting::Area ||
+                    options.weighting == NormalWeighting::AreaAngle;
+  const bool angle = options.weighting == NormalWeighting::Angle ||
+                     options.weighting == NormalWeighting::AreaAngle;
+  const std::size_t blocks = (triangleCount + kBlock - 1) / kBlock;
+  const bool crease = options.creaseAngle > 0.0f;
+
+  // On one thread, triangles scatter into the vertices. Each vertex still
+  // sums its corners in ascending order, as the gather below does, so both
+  // give the same bits.
+  if (!pool && !crease) {
+    std::vector<float> sums(vertexCount * 3, 0.0f);
+    for (std::size_t b = 0; b < blocks; ++b) {
+      const std::size_t first = b * kBlock;
+      const std::size_t count = std::min(kBlock, triangleCount - first);
+      float faces[6][kBlock];
+      computeFaces(in, first, count, area, angle, faces);
+      for (std::size_t i = 0; i < count; ++i) {
+        for (int k = 0; k < 3; ++k) {
+          float* sum = sums.data() +
+                       std::size_t{in.indices[(first + i) * 3 + k] -
+                                   in.indexBase} * 3;
+          for (int a = 0; a < 3; ++a) sum[a] += faces[3 + k][i] * faces[a][i];
+        }
+      }
+    }
+    for (std::size_t v = 0; v < vertexCount; ++v)
+      writeNormal(sums.data() + v * 3, normals + v * normalStride);
+    return;
+  }
+
+  // Adjacency is keyed by vertex, or with a crease angle by position group
+  // so seam vertices see each other's triangles.
+  std::vector<std::uint32_t> group;
+  const std::size_t keyCount =
+      crease ? positionGroups(in, group) : vertexCount;
+  auto keyOf = [&](std::size_t c) -> std::size_t {
+    const std::uint32_t v = in.indices[c] - in.indexBase;
+    if (v >= vertexCount)
+      throw std::runtime_error("generateNormals: index out of range");
+    return crease ? group[v] : v;
+  };
+
+  // Corners of each key in ascending order (CSR), built like a parallel
+  // radix sort: index chunks count and scatter their corners into key-range
+  // buckets (keeping chunk order), then each bucket counting-sorts its own
+  // keys, so no two threads ever write the same slot.
+  const std::size_t bucketCount = std::max<std::size_t>(
+      1, std::min<std::size_t>(pool ? (pool->size() + 1) * 4 : 1, keyCount));
+  const std::size_t keysPerBucket =
+      std::max<std::size_t>(1, (keyCount + bucketCount - 1) / bucketCount);
+  const std::size_t chunkCount =
+      (cornerCount + kCornerChunk - 1) / kCornerChunk;
+  std::vector<std::size_t> offsets(chunkCount * bucketCount, 0);
+  parallelFor(pool, chunkCount, [&](std::size_t chunk) {
+    std::size_t* counts = offsets.data() + chunk * bucketCount;
+    const std::size_t end = std::min(cornerCount, (chunk + 1) * kCornerChunk);
+    for (std::size_t c = chunk * kCornerChunk; c < end; ++c)
+      ++counts[keyOf(c) / keysPerBucket];
+  });
+  std::vector<std::size_t> bucketStart(bucketCount + 1, 0);
+  std::size_t running = 0;
+  for (std::size_t b = 0; b < bucketCount; ++b) {
+    bucketStart[b] = running;
+    for (std::size_t chunk = 0; chunk < chunkCount; ++chunk) {
+      const std::size_t count = offsets[chunk * bucketCount + b];
+      offsets[chunk * bucketCount + b] = running;
+      running += count;
+    }
+  }
+  bucketStart[bucketCount] = running;
+  std::vector<std::uint32_t> bucketed(cornerCount);
+  parallelFor(pool, chunkCount, [&](std::size_t chunk) {
+    std::size_t* cursor = offsets.data() + chunk * bucketCount;
+    const std::size_t end = std::min(cornerCount, (chunk + 1) * kCornerChunk);
+    for (std::size_t c = chunk * kCornerChunk; c < end; ++c)
+      bucketed[cursor[keyOf(c) / keysPerBucket]++] =
+          static_cast<std::uint32_t>(c);
+  });
+  std::vector<std::uint32_t> start(keyCount + 1, 0);
+  std::vector<std::uint32_t> corners(cornerCount);
+  parallelFor(pool, bucketCount, [&](std::size_t b) {
+    const std::size_t lo = std::min(keyCount, b * keysPerBucket);
+    const std::size_t hi = std::min(keyCount, lo + keysPerBucket);
+    for (std::size_t i = bucketStart[b]; i < bucketStart[b + 1]; ++i)
+      ++start[keyOf(bucketed[i])];
+    auto next = static_cast<std::uint32_t>(bucketStart[b]);
+    for (std::size_t k = lo; k < hi; ++k) {
+      const std::uint32_t count = start[k];
+      start[k] = next;
+      next += count;
+    }
+    std::vector<std::uint32_t> cursor(start.begin() + lo, start.begin() + hi);
+    for (std::size_t i = bucketStart[b]; i < bucketStart[b + 1]; ++i) {
+      const std::uint32_t c = bucketed[i];
+      corners[cursor[keyOf(c) - lo]++] = c;
+    }
+  });
+  start[keyCount] = static_cast<std::uint32_t>(cornerCount);
+  bucketed = {};
+
+  // Per triangle: normal xyz, then the weight of each corner.
+  std::vector<float> faceData(triangleCount * 6);
+  parallelFor(pool, blocks, [&](std::size_t b) {
+    const std::size_t first = b * kBlock;
+    const std::size_t count = std::min(kBlock, triangleCount - first);
+    float faces[6][kBlock];
+    computeFaces(in, first, count, area, angle, faces);
+    float* dst = faceData.data() + first * 6;
+    for (std::size_t i = 0; i < count; ++i)
+      for (int j = 0; j < 6; ++j) *dst++ = faces[j][i];
+  });
+
+  auto add = [&](std::uint32_t c, float* sum) {
+    const float* face = faceData.data() + std::size_t{c / 3} * 6;
+    const float w = face[3 + c % 3];
+    for (int a = 0; a < 3; ++a) sum[a] += w * face[a];
+  };
+  const float cosCrease =
+      std::cos(std::min(options.creaseAngle, 180.0f) * kPi / 180.0f);
+  const std::size_t vertexChunks =
+      (vertexCount + kVertexChunk - 1) / kVertexChunk;
+  parallelFor(pool, vertexChunks, [&](std::size_t chunk) {
+    const std::size_t end = std::min(vertexCount, (chunk + 1) * kVertexChunk);
+    for (std::size_t v = chunk * kVertexChunk; v < end; ++v) {
+      const std::size_t key = crease ? group[v] : v;
+      float sum[3] = {0.0f, 0.0f, 0.0f};
+      for (std::uint32_t i = start[key]; i < start[key + 1]; ++i)
+        if (!crease || in.indices[corners[i]] - in.indexBase == v)
+          add(corners[i], sum);
+      // The vertex's own triangles define the normal that the other
+      // triangles at its position are compared against.
+      const float ownLength = crease ? length(sum) : 0.0f;
+      if (ownLength > 1e-8f) {
+        const float own[3] = {sum[0] / ownLength, sum[1] / ownLength,
+                              sum[2] / ownLength};
+        for (std::uint32_t i = start[key]; i < start[key + 1]; ++i) {
+          const std::uint32_t c = corners[i];
+          if (in.indices[c] - in.indexBase == v) continue;
+          const float* n = faceData.data() + std::size_t{c / 3} * 6;
+          if ((n[0] * own[0] + n[1] * own[1]) + n[2] * own[2] >= cosCrease)
+            add(c, sum);
+        }
+      }
+      writeNormal(sum, normals + v * normalStride);
+    }
+  });
+}
+
+}  // namespace utils
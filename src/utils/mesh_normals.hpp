@@ -0,0 +1,50 @@
+#ifndef MESH_NORMALS_HPP
+#define MESH_NORMALS_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+namespace utils {
+
+class ThreadPool;
+
+// How much a triangle contributes to the normal at each of its corners.
+enum class NormalWeighting {
+  Uniform,    // every triangle alike
+  Area,       // proportional to the triangle's area
+  Angle,      // proportional to the angle at the corner
+  AreaAngle,  // both
+};
+
+struct NormalOptions {
+  NormalWeighting weighting = NormalWeighting::Angle;
+  // Degrees; 0 disables. With a crease angle, vertices sharing a position
+  // (UV or material seams) are also smoothed with each other's triangles
+  // whose normal lies within this angle of their own. Vertices are never
+  // split, so triangles sharing an index are always smoothed together.
+  float creaseAngle = 0.0f;
+};
+
+struct NormalInput {
+  const std::byte* positions = nullptr;  // float3
+  std::size_t positionStride = 12;
+  std::size_t vertexCount = 0;
+  const std::uint32_t* indices = nullptr;  // triangle list
+  std::size_t indexCount = 0;
+  // Subtracted from every index; the results must be below vertexCount.
+  std::uint32_t indexBase = 0;
+};
+
+// Writes a unit float3 normal per vertex to `normals` (stride in bytes);
+// vertices no triangle references get (0, 1, 0). With a `pool` (null =
+// calling thread) each vertex gathers its triangles through a sorted
+// vertex -> corner adjacency, so threads never share a write. The result
+// does not depend on the pool or the SIMD level.
+void generateNormals(const NormalInput& in, std::byte* normals,
+                     std::size_t normalStride,
+                     const NormalOptions& options = {},
+                     ThreadPool* pool = nullptr);
+
+}  // namespace utils
+
+#endif
@@ -0,0 +1,366 @@
+#include "mesh_optimize.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <limits>
+#include <memory>
+#include <numeric>
+#include <stdexcept>
+#include <vector>
+
+#include "thread_pool.hpp"
+
+namespace utils {
+namespace {
+
+constexpr std::uint32_t kNone = std::numeric_limits<std::uint32_t>::max();
+
+// Maps the (global) vertex ids of one index range onto 0..count-1.
+struct LocalVertices {
+  std::uint32_t minVertex = 0;
+  std::vector<std::uint32_t> toLocal;  // indexed by id - minVertex
+  std::vector<std::uint32_t> toGlobal;
+
+  LocalVertices(const std::uint32_t* indices, std::size_t indexCount) {
+    if (indexCount == 0) return;
+    const auto [lo, hi] = std::minmax_element(indices, indices + indexCount);
+    minVertex = *lo;
+    toLocal.assign(static_cast<std::size_t>(*hi - *lo) + 1, kNone);
+    for (std::size_t i = 0; i < indexCount; ++i) {
+      std::uint32_t& slot = toLocal[indices[i] - minVertex];
+      if (slot == kNone) {
+        slot = static_cast<std::uint32_t>(toGlobal.size());
+        toGlobal.push_back(indices[i]);
+      }
+    }
+  }
+  std::uint32_t local(std::uint32_t global) const {
+    return toLocal[global - minVertex];
+  }
+};
+
+// FIFO cache simulation with timestamps: a vertex is cached while fewer than
+// cacheSize misses happened since it was last loaded.
+class FifoCache {
+ public:
+  FifoCache(std::size_t vertexCount, unsigned cacheSize)
+      : loadedAt_(vertexCount, 0), size_(cacheSize) {}
+
+  bool access(std::uint32_t v) {
+    if (loadedAt_[v] > flushedAt_ && time_ - loadedAt_[v] < size_) return true;
+    loadedAt_[v] = ++time_;
+    return false;
+  }
+
+  // Empties the cache in O(1).
+  void flush() { flushedAt_ = time_; }
+
+ private:
+  std::vector<std::size_t> loadedAt_;
+  std::size_t time_ = 0;
+  std::size_t flushedAt_ = 0;
+  std::size_t size_;
+};
+
+}  // namespace
+
+VertexCacheStats analyzeVertexCache(const std::uint32_t* indices,
+                                    std::size_t indexCount,
+                                    unsigned cacheSize) {
+  VertexCacheStats stats;
+  stats.triangles = indexCount / 3;
+  if (stats.triangles == 0) return stats;
+
+  LocalVertices local(indices, indexCount);
+  FifoCache cache(local.toGlobal.size(), cacheSize);
+  for (std::size_t i = 0; i < stats.triangles * 3; ++i)
+    if (!cache.access(local.local(indices[i]))) stats.misses++;
+
+  stats.uniqueVertices = local.toGlobal.size();
+  stats.acmr = static_cast<float>(stats.misses) / stats.triangles;
+  stats.atvr = static_cast<float>(stats.misses) / stats.uniqueVertices;
+  return stats;
+}
+
+VertexFetchStats analyzeVertexFetch(const std::uint32_t* indices,
+                                    std::size_t indexCount,
+                                    std::size_t vertexSize) {
+  constexpr std::size_t kLineSize = 64;
+  constexpr std::size_t kLines = (16u << 10) / kLineSize;
+  VertexFetchStats stats;
+  if (indexCount == 0 || vertexSize == 0) return stats;
+
+  std::vector<std::size_t> lines(kLines, kNone);
+  for (std::size_t i = 0; i < indexCount; ++i) {
+    const std::size_t begin = indices[i] * vertexSize;
+    const std::size_t end = begin + vertexSize;
+    for (std::size_t line = begin / kLineSize; line * kLineSize < end;
+         ++line) {
+      std::size_t& slot = lines[line % kLines];
+      if (slot == line) continue;
+      slot = line;
+      stats.bytesFetched += kLineSize;
+    }
+  }
+
+  LocalVertices local(indices, indexCount);
+  stats.overfetch = static_cast<float>(stats.bytesFetched) /
+                    static_cast<float>(local.toGlobal.size() * vertexSize);
+  return stats;
+}
+
+void optimizeVertexCache(std::uint32_t* dst, const std::uint32_t* src,
+                         std::size_t indexCount, unsigned cacheSize) {
+  const std::size_t triCount = indexCount / 3;
+  if (triCount == 0) return;
+
+  LocalVertices local(src, indexCount);
+  const std::size_t vertexCount = local.toGlobal.size();
+  std::vector<std::uint32_t> tris(triCount * 3);
+  for (std::size_t i = 0; i < tris.size(); ++i) tris[i] = local.local(src[i]);
+
+  // Vertex -> triangle adjacency (CSR) and live triangle counts.
+  std::vector<std::uint32_t> adjStart(vertexCount + 1, 0);
+  for (std::uint32_t v : tris) adjStart[v + 1]++;
+  for (std::size_t v = 0; v < vertexCount; ++v)
+    adjStart[v + 1] += adjStart[v];
+  std::vector<std::uint32_t> adj(tris.size());
+  {
+    std::vector<std::uint32_t> cursor(adjStart.begin(), adjStart.end() - 1);
+    for (std::size_t i = 0; i < tris.size(); ++i)
+      adj[cursor[tris[i]]++] = static_cast<std::uint32_t>(i / 3);
+  }
+  std::vector<std::uint32_t> live(vertexCount);
+  for (std::size_t v = 0; v < vertexCount; ++v)
+    live[v] = adjStart[v + 1] - adjStart[v];
+
+  std::vector<std::size_t> timestamp(vertexCount, 0);
+  std::vector<bool> emitted(triCount, false);
+  std::vector<std::uint32_t> deadEnd;
+  std::vector<std::uint32_t> candidates;
+  std::vector<std::uint32_t> out;
+  out.reserve(tris.size());
+
+  std::size_t time = cacheSize + 1;
+  std::uint32_t cursor = 0;
+  std::uint32_t fan = 0;
+  while (fan != kNone) {
+    candidates.clear();
+    for (std::uint32_t a = adjStart[fan]; a < adjStart[fan + 1]; ++a) {
+      const std::uint32_t t = adj[a];
+      if (emitted[t]) continue;
+      emitted[t] = true;
+      for (int k = 0; k < 3; ++k) {
+        const std::uint32_t v = tris[t * 3 + k];
+        out.push_back(v);
+        deadEnd.push_back(v);
+        candidates.push_back(v);
+        live[v]--;
+        if (time - timestamp[v] > cacheSize) timestamp[v] = time++;
+      }
+    }
+
+    // Next fanning vertex: the candidate that stays in cache longest while
+    // its remaining triangles are emitted.
+    fan = kNone;
+    std::size_t best = 0;
+    bool found = false;
+    for (std::uint32_t v : candidates) {
+      if (live[v] == 0) continue;
+      std::size_t priority = 0;
+      if (time - timestamp[v] + 2 * live[v] <= cacheSize)
+        priority = time - timestamp[v];
+      if (!found || priority > best) {
+        best = priority;
+        fan = v;
+        found = true;
+      }
+    }
+    if (found) continue;
+
+    while (!deadEnd.empty()) {
+      const std::uint32_t v = deadEnd.back();
+      deadEnd.pop_back();
+      if (live[v] > 0) {
+        fan = v;
+        break;
+      }
+    }
+    if (fan != kNone) continue;
+    while (cursor < vertexCount && live[cursor] == 0) ++cursor;
+    if (cursor < vertexCount) fan = cursor;
+  }
+
+  for (std::size_t i = 0; i < out.size(); ++i) dst[i] = local.toGlobal[out[i]];
+  // A trailing partial triangle (if any) is left untouched.
+  if (dst != src)
+    std::copy(src + out.size(), src + indexCount, dst + out.size());
+}
+
+void optimizeOverdraw(std::uint32_t* dst, const std::uint32_t* src,
+                      std::size_t indexCount, const VertexPU* vertices,
+                      unsigned cacheSize, float threshold) {
+  const std::size_t triCount = indexCount / 3;
+  if (triCount == 0) return;
+
+  LocalVertices local(src, indexCount);
+  FifoCache cache(local.toGlobal.size(), cacheSize);
+  std::vector<std::uint8_t> misses(triCount, 0);
+  for (std::size_t t = 0; t < triCount; ++t)
+    for (int k = 0; k < 3; ++k)
+      if (!cache.access(local.local(src[t * 3 + k]))) misses[t]++;
+
+  // Hard boundaries where the cache was flushed (all three vertices miss).
+  // Each hard cluster is then split wherever the current piece, simulated
+  // from a cold cache, reaches threshold x the hard cluster's ACMR: pieces can
+  // then be drawn in any order for at most that much vertex cache cost.
+  std::vector<std::size_t> clusterStart;
+  for (std::size_t hard = 0; hard < triCount;) {
+    std::size_t hardEnd = hard + 1;
+    std::size_t hardMisses = misses[hard];
+    while (hardEnd < triCount && misses[hardEnd] != 3)
+      hardMisses += misses[hardEnd++];
+    const float limit =
+        threshold * static_cast<float>(hardMisses) / (hardEnd - hard);
+
+    std::size_t softStart = hard, softMisses = 0;
+    cache.flush();
+    for (std::size_t t = hard; t < hardEnd; ++t) {
+      for (int k = 0; k < 3; ++k)
+        if (!cache.access(local.local(src[t * 3 + k]))) softMisses++;
+      if (static_cast<float>(softMisses) <= limit * (t - softStart + 1)) {
+        clusterStart.push_back(softStart);
+        softStart = t + 1;
+        softMisses = 0;
+        cache.flush();
+      }
+    }
+    if (softStart < hardEnd) clusterStart.push_back(softStart);
+    hard = hardEnd;
+  }
+  clusterStart.push_back(triCount);
+
+  // Sort key: how much a cluster faces away from the range centroid. Outer,
+  // outward-facing clusters are drawn first and occlude the rest.
+  const std::size_t clusterCount = clusterStart.size() - 1;
+  std::vector<glm::vec3> centroid(clusterCount, glm::vec3(0.0f));
+  std::vector<glm::vec3> normal(clusterCount, glm::vec3(0.0f));
+  std::vector<float> area(clusterCount, 0.0f);
+  glm::vec3 meshCentroid(0.0f);
+  float meshArea = 0.0f;
+  for (std::size_t c = 0; c < clusterCount; ++c) {
+    for (std::size_t t = clusterStart[c]; t < clusterStart[c + 1]; ++t) {
+      const glm::vec3& a = vertices[src[t * 3 + 0]].pos;
+      const glm::vec3& b = vertices[src[t * 3 + 1]].pos;
+      const glm::vec3& d = vertices[src[t * 3 + 2]].pos;
+      const glm::vec3 n = glm::cross(b - a, d - a);
+      const float triArea = glm::length(n);
+      centroid[c] += (a + b + d) * (triArea / 3.0f);
+      normal[c] += n;
+      area[c] += triArea;
+    }
+    meshCentroid += centroid[c];
+    meshArea += area[c];
+    if (area[c] > 0.0f) centroid[c] /= area[c];
+  }
+  if (meshArea > 0.0f) meshCentroid /= meshArea;
+
+  std::vector<float> key(clusterCount, 0.0f);
+  for (std::size_t c = 0; c < clusterCount; ++c) {
+    const float len = glm::length(normal[c]);
+    if (len > 0.0f)
+      key[c] = glm::dot(centroid[c] - meshCentroid, normal[c] / len);
+  }
+  std::vector<std::size_t> order(clusterCount);
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(
+      order.begin(), order.end(),
+      [&](std::size_t a, std::size_t b) { return key[a] > key[b]; });
+
+  std::vector<std::uint32_t> out;
+  out.reserve(indexCount);
+  for (std::size_t c : order)
+    out.insert(out.end(), src + clusterStart[c] * 3,
+               src + clusterStart[c + 1] * 3);
+  out.insert(out.end(), src + triCount * 3, src + indexCount);
+  std::copy(out.begin(), out.end(), dst);
+}
+
+std::size_t optimizeVertexFetch(VertexPU* dstVertices, std::uint32_t* indices,
+                                std::size_t indexCount,
+                                const VertexPU* vertices,
+                                std::size_t vertexCount) {
+  std::vector<std::uint32_t> remap(vertexCount, kNone);
+  std::uint32_t next = 0;
+  for (std::size_t i = 0; i < indexCount; ++i) {
+    std::uint32_t& slot = remap.at(indices[i]);
+    if (slot == kNone) {
+      slot = next++;
+      dstVertices[slot] = vertices[indices[i]];
+    }
+    indices[i] = slot;
+  }
+  return next;
+}
+
+OptimizeStats optimizeModel(ModelData& model, const OptimizeOptions& options) {
+  if (model.borrowedVertices || model.borrowedIndices)
+    throw std::runtime_error("optimizeModel needs owned geometry");
+
+  const auto t0 = std::chrono::steady_clock::now();
+  OptimizeStats stats;
+  const unsigned threads = ThreadPool::resolveThreadCount(options.threadCount);
+  std::unique_ptr<ThreadPool> pool;
+  if (threads > 1) pool = std::make_unique<ThreadPool>(threads - 1);
+
+  stats.fetchBefore = analyzeVertexFetch(
+      model.indices.data(), model.indices.size(), sizeof(VertexPU));
+
+  std::vector<VertexCacheStats> before(model.submeshes.size());
+  std::vector<VertexCacheStats> tipsify(model.submeshes.size());
+  std::vector<VertexCacheStats> overdraw(model.submeshes.size());
+  parallelFor(pool.get(), model.submeshes.size(), [&](std::size_t s) {
+    const Submesh& sm = model.submeshes[s];
+    std::uint32_t* range = model.indices.data() + sm.indexOffset;
+    before[s] = analyzeVertexCache(range, sm.indexCount, options.cacheSize);
+    optimizeVertexCache(range, range, sm.indexCount, options.cacheSize);
+    tipsify[s] = analyzeVertexCache(range, sm.indexCount, options.cacheSize);
+    if (options.overdrawThreshold > 0.0f)
+      optimizeOverdraw(range, range, sm.indexCount, model.vertices.data(),
+                       options.cacheSize, options.overdrawThreshold);
+    overdraw[s] = analyzeVertexCache(range, sm.indexCount, options.cacheSize);
+  });
+
+  auto total = [](const std::vector<VertexCacheStats>& parts) {
+    VertexCacheStats sum;
+    for (const auto& p : parts) {
+      sum.triangles += p.triangles;
+      sum.uniqueVertices += p.uniqueVertices;
+      sum.misses += p.misses;
+    }
+    if (sum.triangles)
+      sum.acmr = static_cast<float>(sum.misses) / sum.triangles;
+    if (sum.uniqueVertices)
+      sum.atvr = static_cast<float>(sum.misses) / sum.uniqueVertices;
+    return sum;
+  };
+  stats.cacheBefore = total(before);
+  stats.cacheAfterTipsify = total(tipsify);
+  stats.cacheAfterOverdraw = total(overdraw);
+
+  std::vector<VertexPU> vertices(model.vertices.size());
+  vertices.resize(optimizeVertexFetch(vertices.data(), model.indices.data(),
+                                      model.indices.size(),
+                                      model.vertices.data(),
+                                      model.vertices.size()));
+  model.vertices = std::move(vertices);
+  stats.fetchAfter = analyzeVertexFetch(
+      model.indices.data(), model.indices.size(), sizeof(VertexPU));
+
+  stats.milliseconds = std::chrono::duration<double, std::milli>(
+                           std::chrono::steady_clock::now() - t0)
+                           .count();
+  return stats;
+}
+
+}  // namespace utils
@@ -0,0 +1,76 @@
+#ifndef MESH_OPTIMIZE_HPP
+#define MESH_OPTIMIZE_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+#include "mesh.hpp"
+
+namespace utils {
+
+struct VertexCacheStats {
+  std::size_t triangles = 0;
+  std::size_t uniqueVertices = 0;
+  std::size_t misses = 0;
+  float acmr = 0.0f;  // misses per triangle: 0.5 ideal, 3 worst
+  float atvr = 0.0f;  // misses per unique vertex: 1 ideal
+};
+
+struct VertexFetchStats {
+  std::size_t bytesFetched = 0;
+  // bytesFetched / (unique vertices * vertex size): 1 is ideal.
+  float overfetch = 0.0f;
+};
+
+// Simulates a FIFO post-transform cache of cacheSize entries.
+VertexCacheStats analyzeVertexCache(const std::uint32_t* indices,
+                                    std::size_t indexCount,
+                                    unsigned cacheSize = 16);
+
+// Simulates a 16 KiB direct-mapped cache of 64-byte lines over the vertex
+// buffer, vertexSize bytes per vertex.
+VertexFetchStats analyzeVertexFetch(const std::uint32_t* indices,
+                                    std::size_t indexCount,
+                                    std::size_t vertexSize);
+
+// Tipsify (Sander et al. 2007): reorders the triangles of one index range
+// for post-transform cache reuse. dst may alias src.
+void optimizeVertexCache(std::uint32_t* dst, const std::uint32_t* src,
+                         std::size_t indexCount, unsigned cacheSize = 16);
+
+// Splits a cache-optimized range into clusters at cache flush points (as long
+// as a cluster's ACMR stays within threshold x the range's ACMR) and sorts
+// the clusters front-to-back from the outside in, to cut overdraw.
+void optimizeOverdraw(std::uint32_t* dst, const std::uint32_t* src,
+                      std::size_t indexCount, const VertexPU* vertices,
+                      unsigned cacheSize = 16, float threshold = 1.05f);
+
+// Reorders vertices by first use in `indices` and remaps the indices in
+// place; unreferenced vertices are dropped. Returns the new vertex count.
+std::size_t optimizeVertexFetch(VertexPU* dstVertices, std::uint32_t* indices,
+                                std::size_t indexCount,
+                                const VertexPU* vertices,
+                                std::size_t vertexCount);
+
+struct OptimizeOptions {
+  unsigned cacheSize = 16;
+  // Overdraw clustering; <= 0 skips the stage.
+  float overdrawThreshold = 1.05f;
+  // 0 = hardware concurrency, 1 = calling thread only.
+  unsigned threadCount = 0;
+};
+
+struct OptimizeStats {
+  VertexCacheStats cacheBefore, cacheAfterTipsify, cacheAfterOverdraw;
+  VertexFetchStats fetchBefore, fetchAfter;
+  double milliseconds = 0.0;
+};
+
+// Runs the three stages on every submesh range of the model (in parallel
+// across submeshes), then reorders model.vertices for fetch locality.
+OptimizeStats optimizeModel(ModelData& model,
+                            const OptimizeOptions& options = {});
+
+}  // namespace utils
+
+#endif
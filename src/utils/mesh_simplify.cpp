@@ -0,0 +1,323 @@
+#include "mesh_simplify.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <unordered_map>
+
+#include "mesh_optimize.hpp"
+#include "thread_pool.hpp"
+
+namespace utils {
+namespace {
+
+constexpr std::uint32_t kNone = std::numeric_limits<std::uint32_t>::max();
+
+// Symmetric 4x4 error quadric plus the total area it was built from.
+struct Quadric {
+  double a00 = 0, a01 = 0, a02 = 0, a03 = 0;
+  double a11 = 0, a12 = 0, a13 = 0;
+  double a22 = 0, a23 = 0;
+  double a33 = 0;
+  double weight = 0;
+
+  static Quadric fromPlane(const glm::dvec3& n, double d, double w) {
+    Quadric q;
+    q.a00 = w * n.x * n.x;
+    q.a01 = w * n.x * n.y;
+    q.a02 = w * n.x * n.z;
+    q.a03 = w * n.x * d;
+    q.a11 = w * n.y * n.y;
+    q.a12 = w * n.y * n.z;
+    q.a13 = w * n.y * d;
+    q.a22 = w * n.z * n.z;
+    q.a23 = w * n.z * d;
+    q.a33 = w * d * d;
+    q.weight = w;
+    return q;
+  }
+
+  Quadric& operator+=(const Quadric& o) {
+    a00 += o.a00, a01 += o.a01, a02 += o.a02, a03 += o.a03;
+    a11 += o.a11, a12 += o.a12, a13 += o.a13;
+    a22 += o.a22, a23 += o.a23;
+    a33 += o.a33;
+    weight += o.weight;
+    return *this;
+  }
+
+  // Area-weighted mean squared distance of p to the accumulated planes.
+  double error(const glm::vec3& p) const {
+    const double x = p.x, y = p.y, z = p.z;
+    const double e = a00 * x * x + 2 * a01 * x * y + 2 * a02 * x * z +
+                     2 * a03 * x + a11 * y * y + 2 * a12 * y * z +
+                     2 * a13 * y + a22 * z * z + 2 * a23 * z + a33;
+    return weight > 0 ? std::max(e, 0.0) / weight : 0.0;
+  }
+};
+
+struct Collapse {
+  std::uint32_t from;
+  std::uint32_t to;
+  double cost;
+};
+
+std::uint64_t edgeKey(std::uint32_t a, std::uint32_t b) {
+  if (a > b) std::swap(a, b);
+  return (std::uint64_t{a} << 32) | b;
+}
+
+}  // namespace
+
+std::vector<std::uint32_t> simplifyIndices(const VertexPU* vertices,
+                                           const std::uint32_t* indices,
+                                           std::size_t indexCount,
+                                           std::size_t targetIndexCount,
+                                           float maxError,
+                                           float* resultError) {
+  if (resultError) *resultError = 0.0f;
+  const std::size_t triCount = indexCount / 3;
+  const std::size_t targetTris = targetIndexCount / 3;
+
+  // Local vertex ids keep the working arrays proportional to the range.
+  std::unordered_map<std::uint32_t, std::uint32_t> toLocal;
+  std::vector<std::uint32_t> toGlobal;
+  std::vector<std::uint32_t> tris(triCount * 3);
+  for (std::size_t i = 0; i < tris.size(); ++i) {
+    auto [it, inserted] = toLocal.try_emplace(
+        indices[i], static_cast<std::uint32_t>(toGlobal.size()));
+    if (inserted) toGlobal.push_back(indices[i]);
+    tris[i] = it->second;
+  }
+  const std::size_t vertexCount = toGlobal.size();
+  std::vector<glm::vec3> pos(vertexCount);
+  for (std::size_t v = 0; v < vertexCount; ++v)
+    pos[v] = vertices[toGlobal[v]].pos;
+
+  std::vector<Quadric> quadric(vertexCount);
+  for (std::size_t t = 0; t < triCount; ++t) {
+    const glm::dvec3 a = pos[tris[t * 3]], b = pos[tris[t * 3 + 1]],
+                     c = pos[tris[t * 3 + 2]];
+    glm::dvec3 n = glm::cross(b - a, c - a);
+    const double len = glm::length(n);
+    if (len <= 0.0) continue;
+    n /= len;
+    const Quadric q = Quadric::fromPlane(n, -glm::dot(n, a), len * 0.5);
+    for (int k = 0; k < 3; ++k) quadric[tris[t * 3 + k]] += q;
+  }
+
+  std::vector<bool> locked(vertexCount, false);
+  {
+    std::unordered_map<std::uint64_t, int> edgeUse;
+    edgeUse.reserve(tris.size());
+    for (std::size_t t = 0; t < triCount; ++t)
+      for (int k = 0; k < 3; ++k)
+        edgeUse[edgeKey(tris[t * 3 + k], tris[t * 3 + (k + 1) % 3])]++;
+    for (const auto& [key, uses] : edgeUse) {
+      if (uses == 2) continue;
+      locked[static_cast<std::uint32_t>(key >> 32)] = true;
+      locked[static_cast<std::uint32_t>(key)] = true;
+    }
+  }
+
+  const double maxCost = static_cast<double>(maxError) * maxError;
+  double reachedCost = 0.0;
+  std::vector<std::uint32_t> adjStart, adj;
+  std::vector<Collapse> candidates;
+  std::vector<bool> touched;
+
+  while (tris.size() / 3 > targetTris) {
+    const std::size_t currentTris = tris.size() / 3;
+
+    adjStart.assign(vertexCount + 1, 0);
+    for (std::uint32_t v : tris) adjStart[v + 1]++;
+    for (std::size_t v = 0; v < vertexCount; ++v)
+      adjStart[v + 1] += adjStart[v];
+    adj.resize(tris.size());
+    {
+      std::vector<std::uint32_t> cursor(adjStart.begin(), adjStart.end() - 1);
+      for (std::size_t i = 0; i < tris.size(); ++i)
+        adj[cursor[tris[i]]++] = static_cast<std::uint32_t>(i / 3);
+    }
+
+    // Cheapest direction of every edge whose source can move.
+    candidates.clear();
+    for (std::size_t t = 0; t < currentTris; ++t) {
+      for (int k = 0; k < 3; ++k) {
+        const std::uint32_t a = tris[t * 3 + k];
+        const std::uint32_t b = tris[t * 3 + (k + 1) % 3];
+        if (a > b) continue;  // each undirected edge once per triangle
+        Quadric q = quadric[a];
+        q += quadric[b];
+        const double toB = locked[a] ? -1.0 : q.error(pos[b]);
+        const double toA = locked[b] ? -1.0 : q.error(pos[a]);
+        if (toB < 0.0 && toA < 0.0) continue;
+        if (toA < 0.0 || (toB >= 0.0 && toB <= toA))
+          candidates.push_back({a, b, toB});
+        else
+          candidates.push_back({b, a, toA});
+      }
+    }
+    if (candidates.empty()) break;
+    std::sort(candidates.begin(), candidates.end(),
+              [](const Collapse& x, const Collapse& y) {
+                if (x.cost != y.cost) return x.cost < y.cost;
+                if (x.from != y.from) return x.from < y.from;
+                return x.to < y.to;
+              });
+
+    // Each collapse removes about two triangles; vertices around a collapse
+    // are frozen for the rest of the pass so the flip tests stay valid.
+    const std::size_t budget = (currentTris - targetTris) / 2 + 1;
+    std::size_t collapsed = 0;
+    touched.assign(vertexCount, false);
+    std::vector<std::uint32_t> remap(vertexCount);
+    for (std::size_t v = 0; v < vertexCount; ++v)
+      remap[v] = static_cast<std::uint32_t>(v);
+
+    for (const Collapse& c : candidates) {
+      if (collapsed >= budget || c.cost > maxCost) break;
+      if (touched[c.from] || touched[c.to]) continue;
+
+      bool flips = false;
+      for (std::uint32_t a = adjStart[c.from]; a < adjStart[c.from + 1]; ++a) {
+        const std::uint32_t* tri = &tris[adj[a] * 3];
+        if (tri[0] == c.to || tri[1] == c.to || tri[2] == c.to) continue;
+        glm::vec3 p[3], q[3];
+        for (int k = 0; k < 3; ++k) {
+          p[k] = pos[tri[k]];
+          q[k] = tri[k] == c.from ? pos[c.to] : p[k];
+        }
+        const glm::vec3 before = glm::cross(p[1] - p[0], p[2] - p[0]);
+        const glm::vec3 after = glm::cross(q[1] - q[0], q[2] - q[0]);
+        if (glm::dot(before, after) <= 0.0f) {
+          flips = true;
+          break;
+        }
+      }
+      if (flips) continue;
+
+      remap[c.from] = c.to;
+      quadric[c.to] += quadric[c.from];
+      reachedCost = std::max(reachedCost, c.cost);
+      for (std::uint32_t a = adjStart[c.from]; a < adjStart[c.from + 1]; ++a)
+        for (int k = 0; k < 3; ++k) touched[tris[adj[a] * 3 + k]] = true;
+      collapsed++;
+    }
+    if (collapsed == 0) break;
+
+    std::size_t kept = 0;
+    for (std::size_t t = 0; t < currentTris; ++t) {
+      const std::uint32_t a = remap[tris[t * 3]];
+      const std::uint32_t b = remap[tris[t * 3 + 1]];
+      const std::uint32_t c = remap[tris[t * 3 + 2]];
+      if (a == b || b == c || a == c) continue;
+      tris[kept * 3] = a;
+      tris[kept * 3 + 1] = b;
+      tris[kept * 3 + 2] = c;
+      kept++;
+    }
+    tris.resize(kept * 3);
+  }
+
+  if (resultError) *resultError = static_cast<float>(std::sqrt(reachedCost));
+  for (std::uint32_t& v : tris) v = toGlobal[v];
+  return tris;
+}
+
+void computeBounds(const VertexPU* vertices, const std::uint32_t* indices,
+                   std::size_t indexCount, glm::vec3& center, float& radius) {
+  center = glm::vec3(0.0f);
+  radius = 0.0f;
+  if (indexCount == 0) return;
+  glm::vec3 lo = vertices[indices[0]].pos, hi = lo;
+  for (std::size_t i = 1; i < indexCount; ++i) {
+    lo = glm::min(lo, vertices[indices[i]].pos);
+    hi = glm::max(hi, vertices[indices[i]].pos);
+  }
+  center = (lo + hi) * 0.5f;
+  float r2 = 0.0f;
+  for (std::size_t i = 0; i < indexCount; ++i) {
+    const glm::vec3 d = vertices[indices[i]].pos - center;
+    r2 = std::max(r2, glm::dot(d, d));
+  }
+  radius = std::sqrt(r2);
+}
+
+LodStats buildLods(ModelData& model, const LodOptions& options) {
+  if (model.borrowedVertices || model.borrowedIndices)
+    throw std::runtime_error("buildLods needs owned geometry");
+
+  const auto t0 = std::chrono::steady_clock::now();
+  const unsigned threads = ThreadPool::resolveThreadCount(options.threadCount);
+  std::unique_ptr<ThreadPool> pool;
+  if (threads > 1) pool = std::make_unique<ThreadPool>(threads - 1);
+
+  struct Chain {
+    std::vector<std::vector<std::uint32_t>> levels;
+    std::vector<float> errors;
+  };
+  std::vector<Chain> chains(model.submeshes.size());
+
+  parallelFor(pool.get(), model.submeshes.size(), [&](std::size_t s) {
+    Submesh& sm = model.submeshes[s];
+    const std::uint32_t* range = model.indices.data() + sm.indexOffset;
+    computeBounds(model.vertices.data(), range, sm.indexCount, sm.center,
+                  sm.radius);
+
+    const float maxError = options.maxError * sm.radius;
+    std::vector<std::uint32_t> previous(range, range + sm.indexCount);
+    // Each level simplifies the previous one, so its deviation from LOD 0 is
+    // bounded by the sum of the level errors; that sum is what selection
+    // compares, and it spends a single maxError budget for the chain.
+    float error = 0.0f;
+    for (unsigned level = 0; level < options.maxLods; ++level) {
+      const std::size_t tris = previous.size() / 3;
+      const auto target = static_cast<std::size_t>(tris * options.reduction);
+      if (target < options.minTriangles || error >= maxError) break;
+
+      float levelError = 0.0f;
+      std::vector<std::uint32_t> lod = simplifyIndices(
+          model.vertices.data(), previous.data(), previous.size(), target * 3,
+          maxError - error, &levelError);
+      // Stop once the simplifier stalls (locked borders, error limit).
+      if (lod.empty() || lod.size() / 3 > tris * 9 / 10) break;
+
+      optimizeVertexCache(lod.data(), lod.data(), lod.size());
+      error += levelError;
+      chains[s].levels.push_back(lod);
+      chains[s].errors.push_back(error);
+      previous = std::move(lod);
+    }
+  });
+
+  LodStats stats;
+  for (std::size_t s = 0; s < model.submeshes.size(); ++s) {
+    Submesh& sm = model.submeshes[s];
+    sm.lods.clear();
+    if (stats.trianglesPerLod.empty()) stats.trianglesPerLod.push_back(0);
+    stats.trianglesPerLod[0] += sm.indexCount / 3;
+    for (std::size_t l = 0; l < chains[s].levels.size(); ++l) {
+      const auto& lod = chains[s].levels[l];
+      if (model.indices.size() + lod.size() > UINT32_MAX)
+        throw std::runtime_error("buildLods: index buffer exceeds 32 bits");
+      sm.lods.push_back({static_cast<std::uint32_t>(model.indices.size()),
+                         static_cast<std::uint32_t>(lod.size()),
+                         chains[s].errors[l]});
+      model.indices.insert(model.indices.end(), lod.begin(), lod.end());
+      if (stats.trianglesPerLod.size() < l + 2)
+        stats.trianglesPerLod.push_back(0);
+      stats.trianglesPerLod[l + 1] += lod.size() / 3;
+    }
+  }
+
+  stats.milliseconds = std::chrono::duration<double, std::milli>(
+                           std::chrono::steady_clock::now() - t0)
+                           .count();
+  return stats;
+}
+
+}  // namespace utils
@@ -0,0 +1,50 @@
+#ifndef MESH_SIMPLIFY_HPP
+#define MESH_SIMPLIFY_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "mesh.hpp"
+
+namespace utils {
+
+// Quadric-error edge collapse (Garland & Heckbert) onto existing vertices,
+// so the result indexes the same vertex buffer. Border and non-manifold
+// edges are locked, which also keeps UV/normal seams intact. Stops at
+// targetIndexCount or when the next collapse would exceed maxError (model
+// units); the error reached is written to resultError.
+std::vector<std::uint32_t> simplifyIndices(const VertexPU* vertices,
+                                           const std::uint32_t* indices,
+                                           std::size_t indexCount,
+                                           std::size_t targetIndexCount,
+                                           float maxError,
+                                           float* resultError = nullptr);
+
+// Bounding sphere (bounds center, farthest vertex) of an index range.
+void computeBounds(const VertexPU* vertices, const std::uint32_t* indices,
+                   std::size_t indexCount, glm::vec3& center, float& radius);
+
+struct LodOptions {
+  unsigned maxLods = 4;      // levels beyond LOD 0
+  float reduction = 0.5f;    // triangle ratio between consecutive levels
+  // Error budget of the whole chain (LOD errors accumulate), relative to
+  // the submesh's bounding radius.
+  float maxError = 0.05f;
+  unsigned minTriangles = 32;
+  // 0 = hardware concurrency, 1 = calling thread only.
+  unsigned threadCount = 0;
+};
+
+struct LodStats {
+  std::vector<std::size_t> trianglesPerLod;  // summed over submeshes
+  double milliseconds = 0.0;
+};
+
+// Computes submesh bounds and appends each submesh's LOD chain to
+// model.indices (submeshes in parallel; the output is deterministic).
+LodStats buildLods(ModelData& model, const LodOptions& options = {});
+
+}  // namespace utils
+
+#endif
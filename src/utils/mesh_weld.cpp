@@ -0,0 +1,171 @@
+#include "mesh_weld.hpp"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+#include "hash.hpp"
+#include "thread_pool.hpp"
+
+namespace utils {
+namespace {
+
+constexpr std::uint32_t kUnreferenced =
+    std::numeric_limits<std::uint32_t>::max();
+constexpr std::size_t kChunkSize = 1u << 14;
+
+// Quantized position, uv, normal and owning submesh.
+using WeldKey = std::array<std::int64_t, 9>;
+
+std::int64_t quantize(float v, float epsilon) {
+  if (epsilon > 0.0f && std::isfinite(v)) {
+    const double q = std::floor(static_cast<double>(v) / epsilon + 0.5);
+    if (std::fabs(q) < 9.0e18) return static_cast<std::int64_t>(q);
+  }
+  if (v == 0.0f) return 0;  // +0 and -0 weld
+  std::int32_t bits = 0;
+  std::memcpy(&bits, &v, sizeof(bits));
+  return bits;
+}
+
+WeldKey makeKey(const VertexPU& v, std::uint32_t owner,
+                const WeldOptions& o) {
+  return {quantize(v.pos.x, o.positionEpsilon),
+          quantize(v.pos.y, o.positionEpsilon),
+          quantize(v.pos.z, o.positionEpsilon),
+          quantize(v.uv.x, o.uvEpsilon),
+          quantize(v.uv.y, o.uvEpsilon),
+          quantize(v.normal.x, o.normalEpsilon),
+          quantize(v.normal.y, o.normalEpsilon),
+          quantize(v.normal.z, o.normalEpsilon),
+          static_cast<std::int64_t>(owner)};
+}
+
+std::size_t chunkCount(std::size_t n) {
+  return (n + kChunkSize - 1) / kChunkSize;
+}
+
+}  // namespace
+
+WeldStats weldVertices(ModelData& model, const WeldOptions& options) {
+  if (model.borrowedVertices || model.borrowedIndices)
+    throw std::runtime_error("weldVertices needs owned geometry");
+
+  const auto t0 = std::chrono::steady_clock::now();
+  const std::size_t n = model.vertices.size();
+  WeldStats stats;
+  stats.verticesBefore = n;
+
+  const unsigned threads = ThreadPool::resolveThreadCount(options.threadCount);
+  std::unique_ptr<ThreadPool> pool;
+  if (threads > 1) pool = std::make_unique<ThreadPool>(threads - 1);
+
+  // Owner = first submesh referencing the vertex; indices outside every
+  // submesh get a shared owner past the end.
+  std::vector<std::uint32_t> owner(n, kUnreferenced);
+  for (std::size_t s = 0; s < model.submeshes.size(); ++s) {
+    const Submesh& sm = model.submeshes[s];
+    for (std::uint32_t i = sm.indexOffset; i < sm.indexOffset + sm.indexCount;
+         ++i) {
+      const std::uint32_t v = model.indices.at(i);
+      if (v >= n) throw std::runtime_error("weldVertices: index out of range");
+      if (owner[v] == kUnreferenced) owner[v] = static_cast<std::uint32_t>(s);
+    }
+  }
+  for (std::uint32_t v : model.indices) {
+    if (v >= n) throw std::runtime_error("weldVertices: index out of range");
+    if (owner[v] == kUnreferenced)
+      owner[v] = static_cast<std::uint32_t>(model.submeshes.size());
+  }
+
+  std::vector<WeldKey> keys(n);
+  std::vector<std::uint64_t> hashes(n, 0);
+  parallelFor(pool.get(), chunkCount(n), [&](std::size_t c) {
+    const std::size_t end = std::min(n, (c + 1) * kChunkSize);
+    for (std::size_t i = c * kChunkSize; i < end; ++i) {
+      if (owner[i] == kUnreferenced) continue;
+      keys[i] = makeKey(model.vertices[i], owner[i], options);
+      hashes[i] = hash64(keys[i].data(), sizeof(WeldKey));
+    }
+  });
+
+  // Partition by hash so buckets can be deduplicated independently. The
+  // scatter keeps each bucket in ascending vertex order, so the first vertex
+  // inserted into a bucket's table (its canonical one) is always the lowest
+  // index of its group, whatever the thread count.
+  const std::size_t bucketCount = std::max<std::size_t>(1, threads * 16);
+  std::vector<std::size_t> bucketStart(bucketCount + 1, 0);
+  for (std::size_t i = 0; i < n; ++i)
+    if (owner[i] != kUnreferenced) bucketStart[hashes[i] % bucketCount + 1]++;
+  for (std::size_t b = 0; b < bucketCount; ++b)
+    bucketStart[b + 1] += bucketStart[b];
+  std::vector<std::uint32_t> bucketed(bucketStart[bucketCount]);
+  {
+    std::vector<std::size_t> cursor(bucketStart.begin(), bucketStart.end() - 1);
+    for (std::size_t i = 0; i < n; ++i)
+      if (owner[i] != kUnreferenced)
+        bucketed[cursor[hashes[i] % bucketCount]++] =
+            static_cast<std::uint32_t>(i);
+  }
+
+  std::vector<std::uint32_t> canonical(n, kUnreferenced);
+  parallelFor(pool.get(), bucketCount, [&](std::size_t b) {
+    const std::size_t count = bucketStart[b + 1] - bucketStart[b];
+    std::size_t tableSize = 16;
+    while (tableSize < count * 2) tableSize *= 2;
+    // Open addressing on the hash bits above those used for bucketing.
+    std::vector<std::uint32_t> table(tableSize, kUnreferenced);
+    for (std::size_t k = bucketStart[b]; k < bucketStart[b + 1]; ++k) {
+      const std::uint32_t v = bucketed[k];
+      std::size_t slot = (hashes[v] / bucketCount) & (tableSize - 1);
+      for (;;) {
+        const std::uint32_t other = table[slot];
+        if (other == kUnreferenced) {
+          table[slot] = v;
+          canonical[v] = v;
+          break;
+        }
+        if (hashes[other] == hashes[v] && keys[other] == keys[v]) {
+          canonical[v] = other;
+          break;
+        }
+        slot = (slot + 1) & (tableSize - 1);
+      }
+    }
+  });
+
+  std::vector<std::uint32_t> remap(n, kUnreferenced);
+  std::uint32_t kept = 0;
+  for (std::size_t i = 0; i < n; ++i)
+    if (canonical[i] == i) remap[i] = kept++;
+
+  std::vector<VertexPU> vertices(kept);
+  parallelFor(pool.get(), chunkCount(n), [&](std::size_t c) {
+    const std::size_t end = std::min(n, (c + 1) * kChunkSize);
+    for (std::size_t i = c * kChunkSize; i < end; ++i)
+      if (remap[i] != kUnreferenced) vertices[remap[i]] = model.vertices[i];
+  });
+
+  const std::size_t indexCount = model.indices.size();
+  parallelFor(pool.get(), chunkCount(indexCount), [&](std::size_t c) {
+    const std::size_t end = std::min(indexCount, (c + 1) * kChunkSize);
+    for (std::size_t i = c * kChunkSize; i < end; ++i)
+      model.indices[i] = remap[canonical[model.indices[i]]];
+  });
+
+  model.vertices = std::move(vertices);
+  stats.verticesAfter = kept;
+  stats.milliseconds = std::chrono::duration<double, std::milli>(
+                           std::chrono::steady_clock::now() - t0)
+                           .count();
+  return stats;
+}
+
+}  // namespace utils
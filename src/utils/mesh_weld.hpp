@@ -0,0 +1,37 @@
+#ifndef MESH_WELD_HPP
+#define MESH_WELD_HPP
+
+#include <cstddef>
+
+#include "mesh.hpp"
+
+namespace utils {
+
+struct WeldOptions {
+  // Each component is rounded to the nearest multiple of its epsilon and
+  // vertices whose rounded attributes all match are merged (the lowest index
+  // survives, unsnapped). Values within epsilon of each other can still round
+  // to neighbouring multiples and stay apart. 0 means bit-exact matching.
+  float positionEpsilon = 1e-5f;
+  float normalEpsilon = 1e-3f;
+  float uvEpsilon = 1e-5f;
+  // 0 = hardware concurrency, 1 = calling thread only. The result does not
+  // depend on this value.
+  unsigned threadCount = 0;
+};
+
+struct WeldStats {
+  std::size_t verticesBefore = 0;
+  std::size_t verticesAfter = 0;
+  double milliseconds = 0.0;
+};
+
+// Merges duplicate vertices of model.vertices, drops unreferenced ones and
+// remaps model.indices. Vertices are only merged within the submesh that
+// first references them, and survivors keep their relative order, so each
+// submesh's vertices stay contiguous.
+WeldStats weldVertices(ModelData& model, const WeldOptions& options = {});
+
+}  // namespace utils
+
+#endif
@@ -0,0 +1,805 @@
+#include "meshopt_decode.hpp"
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#include "cpu_features.hpp"
+
+#ifdef MGE_X86
+#include <immintrin.h>
+#endif
+
+namespace utils {
+namespace {
+
+constexpr unsigned char kVertexHeader = 0xa0;
+constexpr unsigned char kIndexHeader = 0xe0;
+constexpr unsigned char kSequenceHeader = 0xd0;
+
+constexpr std::size_t kVertexBlockSizeBytes = 8192;
+constexpr std::size_t kVertexBlockMaxSize = 256;
+constexpr std::size_t kByteGroupSize = 16;
+// A byte group reads at most 24 bytes (8 header + 16 escaped values).
+constexpr std::size_t kByteGroupDecodeLimit = 24;
+constexpr std::size_t kTailMaxSize = 32;
+
+[[noreturn]] void fail(const char* what) {
+  throw std::runtime_error(std::string("meshopt decode: ") + what);
+}
+
+// ---------------------------------------------------------------------------
+// Vertex codec: per 256-vertex block, each byte channel is delta coded
+// against the previous vertex, zigzagged and packed in groups of 16 values
+// of 0, 2, 4 or 8 bits (the 2/4-bit modes escape larger values to a byte).
+
+std::size_t vertexBlockSize(std::size_t stride) {
+  std::size_t result = kVertexBlockSizeBytes / stride;
+  result &= ~(kByteGroupSize - 1);
+  return result < kVertexBlockMaxSize ? result : kVertexBlockMaxSize;
+}
+
+inline unsigned char unzigzag8(unsigned char v) {
+  return static_cast<unsigned char>(-(v & 1) ^ (v >> 1));
+}
+
+const unsigned char* decodeBytesGroup(const unsigned char* data,
+                                      unsigned char* out, int bitslog2) {
+  switch (bitslog2) {
+    case 0:
+      std::memset(out, 0, kByteGroupSize);
+      return data;
+    case 3:
+      std::memcpy(out, data, kByteGroupSize);
+      return data + kByteGroupSize;
+    default: {
+      // Values are stored most significant first; all-ones escapes to the
+      // next byte after the packed values.
+      const int bits = bitslog2 == 1 ? 2 : 4;
+      const unsigned sentinel = (1u << bits) - 1;
+      const unsigned char* escaped = data + kByteGroupSize * bits / 8;
+      for (std::size_t i = 0; i < kByteGroupSize; ++i) {
+        const unsigned byte = data[i * bits / 8];
+        const int shift = 8 - bits - static_cast<int>(i * bits % 8);
+        const unsigned v = (byte >> shift) & sentinel;
+        out[i] = static_cast<unsigned char>(v == sentinel ? *escaped++ : v);
+      }
+      return escaped;
+    }
+  }
+}
+
+const unsigned char* decodeBytes(const unsigned char* data,
+                                 const unsigned char* end,
+                                 unsigned char* buffer, std::size_t size) {
+  const unsigned char* header = data;
+  const std::size_t headerSize = (size / kByteGroupSize + 3) / 4;
+  if (static_cast<std::size_t>(end - data) < headerSize)
+    fail("truncated vertex data");
+  data += headerSize;
+  for (std::size_t i = 0; i < size; i += kByteGroupSize) {
+    if (static_cast<std::size_t>(end - data) < kByteGroupDecodeLimit)
+      fail("truncated vertex data");
+    const std::size_t group = i / kByteGroupSize;
+    const int bitslog2 = (header[group / 4] >> ((group % 4) * 2)) & 3;
+    data = decodeBytesGroup(data, buffer + i, bitslog2);
+  }
+  return data;
+}
+
+const unsigned char* decodeVertexBlock(const unsigned char* data,
+                                       const unsigned char* end,
+                                       unsigned char* vertices,
+                                       std::size_t count, std::size_t stride,
+                                       unsigned char* lastVertex) {
+  unsigned char buffer[kVertexBlockMaxSize];
+  const std::size_t aligned =
+      (count + kByteGroupSize - 1) & ~(kByteGroupSize - 1);
+  for (std::size_t k = 0; k < stride; ++k) {
+    data = decodeBytes(data, end, buffer, aligned);
+    unsigned char p = lastVertex[k];
+    for (std::size_t i = 0; i < count; ++i) {
+      p = static_cast<unsigned char>(unzigzag8(buffer[i]) + p);
+      vertices[i * stride + k] = p;
+    }
+    lastVertex[k] = p;
+  }
+  return data;
+}
+
+#ifdef MGE_X86
+// pshufb masks that gather the escaped bytes of 8 values, indexed by the
+// bitmask of values that were escaped, and how many bytes each consumes.
+struct ByteGroupTables {
+  unsigned char shuffle[256][8];
+  unsigned char count[256];
+
+  ByteGroupTables() {
+    for (int mask = 0; mask < 256; ++mask) {
+      unsigned char next = 0;
+      for (int i = 0; i < 8; ++i)
+        shuffle[mask][i] = (mask & (1 << i)) ? next++ : 0x80;
+      count[mask] = next;
+    }
+  }
+};
+
+const ByteGroupTables& byteGroupTables() {
+  static const ByteGroupTables tables;
+  return tables;
+}
+
+MGE_TARGET("ssse3")
+__m128i escapedBytes(const ByteGroupTables& t, __m128i values,
+                     __m128i escapes, const unsigned char* rest,
+                     std::size_t& consumed) {
+  const int mask = _mm_movemask_epi8(escapes);
+  const int mask0 = mask & 255;
+  const int mask1 = mask >> 8;
+  __m128i sm0 = _mm_loadl_epi64(
+      reinterpret_cast<const __m128i*>(t.shuffle[mask0]));
+  __m128i sm1 = _mm_loadl_epi64(
+      reinterpret_cast<const __m128i*>(t.shuffle[mask1]));
+  // Zeroing lanes stay >= 0x80 after the offset.
+  sm1 = _mm_add_epi8(sm1, _mm_set1_epi8(static_cast<char>(t.count[mask0])));
+  const __m128i shuffle = _mm_unpacklo_epi64(sm0, sm1);
+  const __m128i bytes =
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(rest));
+  consumed = static_cast<std::size_t>(t.count[mask0]) + t.count[mask1];
+  return _mm_or_si128(_mm_shuffle_epi8(bytes, shuffle),
+                      _mm_andnot_si128(escapes, values));
+}
+
+MGE_TARGET("ssse3")
+const unsigned char* decodeBytesGroupSimd(const ByteGroupTables& t,
+                                          const unsigned char* data,
+                                          unsigned char* out, int bitslog2) {
+  __m128i result;
+  std::size_t consumed = 0;
+  switch (bitslog2) {
+    case 0:
+      result = _mm_setzero_si128();
+      break;
+    case 1: {
+      int packed;
+      std::memcpy(&packed, data, sizeof(packed));
+      // Spread each byte into four 2-bit lanes, most significant first.
+      const __m128i sel2 = _mm_cvtsi32_si128(packed);
+      const __m128i sel22 = _mm_unpacklo_epi8(_mm_srli_epi16(sel2, 4), sel2);
+      const __m128i sel2222 =
+          _mm_unpacklo_epi8(_mm_srli_epi16(sel22, 2), sel22);
+      const __m128i values = _mm_and_si128(sel2222, _mm_set1_epi8(3));
+      const __m128i escapes = _mm_cmpeq_epi8(values, _mm_set1_epi8(3));
+      result = escapedBytes(t, values, escapes, data + 4, consumed);
+      data += 4 + consumed;
+      break;
+    }
+    case 2: {
+      const __m128i sel4 =
+          _mm_loadl_epi64(reinterpret_cast<const __m128i*>(data));
+      const __m128i sel44 = _mm_unpacklo_epi8(_mm_srli_epi16(sel4, 4), sel4);
+      const __m128i values = _mm_and_si128(sel44, _mm_set1_epi8(15));
+      const __m128i escapes = _mm_cmpeq_epi8(values, _mm_set1_epi8(15));
+      result = escapedBytes(t, values, escapes, data + 8, consumed);
+      data += 8 + consumed;
+      break;
+    }
+    default:
+      result = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data));
+      data += kByteGroupSize;
+      break;
+  }
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(out), result);
+  return data;
+}
+
+MGE_TARGET("ssse3")
+const unsigned char* decodeBytesSimd(const ByteGroupTables& t,
+                                     const unsigned char* data,
+                                     const unsigned char* end,
+                                     unsigned char* buffer, std::size_t size) {
+  const unsigned char* header = data;
+  const std::size_t headerSize = (size / kByteGroupSize + 3) / 4;
+  if (static_cast<std::size_t>(end - data) < headerSize)
+    fail("truncated vertex data");
+  data += headerSize;
+  for (std::size_t i = 0; i < size; i += kByteGroupSize) {
+    if (static_cast<std::size_t>(end - data) < kByteGroupDecodeLimit)
+      fail("truncated vertex data");
+    const std::size_t group = i / kByteGroupSize;
+    const int bitslog2 = (header[group / 4] >> ((group % 4) * 2)) & 3;
+    data = decodeBytesGroupSimd(t, data, buffer + i, bitslog2);
+  }
+  return data;
+}
+
+MGE_TARGET("ssse3")
+__m128i unzigzagPrefixSum(__m128i v, __m128i& last) {
+  const __m128i odd = _mm_and_si128(v, _mm_set1_epi8(1));
+  v = _mm_xor_si128(_mm_and_si128(_mm_srli_epi16(v, 1), _mm_set1_epi8(0x7f)),
+                    _mm_sub_epi8(_mm_setzero_si128(), odd));
+  v = _mm_add_epi8(v, _mm_slli_si128(v, 1));
+  v = _mm_add_epi8(v, _mm_slli_si128(v, 2));
+  v = _mm_add_epi8(v, _mm_slli_si128(v, 4));
+  v = _mm_add_epi8(v, _mm_slli_si128(v, 8));
+  v = _mm_add_epi8(v, last);
+  last = _mm_shuffle_epi8(v, _mm_set1_epi8(15));
+  return v;
+}
+
+// Decodes four byte channels at a time and transposes 16 vertices x 4
+// channels with unpacks; strides are multiples of 4 here.
+MGE_TARGET("ssse3")
+const unsigned char* decodeVertexBlockSimd(const ByteGroupTables& t,
+                                           const unsigned char* data,
+                                           const unsigned char* end,
+                                           unsigned char* vertices,
+                                           std::size_t count,
+                                           std::size_t stride,
+                                           unsigned char* lastVertex) {
+  alignas(16) unsigned char buffer[4][kVertexBlockMaxSize];
+  alignas(16) unsigned char lanes[64];
+  const std::size_t aligned =
+      (count + kByteGroupSize - 1) & ~(kByteGroupSize - 1);
+  for (std::size_t k = 0; k < stride; k += 4) {
+    __m128i last[4];
+    for (int c = 0; c < 4; ++c) {
+      data = decodeBytesSimd(t, data, end, buffer[c], aligned);
+      last[c] = _mm_set1_epi8(static_cast<char>(lastVertex[k + c]));
+    }
+    for (std::size_t i = 0; i < count; i += kByteGroupSize) {
+      __m128i r[4];
+      for (int c = 0; c < 4; ++c) {
+        const __m128i v =
+            _mm_load_si128(reinterpret_cast<const __m128i*>(buffer[c] + i));
+        r[c] = unzigzagPrefixSum(v, last[c]);
+      }
+      const __m128i t0 = _mm_unpacklo_epi8(r[0], r[1]);
+      const __m128i t1 = _mm_unpackhi_epi8(r[0], r[1]);
+      const __m128i t2 = _mm_unpacklo_epi8(r[2], r[3]);
+      const __m128i t3 = _mm_unpackhi_epi8(r[2], r[3]);
+      __m128i* out = reinterpret_cast<__m128i*>(lanes);
+      _mm_store_si128(out + 0, _mm_unpacklo_epi16(t0, t2));
+      _mm_store_si128(out + 1, _mm_unpackhi_epi16(t0, t2));
+      _mm_store_si128(out + 2, _mm_unpacklo_epi16(t1, t3));
+      _mm_store_si128(out + 3, _mm_unpackhi_epi16(t1, t3));
+      const std::size_t n =
+          count - i < kByteGroupSize ? count - i : kByteGroupSize;
+      for (std::size_t j = 0; j < n; ++j)
+        std::memcpy(vertices + (i + j) * stride + k, lanes + j * 4, 4);
+    }
+    std::memcpy(lastVertex + k, vertices + (count - 1) * stride + k, 4);
+  }
+  return data;
+}
+#endif
+
+// ---------------------------------------------------------------------------
+// Index codecs.
+
+void writeIndex(void* dst, std::size_t i, std::size_t stride,
+                std::uint32_t index) {
+  auto* out = static_cast<unsigned char*>(dst) + i * stride;
+  if (stride == 2) {
+    const auto narrow = static_cast<std::uint16_t>(index);
+    std::memcpy(out, &narrow, sizeof(narrow));
+  } else {
+    std::memcpy(out, &index, sizeof(index));
+  }
+}
+
+std::uint32_t decodeVByte(const unsigned char*& data) {
+  const unsigned char lead = *data++;
+  if (lead < 128) return lead;
+  std::uint32_t result = lead & 127;
+  unsigned shift = 7;
+  for (int i = 0; i < 4; ++i) {
+    const unsigned char group = *data++;
+    result |= static_cast<std::uint32_t>(group & 127) << shift;
+    shift += 7;
+    if (group < 128) break;
+  }
+  return result;
+}
+
+std::uint32_t unzigzag32(std::uint32_t v) { return (v >> 1) ^ (0u - (v & 1)); }
+
+std::uint32_t decodeIndex(const unsigned char*& data, std::uint32_t last) {
+  return last + unzigzag32(decodeVByte(data));
+}
+
+struct IndexFifos {
+  std::uint32_t edges[16][2];
+  std::uint32_t vertices[16];
+  std::size_t edgeOffset = 0;
+  std::size_t vertexOffset = 0;
+
+  IndexFifos() {
+    std::memset(edges, 0xff, sizeof(edges));
+    std::memset(vertices, 0xff, sizeof(vertices));
+  }
+  void pushEdge(std::uint32_t a, std::uint32_t b) {
+    edges[edgeOffset][0] = a;
+    edges[edgeOffset][1] = b;
+    edgeOffset = (edgeOffset + 1) & 15;
+  }
+  void pushVertex(std::uint32_t v, bool advance = true) {
+    vertices[vertexOffset] = v;
+    vertexOffset = (vertexOffset + (advance ? 1 : 0)) & 15;
+  }
+  // `back` = 1 is the most recently pushed vertex.
+  std::uint32_t vertex(std::size_t back) const {
+    return vertices[(vertexOffset - back) & 15];
+  }
+};
+
+// ---------------------------------------------------------------------------
+// Filters. The scalar and SIMD versions round identically (half away from
+// zero, truncating conversion), so they produce the same bits.
+
+inline int roundSigned(float v) {
+  return static_cast<int>(v + (v >= 0.0f ? 0.5f : -0.5f));
+}
+
+template <typename T>
+void octahedralScalar(T* data, std::size_t begin, std::size_t count) {
+  const float max = static_cast<float>((1 << (sizeof(T) * 8 - 1)) - 1);
+  for (std::size_t i = begin; i < count; ++i) {
+    T* e = data + i * 4;
+    float x = static_cast<float>(e[0]);
+    float y = static_cast<float>(e[1]);
+    const float z = static_cast<float>(e[2]) - std::fabs(x) - std::fabs(y);
+    // Fold the lower hemisphere back.
+    const float t = z < 0.0f ? z : 0.0f;
+    x += x >= 0.0f ? t : -t;
+    y += y >= 0.0f ? t : -t;
+    const float s = max / std::sqrt(x * x + y * y + z * z);
+    e[0] = static_cast<T>(roundSigned(x * s));
+    e[1] = static_cast<T>(roundSigned(y * s));
+    e[2] = static_cast<T>(roundSigned(z * s));
+  }
+}
+
+void quaternionScalar(std::int16_t* data, std::size_t begin,
+                      std::size_t count) {
+  const float scale = 1.0f / std::sqrt(2.0f);
+  for (std::size_t i = begin; i < count; ++i) {
+    std::int16_t* e = data + i * 4;
+    // The largest component was dropped; its index is in the low bits of
+    // the fourth value, the quantization scale in the rest.
+    const int sf = e[3] | 3;
+    const float ss = scale / static_cast<float>(sf);
+    const float x = static_cast<float>(e[0]) * ss;
+    const float y = static_cast<float>(e[1]) * ss;
+    const float z = static_cast<float>(e[2]) * ss;
+    const float ww = 1.0f - x * x - y * y - z * z;
+    const float w = std::sqrt(ww >= 0.0f ? ww : 0.0f);
+    const int qc = e[3] & 3;
+    e[(qc + 1) & 3] = static_cast<std::int16_t>(roundSigned(x * 32767.0f));
+    e[(qc + 2) & 3] = static_cast<std::int16_t>(roundSigned(y * 32767.0f));
+    e[(qc + 3) & 3] = static_cast<std::int16_t>(roundSigned(z * 32767.0f));
+    e[qc] = static_cast<std::int16_t>(static_cast<int>(w * 32767.0f + 0.5f));
+  }
+}
+
+void exponentialScalar(std::uint32_t* data, std::size_t begin,
+                       std::size_t count) {
+  for (std::size_t i = begin; i < count; ++i) {
+    const std::uint32_t v = data[i];
+    // 24-bit signed mantissa, 8-bit signed exponent.
+    const auto m = static_cast<std::int32_t>(v << 8) >> 8;
+    const auto e = static_cast<std::int32_t>(v) >> 24;
+    const std::uint32_t bits = static_cast<std::uint32_t>(e + 127) << 23;
+    float scale;
+    std::memcpy(&scale, &bits, sizeof(scale));
+    const float result = scale * static_cast<float>(m);
+    std::memcpy(&data[i], &result, sizeof(result));
+  }
+}
+
+#ifdef MGE_X86
+MGE_TARGET("sse2")
+__m128i roundSignedSimd(__m128 v) {
+  const __m128 half = _mm_set1_ps(0.5f);
+  const __m128 sign = _mm_set1_ps(-0.0f);
+  const __m128 nonNegative = _mm_cmpge_ps(v, _mm_setzero_ps());
+  const __m128 bias =
+      _mm_or_ps(half, _mm_andnot_ps(nonNegative, sign));
+  return _mm_cvttps_epi32(_mm_add_ps(v, bias));
+}
+
+// Sign-extends the `bits`-bit field at bit `shift` of each lane to float.
+MGE_TARGET("sse2")
+__m128 signedField(__m128i v, int shift, int bits) {
+  return _mm_cvtepi32_ps(
+      _mm_srai_epi32(_mm_slli_epi32(v, 32 - shift - bits), 32 - bits));
+}
+
+MGE_TARGET("sse2")
+void octahedralSimd(__m128 x, __m128 y, __m128 zIn, float max, __m128i& xi,
+                    __m128i& yi, __m128i& zi) {
+  const __m128 sign = _mm_set1_ps(-0.0f);
+  const __m128 zero = _mm_setzero_ps();
+  const __m128 z = _mm_sub_ps(_mm_sub_ps(zIn, _mm_andnot_ps(sign, x)),
+                              _mm_andnot_ps(sign, y));
+  const __m128 t = _mm_min_ps(z, zero);
+  const __m128 negT = _mm_xor_ps(t, sign);
+  const __m128 xPos = _mm_cmpge_ps(x, zero);
+  const __m128 yPos = _mm_cmpge_ps(y, zero);
+  x = _mm_add_ps(x, _mm_or_ps(_mm_and_ps(xPos, t), _mm_andnot_ps(xPos, negT)));
+  y = _mm_add_ps(y, _mm_or_ps(_mm_and_ps(yPos, t), _mm_andnot_ps(yPos, negT)));
+  const __m128 len = _mm_sqrt_ps(_mm_add_ps(
+      _mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)), _mm_mul_ps(z, z)));
+  const __m128 s = _mm_div_ps(_mm_set1_ps(max), len);
+  xi = roundSignedSimd(_mm_mul_ps(x, s));
+  yi = roundSignedSimd(_mm_mul_ps(y, s));
+  zi = roundSignedSimd(_mm_mul_ps(z, s));
+}
+
+MGE_TARGET("sse2")
+std::size_t octahedral8Simd(std::int8_t* data, std::size_t count) {
+  const __m128i byte = _mm_set1_epi32(0xff);
+  std::size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    auto* p = reinterpret_cast<__m128i*>(data + i * 4);
+    const __m128i v = _mm_loadu_si128(p);
+    const __m128 x = signedField(v, 0, 8);
+    const __m128 y = signedField(v, 8, 8);
+    const __m128 z = signedField(v, 16, 8);
+    __m128i xi, yi, zi;
+    octahedralSimd(x, y, z, 127.0f, xi, yi, zi);
+    __m128i r = _mm_andnot_si128(_mm_set1_epi32(0xffffff), v);
+    r = _mm_or_si128(r, _mm_and_si128(xi, byte));
+    r = _mm_or_si128(r, _mm_slli_epi32(_mm_and_si128(yi, byte), 8));
+    r = _mm_or_si128(r, _mm_slli_epi32(_mm_and_si128(zi, byte), 16));
+    _mm_storeu_si128(p, r);
+  }
+  return i;
+}
+
+// Splits four 4 x int16 elements into their (x | y << 16) and (z | w << 16)
+// halves, one element per lane.
+MGE_TARGET("sse2")
+void loadInt16x4(const std::int16_t* data, __m128i& xy, __m128i& zw) {
+  const __m128 a = _mm_castsi128_ps(
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(data)));
+  const __m128 b = _mm_castsi128_ps(
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 8)));
+  xy = _mm_castps_si128(_mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)));
+  zw = _mm_castps_si128(_mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+}
+
+MGE_TARGET("sse2")
+void storeInt16x4(std::int16_t* data, __m128i xy, __m128i zw) {
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(data),
+                   _mm_unpacklo_epi32(xy, zw));
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(data + 8),
+                   _mm_unpackhi_epi32(xy, zw));
+}
+
+MGE_TARGET("sse2")
+std::size_t octahedral16Simd(std::int16_t* data, std::size_t count) {
+  const __m128i low = _mm_set1_epi32(0xffff);
+  std::size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    __m128i xy, zw;
+    loadInt16x4(data + i * 4, xy, zw);
+    const __m128 x = signedField(xy, 0, 16);
+    const __m128 y = signedField(xy, 16, 16);
+    const __m128 z = signedField(zw, 0, 16);
+    __m128i xi, yi, zi;
+    octahedralSimd(x, y, z, 32767.0f, xi, yi, zi);
+    xy = _mm_or_si128(_mm_and_si128(xi, low), _mm_slli_epi32(yi, 16));
+    zw = _mm_or_si128(_mm_and_si128(zi, low), _mm_andnot_si128(low, zw));
+    storeInt16x4(data + i * 4, xy, zw);
+  }
+  return i;
+}
+
+// Reconstruction in SIMD; the per-element output swizzle stays scalar.
+MGE_TARGET("sse2")
+std::size_t quaternionSimd(std::int16_t* data, std::size_t count) {
+  alignas(16) std::int32_t out[4][4];
+  const __m128 zero = _mm_setzero_ps();
+  const __m128 one = _mm_set1_ps(1.0f);
+  const __m128 unit = _mm_set1_ps(32767.0f);
+  const __m128 scale = _mm_set1_ps(1.0f / std::sqrt(2.0f));
+  std::size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    std::int16_t* e = data + i * 4;
+    __m128i xy, zw;
+    loadInt16x4(e, xy, zw);
+    const __m128i w = _mm_srai_epi32(zw, 16);
+    const __m128 ss =
+        _mm_div_ps(scale, _mm_cvtepi32_ps(_mm_or_si128(w, _mm_set1_epi32(3))));
+    const __m128 x = _mm_mul_ps(signedField(xy, 0, 16), ss);
+    const __m128 y = _mm_mul_ps(signedField(xy, 16, 16), ss);
+    const __m128 z = _mm_mul_ps(signedField(zw, 0, 16), ss);
+    const __m128 ww = _mm_sub_ps(
+        _mm_sub_ps(_mm_sub_ps(one, _mm_mul_ps(x, x)), _mm_mul_ps(y, y)),
+        _mm_mul_ps(z, z));
+    const __m128 wf = _mm_sqrt_ps(_mm_max_ps(ww, zero));
+    _mm_store_si128(reinterpret_cast<__m128i*>(out[0]),
+                    roundSignedSimd(_mm_mul_ps(x, unit)));
+    _mm_store_si128(reinterpret_cast<__m128i*>(out[1]),
+                    roundSignedSimd(_mm_mul_ps(y, unit)));
+    _mm_store_si128(reinterpret_cast<__m128i*>(out[2]),
+                    roundSignedSimd(_mm_mul_ps(z, unit)));
+    _mm_store_si128(reinterpret_cast<__m128i*>(out[3]),
+                    _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(wf, unit),
+                                                _mm_set1_ps(0.5f))));
+    for (int j = 0; j < 4; ++j) {
+      std::int16_t* q = e + j * 4;
+      const int qc = q[3] & 3;
+      q[(qc + 1) & 3] = static_cast<std::int16_t>(out[0][j]);
+      q[(qc + 2) & 3] = static_cast<std::int16_t>(out[1][j]);
+      q[(qc + 3) & 3] = static_cast<std::int16_t>(out[2][j]);
+      q[qc] = static_cast<std::int16_t>(out[3][j]);
+    }
+  }
+  return i;
+}
+
+MGE_TARGET("sse2")
+std::size_t exponentialSse2(std::uint32_t* data, std::size_t count) {
+  std::size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    auto* p = reinterpret_cast<__m128i*>(data + i);
+    const __m128i v = _mm_loadu_si128(p);
+    const __m128i m = _mm_srai_epi32(_mm_slli_epi32(v, 8), 8);
+    const __m128i e = _mm_srai_epi32(v, 24);
+    const __m128 scale = _mm_castsi128_ps(
+        _mm_slli_epi32(_mm_add_epi32(e, _mm_set1_epi32(127)), 23));
+    _mm_storeu_ps(reinterpret_cast<float*>(p),
+                  _mm_mul_ps(scale, _mm_cvtepi32_ps(m)));
+  }
+  return i;
+}
+
+MGE_TARGET("avx2")
+std::size_t exponentialAvx2(std::uint32_t* data, std::size_t count) {
+  std::size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    auto* p = reinterpret_cast<__m256i*>(data + i);
+    const __m256i v = _mm256_loadu_si256(p);
+    const __m256i m = _mm256_srai_epi32(_mm256_slli_epi32(v, 8), 8);
+    const __m256i e = _mm256_srai_epi32(v, 24);
+    const __m256 scale = _mm256_castsi256_ps(
+        _mm256_slli_epi32(_mm256_add_epi32(e, _mm256_set1_epi32(127)), 23));
+    _mm256_storeu_ps(reinterpret_cast<float*>(p),
+                     _mm256_mul_ps(scale, _mm256_cvtepi32_ps(m)));
+  }
+  return i;
+}
+#endif
+
+}  // namespace
+
+void decodeMeshoptVertices(void* dst, std::size_t count, std::size_t stride,
+                           const unsigned char* src, std::size_t size) {
+  if (stride == 0 || stride > 256 || stride % 4 != 0)
+    fail("vertex stride must be a multiple of 4 up to 256");
+  if (size < 1 + stride) fail("truncated vertex data");
+  if ((src[0] & 0xf0) != kVertexHeader) fail("not a vertex buffer");
+  if ((src[0] & 0x0f) > 0) fail("unsupported vertex codec version");
+
+  const unsigned char* data = src + 1;
+  const unsigned char* end = src + size;
+  // The encoder stores the first vertex last, as the initial prediction.
+  unsigned char lastVertex[256];
+  std::memcpy(lastVertex, end - stride, stride);
+
+  auto* vertices = static_cast<unsigned char*>(dst);
+  const std::size_t blockSize = vertexBlockSize(stride);
+#ifdef MGE_X86
+  const bool simd = cpuFeatures().ssse3;
+  const ByteGroupTables* tables = simd ? &byteGroupTables() : nullptr;
+#endif
+  for (std::size_t offset = 0; offset < count; offset += blockSize) {
+    const std::size_t n =
+        count - offset < blockSize ? count - offset : blockSize;
+    unsigned char* block = vertices + offset * stride;
+#ifdef MGE_X86
+    if (simd) {
+      data = decodeVertexBlockSimd(*tables, data, end, block, n, stride,
+                                   lastVertex);
+      continue;
+    }
+#endif
+    data = decodeVertexBlock(data, end, block, n, stride, lastVertex);
+  }
+
+  const std::size_t tailSize = stride < kTailMaxSize ? kTailMaxSize : stride;
+  if (static_cast<std::size_t>(end - data) != tailSize)
+    fail("vertex data size mismatch");
+}
+
+void decodeMeshoptTriangles(void* dst, std::size_t count, std::size_t stride,
+                            const unsigned char* src, std::size_t size) {
+  if (count % 3 != 0) fail("triangle index count must be a multiple of 3");
+  if (stride != 2 && stride != 4) fail("index stride must be 2 or 4");
+  // Header, one code byte per triangle and the 16-byte codeaux table.
+  if (size < 1 + count / 3 + 16) fail("truncated index data");
+  if ((src[0] & 0xf0) != kIndexHeader) fail("not a triangle index buffer");
+  const int version = src[0] & 0x0f;
+  if (version > 1) fail("unsupported index codec version");
+
+  IndexFifos fifo;
+  std::uint32_t next = 0;
+  std::uint32_t last = 0;
+  const int fecmax = version >= 1 ? 13 : 15;
+
+  const unsigned char* code = src + 1;
+  const unsigned char* data = code + count / 3;
+  // Free indices and codeaux bytes end where the codeaux table begins; a
+  // triangle reads at most 16 bytes, so one check per triangle suffices.
+  const unsigned char* dataEnd = src + size - 16;
+  const unsigned char* codeauxTable = dataEnd;
+
+  for (std::size_t i = 0; i < count; i += 3) {
+    if (data > dataEnd) fail("truncated index data");
+    const unsigned char codetri = *code++;
+
+    if (codetri < 0xf0) {
+      // Shares edge `fe` of an earlier triangle; the third vertex is the
+      // next new one, a vertex fifo entry or a (delta coded) free index.
+      const int fe = codetri >> 4;
+      const auto* edge = fifo.edges[(fifo.edgeOffset - 1 - fe) & 15];
+      const std::uint32_t a = edge[0];
+      const std::uint32_t b = edge[1];
+      const int fec = codetri & 15;
+      std::uint32_t c;
+      bool pushed = true;
+      if (fec == 0) {
+        c = next++;
+      } else if (fec < fecmax) {
+        c = fifo.vertex(static_cast<std::size_t>(fec) + 1);
+        pushed = false;
+      } else {
+        // 13/14 (v1) step the last free index by -1/+1.
+        c = last = fec != 15 ? last + static_cast<std::uint32_t>(
+                                          fec - (fec ^ 3))
+                             : decodeIndex(data, last);
+      }
+      writeIndex(dst, i + 0, stride, a);
+      writeIndex(dst, i + 1, stride, b);
+      writeIndex(dst, i + 2, stride, c);
+      fifo.pushVertex(c, pushed);
+      fifo.pushEdge(c, b);
+      fifo.pushEdge(a, c);
+      continue;
+    }
+
+    // No shared edge: `a` is the next vertex (0xf0..0xfd, fifo codes from
+    // the table) or as coded by an explicit codeaux byte (0xfe/0xff).
+    std::uint32_t a, b, c;
+    int feb, fec;
+    if (codetri < 0xfe) {
+      const unsigned char codeaux = codeauxTable[codetri & 15];
+      feb = codeaux >> 4;
+      fec = codeaux & 15;
+      a = next++;
+      b = feb == 0 ? next++ : fifo.vertex(static_cast<std::size_t>(feb));
+      c = fec == 0 ? next++ : fifo.vertex(static_cast<std::size_t>(fec));
+    } else {
+      const unsigned char codeaux = *data++;
+      const int fea = codetri == 0xfe ? 0 : 15;
+      feb = codeaux >> 4;
+      fec = codeaux & 15;
+      if (codeaux == 0) next = 0;  // restart code
+      a = fea == 0 ? next++ : 0;
+      b = feb == 0 ? next++ : fifo.vertex(static_cast<std::size_t>(feb));
+      c = fec == 0 ? next++ : fifo.vertex(static_cast<std::size_t>(fec));
+      if (fea == 15) last = a = decodeIndex(data, last);
+      if (feb == 15) last = b = decodeIndex(data, last);
+      if (fec == 15) last = c = decodeIndex(data, last);
+    }
+    writeIndex(dst, i + 0, stride, a);
+    writeIndex(dst, i + 1, stride, b);
+    writeIndex(dst, i + 2, stride, c);
+    fifo.pushVertex(a);
+    fifo.pushVertex(b, feb == 0 || feb == 15);
+    fifo.pushVertex(c, fec == 0 || fec == 15);
+    fifo.pushEdge(b, a);
+    fifo.pushEdge(c, b);
+    fifo.pushEdge(a, c);
+  }
+
+  if (data != dataEnd) fail("index data size mismatch");
+}
+
+void decodeMeshoptIndices(void* dst, std::size_t count, std::size_t stride,
+                          const unsigned char* src, std::size_t size) {
+  if (stride != 2 && stride != 4) fail("index stride must be 2 or 4");
+  // Header, at least one byte per index and a 4-byte tail.
+  if (size < 1 + count + 4) fail("truncated index sequence");
+  if ((src[0] & 0xf0) != kSequenceHeader) fail("not an index sequence");
+  if ((src[0] & 0x0f) > 1) fail("unsupported index sequence version");
+
+  const unsigned char* data = src + 1;
+  const unsigned char* dataEnd = src + size - 4;
+  // Two baselines; the low bit of each code picks the one it is relative to.
+  std::uint32_t last[2] = {0, 0};
+  for (std::size_t i = 0; i < count; ++i) {
+    if (data >= dataEnd) fail("truncated index sequence");
+    const std::uint32_t v = decodeVByte(data);
+    const std::uint32_t baseline = v & 1;
+    const std::uint32_t index = last[baseline] + unzigzag32(v >> 1);
+    last[baseline] = index;
+    writeIndex(dst, i, stride, index);
+  }
+
+  if (data != dataEnd) fail("index sequence size mismatch");
+}
+
+void applyMeshoptFilter(MeshoptFilter filter, void* data, std::size_t count,
+                        std::size_t stride) {
+  std::size_t done = 0;
+#ifdef MGE_X86
+  const CpuFeatures features = cpuFeatures();
+#endif
+  switch (filter) {
+    case MeshoptFilter::None:
+      return;
+    case MeshoptFilter::Octahedral:
+      if (stride == 4) {
+        auto* d = static_cast<std::int8_t*>(data);
+#ifdef MGE_X86
+        if (features.sse2) done = octahedral8Simd(d, count);
+#endif
+        octahedralScalar(d, done, count);
+      } else if (stride == 8) {
+        auto* d = static_cast<std::int16_t*>(data);
+#ifdef MGE_X86
+        if (features.sse2) done = octahedral16Simd(d, count);
+#endif
+        octahedralScalar(d, done, count);
+      } else {
+        fail("octahedral filter needs stride 4 or 8");
+      }
+      return;
+    case MeshoptFilter::Quaternion: {
+      if (stride != 8) fail("quaternion filter needs stride 8");
+      auto* d = static_cast<std::int16_t*>(data);
+#ifdef MGE_X86
+      if (features.sse2) done = quaternionSimd(d, count);
+#endif
+      quaternionScalar(d, done, count);
+      return;
+    }
+    case MeshoptFilter::Exponential: {
+      if (stride % 4 != 0) fail("exponential filter needs a stride of 4n");
+      auto* d = static_cast<std::uint32_t*>(data);
+      const std::size_t values = count * stride / 4;
+#ifdef MGE_X86
+      if (features.avx2)
+        done = exponentialAvx2(d, values);
+      else if (features.sse2)
+        done = exponentialSse2(d, values);
+#endif
+      exponentialScalar(d, done, values);
+      return;
+    }
+  }
+}
+
+void decodeMeshoptBuffer(MeshoptMode mode, MeshoptFilter filter, void* dst,
+                         std::size_t count, std::size_t stride,
+                         const unsigned char* src, std::size_t size) {
+  switch (mode) {
+    case MeshoptMode::Attributes:
+      decodeMeshoptVertices(dst, count, stride, src, size);
+      applyMeshoptFilter(filter, dst, count, stride);
+      return;
+    case MeshoptMode::Triangles:
+      decodeMeshoptTriangles(dst, count, stride, src, size);
+      return;
+    case MeshoptMode::Indices:
+      decodeMeshoptIndices(dst, count, stride, src, size);
+      return;
+  }
+}
+
+}  // namespace utils
@@ -0,0 +1,38 @@
+#ifndef MESHOPT_DECODE_HPP
+#define MESHOPT_DECODE_HPP
+
+#include <cstddef>
+
+namespace utils {
+
+// Decoders for the bitstreams of EXT_meshopt_compression (meshoptimizer's
+// vertex codec v0, index codec v0/v1 and index sequence codec). They pick an
+// SSE/AVX kernel when cpuFeatures() allows it; every path writes the same
+// bytes. Malformed input throws std::runtime_error.
+
+enum class MeshoptMode { Attributes, Triangles, Indices };
+enum class MeshoptFilter { None, Octahedral, Quaternion, Exponential };
+
+// `dst` receives count * stride bytes. Attributes need a stride that is a
+// multiple of 4 up to 256; Triangles and Indices a stride of 2 or 4.
+void decodeMeshoptVertices(void* dst, std::size_t count, std::size_t stride,
+                           const unsigned char* src, std::size_t size);
+void decodeMeshoptTriangles(void* dst, std::size_t count, std::size_t stride,
+                            const unsigned char* src, std::size_t size);
+void decodeMeshoptIndices(void* dst, std::size_t count, std::size_t stride,
+                          const unsigned char* src, std::size_t size);
+
+// In-place filter over `count` elements of `stride` bytes, applied after
+// decodeMeshoptVertices: Octahedral takes stride 4 (int8) or 8 (int16),
+// Quaternion stride 8, Exponential any multiple of 4.
+void applyMeshoptFilter(MeshoptFilter filter, void* data, std::size_t count,
+                        std::size_t stride);
+
+// Mode dispatch + filter, as a compressed bufferView describes it.
+void decodeMeshoptBuffer(MeshoptMode mode, MeshoptFilter filter, void* dst,
+                         std::size_t count, std::size_t stride,
+                         const unsigned char* src, std::size_t size);
+
+}  // namespace utils
+
+#endif
@@ -0,0 +1,325 @@
+#include "asyncModelLoader.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <utility>
+#include <vector>
+
+#include "../gl_debug.hpp"
+#include "../gpu_cache.hpp"
+#include "../gpu_geometry.hpp"
+#include "../texture_streamer.hpp"
+#include "cookedModel.hpp"
+
+namespace loader {
+
+AsyncModelLoader::AsyncModelLoader(std::size_t queueCapacityBytes,
+                                   std::size_t chunkBytes)
+    : queue_(queueCapacityBytes),
+      chunkBytes_(std::max<std::size_t>(chunkBytes, 4096)),
+      worker_([this] { workerLoop(); }) {}
+
+AsyncModelLoader::~AsyncModelLoader() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+    requests_.clear();
+  }
+  cv_.notify_all();
+  queue_.close();
+  worker_.join();
+  // Tasks that never ran own meshes and textures: release them here, on the
+  // render thread, now that the worker can no longer add any.
+  queue_.discard();
+}
+
+void AsyncModelLoader::load(const std::string& path,
+                            const LoadOptions& options,
+                            ReadyCallback onReady) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    requests_.push_back({path, options, std::move(onReady)});
+    pending_++;
+  }
+  cv_.notify_one();
+}
+
+utils::UploadQueue::DrainStats AsyncModelLoader::update(
+    std::size_t byteBudget, double timeBudgetMs) {
+  return queue_.drain(byteBudget, timeBudgetMs);
+}
+
+std::size_t AsyncModelLoader::pending() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return pending_;
+}
+
+void AsyncModelLoader::workerLoop() {
+  for (;;) {
+    Request request;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      cv_.wait(lock, [this] { return stopping_ || !requests_.empty(); });
+      if (stopping_) return;
+      request = std::move(requests_.front());
+      requests_.pop_front();
+    }
+
+    try {
+      const auto t0 = std::chrono::steady_clock::now();
+      auto data = std::make_shared<utils::ModelData>(
+          DecodeModelCached(request.path, request.options));
+      const double ms = std::chrono::duration<double, std::milli>(
+                            std::chrono::steady_clock::now() - t0)
+                            .count();
+      LOG_INFO("AsyncModelLoader - decoded " << request.path << " in " << ms
+                                             << " ms (background)");
+      auto geometry = std::make_shared<utils::GpuGeometry>(
+          utils::buildGpuGeometry(*data, request.options.vertexFormat,
+                                  request.options.narrowIndices));
+      enqueueUploads(request.path, std::move(data), geometry, request.options,
+                     std::move(request.onReady));
+    } catch (const std::exception& e) {
+      LOG_ERROR("AsyncModelLoader - failed to load " << request.path << ": "
+                                                     << e.what());
+      std::lock_guard<std::mutex> lock(mutex_);
+      pending_--;
+    }
+  }
+}
+
+void AsyncModelLoader::enqueueUploads(
+    const std::string& path, std::shared_ptr<utils::ModelData> data,
+    const std::shared_ptr<const utils::GpuGeometry>& geometry,
+    const LoadOptions& options, ReadyCallback onReady) {
+  // This thread must never drop the last reference to a GL object. Every
+  // reference it holds ends up in a queued task, which the render thread
+  // destroys after running it (or in discard() if the queue was closed).
+  auto mesh = std::make_shared<utils::Mesh>();
+  std::vector<utils::GpuObjectRef> sharedTextures;
+  // On a failed push: hand over what is left and stop counting the model.
+  auto abandon = [&] {
+    queue_.push(0, [data = std::move(data), mesh = std::move(mesh),
+                    sharedTextures = std::move(sharedTextures)] {});
+    std::lock_guard<std::mutex> lock(mutex_);
+    pending_--;
+  };
+  // Set on the render thread by the first upload that throws: the model's
+  // remaining uploads are skipped and publish drops it instead.
+  auto failed = std::make_shared<bool>(false);
+  auto push = [&](std::size_t bytes, std::function<void()> upload) {
+    return queue_.push(bytes, [failed, path, upload = std::move(upload)] {
+      if (*failed) return;
+      try {
+        upload();
+      } catch (const std::exception& e) {
+        *failed = true;
+        LOG_ERROR("AsyncModelLoader - failed to upload " << path << ": "
+                                                         << e.what());
+      }
+    });
+  };
+
+  // Shared objects come from the GpuObjectCache: the model that creates an
+  // entry uploads it, later ones only bind it. The queue is FIFO, so the
+  // creator's uploads have run before anything else uses the object.
+  utils::GpuObjectCache& cache = utils::GpuObjectCache::instance();
+  utils::GpuObjectRef vertexBuffer, indexBuffer;
+  bool uploadVertices = true, uploadIndices = true;
+  if (options.shareGpuObjects) {
+    const auto& vertices = geometry->vertexBytes;
+    const auto& indices = geometry->indexBytes;
+    vertexBuffer = cache.acquire(
+        utils::GpuObjectKind::Buffer,
+        utils::hash128(vertices.data(), vertices.size()), vertices.size(),
+        uploadVertices);
+    if (!indices.empty())
+      indexBuffer = cache.acquire(
+          utils::GpuObjectKind::Buffer,
+          utils::hash128(indices.data(), indices.size()), indices.size(),
+          uploadIndices);
+  }
+  std::size_t reused = (uploadVertices ? 0 : 1) + (uploadIndices ? 0 : 1);
+  auto allocateMesh = [mesh, geometry, vertexBuffer = std::move(vertexBuffer),
+                       indexBuffer = std::move(indexBuffer)] {
+    mesh->allocate(*geometry, vertexBuffer, indexBuffer);
+  };
+  if (!push(0, std::move(allocateMesh))) return abandon();
+
+  const std::size_t vertexBytes =
+      uploadVertices ? geometry->vertexBytes.size() : 0;
+  for (std::size_t first = 0; first < vertexBytes; first += chunkBytes_) {
+    const std::size_t size = std::min(chunkBytes_, vertexBytes - first);
+    auto upload = [mesh, geometry, first, size] {
+      mesh->uploadVertexBytes(first, geometry->vertexBytes.data() + first,
+                              size);
+    };
+    if (!push(size, upload)) return abandon();
+  }
+
+  const std::size_t indexBytes =
+      uploadIndices ? geometry->indexBytes.size() : 0;
+  for (std::size_t first = 0; first < indexBytes; first += chunkBytes_) {
+    const std::size_t size = std::min(chunkBytes_, indexBytes - first);
+    auto upload = [mesh, geometry, first, size] {
+      mesh->uploadIndexBytes(first, geometry->indexBytes.data() + first, size);
+    };
+    if (!push(size, upload)) return abandon();
+  }
+
+  if (!data->instances.empty()) {
+    const std::size_t size = data->instances.size() * sizeof(glm::mat4);
+    auto upload = [mesh, data] {
+      mesh->uploadInstances(data->instances.data(), data->instances.size());
+    };
+    if (!push(size, upload)) return abandon();
+  }
+
+  // Textures: one per image, or with textureArrays one GL_TEXTURE_2D_ARRAY
+  // per group of compatible images, each image a layer. Allocate all levels
+  // (streamed textures: the coarse tail), then upload each in row bands.
+  const bool textureArrays = options.textureArrays;
+  std::vector<std::vector<int>> groups;
+  if (textureArrays) {
+    groups = utils::groupTextureArrays(data->images);
+  } else {
+    for (std::size_t i = 0; i < data->images.size(); ++i)
+      groups.push_back({static_cast<int>(i)});
+  }
+  // Virtually textured models stream their pages from files instead.
+  if (!data->virtualTextures.empty()) groups.clear();
+  auto textures = std::make_shared<std::vector<GLuint>>(groups.size());
+  // Per image: its entry in `textures` and its layer (-1 without arrays).
+  auto slots = std::make_shared<std::vector<std::pair<int, int>>>(
+      data->images.size());
+  const bool shareTextures = SharesTextures(options);
+  for (std::size_t g = 0; g < groups.size(); ++g) {
+    const std::vector<int>& group = groups[g];
+    const auto first = static_cast<std::size_t>(group.front());
+    const int layers = static_cast<int>(group.size());
+    for (int layer = 0; layer < layers; ++layer) {
+      const auto i =
+          static_cast<std::size_t>(group[static_cast<std::size_t>(layer)]);
+      (*slots)[i] = {static_cast<int>(g), textureArrays ? layer : -1};
+    }
+
+    utils::GpuObjectRef shared;
+    if (shareTextures) {
+      std::size_t bytes = 0;
+      for (int index : group)
+        bytes +=
+            utils::textureLevelBytes(data->images[static_cast<size_t>(index)]);
+      const utils::Hash128 key =
+          textureArrays ? utils::textureArrayKey(data->images, group)
+                        : utils::textureKey(data->images[first]);
+      bool created = false;
+      shared = cache.acquire(utils::GpuObjectKind::Texture, key, bytes,
+                             created);
+      sharedTextures.push_back(shared);
+      if (!created) {
+        ++reused;
+        auto bind = [textures, g, shared] { (*textures)[g] = shared->name(); };
+        if (!push(0, bind)) return abandon();
+        continue;
+      }
+    }
+
+    const int baseLevel =
+        textureArrays ? 0
+                      : utils::streamingBaseLevel(data->images[first],
+                                                  options.streamResidentSize);
+    auto allocate = [data, textures, g, first, layers, baseLevel,
+                     textureArrays, shared] {
+      const utils::TextureImage& image = data->images[first];
+      (*textures)[g] = textureArrays
+                           ? utils::allocateTextureArray(image, layers)
+                           : utils::allocateTexture(image, baseLevel);
+      if (shared) shared->setName((*textures)[g]);
+    };
+    if (!push(0, allocate)) return abandon();
+
+    for (int layer = 0; layer < layers; ++layer) {
+      const auto i =
+          static_cast<std::size_t>(group[static_cast<std::size_t>(layer)]);
+      const utils::TextureImage& image = data->images[i];
+      // Bands cover whole stored rows (rows of 4x4 blocks when compressed).
+      const int rowHeight = utils::mipRowHeight(image);
+      for (int level = baseLevel; level < image.levelCount(); ++level) {
+        const int h = std::max(1, image.height >> level);
+        const std::size_t rowBytes = utils::mipRowBytes(image, level);
+        const int bandRows =
+            rowHeight * static_cast<int>(
+                            std::max<std::size_t>(1, chunkBytes_ / rowBytes));
+        for (int y = 0; y < h; y += bandRows) {
+          const int rows = std::min(bandRows, h - y);
+          auto upload = [data, textures, g, i, layer, level, y, rows,
+                         textureArrays] {
+            const GLuint tex = (*textures)[g];
+            if (textureArrays)
+              utils::uploadTextureLayerRows(tex, data->images[i], layer,
+                                            level, y, rows);
+            else
+              utils::uploadTextureRows(tex, data->images[i], level, y, rows);
+          };
+          const int storedRows = (rows + rowHeight - 1) / rowHeight;
+          if (!push(rowBytes * storedRows, upload)) return abandon();
+        }
+      }
+    }
+
+    auto finish = [data, textures, g, first, baseLevel, textureArrays] {
+      if (textureArrays)
+        utils::finishTextureArray((*textures)[g], data->images[first]);
+      else
+        utils::finishTexture((*textures)[g], data->images[first], baseLevel);
+    };
+    if (!push(0, finish)) return abandon();
+  }
+
+  if (reused > 0) {
+    const utils::GpuObjectCache::Stats cacheStats = cache.stats();
+    LOG_INFO("AsyncModelLoader - " << reused
+                                   << " GPU objects shared with loaded models"
+                                   << " (" << cacheStats.objects << " cached, "
+                                   << cacheStats.bytes / 1024 << " KiB; "
+                                   << cacheStats.savedBytes / 1024
+                                   << " KiB of uploads saved so far)");
+  }
+
+  // Runs after every upload above (the queue is FIFO): publish the model.
+  // Streamed textures need the images after that.
+  const bool keepImages = options.streamResidentSize > 0;
+  auto publish = [this, data = std::move(data), mesh = std::move(mesh),
+                  textures, slots, keepImages, failed,
+                  sharedTextures = std::move(sharedTextures),
+                  onReady = std::move(onReady)]() mutable {
+    if (*failed) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      pending_--;
+      return;
+    }
+    data->sharedTextures = std::move(sharedTextures);
+    for (auto& mat : data->materials) {
+      if (mat.baseColorVirtual >= 0 || mat.baseColorImage < 0 ||
+          mat.baseColorImage >= static_cast<int>(slots->size()))
+        continue;
+      const auto& slot = (*slots)[static_cast<size_t>(mat.baseColorImage)];
+      mat.baseColorTex = (*textures)[static_cast<size_t>(slot.first)];
+      mat.baseColorLayer = slot.second;
+      mat.hasBaseColorTex = (mat.baseColorTex != 0);
+    }
+    if (data->virtualTextures.empty()) LogTextureMemory(*data);
+    if (!keepImages) ReleaseModelImages(*data);
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      pending_--;
+    }
+    if (onReady) onReady(data, mesh);
+  };
+  if (!queue_.push(0, std::move(publish))) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    pending_--;
+  }
+}
+
+}  // namespace loader
@@ -0,0 +1,75 @@
+#ifndef ASYNC_MODEL_LOADER_HPP
+#define ASYNC_MODEL_LOADER_HPP
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "../mesh.hpp"
+#include "../upload_queue.hpp"
+#include "gltfLoaderTiny.hpp"
+
+namespace loader {
+
+// Decodes models on a background thread (DecodeModelCached, then
+// buildGpuGeometry in the requested layout) and feeds their GL uploads
+// through a bounded UploadQueue in chunks, so the render thread can spread
+// them over frames with update(). With LoadOptions::shareGpuObjects, payloads
+// another model already uploaded are bound instead of queued again.
+class AsyncModelLoader {
+ public:
+  using ReadyCallback = std::function<void(std::shared_ptr<utils::ModelData>,
+                                           std::shared_ptr<utils::Mesh>)>;
+
+  AsyncModelLoader(std::size_t queueCapacityBytes = 64u << 20,
+                   std::size_t chunkBytes = 1u << 20);
+  ~AsyncModelLoader();
+
+  AsyncModelLoader(const AsyncModelLoader&) = delete;
+  AsyncModelLoader& operator=(const AsyncModelLoader&) = delete;
+
+  // onReady runs on the render thread (inside update()) once the mesh and
+  // all of the model's textures are on the GPU. A model that fails to
+  // decode or upload is logged and never reaches it.
+  void load(const std::string& path, const LoadOptions& options,
+            ReadyCallback onReady);
+
+  // Render thread, once per frame.
+  utils::UploadQueue::DrainStats update(std::size_t byteBudget,
+                                        double timeBudgetMs);
+
+  // Models requested but not yet handed to their ReadyCallback.
+  std::size_t pending() const;
+
+ private:
+  struct Request {
+    std::string path;
+    LoadOptions options;
+    ReadyCallback onReady;
+  };
+
+  void workerLoop();
+  void enqueueUploads(const std::string& path,
+                      std::shared_ptr<utils::ModelData> data,
+                      const std::shared_ptr<const utils::GpuGeometry>& geometry,
+                      const LoadOptions& options, ReadyCallback onReady);
+
+  utils::UploadQueue queue_;
+  std::size_t chunkBytes_;
+
+  mutable std::mutex mutex_;
+  std::condition_variable cv_;
+  std::deque<Request> requests_;
+  std::size_t pending_ = 0;
+  bool stopping_ = false;
+  std::thread worker_;
+};
+
+}  // namespace loader
+
+#endif
@@ -0,0 +1,797 @@
+#include "cookedModel.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "../block_compress.hpp"
+#include "../gl_debug.hpp"
+#include "../hash.hpp"
+#include "../mapped_file.hpp"
+#include "../texture_mips.hpp"
+#include "../thread_pool.hpp"
+#include "../virtual_texture_file.hpp"
+
+namespace loader {
+namespace {
+
+constexpr char kMagic[8] = {'M', 'G', 'E', 'C', 'O', 'O', 'K', '\0'};
+constexpr std::uint32_t kCookedVersion = 10;
+constexpr std::uint64_t kAlignment = 16;
+// Larger than any texture GL accepts; bounds image records before level
+// sizes are derived from them.
+constexpr std::int32_t kMaxImageSize = 1 << 16;
+
+// All records are stored little-endian in host layout; vertexStride guards
+// against VertexPU changing shape between builds. Compact models store their
+// records as they are, described by a LayoutRecord. Compressed files store
+// the vertex and index data and every mip level as a utils::compressStream
+// stream instead, the levels of an image back to back.
+struct FileHeader {
+  char magic[8];
+  std::uint32_t version;
+  std::uint32_t vertexStride;
+  std::uint64_t sourceHash;
+  std::uint64_t vertexCount;
+  std::uint64_t vertexOffset;
+  std::uint64_t indexCount;
+  std::uint64_t indexOffset;
+  std::uint32_t submeshCount;
+  std::uint32_t materialCount;
+  std::uint64_t submeshOffset;
+  std::uint64_t materialOffset;
+  std::uint32_t imageCount;
+  std::uint32_t compressed;  // 1 = geometry and mips in compressed streams
+  std::uint64_t imageOffset;
+  std::uint64_t lodOffset;
+  std::uint32_t lodCount;
+  std::uint32_t meshletCount;
+  std::uint64_t meshletOffset;
+  std::uint32_t instanceCount;
+  std::uint32_t compactVertices;  // 1 = layout record at layoutOffset
+  std::uint64_t instanceOffset;
+  std::uint64_t layoutOffset;
+};
+
+struct SubmeshRecord {
+  std::uint32_t indexOffset;
+  std::uint32_t indexCount;
+  std::int32_t materialIndex;
+  std::uint32_t lodCount;  // records that follow the previous submesh's
+  float center[3];
+  float radius;
+  std::uint32_t meshletCount;  // likewise
+  std::uint32_t instanceOffset;
+  std::uint32_t instanceCount;
+  float uvDensity;
+};
+
+struct LodRecord {
+  std::uint32_t indexOffset;
+  std::uint32_t indexCount;
+  float error;
+  std::uint32_t reserved;
+};
+
+struct MeshletRecord {
+  std::uint32_t indexOffset;
+  std::uint32_t indexCount;
+  float center[3];
+  float radius;
+  float coneAxis[3];
+  float coneCutoff;
+};
+
+struct AttributeRecord {
+  std::uint32_t type;
+  std::int32_t components;
+  std::uint32_t normalized;
+  std::uint32_t offset;
+};
+
+struct LayoutRecord {
+  AttributeRecord position;
+  AttributeRecord uv;
+  AttributeRecord normal;
+  std::uint32_t stride;
+  std::uint32_t reserved[3];
+};
+
+struct MaterialRecord {
+  float baseColorFactor[4];
+  std::int32_t baseColorImage;
+  std::uint32_t doubleSided;
+  std::uint32_t reserved[2];
+};
+
+struct ImageRecord {
+  std::int32_t width;
+  std::int32_t height;
+  std::int32_t components;
+  std::uint32_t srgb;
+  std::int32_t wrapS;
+  std::int32_t wrapT;
+  std::int32_t minFilter;
+  std::int32_t magFilter;
+  std::uint32_t levelCount;
+  std::uint32_t compression;  // utils::TextureCompression
+  std::uint64_t dataOffset;
+};
+
+static_assert(sizeof(FileHeader) == 144, "FileHeader layout");
+static_assert(sizeof(SubmeshRecord) == 48, "SubmeshRecord layout");
+static_assert(sizeof(LodRecord) == 16, "LodRecord layout");
+static_assert(sizeof(MeshletRecord) == 40, "MeshletRecord layout");
+static_assert(sizeof(LayoutRecord) == 64, "LayoutRecord layout");
+static_assert(sizeof(MaterialRecord) == 32, "MaterialRecord layout");
+static_assert(sizeof(ImageRecord) == 48, "ImageRecord layout");
+
+std::uint64_t alignUp(std::uint64_t v) {
+  return (v + kAlignment - 1) & ~(kAlignment - 1);
+}
+
+double msSince(std::chrono::steady_clock::time_point t0) {
+  return std::chrono::duration<double, std::milli>(
+             std::chrono::steady_clock::now() - t0)
+      .count();
+}
+
+class Writer {
+ public:
+  explicit Writer(const std::string& path)
+      : out_(path, std::ios::binary | std::ios::trunc) {
+    if (!out_) throw std::runtime_error("Cannot write cooked model " + path);
+  }
+
+  std::uint64_t offset() const { return offset_; }
+
+  void write(const void* data, std::size_t size) {
+    out_.write(static_cast<const char*>(data),
+               static_cast<std::streamsize>(size));
+    offset_ += size;
+  }
+
+  std::uint64_t align() {
+    static const char zeros[kAlignment] = {};
+    const std::uint64_t aligned = alignUp(offset_);
+    write(zeros, static_cast<std::size_t>(aligned - offset_));
+    return offset_;
+  }
+
+  void seekAndWrite(std::uint64_t at, const void* data, std::size_t size) {
+    out_.seekp(static_cast<std::streamoff>(at));
+    out_.write(static_cast<const char*>(data),
+               static_cast<std::streamsize>(size));
+  }
+
+  void close() {
+    out_.close();
+    if (!out_) throw std::runtime_error("Failed writing cooked model");
+  }
+
+ private:
+  std::ofstream out_;
+  std::uint64_t offset_ = 0;
+};
+
+bool inBounds(const utils::MappedFile& file, std::uint64_t offset,
+              std::uint64_t size) {
+  return offset <= file.size() && size <= file.size() - offset;
+}
+
+// Whether the rest of the file could hold a compressed stream of `size`
+// bytes; LZ4 sequences expand to at most 255 bytes per stored byte.
+bool inBoundsCompressed(const utils::MappedFile& file, std::uint64_t offset,
+                        std::uint64_t size) {
+  return offset <= file.size() && size / 255 <= file.size() - offset;
+}
+
+// count * size for header counts, which are untrusted: false if it would
+// wrap instead of being caught by the bounds checks.
+bool checkedBytes(std::uint64_t count, std::uint64_t size,
+                  std::uint64_t& bytes) {
+  if (size != 0 && count > std::numeric_limits<std::uint64_t>::max() / size)
+    return false;
+  bytes = count * size;
+  return true;
+}
+
+// The calling thread works too, so threadCount - 1 workers.
+std::unique_ptr<utils::ThreadPool> makePool(unsigned threadCount) {
+  const unsigned threads = utils::ThreadPool::resolveThreadCount(threadCount);
+  if (threads <= 1) return nullptr;
+  return std::make_unique<utils::ThreadPool>(threads - 1);
+}
+
+double megabytes(std::uint64_t bytes) {
+  return static_cast<double>(bytes) / (1 << 20);
+}
+
+AttributeRecord toRecord(const utils::VertexAttribute& a) {
+  return {a.type, a.components, a.normalized, a.offset};
+}
+
+// Only the types the loader emits, inside the record.
+bool fromRecord(const AttributeRecord& r, std::uint32_t stride,
+                utils::VertexAttribute& a) {
+  std::uint32_t size = 0;
+  switch (r.type) {
+    case GL_BYTE:
+    case GL_UNSIGNED_BYTE:
+      size = 1;
+      break;
+    case GL_SHORT:
+    case GL_UNSIGNED_SHORT:
+      size = 2;
+      break;
+    case GL_FLOAT:
+      size = 4;
+      break;
+    default:
+      return false;
+  }
+  if (r.components < 0 || r.components > 4 ||
+      std::uint64_t{r.offset} + size * r.components > stride)
+    return false;
+  a.type = r.type;
+  a.components = r.components;
+  a.normalized = r.normalized ? GL_TRUE : GL_FALSE;
+  a.offset = r.offset;
+  return true;
+}
+
+// The cooked data also depends on the load-time processing options, so they
+// are folded into the hash stored in (and checked against) the file.
+std::uint64_t cookKey(std::uint64_t sourceHash, const LoadOptions& options) {
+  std::uint64_t key = sourceHash;
+  const std::uint32_t flags = (options.instancing ? 1u : 0u) |
+                              (options.keepQuantized ? 2u : 0u) |
+                              (options.compressCooked ? 4u : 0u);
+  if (flags != 0) key = utils::hash64(&flags, sizeof(flags), key);
+  // Always folded in: the generated normals of models without NORMAL depend
+  // on it, and earlier caches were built with uniform weighting.
+  const float normals[2] = {
+      static_cast<float>(options.normalOptions.weighting),
+      options.normalOptions.creaseAngle};
+  key = utils::hash64(normals, sizeof(normals), key);
+  if (options.weld) {
+    const float weld[3] = {options.weldOptions.positionEpsilon,
+                           options.weldOptions.normalEpsilon,
+                           options.weldOptions.uvEpsilon};
+    key = utils::hash64(weld, sizeof(weld), key);
+  }
+  if (options.optimize) {
+    const float optimize[2] = {
+        static_cast<float>(options.optimizeOptions.cacheSize),
+        options.optimizeOptions.overdrawThreshold};
+    key = utils::hash64(optimize, sizeof(optimize), key);
+  }
+  if (options.buildLods) {
+    const float lods[4] = {static_cast<float>(options.lodOptions.maxLods),
+                           options.lodOptions.reduction,
+                           options.lodOptions.maxError,
+                           static_cast<float>(options.lodOptions.minTriangles)};
+    key = utils::hash64(lods, sizeof(lods), key);
+  }
+  if (options.buildMeshlets) {
+    const std::uint32_t meshlets[2] = {options.meshletOptions.maxVertices,
+                                       options.meshletOptions.maxTriangles};
+    key = utils::hash64(meshlets, sizeof(meshlets), key);
+  }
+  if (options.textureCompression != utils::TextureCompression::None) {
+    const auto compression =
+        static_cast<std::uint32_t>(options.textureCompression);
+    key = utils::hash64(&compression, sizeof(compression), key);
+  } else if (options.basisuTarget != utils::TextureCompression::None) {
+    // Only KHR_texture_basisu images use it, which the key cannot tell;
+    // shifted apart from the textureCompression values.
+    const auto basisu = static_cast<std::uint32_t>(options.basisuTarget) << 8;
+    key = utils::hash64(&basisu, sizeof(basisu), key);
+  }
+  if (options.mipFilter != utils::MipFilter::Box) {
+    const auto mipFilter = static_cast<std::uint32_t>(options.mipFilter);
+    key = utils::hash64(&mipFilter, sizeof(mipFilter), key);
+  }
+  return key;
+}
+
+// Writes (or reuses, while their key matches) a page file per image beside
+// the cooked model and points the materials at them.
+void CookVirtualTextures(const std::string& cookedPath,
+                         std::uint64_t sourceHash, const LoadOptions& options,
+                         utils::ModelData& model) {
+  const utils::VirtualTextureLayout& layout = options.virtualTextureLayout;
+  const std::int32_t params[2] = {layout.pageSize, layout.border};
+  const std::uint64_t layoutKey =
+      utils::hash64(params, sizeof(params), sourceHash);
+  std::size_t written = 0;
+  for (std::size_t i = 0; i < model.images.size(); ++i) {
+    const std::string path = cookedPath + "." + std::to_string(i) + ".vtex";
+    const std::uint64_t index = i;
+    const std::uint64_t key = utils::hash64(&index, sizeof(index), layoutKey);
+    utils::VirtualTextureInfo info;
+    if (!utils::readVirtualTextureInfo(path, info) || info.key != key) {
+      utils::writeVirtualTexture(path, model.images[i], layout, key);
+      ++written;
+    }
+    model.virtualTextures.push_back({path, -1});
+  }
+  for (utils::MaterialGL& mat : model.materials)
+    mat.baseColorVirtual = mat.baseColorImage;
+  LOG_INFO("LoadModelCached - " << model.virtualTextures.size()
+                                << " virtual textures (" << written
+                                << " written)");
+}
+
+// With LoadOptions::virtualTextures; on failure the model keeps ordinary
+// textures.
+void AttachVirtualTextures(const std::string& cookedPath,
+                           std::uint64_t sourceHash,
+                           const LoadOptions& options,
+                           utils::ModelData& model) {
+  if (!options.virtualTextures) return;
+  try {
+    CookVirtualTextures(cookedPath, sourceHash, options, model);
+  } catch (const std::exception& e) {
+    LOG_WARN("LoadModelCached - no virtual textures: " << e.what());
+    model.virtualTextures.clear();
+    for (utils::MaterialGL& mat : model.materials) mat.baseColorVirtual = -1;
+  }
+}
+
+}  // namespace
+
+std::string CookedPathFor(const std::string& sourcePath,
+                          const std::string& cacheDir) {
+  namespace fs = std::filesystem;
+  const fs::path source(sourcePath);
+  if (cacheDir.empty()) return source.string() + ".cooked";
+  return (fs::path(cacheDir) / source.filename()).string() + ".cooked";
+}
+
+void WriteCookedModel(const std::string& cookedPath,
+                      const utils::ModelData& model, std::uint64_t sourceHash,
+                      bool compress, unsigned threadCount) {
+  namespace fs = std::filesystem;
+  const fs::path target(cookedPath);
+  if (target.has_parent_path()) fs::create_directories(target.parent_path());
+
+  const std::string tmpPath = cookedPath + ".tmp";
+  Writer w(tmpPath);
+
+  // Blocks of the larger streams are compressed in parallel.
+  const std::unique_ptr<utils::ThreadPool> pool =
+      compress ? makePool(threadCount) : nullptr;
+  std::uint64_t rawBytes = 0, storedBytes = 0;
+  const auto writeData = [&](const void* data, std::size_t size) {
+    if (!compress) {
+      w.write(data, size);
+      return;
+    }
+    const std::vector<unsigned char> stream = utils::compressStream(
+        data, size, utils::kCompressedBlockSize, pool.get());
+    w.write(stream.data(), stream.size());
+    rawBytes += size;
+    storedBytes += stream.size();
+  };
+
+  FileHeader header{};
+  std::memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.version = kCookedVersion;
+  header.vertexStride = model.compact() ? model.compactLayout.stride
+                                        : sizeof(utils::VertexPU);
+  header.compactVertices = model.compact() ? 1u : 0u;
+  header.sourceHash = sourceHash;
+  header.vertexCount = model.vertexCount();
+  header.indexCount = model.indexCount();
+  header.submeshCount = static_cast<std::uint32_t>(model.submeshes.size());
+  header.materialCount = static_cast<std::uint32_t>(model.materials.size());
+  header.imageCount = static_cast<std::uint32_t>(model.images.size());
+  for (const auto& sm : model.submeshes)
+    header.lodCount += static_cast<std::uint32_t>(sm.lods.size());
+  header.meshletCount = static_cast<std::uint32_t>(model.meshlets.size());
+  header.instanceCount = static_cast<std::uint32_t>(model.instances.size());
+  header.compressed = compress ? 1u : 0u;
+  w.write(&header, sizeof(header));
+
+  header.vertexOffset = w.align();
+  if (model.compact())
+    writeData(model.compactVertexData(),
+              model.vertexCount() * model.compactLayout.stride);
+  else
+    writeData(model.vertexData(),
+              model.vertexCount() * sizeof(utils::VertexPU));
+
+  header.indexOffset = w.align();
+  writeData(model.indexData(), model.indexCount() * sizeof(std::uint32_t));
+
+  header.submeshOffset = w.align();
+  for (const auto& sm : model.submeshes) {
+    const SubmeshRecord r{sm.indexOffset,
+                          sm.indexCount,
+                          sm.materialIndex,
+                          static_cast<std::uint32_t>(sm.lods.size()),
+                          {sm.center.x, sm.center.y, sm.center.z},
+                          sm.radius,
+                          sm.meshletCount,
+                          sm.instanceOffset,
+                          sm.instanceCount,
+                          sm.uvDensity};
+    w.write(&r, sizeof(r));
+  }
+
+  header.lodOffset = w.align();
+  for (const auto& sm : model.submeshes) {
+    for (const auto& lod : sm.lods) {
+      const LodRecord r{lod.indexOffset, lod.indexCount, lod.error, 0};
+      w.write(&r, sizeof(r));
+    }
+  }
+
+  // Meshlets are stored in submesh order, like the LODs.
+  header.meshletOffset = w.align();
+  for (const auto& sm : model.submeshes) {
+    for (std::uint32_t m = 0; m < sm.meshletCount; ++m) {
+      const utils::Meshlet& meshlet = model.meshlets.at(sm.meshletOffset + m);
+      const MeshletRecord r{
+          meshlet.indexOffset,
+          meshlet.indexCount,
+          {meshlet.center.x, meshlet.center.y, meshlet.center.z},
+          meshlet.radius,
+          {meshlet.coneAxis.x, meshlet.coneAxis.y, meshlet.coneAxis.z},
+          meshlet.coneCutoff};
+      w.write(&r, sizeof(r));
+    }
+  }
+
+  header.instanceOffset = w.align();
+  w.write(model.instances.data(), model.instances.size() * sizeof(glm::mat4));
+
+  if (model.compact()) {
+    const utils::VertexLayout& layout = model.compactLayout;
+    const LayoutRecord r{toRecord(layout.position),
+                         toRecord(layout.uv),
+                         toRecord(layout.normal),
+                         layout.stride,
+                         {}};
+    header.layoutOffset = w.align();
+    w.write(&r, sizeof(r));
+  }
+
+  header.materialOffset = w.align();
+  for (const auto& mat : model.materials) {
+    MaterialRecord r{};
+    for (int k = 0; k < 4; ++k) r.baseColorFactor[k] = mat.baseColorFactor[k];
+    r.baseColorImage = mat.baseColorImage;
+    r.doubleSided = mat.doubleSided ? 1u : 0u;
+    w.write(&r, sizeof(r));
+  }
+
+  // Image records first, then each image's mip chain.
+  header.imageOffset = w.align();
+  std::vector<ImageRecord> records(model.images.size());
+  w.write(records.data(), records.size() * sizeof(ImageRecord));
+
+  for (std::size_t i = 0; i < model.images.size(); ++i) {
+    const utils::TextureImage& src = model.images[i];
+    utils::TextureImage withMips;
+    const utils::TextureImage* image = &src;
+    // DecodeGLB builds the chains; this covers models put together by hand.
+    if (src.levelCount() == 1 &&
+        src.compression == utils::TextureCompression::None &&
+        utils::samplesMipmaps(src)) {
+      withMips = src;
+      utils::generateMipChain(withMips);
+      image = &withMips;
+    }
+
+    ImageRecord& r = records[i];
+    r.width = src.width;
+    r.height = src.height;
+    r.components = src.components;
+    r.srgb = src.srgb ? 1u : 0u;
+    r.wrapS = src.wrapS;
+    r.wrapT = src.wrapT;
+    r.minFilter = src.minFilter;
+    r.magFilter = src.magFilter;
+    r.levelCount = static_cast<std::uint32_t>(image->levelCount());
+    r.compression = static_cast<std::uint32_t>(src.compression);
+    r.dataOffset = w.align();
+    for (int level = 0; level < image->levelCount(); ++level)
+      writeData(image->levelData(level), utils::mipLevelSize(*image, level));
+  }
+
+  w.seekAndWrite(0, &header, sizeof(header));
+  w.seekAndWrite(header.imageOffset, records.data(),
+                 records.size() * sizeof(ImageRecord));
+  w.close();
+
+  fs::rename(tmpPath, target);
+  if (compress)
+    LOG_INFO("LoadModelCached - compressed " << megabytes(rawBytes)
+                                             << " MB of geometry and mips to "
+                                             << megabytes(storedBytes)
+                                             << " MB");
+}
+
+bool LoadCookedModel(const std::string& cookedPath, std::uint64_t sourceHash,
+                     utils::ModelData& out, unsigned threadCount) {
+  if (!std::filesystem::exists(cookedPath)) return false;
+
+  auto file = std::make_shared<utils::MappedFile>(cookedPath);
+  if (file->size() < sizeof(FileHeader)) return false;
+
+  FileHeader header;
+  std::memcpy(&header, file->data(), sizeof(header));
+  if (std::memcmp(header.magic, kMagic, sizeof(kMagic)) != 0 ||
+      header.version != kCookedVersion ||
+      (!header.compactVertices &&
+       header.vertexStride != sizeof(utils::VertexPU)) ||
+      header.sourceHash != sourceHash)
+    return false;
+  if (header.compressed > 1)
+    throw std::runtime_error("Bad compression in " + cookedPath);
+  const bool compressed = header.compressed != 0;
+  // Everything but the small records is read and decoded right away, so
+  // start reading it all while the records are parsed.
+  const auto readStart = std::chrono::steady_clock::now();
+  if (compressed) file->prefetch(0, file->size());
+
+  utils::VertexLayout compactLayout;
+  if (header.compactVertices) {
+    LayoutRecord r;
+    if (!inBounds(*file, header.layoutOffset, sizeof(r)))
+      throw std::runtime_error("Truncated cooked model " + cookedPath);
+    std::memcpy(&r, file->data() + header.layoutOffset, sizeof(r));
+    compactLayout.stride = r.stride;
+    if (r.stride == 0 || r.stride != header.vertexStride ||
+        !fromRecord(r.position, r.stride, compactLayout.position) ||
+        !fromRecord(r.uv, r.stride, compactLayout.uv) ||
+        !fromRecord(r.normal, r.stride, compactLayout.normal))
+      throw std::runtime_error("Bad vertex layout in " + cookedPath);
+  }
+
+  std::uint64_t vertexBytes = 0, indexBytes = 0;
+  if (!checkedBytes(header.vertexCount, header.vertexStride, vertexBytes) ||
+      !checkedBytes(header.indexCount, sizeof(std::uint32_t), indexBytes) ||
+      vertexBytes > std::numeric_limits<std::size_t>::max() ||
+      indexBytes > std::numeric_limits<std::size_t>::max())
+    throw std::runtime_error("Bad header in " + cookedPath);
+  const auto dataInBounds = compressed ? inBoundsCompressed : inBounds;
+  if (!dataInBounds(*file, header.vertexOffset, vertexBytes) ||
+      !dataInBounds(*file, header.indexOffset, indexBytes) ||
+      !inBounds(*file, header.submeshOffset,
+                std::uint64_t{header.submeshCount} * sizeof(SubmeshRecord)) ||
+      !inBounds(*file, header.materialOffset,
+                std::uint64_t{header.materialCount} * sizeof(MaterialRecord)) ||
+      !inBounds(*file, header.imageOffset,
+                std::uint64_t{header.imageCount} * sizeof(ImageRecord)) ||
+      !inBounds(*file, header.lodOffset,
+                std::uint64_t{header.lodCount} * sizeof(LodRecord)) ||
+      !inBounds(*file, header.meshletOffset,
+                std::uint64_t{header.meshletCount} * sizeof(MeshletRecord)) ||
+      !inBounds(*file, header.instanceOffset,
+                std::uint64_t{header.instanceCount} * sizeof(glm::mat4)))
+    throw std::runtime_error("Truncated cooked model " + cookedPath);
+
+  const std::byte* base = file->data();
+  utils::ModelData model;
+
+  // Compressed data is decoded into the model's own arrays, all streams'
+  // blocks at once.
+  std::vector<utils::CompressedBlock> blocks;
+  std::uint64_t compressedBytes = 0, decodedBytes = 0;
+  const auto addStream = [&](std::uint64_t at, void* dst, std::size_t size) {
+    const std::size_t stored = utils::appendStreamBlocks(
+        reinterpret_cast<const unsigned char*>(base + at), file->size() - at,
+        static_cast<unsigned char*>(dst), size, blocks);
+    compressedBytes += stored;
+    decodedBytes += size;
+    return stored;
+  };
+
+  model.images.resize(header.imageCount);
+  for (std::uint32_t i = 0; i < header.imageCount; ++i) {
+    ImageRecord r;
+    std::memcpy(&r, base + header.imageOffset + i * sizeof(r), sizeof(r));
+    if (r.width <= 0 || r.height <= 0 || r.width > kMaxImageSize ||
+        r.height > kMaxImageSize || r.components < 1 || r.components > 4 ||
+        r.levelCount == 0 ||
+        r.levelCount >
+            static_cast<std::uint32_t>(utils::mipLevelCount(r.width, r.height)))
+      throw std::runtime_error("Bad image record in " + cookedPath);
+    utils::TextureImage& image = model.images[i];
+    image.width = r.width;
+    image.height = r.height;
+    image.components = r.components;
+    image.srgb = r.srgb != 0;
+    image.wrapS = r.wrapS;
+    image.wrapT = r.wrapT;
+    image.minFilter = r.minFilter;
+    image.magFilter = r.magFilter;
+    if (r.compression >
+        static_cast<std::uint32_t>(utils::TextureCompression::BC7))
+      throw std::runtime_error("Bad image compression in " + cookedPath);
+    image.compression = static_cast<utils::TextureCompression>(r.compression);
+    if (!compressed) image.backing = file;
+    std::uint64_t at = r.dataOffset;
+    for (std::uint32_t level = 0; level < r.levelCount; ++level) {
+      const std::size_t size =
+          utils::mipLevelSize(image, static_cast<int>(level));
+      if (!dataInBounds(*file, at, size))
+        throw std::runtime_error("Truncated cooked image in " + cookedPath);
+      if (compressed) {
+        image.levels.emplace_back(size);
+        at += addStream(at, image.levels.back().data(), size);
+      } else {
+        image.borrowedLevels.push_back(
+            reinterpret_cast<const unsigned char*>(base + at));
+        at += size;
+      }
+    }
+  }
+
+  model.submeshes.resize(header.submeshCount);
+  std::uint32_t nextLod = 0, nextMeshlet = 0;
+  for (std::uint32_t i = 0; i < header.submeshCount; ++i) {
+    SubmeshRecord r;
+    std::memcpy(&r, base + header.submeshOffset + i * sizeof(r), sizeof(r));
+    if (std::uint64_t{r.indexOffset} + r.indexCount > header.indexCount ||
+        r.lodCount > header.lodCount - nextLod ||
+        r.meshletCount > header.meshletCount - nextMeshlet ||
+        std::uint64_t{r.instanceOffset} + r.instanceCount >
+            header.instanceCount)
+      throw std::runtime_error("Bad submesh range in " + cookedPath);
+    utils::Submesh& sm = model.submeshes[i];
+    sm.indexOffset = r.indexOffset;
+    sm.indexCount = r.indexCount;
+    sm.materialIndex = r.materialIndex;
+    sm.center = glm::vec3(r.center[0], r.center[1], r.center[2]);
+    sm.radius = r.radius;
+    sm.uvDensity = r.uvDensity;
+    for (std::uint32_t l = 0; l < r.lodCount; ++l, ++nextLod) {
+      LodRecord lr;
+      std::memcpy(&lr, base + header.lodOffset + nextLod * sizeof(lr),
+                  sizeof(lr));
+      if (std::uint64_t{lr.indexOffset} + lr.indexCount > header.indexCount)
+        throw std::runtime_error("Bad LOD range in " + cookedPath);
+      sm.lods.push_back({lr.indexOffset, lr.indexCount, lr.error});
+    }
+    sm.instanceOffset = r.instanceOffset;
+    sm.instanceCount = r.instanceCount;
+    sm.meshletOffset = nextMeshlet;
+    sm.meshletCount = r.meshletCount;
+    nextMeshlet += r.meshletCount;
+  }
+
+  model.instances.resize(header.instanceCount);
+  if (!model.instances.empty())
+    std::memcpy(model.instances.data(), base + header.instanceOffset,
+                model.instances.size() * sizeof(glm::mat4));
+
+  model.meshlets.resize(header.meshletCount);
+  for (std::uint32_t i = 0; i < header.meshletCount; ++i) {
+    MeshletRecord r;
+    std::memcpy(&r, base + header.meshletOffset + i * sizeof(r), sizeof(r));
+    if (std::uint64_t{r.indexOffset} + r.indexCount > header.indexCount)
+      throw std::runtime_error("Bad meshlet range in " + cookedPath);
+    utils::Meshlet& meshlet = model.meshlets[i];
+    meshlet.indexOffset = r.indexOffset;
+    meshlet.indexCount = r.indexCount;
+    meshlet.center = glm::vec3(r.center[0], r.center[1], r.center[2]);
+    meshlet.radius = r.radius;
+    meshlet.coneAxis = glm::vec3(r.coneAxis[0], r.coneAxis[1], r.coneAxis[2]);
+    meshlet.coneCutoff = r.coneCutoff;
+  }
+
+  model.materials.resize(header.materialCount);
+  for (std::uint32_t i = 0; i < header.materialCount; ++i) {
+    MaterialRecord r;
+    std::memcpy(&r, base + header.materialOffset + i * sizeof(r), sizeof(r));
+    utils::MaterialGL& mat = model.materials[i];
+    mat.baseColorFactor = glm::vec4(r.baseColorFactor[0], r.baseColorFactor[1],
+                                    r.baseColorFactor[2], r.baseColorFactor[3]);
+    mat.doubleSided = r.doubleSided != 0;
+    if (r.baseColorImage >= 0 &&
+        r.baseColorImage < static_cast<std::int32_t>(header.imageCount))
+      mat.baseColorImage = r.baseColorImage;
+  }
+
+  if (header.compactVertices) model.compactLayout = compactLayout;
+  if (compressed) {
+    const auto vertexCount = static_cast<std::size_t>(header.vertexCount);
+    if (header.compactVertices) {
+      model.compactVertices.resize(vertexCount * header.vertexStride);
+      addStream(header.vertexOffset, model.compactVertices.data(),
+                model.compactVertices.size());
+    } else {
+      model.vertices.resize(vertexCount);
+      addStream(header.vertexOffset, model.vertices.data(),
+                vertexCount * sizeof(utils::VertexPU));
+    }
+    model.indices.resize(static_cast<std::size_t>(header.indexCount));
+    addStream(header.indexOffset, model.indices.data(),
+              model.indices.size() * sizeof(std::uint32_t));
+
+    const std::unique_ptr<utils::ThreadPool> pool = makePool(threadCount);
+    utils::decompressBlocks(blocks, pool.get());
+    const double ms = msSince(readStart);
+    LOG_INFO("LoadModelCached - read and decompressed "
+             << megabytes(compressedBytes) << " MB into "
+             << megabytes(decodedBytes) << " MB (" << blocks.size()
+             << " blocks, " << (pool ? pool->size() + 1 : 1)
+             << " thread(s)) in " << ms << " ms: "
+             << megabytes(decodedBytes) / std::max(ms, 1e-3) * 1000.0
+             << " MB/s");
+  } else {
+    if (header.compactVertices) {
+      model.borrowedCompactVertices =
+          reinterpret_cast<const unsigned char*>(base + header.vertexOffset);
+    } else {
+      model.borrowedVertices = reinterpret_cast<const utils::VertexPU*>(
+          base + header.vertexOffset);
+    }
+    model.borrowedVertexCount = static_cast<std::size_t>(header.vertexCount);
+    model.borrowedIndices =
+        reinterpret_cast<const std::uint32_t*>(base + header.indexOffset);
+    model.borrowedIndexCount = static_cast<std::size_t>(header.indexCount);
+    model.backing = file;
+  }
+
+  out = std::move(model);
+  return true;
+}
+
+utils::ModelData DecodeModelCached(const std::string& path,
+                                   const LoadOptions& options) {
+  const auto t0 = std::chrono::steady_clock::now();
+  const std::uint64_t sourceHash = cookKey(HashModelSource(path), options);
+  const std::string cookedPath = CookedPathFor(path, options.cacheDir);
+  LOG_INFO("LoadModelCached - source hash: " << msSince(t0) << " ms");
+
+  utils::ModelData out;
+  try {
+    if (LoadCookedModel(cookedPath, sourceHash, out, options.threadCount)) {
+      LOG_INFO("LoadModelCached - warm load (mmap " << cookedPath
+                                                    << "): " << msSince(t0)
+                                                    << " ms");
+      AttachVirtualTextures(cookedPath, sourceHash, options, out);
+      return out;
+    }
+  } catch (const std::exception& e) {
+    LOG_WARN("LoadModelCached - ignoring cooked model: " << e.what());
+  }
+
+  out = DecodeGLB(path, options);
+  const double parseMs = msSince(t0);
+
+  try {
+    WriteCookedModel(cookedPath, out, sourceHash, options.compressCooked,
+                     options.threadCount);
+  } catch (const std::exception& e) {
+    LOG_WARN("LoadModelCached - could not write " << cookedPath << ": "
+                                                  << e.what());
+  }
+  LOG_INFO("LoadModelCached - cold load (parse " << parseMs
+                                                 << " ms, with cooking "
+                                                 << msSince(t0) << " ms)");
+  AttachVirtualTextures(cookedPath, sourceHash, options, out);
+  return out;
+}
+
+utils::ModelData LoadModelCached(const std::string& path,
+                                 const LoadOptions& options) {
+  utils::ModelData out = DecodeModelCached(path, options);
+  CreateModelTextures(out, options);
+  if (!KeepsModelImages(options)) ReleaseModelImages(out);
+  return out;
+}
+
+}  // namespace loader
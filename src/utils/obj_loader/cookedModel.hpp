@@ -0,0 +1,48 @@
+#ifndef COOKED_MODEL_HPP
+#define COOKED_MODEL_HPP
+
+#include <cstdint>
+#include <string>
+
+#include "../mesh.hpp"
+#include "gltfLoaderTiny.hpp"
+
+namespace loader {
+
+// Versioned binary snapshot of a loaded ModelData: VertexPU array (or compact
+// records and their layout), uint32 indices, submesh table, material factors
+// and full texture mip chains.
+// Geometry is read back through mmap and borrowed by the returned ModelData,
+// so it can go to Mesh::upload without being copied. Compressed files hold
+// geometry and mips as independently decodable blocks instead, which are
+// decoded in parallel into the ModelData's own arrays.
+
+std::string CookedPathFor(const std::string& sourcePath,
+                          const std::string& cacheDir);
+
+// Requires model.images (as returned by DecodeGLB). With `compress`, the
+// blocks are compressed on `threadCount` threads (0 = hardware concurrency).
+void WriteCookedModel(const std::string& cookedPath,
+                      const utils::ModelData& model, std::uint64_t sourceHash,
+                      bool compress = false, unsigned threadCount = 1);
+
+// Returns false if the file is missing, stale (hash mismatch) or from another
+// format version. CPU only: images come back in ModelData::images with their
+// mips borrowed from the mapping, or decoded on `threadCount` threads when
+// the file is compressed.
+bool LoadCookedModel(const std::string& cookedPath, std::uint64_t sourceHash,
+                     utils::ModelData& out, unsigned threadCount = 1);
+
+// Reads the cooked cache when it matches the source file's hash, otherwise
+// runs DecodeGLB and (re)writes the cache. With LoadOptions::virtualTextures
+// the images' page files are cooked (or reused) beside it. No GL calls.
+utils::ModelData DecodeModelCached(const std::string& path,
+                                   const LoadOptions& options = {});
+
+// DecodeModelCached + CreateModelTextures on the calling (GL) thread.
+utils::ModelData LoadModelCached(const std::string& path,
+                                 const LoadOptions& options = {});
+
+}  // namespace loader
+
+#endif
@@ -3,14 +3,30 @@
 #define STB_IMAGE_IMPLEMENTATION
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 
+#include <algorithm>
+#include <chrono>
+#include <cmath>
 #include <cstring>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/quaternion.hpp>
 #include <iostream>
+#include <memory>
 #include <stdexcept>
+#include <string>
 #include <unordered_set>
 
 #include "../gl_debug.hpp"
+#include "../gpu_cache.hpp"
+#include "../hash.hpp"
+#include "../ktx2.hpp"
+#include "../mesh_normals.hpp"
+#include "../meshopt_decode.hpp"
+#include "../texture_compress.hpp"
+#include "../texture_mips.hpp"
+#include "../texture_streamer.hpp"
+#include "../thread_pool.hpp"
+#include "../vertex_transform.hpp"
+#include "../vfs.hpp"
 #include "tiny_gltf.h"
 
 namespace loader {
@@ -41,17 +57,188 @@ glm::mat4 nodeLocalMatrix(const tinygltf::Node& n) {
          glm::scale(glm::mat4(1.0f), s);
 }
 
+struct ByteSpan {
+  const unsigned char* data = nullptr;
+  std::size_t size = 0;
+};
+
+// Bytes of every glTF buffer, by index: tinygltf's copy, the mapped GLB
+// BIN chunk, or an external file mapped through the Vfs the first time it
+// is read (see stubGltf). A lazy buffer is unmapped again once the reads
+// planned with expect() are done(), so only the buffers of primitives still
+// being decoded stay mapped. Thread-safe.
+class GltfBuffers {
+ public:
+  struct Stats {
+    std::size_t external = 0;  // lazy buffers
+    std::size_t opened = 0;    // of those, mapped at least once
+    std::size_t peakMappedBytes = 0;
+  };
+
+  void reset(std::size_t count) {
+    entries_.assign(count, {});
+    mappedBytes_ = 0;
+    stats_ = {};
+  }
+  void setMapped(std::size_t index, ByteSpan bytes);
+  void setLazy(std::size_t index, std::string path, std::size_t byteLength);
+  // Mapped or lazy: tinygltf only saw a stand-in.
+  bool deferred(std::size_t index) const {
+    return index < entries_.size() && entries_[index].deferred;
+  }
+  bool lazy(std::size_t index) const {
+    return index < entries_.size() && !entries_[index].path.empty();
+  }
+  // Points the other buffers at tinygltf's copies, once it has parsed.
+  void attach(const tinygltf::Model& model);
+
+  std::size_t size() const { return entries_.size(); }
+  // Throws std::runtime_error if a lazy buffer's file is missing or short.
+  ByteSpan bytes(std::size_t index) const;
+  // Turns the buffer into tinygltf's copy, at least `size` bytes long, for
+  // decoding into. Its current bytes are only read with `preserve`.
+  unsigned char* writable(tinygltf::Model& model, std::size_t index,
+                          std::size_t size, bool preserve);
+
+  void expect(std::size_t index);
+  void done(std::size_t index);
+  // Unmaps the lazy buffers no planned read needs.
+  void evictUnused();
+  const Stats& stats() const { return stats_; }
+
+ private:
+  struct Entry {
+    ByteSpan bytes;
+    bool resolved = false;  // bytes valid
+    bool deferred = false;
+    bool opened = false;
+    std::string path;  // lazy: file to map
+    std::size_t byteLength = 0;
+    utils::VfsFile file;  // lazy: the mapping while resident
+    std::size_t pending = 0;
+  };
+
+  void resolve(Entry& e) const;
+  void unmap(Entry& e) const;
+
+  mutable std::mutex mutex_;
+  mutable std::vector<Entry> entries_;
+  mutable std::size_t mappedBytes_ = 0;
+  mutable Stats stats_;
+};
+
+void GltfBuffers::setMapped(std::size_t index, ByteSpan bytes) {
+  Entry& e = entries_[index];
+  e.bytes = bytes;
+  e.resolved = e.deferred = true;
+}
+
+void GltfBuffers::setLazy(std::size_t index, std::string path,
+                          std::size_t byteLength) {
+  Entry& e = entries_[index];
+  e.path = std::move(path);
+  e.byteLength = byteLength;
+  e.deferred = true;
+  ++stats_.external;
+}
+
+void GltfBuffers::attach(const tinygltf::Model& model) {
+  if (entries_.size() < model.buffers.size())
+    entries_.resize(model.buffers.size());
+  for (std::size_t b = 0; b < model.buffers.size(); ++b) {
+    Entry& e = entries_[b];
+    if (e.deferred) continue;
+    e.bytes = {model.buffers[b].data.data(), model.buffers[b].data.size()};
+    e.resolved = true;
+  }
+}
+
+void GltfBuffers::resolve(Entry& e) const {
+  if (e.resolved) return;
+  utils::VfsFile file = utils::Vfs::instance().open(e.path);
+  if (file.size() < e.byteLength)
+    throw std::runtime_error("Buffer " + e.path +
+                             " is shorter than its byteLength");
+  e.file = std::move(file);
+  e.bytes = {e.file.data(), e.byteLength};
+  e.resolved = true;
+  if (!e.opened) ++stats_.opened;
+  e.opened = true;
+  mappedBytes_ += e.byteLength;
+  stats_.peakMappedBytes = std::max(stats_.peakMappedBytes, mappedBytes_);
+}
+
+void GltfBuffers::unmap(Entry& e) const {
+  if (e.path.empty() || !e.resolved) return;
+  e.file = {};
+  e.bytes = {};
+  e.resolved = false;
+  mappedBytes_ -= e.byteLength;
+}
+
+ByteSpan GltfBuffers::bytes(std::size_t index) const {
+  std::lock_guard lock(mutex_);
+  if (index >= entries_.size())
+    throw std::runtime_error("Buffer index out of range");
+  Entry& e = entries_[index];
+  resolve(e);
+  return e.bytes;
+}
+
+unsigned char* GltfBuffers::writable(tinygltf::Model& model,
+                                     std::size_t index, std::size_t size,
+                                     bool preserve) {
+  std::lock_guard lock(mutex_);
+  Entry& e = entries_[index];
+  auto& data = model.buffers[index].data;
+  if (e.deferred) {
+    if (preserve) {
+      resolve(e);
+      data.assign(e.bytes.data, e.bytes.data + e.bytes.size);
+    } else {
+      data.clear();  // tinygltf's stand-in byte
+    }
+    unmap(e);
+    e.path.clear();
+    e.deferred = false;
+  }
+  if (data.size() < size) data.resize(size);
+  e.bytes = {data.data(), data.size()};
+  e.resolved = true;
+  return data.data();
+}
+
+void GltfBuffers::expect(std::size_t index) {
+  std::lock_guard lock(mutex_);
+  if (index < entries_.size()) ++entries_[index].pending;
+}
+
+void GltfBuffers::done(std::size_t index) {
+  std::lock_guard lock(mutex_);
+  if (index >= entries_.size()) return;
+  Entry& e = entries_[index];
+  if (e.pending > 0 && --e.pending == 0) unmap(e);
+}
+
+void GltfBuffers::evictUnused() {
+  std::lock_guard lock(mutex_);
+  for (Entry& e : entries_)
+    if (e.pending == 0) unmap(e);
+}
+
 const std::byte* accBasePtr(const tinygltf::Model& model,
+                            const GltfBuffers& buffers,
                             const tinygltf::Accessor& acc) {
   if (acc.bufferView < 0)
     throw std::runtime_error("Accessor has no bufferView");
   const auto& view = model.bufferViews[static_cast<size_t>(acc.bufferView)];
-  const auto& buf = model.buffers[static_cast<size_t>(view.buffer)];
+  if (view.buffer < 0)
+    throw std::runtime_error("Accessor buffer out of range");
+  const ByteSpan buf = buffers.bytes(static_cast<size_t>(view.buffer));
   const size_t off = static_cast<size_t>(view.byteOffset) +
                      static_cast<size_t>(acc.byteOffset);
-  if (off >= buf.data.size())
-    throw std::runtime_error("Accessor offset out of range");
-  return reinterpret_cast<const std::byte*>(buf.data.data() + off);
+  if (off >= buf.size) throw std::runtime_error("Accessor offset out of range");
+  return reinterpret_cast<const std::byte*>(buf.data + off);
 }
 
 size_t accStride(const tinygltf::Model& model, const tinygltf::Accessor& acc) {
@@ -66,18 +253,6 @@ size_t accStride(const tinygltf::Model& model, const tinygltf::Accessor& acc) {
   return static_cast<size_t>(comps * compSize);
 }
 
-glm::vec3 readVec3f(const std::byte* base, size_t stride, size_t i) {
-  float tmp[3]{};
-  std::memcpy(tmp, base + stride * i, sizeof(tmp));
-  return {tmp[0], tmp[1], tmp[2]};
-}
-
-glm::vec2 readVec2f(const std::byte* base, size_t stride, size_t i) {
-  float tmp[2]{};
-  std::memcpy(tmp, base + stride * i, sizeof(tmp));
-  return {tmp[0], tmp[1]};
-}
-
 std::uint32_t readIndex(const std::byte* base, size_t stride, size_t i,
                         int componentType) {
   const std::byte* p = base + stride * i;
@@ -102,29 +277,125 @@ std::uint32_t readIndex(const std::byte* base, size_t stride, size_t i,
   }
 }
 
-void computeNormalsRange(std::vector<utils::VertexPU>& v,
-                         const std::vector<std::uint32_t>& idx,
-                         std::uint32_t start, std::uint32_t count) {
-  for (std::uint32_t i = start; i < start + count; ++i) {
-    v[idx[i]].normal = glm::vec3(0.0f);
+// Float or 8/16-bit integer component. Integers map to [-1, 1] / [0, 1] only
+// when `normalized`; KHR_mesh_quantization also allows raw integers.
+float readComponent(const std::byte* p, int componentType, bool normalized) {
+  switch (componentType) {
+    case TINYGLTF_COMPONENT_TYPE_FLOAT: {
+      float v{};
+      std::memcpy(&v, p, sizeof(v));
+      return v;
+    }
+    case TINYGLTF_COMPONENT_TYPE_BYTE: {
+      std::int8_t v{};
+      std::memcpy(&v, p, sizeof(v));
+      return normalized ? std::max(v / 127.0f, -1.0f) : v;
+    }
+    case TINYGLTF_COMPONENT_TYPE_SHORT: {
+      std::int16_t v{};
+      std::memcpy(&v, p, sizeof(v));
+      return normalized ? std::max(v / 32767.0f, -1.0f) : v;
+    }
+    case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE: {
+      std::uint8_t v{};
+      std::memcpy(&v, p, sizeof(v));
+      return normalized ? v / 255.0f : v;
+    }
+    case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT: {
+      std::uint16_t v{};
+      std::memcpy(&v, p, sizeof(v));
+      return normalized ? v / 65535.0f : v;
+    }
+    default:
+      throw std::runtime_error("Unsupported accessor componentType");
   }
+}
 
-  for (std::uint32_t i = start; i + 2 < start + count; i += 3) {
-    auto i0 = idx[i];
-    auto i1 = idx[i + 1];
-    auto i2 = idx[i + 2];
-    glm::vec3 n = glm::normalize(
-        glm::cross(v[i1].pos - v[i0].pos, v[i2].pos - v[i0].pos));
-    v[i0].normal += n;
-    v[i1].normal += n;
-    v[i2].normal += n;
+// Element i of `acc` as `comps` floats.
+void readElement(const std::byte* base, size_t stride, size_t i,
+                 const tinygltf::Accessor& acc, int comps, float* out) {
+  const std::byte* p = base + stride * i;
+  if (acc.componentType == TINYGLTF_COMPONENT_TYPE_FLOAT) {
+    std::memcpy(out, p, sizeof(float) * static_cast<size_t>(comps));
+    return;
   }
+  const int size = tinygltf::GetComponentSizeInBytes(acc.componentType);
+  for (int c = 0; c < comps; ++c)
+    out[c] = readComponent(p + c * size, acc.componentType, acc.normalized);
+}
 
-  for (std::uint32_t i = start; i < start + count; ++i) {
-    auto vi = idx[i];
-    float len = glm::length(v[vi].normal);
-    v[vi].normal = (len > 1e-8f) ? (v[vi].normal / len) : glm::vec3(0, 1, 0);
+glm::vec3 readVec3(const std::byte* base, size_t stride, size_t i,
+                   const tinygltf::Accessor& acc) {
+  float tmp[3]{};
+  readElement(base, stride, i, acc, 3, tmp);
+  return {tmp[0], tmp[1], tmp[2]};
+}
+
+glm::vec2 readVec2(const std::byte* base, size_t stride, size_t i,
+                   const tinygltf::Accessor& acc) {
+  float tmp[2]{};
+  readElement(base, stride, i, acc, 2, tmp);
+  return {tmp[0], tmp[1]};
+}
+
+bool isInteger8or16(int componentType) {
+  return componentType == TINYGLTF_COMPONENT_TYPE_BYTE ||
+         componentType == TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE ||
+         componentType == TINYGLTF_COMPONENT_TYPE_SHORT ||
+         componentType == TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT;
+}
+
+// EXT_mesh_gpu_instancing: one TRS transform per instance, relative to the
+// node. Empty when the node does not use the extension.
+std::vector<glm::mat4> gpuInstanceTransforms(const tinygltf::Model& model,
+                                             const GltfBuffers& buffers,
+                                             const tinygltf::Node& node) {
+  const auto ext = node.extensions.find("EXT_mesh_gpu_instancing");
+  if (ext == node.extensions.end() || !ext->second.Has("attributes"))
+    return {};
+  const tinygltf::Value& attributes = ext->second.Get("attributes");
+
+  std::size_t count = 0;
+  bool counted = false;
+  auto accessor = [&](const char* name,
+                      int type) -> const tinygltf::Accessor* {
+    if (!attributes.Has(name)) return nullptr;
+    const int index = attributes.Get(name).GetNumberAsInt();
+    if (index < 0 || index >= static_cast<int>(model.accessors.size()))
+      throw std::runtime_error("Bad EXT_mesh_gpu_instancing accessor");
+    const tinygltf::Accessor& acc = model.accessors[static_cast<size_t>(index)];
+    if (acc.type != type)
+      throw std::runtime_error(std::string("Bad instance ") + name + " type");
+    if (counted && acc.count != count)
+      throw std::runtime_error("Instance attribute counts differ");
+    count = acc.count;
+    counted = true;
+    return &acc;
+  };
+  const tinygltf::Accessor* translation =
+      accessor("TRANSLATION", TINYGLTF_TYPE_VEC3);
+  const tinygltf::Accessor* rotation = accessor("ROTATION", TINYGLTF_TYPE_VEC4);
+  const tinygltf::Accessor* scale = accessor("SCALE", TINYGLTF_TYPE_VEC3);
+  if (!counted) return {};
+
+  auto read = [&](const tinygltf::Accessor* acc, std::size_t i, int comps,
+                  float* out) {
+    readElement(accBasePtr(model, buffers, *acc), accStride(model, *acc), i,
+                *acc, comps, out);
+  };
+
+  std::vector<glm::mat4> transforms(count);
+  for (std::size_t i = 0; i < count; ++i) {
+    float t[3] = {0, 0, 0}, r[4] = {0, 0, 0, 1}, sc[3] = {1, 1, 1};
+    if (translation) read(translation, i, 3, t);
+    if (rotation) read(rotation, i, 4, r);
+    if (scale) read(scale, i, 3, sc);
+    const glm::quat q = glm::normalize(glm::quat(r[3], r[0], r[1], r[2]));
+    transforms[i] = glm::translate(glm::mat4(1.0f), {t[0], t[1], t[2]}) *
+                    glm::mat4_cast(q) *
+                    glm::scale(glm::mat4(1.0f), {sc[0], sc[1], sc[2]});
   }
+  return transforms;
 }
 
 GLint toGLWrap(int wrap) {
@@ -170,69 +441,92 @@ GLint toGLMagFilter(int f) {
   }
 }
 
-GLuint createTextureFromImage(const tinygltf::Image& img,
-                              const tinygltf::Sampler* samplerOrNull,
-                              bool srgbForBaseColor) {
-  if (img.image.empty() || img.width <= 0 || img.height <= 0)
-    throw std::runtime_error("Empty glTF image");
+// Encoded image bytes captured by the tinygltf image-loader hook; pixels
+// are decoded later, and only for images a used material references.
+struct EncodedImages {
+  std::vector<std::vector<unsigned char>> bytes;
+  // Images embedded in a mapped BIN chunk, read in place instead.
+  std::vector<ByteSpan> mapped;
+
+  ByteSpan get(std::size_t index) const {
+    if (index < mapped.size() && mapped[index].data) return mapped[index];
+    if (index < bytes.size()) return {bytes[index].data(), bytes[index].size()};
+    return {};
+  }
+};
+
+bool captureEncodedImage(tinygltf::Image* image, const int imageIndex,
+                         std::string* err, std::string* /*warn*/,
+                         int /*reqWidth*/, int /*reqHeight*/,
+                         const unsigned char* bytes, int size,
+                         void* userData) {
+  if (imageIndex < 0 || size <= 0) {
+    if (err) *err += "Empty image data for image " + image->name + "\n";
+    return false;
+  }
+  auto& encoded = static_cast<EncodedImages*>(userData)->bytes;
+  if (encoded.size() <= static_cast<size_t>(imageIndex))
+    encoded.resize(static_cast<size_t>(imageIndex) + 1);
+  encoded[static_cast<size_t>(imageIndex)].assign(bytes, bytes + size);
+  return true;
+}
 
-  GLenum format = GL_RGBA;
-  if (img.component == 1)
-    format = GL_RED;
-  else if (img.component == 2)
-    format = GL_RG;
-  else if (img.component == 3)
-    format = GL_RGB;
-  else if (img.component == 4)
-    format = GL_RGBA;
-  else
-    throw std::runtime_error("Unsupported image component count");
-
-  GLenum internalFormat = GL_RGBA8;
-  if (srgbForBaseColor) {
-    if (format == GL_RGB)
-      internalFormat = GL_SRGB8;
-    else if (format == GL_RGBA)
-      internalFormat = GL_SRGB8_ALPHA8;
-    else
-      internalFormat = GL_RGBA8;
+struct ImageRequest {
+  int imageIndex = -1;
+  // KHR_texture_basisu: the texture's plain `source`, decoded instead when
+  // the KTX2 image cannot be. Without one the texture is dropped.
+  int fallbackIndex = -1;
+  bool basisu = false;
+  const tinygltf::Sampler* sampler = nullptr;
+  bool srgb = false;
+};
+
+// KTX2 containers (KHR_texture_basisu) keep their stored levels and block
+// format, Basis Universal payloads being transcoded to `basisuTarget`;
+// anything else goes through stb.
+utils::TextureImage decodeImage(ByteSpan bytes, int imageIndex,
+                                const ImageRequest& request,
+                                utils::TextureCompression basisuTarget) {
+  utils::TextureImage out;
+  if (utils::isKtx2(bytes.data, bytes.size)) {
+    out = utils::decodeKtx2(bytes.data, bytes.size, basisuTarget);
   } else {
-    if (format == GL_RGB)
-      internalFormat = GL_RGB8;
-    else if (format == GL_RGBA)
-      internalFormat = GL_RGBA8;
+    int w = 0, h = 0, comp = 0;
+    // Always expand to RGBA, matching tinygltf's default loader.
+    stbi_uc* pixels =
+        stbi_load_from_memory(bytes.data, static_cast<int>(bytes.size), &w,
+                              &h, &comp, STBI_rgb_alpha);
+    if (!pixels || w <= 0 || h <= 0) {
+      if (pixels) stbi_image_free(pixels);
+      throw std::runtime_error("Failed to decode glTF image " +
+                               std::to_string(imageIndex) + ": " +
+                               (stbi_failure_reason() ? stbi_failure_reason()
+                                                      : "unknown error"));
+    }
+    out.width = w;
+    out.height = h;
+    out.components = 4;
+    const size_t size = static_cast<size_t>(w) * static_cast<size_t>(h) * 4;
+    out.levels.emplace_back(pixels, pixels + size);
+    stbi_image_free(pixels);
   }
 
-  GLuint tex = 0;
-  glGenTextures(1, &tex);
-  glBindTexture(GL_TEXTURE_2D, tex);
-
-  GLint wrapS = GL_REPEAT, wrapT = GL_REPEAT;
-  GLint minF = GL_LINEAR_MIPMAP_LINEAR, magF = GL_LINEAR;
-  if (samplerOrNull) {
-    wrapS = toGLWrap(samplerOrNull->wrapS);
-    wrapT = toGLWrap(samplerOrNull->wrapT);
-    minF = toGLMinFilter(samplerOrNull->minFilter);
-    magF = toGLMagFilter(samplerOrNull->magFilter);
+  out.srgb = request.srgb;
+  if (request.sampler) {
+    out.wrapS = toGLWrap(request.sampler->wrapS);
+    out.wrapT = toGLWrap(request.sampler->wrapT);
+    out.minFilter = toGLMinFilter(request.sampler->minFilter);
+    out.magFilter = toGLMagFilter(request.sampler->magFilter);
   }
-
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, wrapS);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, wrapT);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, minF);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, magF);
-
-  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-  glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, img.width, img.height, 0,
-               format, GL_UNSIGNED_BYTE, img.image.data());
-
-  glGenerateMipmap(GL_TEXTURE_2D);
-  glBindTexture(GL_TEXTURE_2D, 0);
-  return tex;
+  return out;
 }
 
-utils::MaterialGL readMaterialAndCreateGL(
-    const tinygltf::Model& model, int materialIndex,
-    std::unordered_map<int, GLuint>& imageTexCache) {
+// Reads material factors and, when withTexture is set, assigns an image slot
+// to its base color texture. The pixels are decoded by decodeImages().
+utils::MaterialGL readMaterial(const tinygltf::Model& model, int materialIndex,
+                               bool withTexture,
+                               std::unordered_map<int, int>& imageSlots,
+                               std::vector<ImageRequest>& requests) {
   utils::MaterialGL out{};
 
   if (materialIndex < 0 ||
@@ -241,6 +535,7 @@ utils::MaterialGL readMaterialAndCreateGL(
 
   const auto& mat = model.materials[static_cast<size_t>(materialIndex)];
   const auto& pbr = mat.pbrMetallicRoughness;
+  out.doubleSided = mat.doubleSided;
 
   if (pbr.baseColorFactor.size() == 4) {
     out.baseColorFactor =
@@ -253,41 +548,125 @@ utils::MaterialGL readMaterialAndCreateGL(
               << out.baseColorFactor.a << std::endl;
   }
   const int texIndex = pbr.baseColorTexture.index;
-  if (texIndex < 0 || texIndex >= static_cast<int>(model.textures.size()))
+  if (!withTexture || texIndex < 0 ||
+      texIndex >= static_cast<int>(model.textures.size()))
     return out;
 
   const auto& tex = model.textures[static_cast<size_t>(texIndex)];
-  const int imageIndex = tex.source;
-  if (imageIndex < 0 || imageIndex >= static_cast<int>(model.images.size()))
-    return out;
+  const int imageCount = static_cast<int>(model.images.size());
+  int imageIndex = tex.source;
+  int fallbackIndex = -1;
+  bool ktx2Source = false;
+  const auto basisu = tex.extensions.find("KHR_texture_basisu");
+  if (basisu != tex.extensions.end() && basisu->second.Has("source")) {
+    const int ktx2 = basisu->second.Get("source").GetNumberAsInt();
+    if (ktx2 >= 0 && ktx2 < imageCount) {
+      if (imageIndex >= 0 && imageIndex < imageCount)
+        fallbackIndex = imageIndex;
+      imageIndex = ktx2;
+      ktx2Source = true;
+    }
+  }
+  if (imageIndex < 0 || imageIndex >= imageCount) return out;
 
-  if (auto it = imageTexCache.find(imageIndex); it != imageTexCache.end()) {
-    out.baseColorTex = it->second;
-    out.hasBaseColorTex = (out.baseColorTex != 0);
+  if (auto it = imageSlots.find(imageIndex); it != imageSlots.end()) {
+    out.baseColorImage = it->second;
     return out;
   }
 
-  const tinygltf::Sampler* samplerPtr = nullptr;
+  ImageRequest request;
+  request.imageIndex = imageIndex;
+  request.fallbackIndex = fallbackIndex;
+  request.basisu = ktx2Source;
+  request.srgb = true;
   if (tex.sampler >= 0 && tex.sampler < static_cast<int>(model.samplers.size()))
-    samplerPtr = &model.samplers[static_cast<size_t>(tex.sampler)];
+    request.sampler = &model.samplers[static_cast<size_t>(tex.sampler)];
 
-  const auto& img = model.images[static_cast<size_t>(imageIndex)];
-  out.baseColorTex =
-      createTextureFromImage(img, samplerPtr, /*srgbForBaseColor=*/true);
-  out.hasBaseColorTex = (out.baseColorTex != 0);
+  out.baseColorImage = static_cast<int>(requests.size());
+  requests.push_back(request);
 
-  imageTexCache[imageIndex] = out.baseColorTex;
+  imageSlots[imageIndex] = out.baseColorImage;
   return out;
 }
 
-void appendPrimitive(const tinygltf::Model& model,
-                     const tinygltf::Primitive& prim, const glm::mat4& world,
-                     utils::ModelData& out, utils::Submesh& outSubmesh,
-                     bool& normalsMissing) {
-  if (prim.mode != TINYGLTF_MODE_TRIANGLES) return;
+struct PrimitiveJob {
+  const tinygltf::Primitive* prim = nullptr;
+  glm::mat4 world{1.0f};
+  std::uint32_t baseVertex = 0;
+  std::uint32_t vertexCount = 0;
+  std::uint32_t indexOffset = 0;
+  std::uint32_t indexCount = 0;
+  std::uint32_t instanceOffset = 0;
+  std::uint32_t instanceCount = 0;
+  bool normalsMissing = false;
+  // `world` mirrors: triangles are rewound to stay counter-clockwise.
+  bool mirrored = false;
+};
+
+struct DecodeChunk {
+  std::size_t job = 0;
+  bool indices = false;
+  std::uint32_t begin = 0;
+  std::uint32_t end = 0;
+};
+
+constexpr std::uint32_t kDecodeChunkSize = 1u << 16;
+
+// World transforms every glTF mesh is drawn with, meshes in first-use order.
+struct MeshInstances {
+  std::vector<int> order;
+  std::vector<std::vector<glm::mat4>> transforms;  // by mesh index
+};
+
+// Baked mode (instances == nullptr): one job per primitive and instance, with
+// the world transform applied while decoding. Instanced mode: only records
+// the transforms; the primitives are added once per mesh afterwards.
+void collectPrimitives(const tinygltf::Model& model,
+                       const GltfBuffers& buffers, int nodeIndex,
+                       const glm::mat4& parent,
+                       std::vector<PrimitiveJob>& jobs,
+                       MeshInstances* instances) {
+  const auto& node = model.nodes[static_cast<size_t>(nodeIndex)];
+  const glm::mat4 world = parent * nodeLocalMatrix(node);
+
+  if (node.mesh >= 0 && node.mesh < static_cast<int>(model.meshes.size())) {
+    std::vector<glm::mat4> transforms =
+        gpuInstanceTransforms(model, buffers, node);
+    if (transforms.empty()) transforms.push_back(glm::mat4(1.0f));
+    for (glm::mat4& t : transforms) t = world * t;
+
+    if (instances) {
+      auto& meshTransforms =
+          instances->transforms[static_cast<size_t>(node.mesh)];
+      if (meshTransforms.empty()) instances->order.push_back(node.mesh);
+      meshTransforms.insert(meshTransforms.end(), transforms.begin(),
+                            transforms.end());
+    } else {
+      const auto& mesh = model.meshes[static_cast<size_t>(node.mesh)];
+      for (const glm::mat4& t : transforms) {
+        for (const auto& prim : mesh.primitives) {
+          PrimitiveJob job;
+          job.prim = &prim;
+          job.world = t;
+          job.mirrored = glm::determinant(glm::mat3(t)) < 0.0f;
+          jobs.push_back(job);
+        }
+      }
+    }
+  }
+
+  for (int child : node.children)
+    collectPrimitives(model, buffers, child, world, jobs, instances);
+}
+
+// Validates the primitive and fills in its vertex/index counts. Returns false
+// for primitives the loader skips (non-triangle or without POSITION).
+bool sizePrimitive(const tinygltf::Model& model, PrimitiveJob& job) {
+  const tinygltf::Primitive& prim = *job.prim;
+  if (prim.mode != TINYGLTF_MODE_TRIANGLES) return false;
 
   const auto itPos = prim.attributes.find("POSITION");
-  if (itPos == prim.attributes.end()) return;
+  if (itPos == prim.attributes.end()) return false;
 
   const tinygltf::Accessor& accPos =
       model.accessors[static_cast<size_t>(itPos->second)];
@@ -297,171 +676,1341 @@ void appendPrimitive(const tinygltf::Model& model,
   if (itNor != prim.attributes.end())
     accNor = &model.accessors[static_cast<size_t>(itNor->second)];
   else
-    normalsMissing = true;
+    job.normalsMissing = true;
 
   const tinygltf::Accessor* accUV = nullptr;
   const auto itUV = prim.attributes.find("TEXCOORD_0");
   if (itUV != prim.attributes.end())
     accUV = &model.accessors[static_cast<size_t>(itUV->second)];
 
-  if (accPos.componentType != TINYGLTF_COMPONENT_TYPE_FLOAT ||
-      accPos.type != TINYGLTF_TYPE_VEC3)
-    throw std::runtime_error("POSITION must be FLOAT VEC3");
-  if (accNor && !(accNor->componentType == TINYGLTF_COMPONENT_TYPE_FLOAT &&
-                  accNor->type == TINYGLTF_TYPE_VEC3))
-    throw std::runtime_error("NORMAL must be FLOAT VEC3");
-  if (accUV && !(accUV->componentType == TINYGLTF_COMPONENT_TYPE_FLOAT &&
-                 accUV->type == TINYGLTF_TYPE_VEC2))
-    throw std::runtime_error("TEXCOORD_0 must be FLOAT VEC2 (minimal)");
-
-  const std::byte* posBase = accBasePtr(model, accPos);
+  // Float, or the integer types KHR_mesh_quantization allows.
+  const auto floatOrInteger = [](const tinygltf::Accessor& acc) {
+    return acc.componentType == TINYGLTF_COMPONENT_TYPE_FLOAT ||
+           isInteger8or16(acc.componentType);
+  };
+  if (accPos.type != TINYGLTF_TYPE_VEC3 || !floatOrInteger(accPos))
+    throw std::runtime_error("POSITION must be a float or 8/16-bit VEC3");
+  if (accNor &&
+      !(accNor->type == TINYGLTF_TYPE_VEC3 &&
+        (accNor->componentType == TINYGLTF_COMPONENT_TYPE_FLOAT ||
+         (accNor->normalized &&
+          (accNor->componentType == TINYGLTF_COMPONENT_TYPE_BYTE ||
+           accNor->componentType == TINYGLTF_COMPONENT_TYPE_SHORT)))))
+    throw std::runtime_error(
+        "NORMAL must be FLOAT or normalized BYTE/SHORT VEC3");
+  if (accUV && (accUV->type != TINYGLTF_TYPE_VEC2 || !floatOrInteger(*accUV)))
+    throw std::runtime_error("TEXCOORD_0 must be a float or 8/16-bit VEC2");
+
+  job.vertexCount = static_cast<std::uint32_t>(accPos.count);
+
+  if (prim.indices < 0) {
+    job.indexCount = job.vertexCount;
+    return true;
+  }
+
+  const tinygltf::Accessor& accIdx =
+      model.accessors[static_cast<size_t>(prim.indices)];
+  if (accIdx.type != TINYGLTF_TYPE_SCALAR)
+    throw std::runtime_error("Indices accessor must be SCALAR");
+  if (accIdx.componentType != TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE &&
+      accIdx.componentType != TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT &&
+      accIdx.componentType != TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT)
+    throw std::runtime_error("Unsupported index componentType");
+
+  job.indexCount = static_cast<std::uint32_t>(accIdx.count);
+  return true;
+}
+
+void decodeVertices(const tinygltf::Model& model, const GltfBuffers& buffers,
+                    const PrimitiveJob& job,
+                    std::uint32_t begin, std::uint32_t end,
+                    utils::VertexPU* dst) {
+  const tinygltf::Primitive& prim = *job.prim;
+  const tinygltf::Accessor& accPos =
+      model.accessors[static_cast<size_t>(prim.attributes.at("POSITION"))];
+
+  const tinygltf::Accessor* accNor = nullptr;
+  if (auto it = prim.attributes.find("NORMAL"); it != prim.attributes.end())
+    accNor = &model.accessors[static_cast<size_t>(it->second)];
+
+  const tinygltf::Accessor* accUV = nullptr;
+  if (auto it = prim.attributes.find("TEXCOORD_0"); it != prim.attributes.end())
+    accUV = &model.accessors[static_cast<size_t>(it->second)];
+
+  const std::byte* posBase = accBasePtr(model, buffers, accPos);
   const size_t posStride = accStride(model, accPos);
 
   const std::byte* norBase = nullptr;
   size_t norStride = 0;
   if (accNor) {
-    norBase = accBasePtr(model, *accNor);
+    norBase = accBasePtr(model, buffers, *accNor);
     norStride = accStride(model, *accNor);
   }
 
   const std::byte* uvBase = nullptr;
   size_t uvStride = 0;
   if (accUV) {
-    uvBase = accBasePtr(model, *accUV);
+    uvBase = accBasePtr(model, buffers, *accUV);
     uvStride = accStride(model, *accUV);
   }
 
-  const std::uint32_t baseVertex =
-      static_cast<std::uint32_t>(out.vertices.size());
-  out.vertices.resize(out.vertices.size() + accPos.count);
-
+  const glm::mat4& world = job.world;
   const glm::mat3 normalMat = glm::mat3(glm::transpose(glm::inverse(world)));
 
-  for (size_t i = 0; i < accPos.count; ++i) {
-    glm::vec3 P = readVec3f(posBase, posStride, i);
+  // Float streams (the common case) go through the SIMD kernels.
+  auto isFloat = [](const tinygltf::Accessor* acc) {
+    return !acc || acc->componentType == TINYGLTF_COMPONENT_TYPE_FLOAT;
+  };
+  if (isFloat(&accPos) && isFloat(accNor) && isFloat(accUV)) {
+    utils::VertexStreams streams;
+    streams.positions = posBase + posStride * begin;
+    streams.positionStride = posStride;
+    if (norBase) {
+      streams.normals = norBase + norStride * begin;
+      streams.normalStride = norStride;
+    }
+    if (uvBase) {
+      streams.uvs = uvBase + uvStride * begin;
+      streams.uvStride = uvStride;
+    }
+    utils::transformVertices(streams, end - begin, world, normalMat,
+                             dst + job.baseVertex + begin);
+    return;
+  }
+
+  for (size_t i = begin; i < end; ++i) {
+    glm::vec3 P = readVec3(posBase, posStride, i, accPos);
     glm::vec3 Pw = glm::vec3(world * glm::vec4(P, 1.0f));
 
     glm::vec3 N(0, 1, 0);
     if (norBase) {
-      glm::vec3 n = readVec3f(norBase, norStride, i);
+      glm::vec3 n = readVec3(norBase, norStride, i, *accNor);
       N = glm::normalize(normalMat * n);
     }
 
     glm::vec2 UV(0.0f);
-    if (uvBase) UV = readVec2f(uvBase, uvStride, i);
+    if (uvBase) UV = readVec2(uvBase, uvStride, i, *accUV);
 
-    out.vertices[baseVertex + static_cast<std::uint32_t>(i)] = {Pw, UV, N};
+    dst[job.baseVertex + i] = {Pw, UV, N};
   }
-  outSubmesh.indexOffset = static_cast<std::uint32_t>(out.indices.size());
-  outSubmesh.materialIndex = prim.material;
+}
 
-  if (prim.indices < 0) {
-    out.indices.reserve(out.indices.size() + accPos.count);
-    for (std::uint32_t i = 0; i < static_cast<std::uint32_t>(accPos.count); ++i)
-      out.indices.push_back(baseVertex + i);
-    outSubmesh.indexCount = static_cast<std::uint32_t>(accPos.count);
+void decodeIndices(const tinygltf::Model& model, const GltfBuffers& buffers,
+                   const PrimitiveJob& job,
+                   std::uint32_t begin, std::uint32_t end,
+                   std::uint32_t* dst) {
+  // Index k's slot, swapping the last two corners of mirrored triangles.
+  auto slot = [&](std::uint32_t k) {
+    std::uint32_t to = k;
+    if (job.mirrored && k - k % 3 + 3 <= job.indexCount)
+      to = k % 3 == 1 ? k + 1 : k % 3 == 2 ? k - 1 : k;
+    return job.indexOffset + to;
+  };
+
+  if (job.prim->indices < 0) {
+    for (std::uint32_t i = begin; i < end; ++i)
+      dst[slot(i)] = job.baseVertex + i;
     return;
   }
 
   const tinygltf::Accessor& accIdx =
-      model.accessors[static_cast<size_t>(prim.indices)];
-  if (accIdx.type != TINYGLTF_TYPE_SCALAR)
-    throw std::runtime_error("Indices accessor must be SCALAR");
-
-  const std::byte* idxBase = accBasePtr(model, accIdx);
+      model.accessors[static_cast<size_t>(job.prim->indices)];
+  const std::byte* idxBase = accBasePtr(model, buffers, accIdx);
   const size_t idxStride = accStride(model, accIdx);
 
-  out.indices.reserve(out.indices.size() + accIdx.count);
-  for (size_t k = 0; k < accIdx.count; ++k) {
+  for (std::uint32_t k = begin; k < end; ++k) {
     std::uint32_t ix = readIndex(idxBase, idxStride, k, accIdx.componentType);
-    out.indices.push_back(baseVertex + ix);
+    if (ix >= job.vertexCount)
+      throw std::runtime_error("Index out of range of its primitive");
+    dst[slot(k)] = job.baseVertex + ix;
   }
-  outSubmesh.indexCount = static_cast<std::uint32_t>(accIdx.count);
 }
 
-void processNode(const tinygltf::Model& model, int nodeIndex,
-                 const glm::mat4& parent, utils::ModelData& out,
-                 bool& anyMissingNormals,
-                 const std::unordered_map<int, int>& materialRemap) {
-  const auto& node = model.nodes[static_cast<size_t>(nodeIndex)];
-  const glm::mat4 world = parent * nodeLocalMatrix(node);
+// KHR_mesh_quantization: true when any primitive stores POSITION, NORMAL or
+// TEXCOORD_0 as integers.
+bool hasQuantizedAttributes(const tinygltf::Model& model) {
+  for (const auto& mesh : model.meshes)
+    for (const auto& prim : mesh.primitives)
+      for (const char* name : {"POSITION", "NORMAL", "TEXCOORD_0"}) {
+        const auto it = prim.attributes.find(name);
+        if (it != prim.attributes.end() &&
+            model.accessors[static_cast<size_t>(it->second)].componentType !=
+                TINYGLTF_COMPONENT_TYPE_FLOAT)
+          return true;
+      }
+  return false;
+}
 
-  if (node.mesh >= 0) {
-    const auto& mesh = model.meshes[static_cast<size_t>(node.mesh)];
-    for (const auto& prim : mesh.primitives) {
-      utils::Submesh sm{};
-      bool normalsMissingThisPrim = false;
+struct CompactSlot {
+  const char* name;
+  utils::VertexAttribute utils::VertexLayout::*attribute;
+  int components;
+};
+
+constexpr CompactSlot kCompactSlots[] = {
+    {"POSITION", &utils::VertexLayout::position, 3},
+    {"TEXCOORD_0", &utils::VertexLayout::uv, 2},
+    {"NORMAL", &utils::VertexLayout::normal, 3}};
+
+// One record layout for every primitive, each attribute in the type its
+// accessors have in the file. Returns false when primitives disagree on an
+// attribute's type. Generated normals are stored as snorm8 when no primitive
+// has any.
+bool chooseCompactLayout(const tinygltf::Model& model,
+                         const std::vector<PrimitiveJob>& jobs,
+                         utils::VertexLayout& layout) {
+  utils::VertexLayout out;
+  for (const CompactSlot& slot : kCompactSlots) {
+    int type = -1;
+    bool normalized = false;
+    for (const auto& job : jobs) {
+      const auto it = job.prim->attributes.find(slot.name);
+      if (it == job.prim->attributes.end()) continue;
+      const auto& acc = model.accessors[static_cast<size_t>(it->second)];
+      if (type < 0) {
+        type = acc.componentType;
+        normalized = acc.normalized;
+      } else if (type != acc.componentType || normalized != acc.normalized) {
+        LOG_WARN("DecodeGLB - primitives store "
+                 << slot.name << " in different types; decoding to float");
+        return false;
+      }
+    }
+    if (type < 0) {
+      if (slot.attribute != &utils::VertexLayout::normal) continue;
+      type = TINYGLTF_COMPONENT_TYPE_BYTE;
+      normalized = true;
+    }
+    utils::VertexAttribute& attribute = out.*slot.attribute;
+    // glTF component types are the GL enums of the same name.
+    attribute.type = static_cast<GLenum>(type);
+    attribute.components = slot.components;
+    attribute.normalized = normalized ? GL_TRUE : GL_FALSE;
+    attribute.offset = out.stride;
+    // Every attribute starts 4-byte aligned, as glTF requires of its own.
+    const auto size = static_cast<std::uint32_t>(
+        slot.components * tinygltf::GetComponentSizeInBytes(type));
+    out.stride += (size + 3) & ~3u;
+  }
+  layout = out;
+  return true;
+}
 
-      appendPrimitive(model, prim, world, out, sm, normalsMissingThisPrim);
+// Copies each vertex's attributes byte for byte into its compact record;
+// attributes the primitive lacks stay zero.
+void decodeCompactVertices(const tinygltf::Model& model,
+                           const GltfBuffers& buffers,
+                           const PrimitiveJob& job,
+                           const utils::VertexLayout& layout,
+                           std::uint32_t begin, std::uint32_t end,
+                           unsigned char* dst) {
+  for (const CompactSlot& slot : kCompactSlots) {
+    const utils::VertexAttribute& attribute = layout.*slot.attribute;
+    const auto it = job.prim->attributes.find(slot.name);
+    if (attribute.components == 0 || it == job.prim->attributes.end())
+      continue;
+    const auto& acc = model.accessors[static_cast<size_t>(it->second)];
+    const std::byte* base = accBasePtr(model, buffers, acc);
+    const size_t stride = accStride(model, acc);
+    const size_t size = static_cast<size_t>(
+        slot.components * tinygltf::GetComponentSizeInBytes(acc.componentType));
+    for (size_t i = begin; i < end; ++i)
+      std::memcpy(dst + (job.baseVertex + i) * layout.stride + attribute.offset,
+                  base + stride * i, size);
+  }
+}
 
-      if (sm.indexCount > 0) {
-        if (sm.materialIndex >= 0) {
-          if (auto it = materialRemap.find(sm.materialIndex);
-              it != materialRemap.end())
-            sm.materialIndex = it->second;
-        }
-        out.submeshes.push_back(sm);
+// Normals for compact records: positions come from the source accessor (in
+// the mesh's quantized space) and the normals are written in the layout's
+// normal type.
+void computeCompactNormals(const tinygltf::Model& model,
+                           const GltfBuffers& buffers,
+                           const PrimitiveJob& job,
+                           const utils::VertexLayout& layout,
+                           const std::vector<std::uint32_t>& idx,
+                           const utils::NormalOptions& options,
+                           utils::ThreadPool* pool, unsigned char* records) {
+  const tinygltf::Accessor& accPos =
+      model.accessors[static_cast<size_t>(job.prim->attributes.at("POSITION"))];
+  const std::byte* posBase = accBasePtr(model, buffers, accPos);
+  const size_t posStride = accStride(model, accPos);
 
-        if (normalsMissingThisPrim) {
-          anyMissingNormals = true;
-          computeNormalsRange(out.vertices, out.indices, sm.indexOffset,
-                              sm.indexCount);
-        }
+  std::vector<glm::vec3> positions(job.vertexCount);
+  for (std::uint32_t v = 0; v < job.vertexCount; ++v)
+    positions[v] = readVec3(posBase, posStride, v, accPos);
+  std::vector<glm::vec3> normals(job.vertexCount);
+  utils::NormalInput input;
+  input.positions = reinterpret_cast<const std::byte*>(positions.data());
+  input.positionStride = sizeof(glm::vec3);
+  input.vertexCount = job.vertexCount;
+  input.indices = idx.data() + job.indexOffset;
+  input.indexCount = job.indexCount;
+  input.indexBase = job.baseVertex;
+  utils::generateNormals(input, reinterpret_cast<std::byte*>(normals.data()),
+                         sizeof(glm::vec3), options, pool);
+
+  const utils::VertexAttribute& attribute = layout.normal;
+  for (std::uint32_t v = 0; v < job.vertexCount; ++v) {
+    const glm::vec3& n = normals[v];
+    unsigned char* dst =
+        records + (job.baseVertex + v) * std::size_t{layout.stride} +
+        attribute.offset;
+    for (int c = 0; c < 3; ++c) {
+      if (attribute.type == GL_BYTE) {
+        const auto q = static_cast<std::int8_t>(std::lround(n[c] * 127.0f));
+        std::memcpy(dst + c, &q, sizeof(q));
+      } else if (attribute.type == GL_SHORT) {
+        const auto q = static_cast<std::int16_t>(std::lround(n[c] * 32767.0f));
+        std::memcpy(dst + c * sizeof(q), &q, sizeof(q));
+      } else {
+        std::memcpy(dst + c * sizeof(float), &n[c], sizeof(float));
       }
     }
   }
+}
 
-  for (int child : node.children)
-    processNode(model, child, world, out, anyMissingNormals, materialRemap);
+// Decodes the requested images into out.images. A KHR_texture_basisu image
+// that fails without a plain fallback is dropped, and the materials that
+// used it lose their texture, rather than failing the load.
+void decodeImages(const EncodedImages& encoded,
+                  const std::vector<ImageRequest>& requests,
+                  utils::TextureCompression basisuTarget,
+                  utils::ThreadPool* pool, utils::ModelData& out) {
+  out.images.resize(requests.size());
+  std::vector<double> timings(requests.size(), 0.0);
+  // Why a request fell back to its plain image (KHR_texture_basisu), or
+  // was dropped.
+  std::vector<std::string> fallbacks(requests.size());
+  std::vector<char> dropped(requests.size(), 0);
+
+  auto decodeIndex = [&](int imageIndex, const ImageRequest& request) {
+    const ByteSpan bytes = encoded.get(static_cast<size_t>(imageIndex));
+    if (bytes.size == 0)
+      throw std::runtime_error("Missing data for glTF image " +
+                               std::to_string(imageIndex));
+    return decodeImage(bytes, imageIndex, request, basisuTarget);
+  };
+
+  utils::parallelFor(pool, requests.size(), [&](std::size_t i) {
+    const ImageRequest& request = requests[i];
+    const auto t0 = std::chrono::steady_clock::now();
+    try {
+      out.images[i] = decodeIndex(request.imageIndex, request);
+    } catch (const std::runtime_error& e) {
+      if (!request.basisu) throw;
+      fallbacks[i] = e.what();
+      if (request.fallbackIndex >= 0)
+        out.images[i] = decodeIndex(request.fallbackIndex, request);
+      else
+        dropped[i] = 1;
+    }
+    timings[i] = std::chrono::duration<double, std::milli>(
+                     std::chrono::steady_clock::now() - t0)
+                     .count();
+  });
+
+  std::vector<int> remap(requests.size(), -1);
+  std::size_t kept = 0;
+  for (std::size_t i = 0; i < requests.size(); ++i) {
+    if (dropped[i]) {
+      LOG_WARN("DecodeGLB - image " << requests[i].imageIndex << ": "
+                                    << fallbacks[i]
+                                    << "; no fallback, texture dropped");
+      continue;
+    }
+    remap[i] = static_cast<int>(kept);
+    const auto& img = out.images[i];
+    const int index = fallbacks[i].empty() ? requests[i].imageIndex
+                                           : requests[i].fallbackIndex;
+    if (!fallbacks[i].empty())
+      LOG_WARN("DecodeGLB - image " << requests[i].imageIndex << ": "
+                                    << fallbacks[i] << "; using image "
+                                    << index << " instead");
+    LOG_INFO("DecodeGLB - image "
+             << index << " (" << img.width << "x" << img.height << " "
+             << utils::textureFormatName(img) << ", "
+             << img.levelCount() << " levels, "
+             << encoded.get(static_cast<size_t>(index)).size
+             << " bytes encoded): " << timings[i] << " ms");
+    if (kept != i) out.images[kept] = std::move(out.images[i]);
+    ++kept;
+  }
+  if (kept == requests.size()) return;
+  out.images.resize(kept);
+  for (utils::MaterialGL& mat : out.materials)
+    if (mat.baseColorImage >= 0)
+      mat.baseColorImage = remap[static_cast<size_t>(mat.baseColorImage)];
+}
+
+// EXT_meshopt_compression: a compressed bufferView names its encoded bytes
+// in the extension and keeps buffer/byteOffset/byteLength for the decoded
+// data, normally in a uri-less "fallback" buffer that has no bytes in the
+// file at all.
+
+constexpr char kMeshoptExtension[] = "EXT_meshopt_compression";
+
+std::uint32_t readU32(const unsigned char* p) {
+  std::uint32_t v = 0;
+  std::memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+void appendU32(std::vector<unsigned char>& out, std::uint32_t v) {
+  const auto* p = reinterpret_cast<const unsigned char*>(&v);
+  out.insert(out.end(), p, p + sizeof(v));
+}
+
+constexpr std::uint32_t kJsonChunk = 0x4E4F534A;
+constexpr std::uint32_t kBinChunk = 0x004E4942;
+
+bool isGlb(const unsigned char* bytes, std::size_t size) {
+  return size >= 4 && std::memcmp(bytes, "glTF", 4) == 0;
+}
+
+// The JSON of a .gltf (the whole file) or of a GLB (its first chunk); empty
+// when the GLB header is malformed.
+std::string_view gltfJson(const unsigned char* bytes, std::size_t size) {
+  const char* text = reinterpret_cast<const char*>(bytes);
+  if (!isGlb(bytes, size)) return {text, size};
+  if (size < 20 || readU32(bytes + 16) != kJsonChunk ||
+      readU32(bytes + 12) > size - 20)
+    return {};
+  return {text + 20, readU32(bytes + 12)};
+}
+
+bool isMeshoptFallback(const nlohmann::json& buffer) {
+  const auto extensions = buffer.find("extensions");
+  if (extensions == buffer.end() || !extensions->is_object()) return false;
+  const auto meshopt = extensions->find(kMeshoptExtension);
+  return meshopt != extensions->end() && meshopt->is_object() &&
+         meshopt->value("fallback", false);
+}
+
+// tinygltf copies every buffer into Model::buffers while parsing: uri-less
+// GLB buffers out of the BIN chunk, external ones from their files. Instead
+// it parses JSON whose buffers are one-byte stand-ins (a 4-byte BIN stub or
+// a data URI) and `buffers` reads them in place: BIN from the mapped file,
+// external files mapped on first use. Geometry is then only copied once,
+// into ModelData, and buffers no decoded primitive uses are never opened.
+// tinygltf reads embedded images during the parse; they go through a
+// one-byte stand-in view until finishStubbedGltf points them back. Meshopt
+// fallback buffers have no bytes in the file (tinygltf would reject them):
+// they are shrunk too and decodeMeshoptViews sizes them.
+struct StubbedGltf {
+  std::vector<unsigned char> glb;  // GLB input: JSON + BIN stub
+  std::string json;                // .gltf input
+  std::vector<int> imageViews;     // by image index: bufferView, or -1
+  bool standInView = false;        // appended after the file's views
+};
+
+constexpr char kStubUri[] = "data:application/octet-stream;base64,AA==";
+
+// False when the file is parsed as is: nothing to defer, or malformed (for
+// tinygltf to report).
+bool stubGltf(const unsigned char* bytes, std::size_t size,
+              const std::string& baseDir, GltfBuffers& buffers,
+              StubbedGltf& out) {
+  const bool binary = isGlb(bytes, size);
+  const std::string_view json = gltfJson(bytes, size);
+  if (json.empty()) return false;
+  ByteSpan bin;
+  if (binary) {
+    const std::size_t binAt = 20 + json.size();
+    if (size - binAt >= 8 && readU32(bytes + binAt + 4) == kBinChunk &&
+        readU32(bytes + binAt) <= size - binAt - 8)
+      bin = {bytes + binAt + 8, readU32(bytes + binAt)};
+  }
+
+  auto doc = nlohmann::json::parse(json.begin(), json.end(), nullptr, false);
+  if (doc.is_discarded() || !doc.is_object()) return false;
+
+  bool changed = false;
+  int standInBuffer = -1;
+  if (const auto list = doc.find("buffers");
+      list != doc.end() && list->is_array()) {
+    buffers.reset(list->size());
+    for (std::size_t b = 0; b < list->size(); ++b) {
+      auto& buffer = (*list)[b];
+      if (!buffer.is_object()) return false;
+      const auto length = buffer.find("byteLength");
+      if (length == buffer.end() || !length->is_number_unsigned())
+        return false;
+      const auto byteLength = length->get<std::uint64_t>();
+      const auto uri = buffer.find("uri");
+      if (uri != buffer.end()) {
+        if (!uri->is_string()) return false;
+        if (tinygltf::IsDataURI(uri->get<std::string>())) continue;
+        std::string decoded;
+        if (!tinygltf::URIDecode(uri->get<std::string>(), &decoded, nullptr))
+          return false;
+        buffers.setLazy(b, baseDir + decoded,
+                        static_cast<std::size_t>(byteLength));
+        *uri = kStubUri;
+      } else if (!isMeshoptFallback(buffer)) {
+        if (!binary || !bin.data || byteLength > bin.size) return false;
+        buffers.setMapped(b, {bin.data, static_cast<std::size_t>(byteLength)});
+      }
+      *length = 1;
+      changed = true;
+      if (standInBuffer < 0 && buffers.deferred(b))
+        standInBuffer = static_cast<int>(b);
+    }
+  }
+  if (!changed) return false;
+
+  const auto views = doc.find("bufferViews");
+  const auto images = doc.find("images");
+  if (standInBuffer >= 0 && views != doc.end() && views->is_array() &&
+      images != doc.end() && images->is_array()) {
+    const std::size_t standIn = views->size();
+    out.imageViews.assign(images->size(), -1);
+    for (std::size_t i = 0; i < images->size(); ++i) {
+      auto& image = (*images)[i];
+      if (!image.is_object()) continue;
+      const auto view = image.find("bufferView");
+      if (view == image.end() || !view->is_number_unsigned() ||
+          view->get<std::size_t>() >= standIn)
+        continue;
+      const auto& bufferView = (*views)[view->get<std::size_t>()];
+      if (!bufferView.is_object()) continue;
+      const auto buffer = bufferView.find("buffer");
+      if (buffer == bufferView.end() || !buffer->is_number_unsigned() ||
+          !buffers.deferred(buffer->get<std::size_t>()))
+        continue;
+      out.imageViews[i] = view->get<int>();
+      *view = standIn;
+      out.standInView = true;
+    }
+    if (out.standInView)
+      views->push_back({{"buffer", standInBuffer}, {"byteLength", 1}});
+  }
+
+  std::string patched = doc.dump();
+  if (!binary) {
+    out.json = std::move(patched);
+    return true;
+  }
+  patched.resize((patched.size() + 3) & ~std::size_t(3), ' ');
+  constexpr std::uint32_t kStubSize = 4;
+  out.glb.reserve(28 + patched.size() + kStubSize);
+  out.glb.insert(out.glb.end(), bytes, bytes + 8);  // magic, version
+  appendU32(out.glb,
+            static_cast<std::uint32_t>(28 + patched.size() + kStubSize));
+  appendU32(out.glb, static_cast<std::uint32_t>(patched.size()));
+  appendU32(out.glb, kJsonChunk);
+  out.glb.insert(out.glb.end(), patched.begin(), patched.end());
+  appendU32(out.glb, kStubSize);
+  appendU32(out.glb, kBinChunk);
+  out.glb.insert(out.glb.end(), kStubSize, 0);
+  return true;
+}
+
+// Drops the stand-in view and reads embedded images from their buffers:
+// in place from the BIN chunk, copied out of lazy files so those can be
+// unmapped.
+void finishStubbedGltf(tinygltf::Model& model, const StubbedGltf& stub,
+                       GltfBuffers& buffers, EncodedImages& encoded) {
+  if (stub.standInView) model.bufferViews.pop_back();
+  buffers.attach(model);
+  encoded.mapped.resize(model.images.size());
+  for (std::size_t i = 0;
+       i < stub.imageViews.size() && i < model.images.size(); ++i) {
+    const int v = stub.imageViews[i];
+    if (v < 0) continue;
+    model.images[i].bufferView = v;
+    const auto& view = model.bufferViews[static_cast<size_t>(v)];
+    const auto b = static_cast<size_t>(view.buffer);
+    const ByteSpan buffer = buffers.bytes(b);
+    if (view.byteOffset > buffer.size ||
+        view.byteLength > buffer.size - view.byteOffset)
+      throw std::runtime_error("LoadGLB failed: image " + std::to_string(i) +
+                               " bufferView out of range");
+    const unsigned char* data = buffer.data + view.byteOffset;
+    if (i >= encoded.bytes.size()) encoded.bytes.resize(i + 1);
+    if (buffers.lazy(b))
+      encoded.bytes[i].assign(data, data + view.byteLength);
+    else
+      encoded.mapped[i] = {data, view.byteLength};
+  }
+  buffers.evictUnused();
+}
+
+// Buffers decoding a primitive reads.
+std::vector<std::size_t> primitiveBuffers(const tinygltf::Model& model,
+                                          const tinygltf::Primitive& prim) {
+  std::vector<std::size_t> out;
+  auto add = [&](int accessor) {
+    if (accessor < 0 ||
+        static_cast<size_t>(accessor) >= model.accessors.size())
+      return;
+    const int view = model.accessors[static_cast<size_t>(accessor)].bufferView;
+    if (view < 0 || static_cast<size_t>(view) >= model.bufferViews.size())
+      return;
+    const int buffer = model.bufferViews[static_cast<size_t>(view)].buffer;
+    if (buffer >= 0 &&
+        std::find(out.begin(), out.end(), static_cast<size_t>(buffer)) ==
+            out.end())
+      out.push_back(static_cast<size_t>(buffer));
+  };
+  for (const char* name : {"POSITION", "NORMAL", "TEXCOORD_0"})
+    if (const auto it = prim.attributes.find(name);
+        it != prim.attributes.end())
+      add(it->second);
+  add(prim.indices);
+  return out;
+}
+
+// tinygltf's file access (external buffers and images) goes through the
+// Vfs, so those resolve inside mounted paks as well.
+bool vfsFileExists(const std::string& path, void*) {
+  return utils::Vfs::instance().exists(path);
+}
+
+std::string vfsExpandFilePath(const std::string& path, void*) { return path; }
+
+bool vfsReadWholeFile(std::vector<unsigned char>* out, std::string* err,
+                      const std::string& path, void*) {
+  utils::VfsFile file;
+  if (!utils::Vfs::instance().tryOpen(path, file)) {
+    if (err) *err += "File not found: " + path + "\n";
+    return false;
+  }
+  out->assign(file.data(), file.data() + file.size());
+  return true;
+}
+
+bool vfsWriteWholeFile(std::string* err, const std::string& path,
+                       const std::vector<unsigned char>& contents, void*) {
+  return tinygltf::WriteWholeFile(err, path, contents, nullptr);
+}
+
+bool vfsFileSize(std::size_t* size, std::string* err, const std::string& path,
+                 void*) {
+  utils::VfsFile file;
+  if (!utils::Vfs::instance().tryOpen(path, file)) {
+    if (err) *err += "File not found: " + path + "\n";
+    return false;
+  }
+  *size = file.size();
+  return true;
+}
+
+struct MeshoptView {
+  const unsigned char* src = nullptr;
+  std::size_t srcSize = 0;
+  int buffer = -1;  // destination, at byteOffset
+  std::size_t byteOffset = 0;
+  std::size_t count = 0;
+  std::size_t stride = 0;
+  utils::MeshoptMode mode = utils::MeshoptMode::Attributes;
+  utils::MeshoptFilter filter = utils::MeshoptFilter::None;
+  int srcBuffer = -1;
+  std::size_t srcOffset = 0;
+};
+
+std::size_t extensionSize(const tinygltf::Value& ext, const char* key,
+                          bool required) {
+  const tinygltf::Value& v = ext.Get(key);
+  if (!v.IsNumber()) {
+    if (required)
+      throw std::runtime_error(std::string(kMeshoptExtension) +
+                               " bufferView without " + key);
+    return 0;
+  }
+  const double number = v.GetNumberAsDouble();
+  if (!(number >= 0.0))
+    throw std::runtime_error(std::string(kMeshoptExtension) + ": bad " + key);
+  return static_cast<std::size_t>(number);
+}
+
+MeshoptView readMeshoptView(const tinygltf::Model& model,
+                            const GltfBuffers& buffers,
+                            const tinygltf::BufferView& view,
+                            const tinygltf::Value& ext) {
+  MeshoptView out;
+  out.srcBuffer = static_cast<int>(extensionSize(ext, "buffer", true));
+  out.srcOffset = extensionSize(ext, "byteOffset", false);
+  out.srcSize = extensionSize(ext, "byteLength", true);
+  out.stride = extensionSize(ext, "byteStride", true);
+  out.count = extensionSize(ext, "count", true);
+
+  const tinygltf::Value& mode = ext.Get("mode");
+  const std::string modeName =
+      mode.IsString() ? mode.Get<std::string>() : std::string();
+  if (modeName == "ATTRIBUTES")
+    out.mode = utils::MeshoptMode::Attributes;
+  else if (modeName == "TRIANGLES")
+    out.mode = utils::MeshoptMode::Triangles;
+  else if (modeName == "INDICES")
+    out.mode = utils::MeshoptMode::Indices;
+  else
+    throw std::runtime_error(std::string(kMeshoptExtension) +
+                             ": unknown mode '" + modeName + "'");
+
+  const tinygltf::Value& filter = ext.Get("filter");
+  const std::string filterName =
+      filter.IsString() ? filter.Get<std::string>() : "NONE";
+  if (filterName == "NONE")
+    out.filter = utils::MeshoptFilter::None;
+  else if (filterName == "OCTAHEDRAL")
+    out.filter = utils::MeshoptFilter::Octahedral;
+  else if (filterName == "QUATERNION")
+    out.filter = utils::MeshoptFilter::Quaternion;
+  else if (filterName == "EXPONENTIAL")
+    out.filter = utils::MeshoptFilter::Exponential;
+  else
+    throw std::runtime_error(std::string(kMeshoptExtension) +
+                             ": unknown filter '" + filterName + "'");
+
+  if (out.srcBuffer >= static_cast<int>(model.buffers.size()) ||
+      view.buffer < 0 ||
+      view.buffer >= static_cast<int>(model.buffers.size()))
+    throw std::runtime_error(std::string(kMeshoptExtension) +
+                             ": buffer index out of range");
+  const ByteSpan src = buffers.bytes(static_cast<size_t>(out.srcBuffer));
+  if (out.srcOffset > src.size || out.srcSize > src.size - out.srcOffset)
+    throw std::runtime_error(std::string(kMeshoptExtension) +
+                             ": compressed range out of bounds");
+  if (out.stride == 0 || out.count > view.byteLength / out.stride)
+    throw std::runtime_error(std::string(kMeshoptExtension) +
+                             ": decoded data exceeds its bufferView");
+  out.buffer = view.buffer;
+  out.byteOffset = view.byteOffset;
+  return out;
+}
+
+// Decodes every compressed bufferView into its own buffer range, one view
+// per task, so accessors read plain data afterwards. A mapped buffer that
+// receives decoded data becomes tinygltf's buffer first, copied only if
+// something besides the decoded views reads it.
+void decodeMeshoptViews(tinygltf::Model& model, GltfBuffers& buffers,
+                        utils::ThreadPool* pool) {
+  std::vector<MeshoptView> views;
+  std::vector<std::size_t> required(model.buffers.size(), 0);
+  std::vector<char> preserve(model.buffers.size(), 0);
+  for (const auto& view : model.bufferViews) {
+    const auto ext = view.extensions.find(kMeshoptExtension);
+    if (ext == view.extensions.end()) {
+      if (view.buffer >= 0 &&
+          static_cast<size_t>(view.buffer) < preserve.size())
+        preserve[static_cast<size_t>(view.buffer)] = 1;
+      continue;
+    }
+    views.push_back(readMeshoptView(model, buffers, view, ext->second));
+    const auto& v = views.back();
+    auto& size = required[static_cast<size_t>(v.buffer)];
+    size = std::max(size, v.byteOffset + v.count * v.stride);
+    preserve[static_cast<size_t>(v.srcBuffer)] = 1;
+  }
+  if (views.empty()) return;
+
+  for (std::size_t b = 0; b < model.buffers.size(); ++b)
+    if (required[b] > 0)
+      buffers.writable(model, b, required[b], preserve[b] != 0);
+  // Resolve the sources only once no buffer moves any more; they stay
+  // mapped until the views are decoded.
+  std::size_t compressedBytes = 0, decodedBytes = 0;
+  for (auto& v : views) {
+    const auto b = static_cast<size_t>(v.srcBuffer);
+    buffers.expect(b);
+    v.src = buffers.bytes(b).data + v.srcOffset;
+    compressedBytes += v.srcSize;
+    decodedBytes += v.count * v.stride;
+  }
+
+  const auto t0 = std::chrono::steady_clock::now();
+  utils::parallelFor(pool, views.size(), [&](std::size_t i) {
+    const auto& v = views[i];
+    unsigned char* dst =
+        model.buffers[static_cast<size_t>(v.buffer)].data.data() +
+        v.byteOffset;
+    utils::decodeMeshoptBuffer(v.mode, v.filter, dst, v.count, v.stride,
+                               v.src, v.srcSize);
+  });
+  for (const auto& v : views) buffers.done(static_cast<size_t>(v.srcBuffer));
+  const double ms = std::chrono::duration<double, std::milli>(
+                        std::chrono::steady_clock::now() - t0)
+                        .count();
+  LOG_INFO("DecodeGLB - " << kMeshoptExtension << ": " << views.size()
+                          << " bufferViews, " << compressedBytes << " -> "
+                          << decodedBytes << " bytes: " << ms << " ms ("
+                          << decodedBytes / 1.0e3 / std::max(ms, 1e-3)
+                          << " MB/s)");
+}
+
+// With `compact`, vertices go to ModelData::compactVertices when the
+// primitives agree on one layout, and to ModelData::vertices otherwise.
+void decodeScene(const tinygltf::Model& model, GltfBuffers& buffers,
+                 std::vector<PrimitiveJob> jobs, utils::ThreadPool* pool,
+                 unsigned threadCount, bool compact,
+                 const utils::NormalOptions& normalOptions,
+                 utils::ModelData& out,
+                 const std::unordered_map<int, int>& materialRemap) {
+  // Sizing pass: exact offsets for every primitive, so decoding can write
+  // straight into preallocated slices in any order.
+  std::size_t vertexTotal = 0, indexTotal = 0;
+  std::vector<PrimitiveJob> sized;
+  sized.reserve(jobs.size());
+  for (auto& job : jobs) {
+    if (!sizePrimitive(model, job)) continue;
+    job.baseVertex = static_cast<std::uint32_t>(vertexTotal);
+    job.indexOffset = static_cast<std::uint32_t>(indexTotal);
+    vertexTotal += job.vertexCount;
+    indexTotal += job.indexCount;
+    sized.push_back(job);
+  }
+  if (vertexTotal > UINT32_MAX || indexTotal > UINT32_MAX)
+    throw std::runtime_error("Model exceeds 32-bit vertex/index range");
+
+  const bool packed =
+      compact && chooseCompactLayout(model, sized, out.compactLayout);
+  if (packed)
+    out.compactVertices.resize(vertexTotal * out.compactLayout.stride);
+  else
+    out.vertices.resize(vertexTotal);
+  out.indices.resize(indexTotal);
+
+  std::vector<DecodeChunk> chunks;
+  for (std::size_t j = 0; j < sized.size(); ++j) {
+    for (std::uint32_t b = 0; b < sized[j].vertexCount; b += kDecodeChunkSize)
+      chunks.push_back(
+          {j, false, b, std::min(sized[j].vertexCount, b + kDecodeChunkSize)});
+    for (std::uint32_t b = 0; b < sized[j].indexCount; b += kDecodeChunkSize)
+      chunks.push_back(
+          {j, true, b, std::min(sized[j].indexCount, b + kDecodeChunkSize)});
+  }
+
+  std::vector<std::size_t> normalJobs;
+  for (std::size_t j = 0; j < sized.size(); ++j)
+    if (sized[j].normalsMissing && sized[j].indexCount > 0)
+      normalJobs.push_back(j);
+
+  // Every chunk (and compact normal job) holds its primitive's buffers; a
+  // lazy buffer is unmapped as soon as the last one is done with it.
+  std::vector<std::vector<std::size_t>> jobBuffers(sized.size());
+  for (std::size_t j = 0; j < sized.size(); ++j)
+    jobBuffers[j] = primitiveBuffers(model, *sized[j].prim);
+  auto expectJob = [&](std::size_t j) {
+    for (std::size_t b : jobBuffers[j]) buffers.expect(b);
+  };
+  auto finishJob = [&](std::size_t j) {
+    for (std::size_t b : jobBuffers[j]) buffers.done(b);
+  };
+  for (const DecodeChunk& chunk : chunks) expectJob(chunk.job);
+  if (packed)
+    for (std::size_t j : normalJobs) expectJob(j);
+
+  auto decodeChunk = [&](std::size_t c) {
+    const DecodeChunk& chunk = chunks[c];
+    const PrimitiveJob& job = sized[chunk.job];
+    if (chunk.indices)
+      decodeIndices(model, buffers, job, chunk.begin, chunk.end,
+                    out.indices.data());
+    else if (packed)
+      decodeCompactVertices(model, buffers, job, out.compactLayout,
+                            chunk.begin, chunk.end, out.compactVertices.data());
+    else
+      decodeVertices(model, buffers, job, chunk.begin, chunk.end,
+                     out.vertices.data());
+    finishJob(chunk.job);
+  };
+  // Each primitive only references its own vertex slice, so ranges are
+  // independent once all chunks are decoded. Large primitives spread over
+  // the pool themselves; the rest run one per task.
+  auto generateNormals = [&](std::size_t n, utils::ThreadPool* inner) {
+    const PrimitiveJob& job = sized[normalJobs[n]];
+    if (packed) {
+      computeCompactNormals(model, buffers, job, out.compactLayout,
+                            out.indices, normalOptions, inner,
+                            out.compactVertices.data());
+      finishJob(normalJobs[n]);
+      return;
+    }
+    utils::VertexPU* vertices = out.vertices.data() + job.baseVertex;
+    utils::NormalInput input;
+    input.positions = reinterpret_cast<const std::byte*>(&vertices->pos);
+    input.positionStride = sizeof(utils::VertexPU);
+    input.vertexCount = job.vertexCount;
+    input.indices = out.indices.data() + job.indexOffset;
+    input.indexCount = job.indexCount;
+    input.indexBase = job.baseVertex;
+    utils::generateNormals(input,
+                           reinterpret_cast<std::byte*>(&vertices->normal),
+                           sizeof(utils::VertexPU), normalOptions, inner);
+  };
+
+  utils::parallelFor(pool, chunks.size(), decodeChunk);
+  const auto tNormals = std::chrono::steady_clock::now();
+  std::vector<std::size_t> smallJobs;
+  for (std::size_t n = 0; n < normalJobs.size(); ++n) {
+    if (sized[normalJobs[n]].indexCount >= kDecodeChunkSize)
+      generateNormals(n, pool);
+    else
+      smallJobs.push_back(n);
+  }
+  utils::parallelFor(pool, smallJobs.size(), [&](std::size_t i) {
+    generateNormals(smallJobs[i], nullptr);
+  });
+  if (!normalJobs.empty()) {
+    const double ms = std::chrono::duration<double, std::milli>(
+                          std::chrono::steady_clock::now() - tNormals)
+                          .count();
+    LOG_INFO("DecodeGLB - generated normals for " << normalJobs.size()
+                                                  << " primitives: " << ms
+                                                  << " ms");
+  }
+
+  for (const auto& job : sized) {
+    if (job.indexCount == 0) continue;
+    utils::Submesh sm{};
+    sm.indexOffset = job.indexOffset;
+    sm.indexCount = job.indexCount;
+    sm.instanceOffset = job.instanceOffset;
+    sm.instanceCount = job.instanceCount;
+    sm.materialIndex = job.prim->material;
+    if (sm.materialIndex >= 0) {
+      if (auto it = materialRemap.find(sm.materialIndex);
+          it != materialRemap.end())
+        sm.materialIndex = it->second;
+    }
+    out.submeshes.push_back(sm);
+  }
+
+  LOG_INFO("DecodeGLB - decoded " << sized.size() << " primitives ("
+                                      << vertexTotal << " vertices, "
+                                      << indexTotal << " indices) on "
+                                      << threadCount << " thread(s)");
 }
 
 }  // namespace
 
-utils::ModelData LoadGLB_ToCPU(const std::string& path) {
+utils::ModelData DecodeGLB(const std::string& path,
+                           const LoadOptions& options) {
   tinygltf::TinyGLTF loader;
   tinygltf::Model model;
   std::string err, warn;
 
-  if (!loader.LoadBinaryFromFile(&model, &err, &warn, path))
-    throw std::runtime_error("LoadGLB failed: " + err);
+  // Keep images encoded during the parse; they are decoded in parallel below.
+  EncodedImages encoded;
+  loader.SetImageLoader(captureEncodedImage, &encoded);
+
+  loader.SetFsCallbacks({vfsFileExists, vfsExpandFilePath, vfsReadWholeFile,
+                         vfsWriteWholeFile, vfsFileSize, nullptr});
+
+  const auto tParse = std::chrono::steady_clock::now();
+  // Parsed straight from the pak's mapping (or the mapped loose file); the
+  // mapping stays alive until decoding is done. A .gltf's external buffers
+  // are only opened when something reads them.
+  const utils::VfsFile file = utils::Vfs::instance().open(path);
+  const std::string baseDir = path.substr(0, path.find_last_of("/\\") + 1);
+  const bool binary = isGlb(file.data(), file.size());
+  GltfBuffers buffers;
+  StubbedGltf stub;
+  if (!stubGltf(file.data(), file.size(), baseDir, buffers, stub)) {
+    buffers.reset(0);
+    stub = {};
+  }
+  bool parsed;
+  if (binary) {
+    const bool stubbed = !stub.glb.empty();
+    parsed = loader.LoadBinaryFromMemory(
+        &model, &err, &warn, stubbed ? stub.glb.data() : file.data(),
+        static_cast<unsigned>(stubbed ? stub.glb.size() : file.size()),
+        baseDir);
+  } else {
+    const std::string_view json = stub.json.empty() ? file.text() : stub.json;
+    parsed = loader.LoadASCIIFromString(&model, &err, &warn, json.data(),
+                                        static_cast<unsigned>(json.size()),
+                                        baseDir);
+  }
+  if (!parsed) throw std::runtime_error("LoadGLB failed: " + err);
+  finishStubbedGltf(model, stub, buffers, encoded);
+  const double parseMs = std::chrono::duration<double, std::milli>(
+                             std::chrono::steady_clock::now() - tParse)
+                             .count();
+  LOG_INFO("DecodeGLB - parse: " << parseMs << " ms");
+
+  const unsigned threadCount =
+      utils::ThreadPool::resolveThreadCount(options.threadCount);
+  std::unique_ptr<utils::ThreadPool> pool;
+  if (threadCount > 1)
+    pool = std::make_unique<utils::ThreadPool>(threadCount - 1);
+
+  // Before anything reads accessor data (instance transforms included).
+  decodeMeshoptViews(model, buffers, pool.get());
 
   const int sceneIndex = (model.defaultScene >= 0) ? model.defaultScene : 0;
   if (sceneIndex < 0 || sceneIndex >= static_cast<int>(model.scenes.size()))
     throw std::runtime_error("No valid scene in GLB");
 
+  // Quantized positions are dequantized by their node transforms, which
+  // cannot be baked into integer vertices: such models are kept instanced.
+  const bool compact = options.keepQuantized && hasQuantizedAttributes(model);
+  const bool instancing = options.instancing || compact;
+
+  std::vector<PrimitiveJob> jobs;
+  MeshInstances meshInstances;
+  meshInstances.transforms.resize(model.meshes.size());
+  for (int n : model.scenes[static_cast<size_t>(sceneIndex)].nodes)
+    collectPrimitives(model, buffers, n, glm::mat4(1.0f), jobs,
+                      instancing ? &meshInstances : nullptr);
+  buffers.evictUnused();  // instance transforms are read
+
   utils::ModelData out;
 
+  if (instancing) {
+    std::size_t bakedPrimitives = 0;
+    for (int mesh : meshInstances.order) {
+      const auto& transforms =
+          meshInstances.transforms[static_cast<size_t>(mesh)];
+      const auto instanceOffset =
+          static_cast<std::uint32_t>(out.instances.size());
+      out.instances.insert(out.instances.end(), transforms.begin(),
+                           transforms.end());
+      const auto& primitives =
+          model.meshes[static_cast<size_t>(mesh)].primitives;
+      for (const auto& prim : primitives) {
+        PrimitiveJob job;
+        job.prim = &prim;
+        job.instanceOffset = instanceOffset;
+        job.instanceCount = static_cast<std::uint32_t>(transforms.size());
+        jobs.push_back(job);
+        bakedPrimitives += transforms.size();
+      }
+    }
+    LOG_INFO("DecodeGLB - instancing: " << meshInstances.order.size()
+                                        << " meshes, " << out.instances.size()
+                                        << " instances, " << jobs.size()
+                                        << " primitives (" << bakedPrimitives
+                                        << " when baked)");
+  }
+
+  std::unordered_set<int> usedMaterials;
+  for (const auto& job : jobs) usedMaterials.insert(job.prim->material);
+
+  // Materials no primitive in the scene uses keep their factors, but their
+  // textures are never decoded.
   out.materials.resize(model.materials.size());
-  std::unordered_map<int, GLuint> imageTexCache;
+  std::unordered_map<int, int> imageSlots;
+  std::vector<ImageRequest> imageRequests;
   for (int mi = 0; mi < static_cast<int>(model.materials.size()); ++mi) {
-    out.materials[static_cast<size_t>(mi)] =
-        readMaterialAndCreateGL(model, mi, imageTexCache);
+    out.materials[static_cast<size_t>(mi)] = readMaterial(
+        model, mi, usedMaterials.count(mi) != 0, imageSlots, imageRequests);
   }
 
   std::unordered_map<int, int> materialRemap;
   for (int mi = 0; mi < static_cast<int>(out.materials.size()); ++mi)
     materialRemap[mi] = mi;
 
-  bool anyMissingNormals = false;
+  const auto tImages = std::chrono::steady_clock::now();
+  const utils::TextureCompression basisuTarget =
+      options.textureCompression != utils::TextureCompression::None
+          ? options.textureCompression
+          : options.basisuTarget;
+  decodeImages(encoded, imageRequests, basisuTarget, pool.get(), out);
+  const double imagesMs = std::chrono::duration<double, std::milli>(
+                              std::chrono::steady_clock::now() - tImages)
+                              .count();
+  LOG_INFO("DecodeGLB - decoded " << out.images.size() << " of "
+                                  << model.images.size() << " images: "
+                                  << imagesMs << " ms");
+  encoded.bytes.clear();
+
+  std::size_t mipmapped = 0;
+  const auto tMips = std::chrono::steady_clock::now();
+  for (utils::TextureImage& image : out.images) {
+    if (image.compression != utils::TextureCompression::None ||
+        image.levelCount() != 1 || !utils::samplesMipmaps(image))
+      continue;
+    utils::generateMipChain(image, options.mipFilter, pool.get());
+    ++mipmapped;
+  }
+  if (mipmapped > 0) {
+    const double mipsMs = std::chrono::duration<double, std::milli>(
+                              std::chrono::steady_clock::now() - tMips)
+                              .count();
+    LOG_INFO("DecodeGLB - mip chains for " << mipmapped << " images: "
+                                           << mipsMs << " ms");
+  }
 
-  const auto& scene = model.scenes[static_cast<size_t>(sceneIndex)];
-  for (int n : scene.nodes)
-    processNode(model, n, glm::mat4(1.0f), out, anyMissingNormals,
-                materialRemap);
+  if (options.textureCompression != utils::TextureCompression::None &&
+      !out.images.empty()) {
+    const auto tCompress = std::chrono::steady_clock::now();
+    for (utils::TextureImage& image : out.images)
+      utils::compressTexture(image, options.textureCompression, pool.get());
+    const double compressMs =
+        std::chrono::duration<double, std::milli>(
+            std::chrono::steady_clock::now() - tCompress)
+            .count();
+    LOG_INFO("DecodeGLB - block-compressed " << out.images.size()
+                                             << " images: " << compressMs
+                                             << " ms");
+  }
 
-  if (out.vertices.empty() || out.indices.empty() || out.submeshes.empty())
+  const auto t0 = std::chrono::steady_clock::now();
+  decodeScene(model, buffers, std::move(jobs), pool.get(), threadCount,
+              compact, options.normalOptions, out, materialRemap);
+  const double decodeMs = std::chrono::duration<double, std::milli>(
+                              std::chrono::steady_clock::now() - t0)
+                              .count();
+  LOG_INFO("DecodeGLB - geometry decode: " << decodeMs << " ms");
+  if (const GltfBuffers::Stats stats = buffers.stats(); stats.external > 0)
+    LOG_INFO("DecodeGLB - external buffers: opened "
+             << stats.opened << " of " << stats.external << ", at most "
+             << stats.peakMappedBytes / (1024.0 * 1024.0)
+             << " MB mapped at once");
+
+  if (out.vertexCount() == 0 || out.indices.empty() || out.submeshes.empty())
     throw std::runtime_error("No geometry found in GLB");
 
+  // The passes below work on float vertices.
+  const bool floatVertices = !out.compact();
+  if (!floatVertices) {
+    LOG_INFO("DecodeGLB - KHR_mesh_quantization: "
+             << out.compactLayout.stride << "-byte vertices kept as stored ("
+             << sizeof(utils::VertexPU) << " as float)");
+    if (options.weld || options.optimize || options.buildLods ||
+        options.buildMeshlets)
+      LOG_WARN("DecodeGLB - weld/optimize/LODs/meshlets skipped for "
+               "quantized vertices");
+  }
+
+  if (options.weld && floatVertices) {
+    utils::WeldOptions weld = options.weldOptions;
+    weld.threadCount = threadCount;
+    const utils::WeldStats stats = utils::weldVertices(out, weld);
+    LOG_INFO("DecodeGLB - weld: " << stats.verticesBefore << " -> "
+                                  << stats.verticesAfter << " vertices in "
+                                  << stats.milliseconds << " ms");
+  }
+
+  if (options.optimize && floatVertices) {
+    utils::OptimizeOptions optimize = options.optimizeOptions;
+    optimize.threadCount = threadCount;
+    const utils::OptimizeStats stats = utils::optimizeModel(out, optimize);
+    LOG_INFO("DecodeGLB - vertex cache ACMR/ATVR: "
+             << stats.cacheBefore.acmr << "/" << stats.cacheBefore.atvr
+             << " -> tipsify " << stats.cacheAfterTipsify.acmr << "/"
+             << stats.cacheAfterTipsify.atvr << " -> overdraw "
+             << stats.cacheAfterOverdraw.acmr << "/"
+             << stats.cacheAfterOverdraw.atvr);
+    LOG_INFO("DecodeGLB - vertex fetch overfetch: "
+             << stats.fetchBefore.overfetch << " -> "
+             << stats.fetchAfter.overfetch << " (" << stats.milliseconds
+             << " ms)");
+  }
+
+  if (options.buildLods && floatVertices) {
+    utils::LodOptions lods = options.lodOptions;
+    lods.threadCount = threadCount;
+    const utils::LodStats stats = utils::buildLods(out, lods);
+    std::string triangles;
+    for (std::size_t count : stats.trianglesPerLod)
+      triangles += (triangles.empty() ? "" : " / ") + std::to_string(count);
+    LOG_INFO("DecodeGLB - LOD triangles " << triangles << " ("
+                                          << stats.milliseconds << " ms)");
+  }
+
+  // Bounds and UV density of every submesh, for LOD selection and texture
+  // streaming.
+  if (floatVertices) {
+    utils::parallelFor(pool.get(), out.submeshes.size(), [&](std::size_t s) {
+      utils::Submesh& sm = out.submeshes[s];
+      const std::uint32_t* range = out.indices.data() + sm.indexOffset;
+      if (sm.radius < 0.0f)
+        utils::computeBounds(out.vertices.data(), range, sm.indexCount,
+                             sm.center, sm.radius);
+      sm.uvDensity =
+          utils::uvDensity(out.vertices.data(), range, sm.indexCount);
+    });
+  }
+
+  if (options.buildMeshlets && floatVertices) {
+    utils::MeshletOptions meshlets = options.meshletOptions;
+    meshlets.threadCount = threadCount;
+    const utils::MeshletStats stats = utils::buildMeshlets(out, meshlets);
+    LOG_INFO("DecodeGLB - " << stats.meshlets << " meshlets, avg "
+                            << stats.averageVertices << " vertices / "
+                            << stats.averageTriangles << " triangles ("
+                            << stats.milliseconds << " ms)");
+  }
+
   return out;
 }
 
+std::uint64_t HashModelSource(const std::string& path) {
+  const utils::Vfs& vfs = utils::Vfs::instance();
+  const utils::VfsFile file = vfs.open(path);
+  std::uint64_t hash = utils::hash64(file.data(), file.size());
+  const std::string_view json = gltfJson(file.data(), file.size());
+  const auto doc =
+      nlohmann::json::parse(json.begin(), json.end(), nullptr, false);
+  if (doc.is_discarded() || !doc.is_object()) return hash;
+
+  const std::string baseDir = path.substr(0, path.find_last_of("/\\") + 1);
+  for (const char* list : {"buffers", "images"}) {
+    const auto entries = doc.find(list);
+    if (entries == doc.end() || !entries->is_array()) continue;
+    for (const auto& entry : *entries) {
+      if (!entry.is_object()) continue;
+      const auto uri = entry.find("uri");
+      std::string decoded;
+      if (uri == entry.end() || !uri->is_string() ||
+          tinygltf::IsDataURI(uri->get<std::string>()) ||
+          !tinygltf::URIDecode(uri->get<std::string>(), &decoded, nullptr))
+        continue;
+      // A missing file still changes the key, so it is cooked once found.
+      utils::VfsFile external;
+      const std::uint64_t h = vfs.tryOpen(baseDir + decoded, external)
+                                  ? utils::hash64(external.data(),
+                                                  external.size())
+                                  : 0;
+      hash = utils::hash64(&h, sizeof(h), hash);
+    }
+  }
+  return hash;
+}
+
+void CreateModelTextures(utils::ModelData& m, const LoadOptions& options) {
+  // Virtually textured models stream their pages from files instead.
+  if (!m.virtualTextures.empty()) return;
+  const bool textureArrays = options.textureArrays;
+  const bool share = SharesTextures(options);
+  const auto t0 = std::chrono::steady_clock::now();
+  // Per image: its texture and, for arrays, its layer.
+  std::vector<GLuint> textures(m.images.size(), 0);
+  std::vector<int> layers(m.images.size(), -1);
+  std::size_t created = 0, reused = 0;
+  // A texture from the cache, or `create` run and its result stored there.
+  auto sharedTexture = [&](const utils::Hash128& key, std::size_t bytes,
+                           auto create) {
+    bool isNew = false;
+    utils::GpuObjectRef object = utils::GpuObjectCache::instance().acquire(
+        utils::GpuObjectKind::Texture, key, bytes, isNew);
+    if (isNew)
+      object->setName(create());
+    else
+      ++reused;
+    m.sharedTextures.push_back(object);
+    return object->name();
+  };
+  if (textureArrays) {
+    for (const std::vector<int>& group : utils::groupTextureArrays(m.images)) {
+      auto create = [&] { return utils::createTextureArray(m.images, group); };
+      std::size_t bytes = 0;
+      for (int index : group)
+        bytes += utils::textureLevelBytes(m.images[static_cast<size_t>(index)]);
+      const GLuint tex =
+          share ? sharedTexture(utils::textureArrayKey(m.images, group), bytes,
+                                create)
+                : create();
+      for (std::size_t layer = 0; layer < group.size(); ++layer) {
+        textures[static_cast<size_t>(group[layer])] = tex;
+        layers[static_cast<size_t>(group[layer])] = static_cast<int>(layer);
+      }
+      ++created;
+    }
+  } else {
+    for (size_t i = 0; i < m.images.size(); ++i) {
+      const utils::TextureImage& image = m.images[i];
+      auto create = [&] {
+        return utils::createTexture(
+            image,
+            utils::streamingBaseLevel(image, options.streamResidentSize));
+      };
+      textures[i] = share ? sharedTexture(utils::textureKey(image),
+                                          utils::textureLevelBytes(image),
+                                          create)
+                          : create();
+    }
+    created = m.images.size();
+  }
+  if (!m.images.empty()) {
+    const double ms = std::chrono::duration<double, std::milli>(
+                          std::chrono::steady_clock::now() - t0)
+                          .count();
+    LOG_INFO("CreateModelTextures - " << created
+                                      << (textureArrays ? " texture arrays"
+                                                        : " textures")
+                                      << " for " << m.images.size()
+                                      << " images on the GL thread ("
+                                      << reused << " shared with loaded"
+                                      << " models): " << ms << " ms");
+  }
+
+  for (auto& mat : m.materials) {
+    if (mat.baseColorImage < 0 ||
+        mat.baseColorImage >= static_cast<int>(textures.size()))
+      continue;
+    mat.baseColorTex = textures[static_cast<size_t>(mat.baseColorImage)];
+    mat.baseColorLayer = layers[static_cast<size_t>(mat.baseColorImage)];
+    mat.hasBaseColorTex = (mat.baseColorTex != 0);
+  }
+  LogTextureMemory(m);
+}
+
+void LogTextureMemory(const utils::ModelData& m) {
+  std::size_t totalBefore = 0, totalAfter = 0;
+  for (const utils::TextureImage& image : m.images) {
+    totalBefore += utils::rgba8MemorySize(image);
+    totalAfter += utils::textureMemorySize(image);
+  }
+  for (size_t i = 0; i < m.materials.size(); ++i) {
+    const int index = m.materials[i].baseColorImage;
+    if (index < 0 || index >= static_cast<int>(m.images.size())) continue;
+    const utils::TextureImage& image = m.images[static_cast<size_t>(index)];
+    // Unsupported block formats are uploaded decoded.
+    const char* format =
+        utils::textureCompressionSupported(image.compression, image.srgb)
+            ? utils::textureFormatName(image)
+            : "RGBA8";
+    LOG_INFO("Material " << i << " base color " << image.width << "x"
+                         << image.height << ": "
+                         << utils::rgba8MemorySize(image) / 1024
+                         << " KiB as RGBA8, "
+                         << utils::textureMemorySize(image) / 1024
+                         << " KiB as " << format);
+  }
+  if (!m.images.empty())
+    LOG_INFO("Texture VRAM: " << totalAfter / 1024 << " KiB (RGBA8: "
+                              << totalBefore / 1024 << " KiB)");
+}
+
+bool KeepsModelImages(const LoadOptions& options) {
+  return options.keepImages || options.streamResidentSize > 0;
+}
+
+void ReleaseModelImages(utils::ModelData& m) {
+  m.images.clear();
+  m.images.shrink_to_fit();
+  for (auto& mat : m.materials) mat.baseColorImage = -1;
+}
+
+utils::ModelData LoadGLB_ToCPU(const std::string& path,
+                               const LoadOptions& options) {
+  utils::ModelData out = DecodeGLB(path, options);
+  CreateModelTextures(out, options);
+  if (!KeepsModelImages(options)) ReleaseModelImages(out);
+  return out;
+}
+
+bool SharesTextures(const LoadOptions& options) {
+  return options.shareGpuObjects && options.streamResidentSize <= 0;
+}
+
 void DestroyModelTextures(utils::ModelData& m) {
+  // Materials share textures (and texture arrays); delete each once. Those
+  // from the GpuObjectCache go with the model's last reference to them.
+  std::unordered_set<GLuint> deleted;
+  for (const utils::GpuObjectRef& object : m.sharedTextures)
+    deleted.insert(object->name());
+  m.sharedTextures.clear();
   for (auto& mat : m.materials) {
-    if (mat.baseColorTex != 0) {
+    if (mat.baseColorTex != 0 && deleted.insert(mat.baseColorTex).second)
       glDeleteTextures(1, &mat.baseColorTex);
-      mat.baseColorTex = 0;
-      mat.hasBaseColorTex = false;
-    }
+    mat.baseColorTex = 0;
+    mat.baseColorLayer = -1;
+    mat.hasBaseColorTex = false;
   }
 }
 }  // namespace loader
\ No newline at end of file
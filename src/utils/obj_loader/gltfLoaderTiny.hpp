@@ -7,10 +7,126 @@
 #include <vector>
 
 #include "../mesh.hpp"
+#include "../mesh_meshlets.hpp"
+#include "../mesh_normals.hpp"
+#include "../mesh_optimize.hpp"
+#include "../mesh_simplify.hpp"
+#include "../mesh_weld.hpp"
+#include "../texture_mips.hpp"
+#include "../virtual_texture_file.hpp"
 
 namespace loader {
 
-utils::ModelData LoadGLB_ToCPU(const std::string& path);
+struct LoadOptions {
+  // Image and geometry decode threads: 0 = hardware concurrency, 1 = calling
+  // thread only. The decoded ModelData is identical for every value.
+  unsigned threadCount = 0;
+  // LoadGLB_ToCPU/LoadModelCached: keep ModelData::images after creating
+  // the GL textures.
+  bool keepImages = false;
+  // LoadModelCached: directory for .cooked files; empty = beside the source.
+  std::string cacheDir;
+  // LoadModelCached: store the cooked vertices, indices and mip levels in
+  // independently compressed blocks (utils::compressStream), read and
+  // decoded across the threads above on warm loads instead of borrowed from
+  // the mapping. Fewer bytes to read, for caches on slow or network storage.
+  bool compressCooked = false;
+  // Keep every glTF mesh once in its local space and list the world
+  // transforms of the nodes (and EXT_mesh_gpu_instancing instances) using it
+  // in ModelData::instances, instead of baking a transformed copy per node.
+  bool instancing = false;
+  // Upload KHR_mesh_quantization attributes in their stored integer types
+  // (ModelData::compactVertices) instead of converting them to float. Such
+  // models load as with `instancing`, since the node transforms that
+  // dequantize positions cannot be baked into integers, and skip the float
+  // passes below.
+  bool keepQuantized = true;
+  // How normals are generated for primitives that have none
+  // (utils::generateNormals).
+  utils::NormalOptions normalOptions;
+  // Merge duplicate vertices after decoding (utils::weldVertices); its
+  // threadCount is taken from the field above.
+  bool weld = false;
+  utils::WeldOptions weldOptions;
+  // Reorder each submesh for vertex cache, overdraw and vertex fetch
+  // (utils::optimizeModel); runs after the weld.
+  bool optimize = false;
+  utils::OptimizeOptions optimizeOptions;
+  // Append a simplified LOD chain per submesh (utils::buildLods); runs last.
+  bool buildLods = false;
+  utils::LodOptions lodOptions;
+  // Regroup each submesh into culling clusters (utils::buildMeshlets); runs
+  // after the LODs so they are simplified from the optimized order.
+  bool buildMeshlets = false;
+  utils::MeshletOptions meshletOptions;
+  // GPU layout AsyncModelLoader uploads with (utils::buildGpuGeometry):
+  // vertex format (compact models keep theirs), and uint16 indices for
+  // ranges spanning < 64k vertices.
+  utils::VertexFormat vertexFormat = utils::VertexFormat::Float32;
+  bool narrowIndices = true;
+  // Encode the base color images, mip chains included, to GPU blocks
+  // (utils::compressTexture). Drivers without the format get them decoded
+  // back to RGBA8 at upload.
+  utils::TextureCompression textureCompression =
+      utils::TextureCompression::None;
+  // Block format KHR_texture_basisu ETC1S images are transcoded to
+  // on the decode threads when textureCompression is None; normally the
+  // best one the GL context samples, which only the GL thread can ask
+  // (utils::textureCompressionSupported). None transcodes to RGBA8.
+  utils::TextureCompression basisuTarget = utils::TextureCompression::None;
+  // Filter of the base color mip chains, which are built on the decode
+  // threads (utils::generateMipChain) so the GL thread only uploads levels.
+  utils::MipFilter mipFilter = utils::MipFilter::Box;
+  // Create the base color textures as GL_TEXTURE_2D_ARRAYs, one per group of
+  // same-sized, same-format images (utils::groupTextureArrays), so that
+  // RenderObject binds a texture only when the array changes.
+  bool textureArrays = false;
+  // > 0: create the base color textures (not arrays) with only the mip
+  // levels at most this many texels wide and high, and keep the images so a
+  // utils::TextureStreamer can load the finer levels on demand.
+  int streamResidentSize = 0;
+  // LoadModelCached/DecodeModelCached: cook each base color image into a
+  // tiled page file beside the cooked model (utils::writeVirtualTexture)
+  // and point the materials at it (MaterialGL::baseColorVirtual) instead of
+  // creating GL textures; a utils::VirtualTextureSystem, whose layout must
+  // match, streams the pages the view needs. Ignored by DecodeGLB.
+  bool virtualTextures = false;
+  utils::VirtualTextureLayout virtualTextureLayout;
+  // Take base color textures (and texture arrays) and, in AsyncModelLoader,
+  // the vertex and index buffers from utils::GpuObjectCache, so models with
+  // byte-identical payloads share one GL object instead of uploading
+  // another. Streamed textures are never shared.
+  bool shareGpuObjects = true;
+};
+
+// Parse + decode only; no GL calls, so it may run on any thread. Base color
+// images are returned in ModelData::images, referenced by
+// MaterialGL::baseColorImage. Also reads .gltf files; their external
+// buffers are mapped when first decoded from and unmapped once decoded.
+utils::ModelData DecodeGLB(const std::string& path,
+                           const LoadOptions& options = {});
+
+// Hash of a .glb/.gltf and the external buffer and image files it
+// references, for cache keys; the file's own hashFile when it has none.
+std::uint64_t HashModelSource(const std::string& path);
+
+// GL stage: creates a texture per ModelData::images entry, or with
+// options.textureArrays a texture array per group of compatible entries,
+// and binds them to the materials. Must run on the GL thread. Shared
+// textures are kept in ModelData::sharedTextures.
+void CreateModelTextures(utils::ModelData& m, const LoadOptions& options = {});
+void ReleaseModelImages(utils::ModelData& m);
+// Whether ModelData::images outlive texture creation.
+bool KeepsModelImages(const LoadOptions& options);
+// Whether base color textures come from utils::GpuObjectCache.
+bool SharesTextures(const LoadOptions& options);
+// Logs the GPU memory of each material's base color texture, as created
+// and as RGBA8 would take. GL thread; CreateModelTextures calls it.
+void LogTextureMemory(const utils::ModelData& m);
+
+// DecodeGLB + CreateModelTextures on the calling (GL) thread.
+utils::ModelData LoadGLB_ToCPU(const std::string& path,
+                               const LoadOptions& options = {});
 
 void DestroyModelTextures(utils::ModelData& m);
 
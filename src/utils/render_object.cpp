@@ -1,13 +1,68 @@
 #include "render_object.hpp"
 
+#include <algorithm>
+#include <cmath>
 #include <iostream>
 #include <memory>
+#include <vector>
 
+#include "mesh_meshlets.hpp"
 #include "shader.hpp"
+#include "texture_streamer.hpp"
+#include "virtual_texture.hpp"
 
 namespace utils
 
 {
+namespace {
+
+float maxAxisScale(const glm::mat4& m) {
+  return std::sqrt(std::max({glm::dot(glm::vec3(m[0]), glm::vec3(m[0])),
+                             glm::dot(glm::vec3(m[1]), glm::vec3(m[1])),
+                             glm::dot(glm::vec3(m[2]), glm::vec3(m[2]))}));
+}
+
+// Pixels per model unit of the submesh drawn with `world`, at the nearest
+// point of its bounding sphere.
+float pixelsPerUnit(const Submesh& submesh, const glm::mat4& world,
+                    const FrameContext& frame) {
+  const float scale = maxAxisScale(world);
+  const glm::vec3 center = glm::vec3(world * glm::vec4(submesh.center, 1));
+  const float distance = std::max(
+      glm::length(frame.cameraPos - center) - submesh.radius * scale, 1e-4f);
+  return frame.projScale * frame.viewportHeight * 0.5f * scale / distance;
+}
+
+// Coarsest LOD (0 = full submesh) whose error, drawn with `world`, projects
+// to at most frame.lodPixelError pixels.
+std::size_t selectLod(const Submesh& submesh, const glm::mat4& world,
+                      const FrameContext& frame) {
+  if (frame.lodPixelError <= 0.0f || submesh.radius < 0.0f ||
+      submesh.lods.empty())
+    return 0;
+  const float pixels = pixelsPerUnit(submesh, world, frame);
+  std::size_t level = 0;
+  while (level < submesh.lods.size() &&
+         submesh.lods[level].error * pixels <= frame.lodPixelError)
+    ++level;
+  return level;
+}
+
+// Level-0 texels of `image` per pixel where the submesh, drawn with
+// `world`, comes closest to the camera; 0 when unknown.
+float texelsPerPixel(const Submesh& submesh, const TextureImage& image,
+                     const glm::mat4& world, const FrameContext& frame) {
+  if (submesh.uvDensity <= 0.0f || submesh.radius < 0.0f ||
+      frame.viewportHeight <= 0.0f)
+    return 0.0f;
+  const float texelsPerUnit =
+      submesh.uvDensity * std::sqrt(static_cast<float>(image.width) *
+                                    static_cast<float>(image.height));
+  return texelsPerUnit / pixelsPerUnit(submesh, world, frame);
+}
+
+}  // namespace
+
 RenderObject::RenderObject(const std::shared_ptr<Mesh>& mesh,
                            const std::shared_ptr<Shader>& shader)
     : mesh_(std::move(mesh)), shader_(std::move(shader)) {}
@@ -20,44 +75,237 @@ RenderObject::RenderObject(const std::shared_ptr<Mesh>& mesh,
       modelData_(std::move(modelData)) {}
 
 void RenderObject::draw(const glm::mat4& viewProj) const {
+  FrameContext frame;
+  frame.viewProj = viewProj;
+  draw(frame);
+}
+
+void RenderObject::draw(const FrameContext& frame) const {
   glm::mat4 model = transform.buildMatrix();
-  shader_->use();
-  shader_->setMat4("uModel", model);
-  shader_->setMat4("uViewProj", viewProj);
-  shader_->setVec3("uLightDirW", glm::normalize(glm::vec3(1, 1, 1)));
+  const Shader& shader = frame.shader ? *frame.shader : *shader_;
+  shader.use();
+  shader.setMat4("uModel", model);
+  shader.setMat4("uViewProj", frame.viewProj);
+  shader.setVec3("uLightDirW", glm::normalize(glm::vec3(1, 1, 1)));
+  shader.setVec3("uPosOffset", mesh_->posOffset());
+  shader.setVec3("uPosScale", mesh_->posScale());
+  shader.setBool("uOctNormal", mesh_->format() == VertexFormat::Packed16);
+  shader.setBool("uInstanced", false);
+  // Distinct units: a program may not sample two sampler types from one.
+  shader.setInt("uBaseColorTex", 0);
+  shader.setInt("uBaseColorArray", 1);
+  shader.setInt("uBaseColorLayer", -1);
+  VirtualTextureSystem::unbind(shader);
 
   if (!modelData_ || modelData_->submeshes.empty()) {
-    shader_->setVec4("uBaseColorFactor", color);
-    shader_->setBool("uHasBaseColorTex", false);
+    shader.setVec4("uBaseColorFactor", color);
+    shader.setBool("uHasBaseColorTex", false);
     mesh_->draw();
+    if (frame.stats) frame.stats->drawCalls++;
     return;
   }
 
+  // Meshlet bounds are tested in model space.
+  const bool cullMeshlets =
+      frame.meshletCulling && !modelData_->meshlets.empty();
+  glm::vec4 planes[6];
+  glm::vec3 cameraModel(0.0f);
+  std::vector<std::uint32_t> offsets, counts;
+  if (cullMeshlets || frame.textureStreamer)
+    extractFrustumPlanes(frame.viewProj * model, planes);
+  if (cullMeshlets)
+    cameraModel =
+        glm::vec3(glm::inverse(model) * glm::vec4(frame.cameraPos, 1.0f));
+
+  // Models loaded with texture arrays keep their textures in a few shared
+  // arrays: material state is set when the material changes and the array
+  // is bound when it changes.
+  const bool textureArrays = std::any_of(
+      modelData_->materials.begin(), modelData_->materials.end(),
+      [](const MaterialGL& mat) { return mat.baseColorLayer >= 0; });
+  int currentMaterial = -2;
+  GLuint boundArray = 0;
+  bool virtualBound = false;
+  bool faceCulling = false;
+
   for (const auto& submesh : modelData_->submeshes) {
     glm::vec4 factor = glm::vec4(1, 1, 1, 1);
     bool hasTex = false;
     GLuint tex = 0;
+    int layer = -1;
 
+    const MaterialGL* mat = nullptr;
     if (submesh.materialIndex >= 0 &&
         submesh.materialIndex < modelData_->materials.size()) {
-      const auto& mat = modelData_->materials[submesh.materialIndex];
-      factor = mat.baseColorFactor;
-      hasTex = mat.hasBaseColorTex;
-      tex = mat.baseColorTex;
+      mat = &modelData_->materials[submesh.materialIndex];
+      factor = mat->baseColorFactor;
+      hasTex = mat->hasBaseColorTex;
+      tex = mat->baseColorTex;
+      layer = mat->baseColorLayer;
+    }
+    // Virtual base colors sample the page cache; without a system they draw
+    // with the factor alone.
+    int virtualId = -1;
+    if (mat && mat->baseColorVirtual >= 0 &&
+        mat->baseColorVirtual <
+            static_cast<int>(modelData_->virtualTextures.size())) {
+      hasTex = false;
+      if (frame.virtualTextures)
+        virtualId = modelData_->virtualTextures[mat->baseColorVirtual].id;
     }
 
-    shader_->setVec4("uBaseColorFactor", factor);
-    shader_->setBool("uHasBaseColorTex", hasTex);
+    if (textureArrays) {
+      if (submesh.materialIndex != currentMaterial) {
+        currentMaterial = submesh.materialIndex;
+        hasTex = hasTex && tex != 0 && layer >= 0;
+        shader.setVec4("uBaseColorFactor", factor);
+        shader.setBool("uHasBaseColorTex", hasTex);
+        shader.setInt("uBaseColorLayer", layer);
+        if (hasTex && tex != boundArray) {
+          glActiveTexture(GL_TEXTURE1);
+          glBindTexture(GL_TEXTURE_2D_ARRAY, tex);
+          boundArray = tex;
+          if (frame.stats) frame.stats->textureBinds++;
+        }
+      }
+    } else {
+      shader.setVec4("uBaseColorFactor", factor);
+      shader.setBool("uHasBaseColorTex", hasTex);
+
+      if (hasTex && tex != 0) {
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, tex);
+        shader.setInt("uBaseColorTex", 0);
+      } else {
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, 0);
+      }
+      if (frame.stats) frame.stats->textureBinds++;
 
-    if (hasTex && tex != 0) {
-      glActiveTexture(GL_TEXTURE0);
-      glBindTexture(GL_TEXTURE_2D, tex);
-      shader_->setInt("uBaseColorTex", 0);
+      if (virtualId >= 0) {
+        frame.virtualTextures->bind(virtualId, shader);
+        virtualBound = true;
+      } else if (virtualBound) {
+        VirtualTextureSystem::unbind(shader);
+        virtualBound = false;
+      }
+    }
+
+    const bool instanced = submesh.instanceCount > 0 &&
+                           submesh.instanceOffset + submesh.instanceCount <=
+                               mesh_->instanceCount();
+
+    // Meshlet culling drops clusters that face away from the camera, so the
+    // rest of a single-sided submesh is drawn with back faces culled too,
+    // alike at every LOD. Instance transforms may mirror: instanced
+    // submeshes keep both faces.
+    const bool cullBackFaces =
+        cullMeshlets && !instanced && !(mat && mat->doubleSided);
+    if (cullBackFaces != faceCulling) {
+      if (cullBackFaces)
+        glEnable(GL_CULL_FACE);
+      else
+        glDisable(GL_CULL_FACE);
+      faceCulling = cullBackFaces;
+    }
+
+    // Streamed textures (kept images only) get the demand of every
+    // submesh that may be on screen; instances are not frustum tested.
+    if (frame.textureStreamer && mat && tex != 0 && layer < 0 &&
+        mat->baseColorImage >= 0 &&
+        mat->baseColorImage < static_cast<int>(modelData_->images.size())) {
+      const TextureImage& image = modelData_->images[mat->baseColorImage];
+      if (instanced) {
+        for (std::uint32_t i = 0; i < submesh.instanceCount; ++i)
+          frame.textureStreamer->request(
+              tex,
+              texelsPerPixel(
+                  submesh, image,
+                  model * modelData_->instances[submesh.instanceOffset + i],
+                  frame));
+      } else if (submesh.radius < 0.0f ||
+                 sphereInFrustum(submesh.center, submesh.radius, planes)) {
+        frame.textureStreamer->request(
+            tex, texelsPerPixel(submesh, image, model, frame));
+      }
+    }
+
+    // Instanced submeshes share one LOD: the finest any instance needs.
+    shader.setBool("uInstanced", instanced);
+    std::size_t level = 0;
+    if (instanced) {
+      level = submesh.lods.size();
+      for (std::uint32_t i = 0; i < submesh.instanceCount && level > 0; ++i)
+        level = std::min(
+            level,
+            selectLod(submesh,
+                      model * modelData_->instances[submesh.instanceOffset + i],
+                      frame));
     } else {
-      glActiveTexture(GL_TEXTURE0);
-      glBindTexture(GL_TEXTURE_2D, 0);
+      level = selectLod(submesh, model, frame);
+    }
+    std::uint32_t indexOffset = submesh.indexOffset;
+    std::uint32_t indexCount = submesh.indexCount;
+    if (level > 0) {
+      indexOffset = submesh.lods[level - 1].indexOffset;
+      indexCount = submesh.lods[level - 1].indexCount;
+    }
+
+    if (instanced) {
+      mesh_->drawRangeInstanced(indexOffset, indexCount,
+                                submesh.instanceOffset, submesh.instanceCount);
+      if (frame.stats) {
+        frame.stats->submeshesPerLod[std::min(level, kMaxLods - 1)]++;
+        frame.stats->triangles +=
+            std::size_t{indexCount / 3} * submesh.instanceCount;
+        frame.stats->drawCalls++;
+      }
+      continue;
+    }
+
+    // Meshlets are culled for the single-transform case only.
+    if (level == 0 && cullMeshlets && submesh.meshletCount > 0) {
+      offsets.clear();
+      counts.clear();
+      std::uint32_t triangles = 0, visible = 0;
+      for (std::uint32_t m = 0; m < submesh.meshletCount; ++m) {
+        const Meshlet& meshlet =
+            modelData_->meshlets[submesh.meshletOffset + m];
+        if (!meshletInFrustum(meshlet, planes) ||
+            (cullBackFaces && meshletBackfacing(meshlet, cameraModel)))
+          continue;
+        triangles += meshlet.indexCount / 3;
+        visible++;
+        // Neighbouring survivors are contiguous in the index buffer.
+        if (!offsets.empty() &&
+            offsets.back() + counts.back() == meshlet.indexOffset) {
+          counts.back() += meshlet.indexCount;
+        } else {
+          offsets.push_back(meshlet.indexOffset);
+          counts.push_back(meshlet.indexCount);
+        }
+      }
+      const std::size_t calls =
+          mesh_->drawRanges(offsets.data(), counts.data(), offsets.size());
+
+      if (frame.stats) {
+        frame.stats->submeshesPerLod[0]++;
+        frame.stats->triangles += triangles;
+        frame.stats->drawCalls += calls;
+        frame.stats->meshlets += submesh.meshletCount;
+        frame.stats->meshletsCulled += submesh.meshletCount - visible;
+      }
+      continue;
+    }
+
+    mesh_->drawRange(indexOffset, indexCount);
+
+    if (frame.stats) {
+      frame.stats->submeshesPerLod[std::min(level, kMaxLods - 1)]++;
+      frame.stats->triangles += indexCount / 3;
+      frame.stats->drawCalls++;
     }
-    mesh_->drawRange(submesh.indexOffset, submesh.indexCount);
   }
+  if (faceCulling) glDisable(GL_CULL_FACE);
 }
 }  // namespace utils
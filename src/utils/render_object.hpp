@@ -3,6 +3,7 @@
 
 #include <memory>
 
+#include "frame_context.hpp"
 #include "mesh.hpp"
 #include "shader.hpp"
 #include "transform.hpp"
@@ -25,7 +26,11 @@ class RenderObject {
                const std::shared_ptr<ModelData>& modelData);
   virtual ~RenderObject() = default;
 
+  // Draws every submesh at LOD 0.
   virtual void draw(const glm::mat4&) const;
+  // Picks, per submesh, the coarsest LOD whose error projects to at most
+  // frame.lodPixelError pixels.
+  virtual void draw(const FrameContext& frame) const;
 };
 
 }  // namespace utils
@@ -1,44 +1,24 @@
 #include "shader.hpp"
 
-#include <fstream>
+#include <exception>
 #include <iostream>
-#include <sstream>
+
+#include "vfs.hpp"
 
 Shader::Shader(const char* vertexPath, const char* fragmentPath,
                const char* geometryPath) {
   std::string vertexCode;
   std::string fragmentCode;
   std::string geometryCode;
-  std::ifstream vShaderFile;
-  std::ifstream fShaderFile;
-  std::ifstream gShaderFile;
-
-  vShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-  fShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-  gShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
 
+  // Through the Vfs, so shaders come straight out of a mounted pak.
   try {
-    vShaderFile.open(vertexPath);
-    fShaderFile.open(fragmentPath);
-    std::stringstream vShaderStream, fShaderStream;
-
-    vShaderStream << vShaderFile.rdbuf();
-    fShaderStream << fShaderFile.rdbuf();
-
-    vShaderFile.close();
-    fShaderFile.close();
-
-    vertexCode = vShaderStream.str();
-    fragmentCode = fShaderStream.str();
-
-    if (geometryPath != nullptr) {
-      gShaderFile.open(geometryPath);
-      std::stringstream gShaderStream;
-      gShaderStream << gShaderFile.rdbuf();
-      gShaderFile.close();
-      geometryCode = gShaderStream.str();
-    }
-  } catch (std::ifstream::failure& e) {
+    const utils::Vfs& vfs = utils::Vfs::instance();
+    vertexCode = std::string(vfs.open(vertexPath).text());
+    fragmentCode = std::string(vfs.open(fragmentPath).text());
+    if (geometryPath != nullptr)
+      geometryCode = std::string(vfs.open(geometryPath).text());
+  } catch (const std::exception& e) {
     std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ: " << e.what()
               << std::endl;
   }
@@ -0,0 +1,518 @@
+#include "texture.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+#include <string_view>
+
+#include "texture_compress.hpp"
+
+// glad is generated without extensions: formats of
+// EXT_texture_compression_s3tc, EXT_texture_sRGB and
+// ARB_texture_compression_bptc.
+#ifndef GL_COMPRESSED_RGBA_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGBA_S3TC_DXT1_EXT 0x83F1
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+#ifndef GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT
+#define GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT 0x8C4D
+#define GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT 0x8C4F
+#endif
+#ifndef GL_COMPRESSED_RGBA_BPTC_UNORM
+#define GL_COMPRESSED_RGBA_BPTC_UNORM 0x8E8C
+#define GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM 0x8E8D
+#endif
+
+namespace utils {
+namespace {
+
+bool usesMipmaps(GLint minFilter) {
+  return minFilter == GL_NEAREST_MIPMAP_NEAREST ||
+         minFilter == GL_LINEAR_MIPMAP_NEAREST ||
+         minFilter == GL_NEAREST_MIPMAP_LINEAR ||
+         minFilter == GL_LINEAR_MIPMAP_LINEAR;
+}
+
+struct CompressionSupport {
+  bool s3tc = false;
+  bool s3tcSrgb = false;
+  bool bptc = false;
+};
+
+// Queried once, from the first context asked.
+const CompressionSupport& compressionSupport() {
+  static const CompressionSupport support = [] {
+    CompressionSupport s;
+    GLint count = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+    for (GLint i = 0; i < count; ++i) {
+      const auto* name = reinterpret_cast<const char*>(
+          glGetStringi(GL_EXTENSIONS, static_cast<GLuint>(i)));
+      if (!name) continue;
+      const std::string_view ext(name);
+      if (ext == "GL_EXT_texture_compression_s3tc")
+        s.s3tc = true;
+      else if (ext == "GL_EXT_texture_sRGB" ||
+               ext == "GL_EXT_texture_compression_s3tc_srgb")
+        s.s3tcSrgb = true;
+      else if (ext == "GL_ARB_texture_compression_bptc")
+        s.bptc = true;
+    }
+    return s;
+  }();
+  return support;
+}
+
+GLenum compressedFormat(const TextureImage& image) {
+  switch (image.compression) {
+    case TextureCompression::BC1:
+      return image.srgb ? GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT
+                        : GL_COMPRESSED_RGBA_S3TC_DXT1_EXT;
+    case TextureCompression::BC3:
+      return image.srgb ? GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT
+                        : GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+    case TextureCompression::BC7:
+      return image.srgb ? GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM
+                        : GL_COMPRESSED_RGBA_BPTC_UNORM;
+    case TextureCompression::None:
+      break;
+  }
+  throw std::runtime_error("Texture image is not compressed");
+}
+
+// Levels go to GL as blocks; other compressed images upload as RGBA8.
+bool uploadsBlocks(const TextureImage& image) {
+  return image.compression != TextureCompression::None &&
+         textureCompressionSupported(image.compression, image.srgb);
+}
+
+// Levels the created texture ends up with.
+int gpuLevelCount(const TextureImage& image) {
+  const int levelCount = image.levelCount();
+  if (levelCount == 1 && usesMipmaps(image.minFilter) && !uploadsBlocks(image))
+    return mipLevelCount(image.width, image.height);
+  return levelCount;
+}
+
+std::size_t texelCount(const TextureImage& image, int level) {
+  return static_cast<std::size_t>(std::max(1, image.width >> level)) *
+         static_cast<std::size_t>(std::max(1, image.height >> level));
+}
+
+void pickFormats(const TextureImage& image, GLenum& format,
+                 GLenum& internalFormat) {
+  // Compressed images reaching here are decoded to RGBA8.
+  const int components = image.compression == TextureCompression::None
+                             ? image.components
+                             : 4;
+  if (components == 1)
+    format = GL_RED;
+  else if (components == 2)
+    format = GL_RG;
+  else if (components == 3)
+    format = GL_RGB;
+  else if (components == 4)
+    format = GL_RGBA;
+  else
+    throw std::runtime_error("Unsupported image component count");
+
+  internalFormat = GL_RGBA8;
+  if (image.srgb) {
+    if (format == GL_RGB)
+      internalFormat = GL_SRGB8;
+    else if (format == GL_RGBA)
+      internalFormat = GL_SRGB8_ALPHA8;
+    else
+      internalFormat = GL_RGBA8;
+  } else {
+    if (format == GL_RGB)
+      internalFormat = GL_RGB8;
+    else if (format == GL_RGBA)
+      internalFormat = GL_RGBA8;
+  }
+}
+
+GLuint genTexture(const TextureImage& image, GLenum target) {
+  GLuint tex = 0;
+  glGenTextures(1, &tex);
+  glBindTexture(target, tex);
+
+  glTexParameteri(target, GL_TEXTURE_WRAP_S, image.wrapS);
+  glTexParameteri(target, GL_TEXTURE_WRAP_T, image.wrapT);
+  glTexParameteri(target, GL_TEXTURE_MIN_FILTER, image.minFilter);
+  glTexParameteri(target, GL_TEXTURE_MAG_FILTER, image.magFilter);
+  return tex;
+}
+
+// Expects the texture bound to `target`.
+void setMipRange(const TextureImage& image, GLenum target,
+                 int baseLevel = 0) {
+  if (baseLevel > 0) glTexParameteri(target, GL_TEXTURE_BASE_LEVEL, baseLevel);
+  const int levelCount = image.levelCount();
+  if (levelCount == 1 && usesMipmaps(image.minFilter) && !uploadsBlocks(image))
+    glGenerateMipmap(target);
+  else
+    glTexParameteri(target, GL_TEXTURE_MAX_LEVEL, levelCount - 1);
+}
+
+void checkNotEmpty(const TextureImage& image) {
+  if (image.levelCount() <= 0 || image.width <= 0 || image.height <= 0)
+    throw std::runtime_error("Empty texture image");
+}
+
+void checkBaseLevel(const TextureImage& image, int baseLevel) {
+  if (baseLevel < 0 || baseLevel >= image.levelCount())
+    throw std::runtime_error("Texture base level out of range");
+}
+
+// Defines `level` of the bound GL_TEXTURE_2D, filled from the image when
+// `withData` (decoded to RGBA8 when its blocks are not supported).
+void defineLevel(const TextureImage& image, int level, bool withData) {
+  GLenum format = GL_RGBA, internalFormat = GL_RGBA8;
+  pickFormats(image, format, internalFormat);
+
+  const int w = std::max(1, image.width >> level);
+  const int h = std::max(1, image.height >> level);
+  const unsigned char* data = withData ? image.levelData(level) : nullptr;
+  if (uploadsBlocks(image)) {
+    glCompressedTexImage2D(GL_TEXTURE_2D, level, compressedFormat(image), w, h,
+                           0, static_cast<GLsizei>(mipLevelSize(image, level)),
+                           data);
+    return;
+  }
+  std::vector<unsigned char> decoded;
+  if (data && image.compression != TextureCompression::None) {
+    decoded.resize(texelCount(image, level) * 4);
+    decompressTextureRows(image, level, 0, (h + 3) / 4, decoded.data());
+    data = decoded.data();
+  }
+  glTexImage2D(GL_TEXTURE_2D, level, internalFormat, w, h, 0, format,
+               GL_UNSIGNED_BYTE, data);
+}
+
+// Rows [firstRow, firstRow + rowCount) of one level, into a GL_TEXTURE_2D
+// or into `layer` of a GL_TEXTURE_2D_ARRAY.
+void uploadRows(GLenum target, GLuint tex, const TextureImage& image,
+                int layer, int level, int firstRow, int rowCount) {
+  GLenum format = GL_RGBA, internalFormat = GL_RGBA8;
+  pickFormats(image, format, internalFormat);
+
+  const int w = std::max(1, image.width >> level);
+  const std::size_t rowBytes = mipRowBytes(image, level);
+  const int rowHeight = mipRowHeight(image);
+  const int firstStored = firstRow / rowHeight;
+  const int storedRows = (rowCount + rowHeight - 1) / rowHeight;
+  const unsigned char* data =
+      image.levelData(level) + rowBytes * static_cast<std::size_t>(firstStored);
+
+  std::vector<unsigned char> decoded;
+  if (!uploadsBlocks(image) && image.compression != TextureCompression::None) {
+    decoded.resize(static_cast<std::size_t>(w) *
+                   static_cast<std::size_t>(storedRows * rowHeight) * 4);
+    decompressTextureRows(image, level, firstStored, storedRows,
+                          decoded.data());
+    data = decoded.data();
+  }
+
+  glBindTexture(target, tex);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  const auto blockBytes =
+      static_cast<GLsizei>(rowBytes * static_cast<std::size_t>(storedRows));
+  if (target == GL_TEXTURE_2D_ARRAY) {
+    if (uploadsBlocks(image))
+      glCompressedTexSubImage3D(target, level, 0, firstRow, layer, w,
+                                rowCount, 1, compressedFormat(image),
+                                blockBytes, data);
+    else
+      glTexSubImage3D(target, level, 0, firstRow, layer, w, rowCount, 1,
+                      format, GL_UNSIGNED_BYTE, data);
+  } else {
+    if (uploadsBlocks(image))
+      glCompressedTexSubImage2D(target, level, 0, firstRow, w, rowCount,
+                                compressedFormat(image), blockBytes, data);
+    else
+      glTexSubImage2D(target, level, 0, firstRow, w, rowCount, format,
+                      GL_UNSIGNED_BYTE, data);
+  }
+  glBindTexture(target, 0);
+}
+
+}  // namespace
+
+int mipLevelCount(int width, int height) {
+  int levels = 1;
+  while (width > 1 || height > 1) {
+    width = std::max(1, width / 2);
+    height = std::max(1, height / 2);
+    ++levels;
+  }
+  return levels;
+}
+
+std::size_t mipLevelSize(const TextureImage& image, int level) {
+  const int h = std::max(1, image.height >> level);
+  const int rowHeight = mipRowHeight(image);
+  return mipRowBytes(image, level) *
+         static_cast<std::size_t>((h + rowHeight - 1) / rowHeight);
+}
+
+std::size_t mipRowBytes(const TextureImage& image, int level) {
+  const auto w = static_cast<std::size_t>(std::max(1, image.width >> level));
+  switch (image.compression) {
+    case TextureCompression::None:
+      return w * static_cast<std::size_t>(image.components);
+    case TextureCompression::BC1:
+      return (w + 3) / 4 * 8;
+    case TextureCompression::BC3:
+    case TextureCompression::BC7:
+      return (w + 3) / 4 * 16;
+  }
+  return 0;
+}
+
+int mipRowHeight(const TextureImage& image) {
+  return image.compression == TextureCompression::None ? 1 : 4;
+}
+
+const char* textureFormatName(const TextureImage& image) {
+  switch (image.compression) {
+    case TextureCompression::BC1:
+      return "BC1";
+    case TextureCompression::BC3:
+      return "BC3";
+    case TextureCompression::BC7:
+      return "BC7";
+    case TextureCompression::None:
+      break;
+  }
+  static const char* const kNames[] = {"R8", "RG8", "RGB8", "RGBA8"};
+  return kNames[std::clamp(image.components, 1, 4) - 1];
+}
+
+bool textureCompressionSupported(TextureCompression compression, bool srgb) {
+  const CompressionSupport& s = compressionSupport();
+  switch (compression) {
+    case TextureCompression::None:
+      return true;
+    case TextureCompression::BC1:
+    case TextureCompression::BC3:
+      return s.s3tc && (!srgb || s.s3tcSrgb);
+    case TextureCompression::BC7:
+      return s.bptc;
+  }
+  return false;
+}
+
+std::size_t textureMemorySize(const TextureImage& image) {
+  std::size_t total = 0;
+  for (int level = 0; level < gpuLevelCount(image); ++level)
+    total += textureLevelMemorySize(image, level);
+  return total;
+}
+
+std::size_t textureLevelMemorySize(const TextureImage& image, int level) {
+  if (uploadsBlocks(image)) return mipLevelSize(image, level);
+  const std::size_t texelBytes =
+      image.compression == TextureCompression::None
+          ? static_cast<std::size_t>(image.components)
+          : 4;
+  return texelCount(image, level) * texelBytes;
+}
+
+std::size_t rgba8MemorySize(const TextureImage& image) {
+  int levels = image.levelCount();
+  if (levels == 1 && usesMipmaps(image.minFilter))
+    levels = mipLevelCount(image.width, image.height);
+  std::size_t total = 0;
+  for (int level = 0; level < levels; ++level)
+    total += texelCount(image, level) * 4;
+  return total;
+}
+
+bool samplesMipmaps(const TextureImage& image) {
+  return usesMipmaps(image.minFilter);
+}
+
+GLuint createTexture(const TextureImage& image, int baseLevel) {
+  checkNotEmpty(image);
+  checkBaseLevel(image, baseLevel);
+
+  const GLuint tex = genTexture(image, GL_TEXTURE_2D);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  for (int level = baseLevel; level < image.levelCount(); ++level)
+    defineLevel(image, level, true);
+  setMipRange(image, GL_TEXTURE_2D, baseLevel);
+
+  glBindTexture(GL_TEXTURE_2D, 0);
+  return tex;
+}
+
+GLuint allocateTexture(const TextureImage& image, int baseLevel) {
+  checkNotEmpty(image);
+  checkBaseLevel(image, baseLevel);
+
+  const GLuint tex = genTexture(image, GL_TEXTURE_2D);
+  for (int level = baseLevel; level < image.levelCount(); ++level)
+    defineLevel(image, level, false);
+  glBindTexture(GL_TEXTURE_2D, 0);
+  return tex;
+}
+
+void uploadTextureRows(GLuint tex, const TextureImage& image, int level,
+                       int firstRow, int rowCount) {
+  uploadRows(GL_TEXTURE_2D, tex, image, 0, level, firstRow, rowCount);
+}
+
+void finishTexture(GLuint tex, const TextureImage& image, int baseLevel) {
+  glBindTexture(GL_TEXTURE_2D, tex);
+  setMipRange(image, GL_TEXTURE_2D, baseLevel);
+  glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+void uploadTextureLevel(GLuint tex, const TextureImage& image, int level) {
+  checkBaseLevel(image, level);
+  glBindTexture(GL_TEXTURE_2D, tex);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  defineLevel(image, level, true);
+  glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+void releaseTextureLevel(GLuint tex, int level) {
+  // Levels below the base level take no part in completeness, so the
+  // format does not have to match.
+  glBindTexture(GL_TEXTURE_2D, tex);
+  glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA8, 0, 0, 0, GL_RGBA,
+               GL_UNSIGNED_BYTE, nullptr);
+  glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+void setTextureBaseLevel(GLuint tex, int level) {
+  glBindTexture(GL_TEXTURE_2D, tex);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level);
+  glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+bool textureArrayCompatible(const TextureImage& a, const TextureImage& b) {
+  return a.width == b.width && a.height == b.height &&
+         a.levelCount() == b.levelCount() && a.compression == b.compression &&
+         a.srgb == b.srgb &&
+         (a.compression != TextureCompression::None ||
+          a.components == b.components) &&
+         a.wrapS == b.wrapS && a.wrapT == b.wrapT &&
+         a.minFilter == b.minFilter && a.magFilter == b.magFilter;
+}
+
+std::vector<std::vector<int>> groupTextureArrays(
+    const std::vector<TextureImage>& images) {
+  std::vector<std::vector<int>> groups;
+  for (int i = 0; i < static_cast<int>(images.size()); ++i) {
+    const TextureImage& image = images[static_cast<std::size_t>(i)];
+    auto fits = [&](const std::vector<int>& group) {
+      return static_cast<int>(group.size()) < kMaxTextureArrayLayers &&
+             textureArrayCompatible(
+                 images[static_cast<std::size_t>(group.front())], image);
+    };
+    auto it = std::find_if(groups.begin(), groups.end(), fits);
+    if (it == groups.end())
+      groups.push_back({i});
+    else
+      it->push_back(i);
+  }
+  return groups;
+}
+
+Hash128 textureKey(const TextureImage& image) {
+  const std::int32_t header[] = {image.width,
+                                 image.height,
+                                 image.components,
+                                 image.srgb,
+                                 static_cast<std::int32_t>(image.compression),
+                                 image.wrapS,
+                                 image.wrapT,
+                                 image.minFilter,
+                                 image.magFilter,
+                                 image.levelCount()};
+  Hash128 key = hash128(header, sizeof(header));
+  for (int level = 0; level < image.levelCount(); ++level)
+    key = hash128(image.levelData(level), mipLevelSize(image, level), key);
+  return key;
+}
+
+Hash128 textureArrayKey(const std::vector<TextureImage>& images,
+                        const std::vector<int>& group) {
+  const std::int32_t layers = static_cast<std::int32_t>(group.size());
+  Hash128 key = hash128(&layers, sizeof(layers), {0, 1});
+  for (int index : group) {
+    const Hash128 layer = textureKey(images[static_cast<std::size_t>(index)]);
+    key = hash128(&layer, sizeof(layer), key);
+  }
+  return key;
+}
+
+std::size_t textureLevelBytes(const TextureImage& image) {
+  std::size_t total = 0;
+  for (int level = 0; level < image.levelCount(); ++level)
+    total += mipLevelSize(image, level);
+  return total;
+}
+
+GLuint createTextureArray(const std::vector<TextureImage>& images,
+                          const std::vector<int>& group) {
+  if (group.empty()) throw std::runtime_error("Empty texture array");
+  const TextureImage& first = images[static_cast<std::size_t>(group.front())];
+  for (int index : group)
+    if (!textureArrayCompatible(first,
+                                images[static_cast<std::size_t>(index)]))
+      throw std::runtime_error("Texture array layers differ");
+
+  const GLuint tex =
+      allocateTextureArray(first, static_cast<int>(group.size()));
+  for (int layer = 0; layer < static_cast<int>(group.size()); ++layer) {
+    const int index = group[static_cast<std::size_t>(layer)];
+    const TextureImage& image = images[static_cast<std::size_t>(index)];
+    for (int level = 0; level < image.levelCount(); ++level)
+      uploadTextureLayerRows(tex, image, layer, level, 0,
+                             std::max(1, image.height >> level));
+  }
+  finishTextureArray(tex, first);
+  return tex;
+}
+
+GLuint allocateTextureArray(const TextureImage& image, int layers) {
+  checkNotEmpty(image);
+  if (layers <= 0 || layers > kMaxTextureArrayLayers)
+    throw std::runtime_error("Bad texture array layer count");
+
+  GLenum format = GL_RGBA, internalFormat = GL_RGBA8;
+  pickFormats(image, format, internalFormat);
+
+  const bool blocks = uploadsBlocks(image);
+  const GLuint tex = genTexture(image, GL_TEXTURE_2D_ARRAY);
+  for (int level = 0; level < image.levelCount(); ++level) {
+    const int w = std::max(1, image.width >> level);
+    const int h = std::max(1, image.height >> level);
+    if (blocks)
+      glCompressedTexImage3D(
+          GL_TEXTURE_2D_ARRAY, level, compressedFormat(image), w, h, layers,
+          0, static_cast<GLsizei>(mipLevelSize(image, level) * layers),
+          nullptr);
+    else
+      glTexImage3D(GL_TEXTURE_2D_ARRAY, level, internalFormat, w, h, layers,
+                   0, format, GL_UNSIGNED_BYTE, nullptr);
+  }
+  glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+  return tex;
+}
+
+void uploadTextureLayerRows(GLuint tex, const TextureImage& image, int layer,
+                            int level, int firstRow, int rowCount) {
+  uploadRows(GL_TEXTURE_2D_ARRAY, tex, image, layer, level, firstRow,
+             rowCount);
+}
+
+void finishTextureArray(GLuint tex, const TextureImage& image) {
+  glBindTexture(GL_TEXTURE_2D_ARRAY, tex);
+  setMipRange(image, GL_TEXTURE_2D_ARRAY);
+  glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+}
+
+}  // namespace utils
@@ -0,0 +1,126 @@
+#ifndef TEXTURE_HPP
+#define TEXTURE_HPP
+
+#include <glad/glad.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "hash.hpp"
+
+namespace utils {
+
+// Block-compressed level storage: rows of 4x4 texel blocks, 8 bytes each
+// for BC1 and 16 for BC3/BC7.
+enum class TextureCompression : std::uint8_t { None, BC1, BC3, BC7 };
+
+// CPU-side texture: level 0 plus an optional precomputed mip chain, and the
+// sampler state it should be created with.
+struct TextureImage {
+  int width = 0;
+  int height = 0;
+  int components = 4;  // of the source texels when compressed
+  bool srgb = false;
+  TextureCompression compression = TextureCompression::None;
+
+  GLint wrapS = GL_REPEAT;
+  GLint wrapT = GL_REPEAT;
+  GLint minFilter = GL_LINEAR_MIPMAP_LINEAR;
+  GLint magFilter = GL_LINEAR;
+
+  std::vector<std::vector<unsigned char>> levels;
+
+  // Level data borrowed from `backing` (e.g. a mapped cooked file); used
+  // instead of `levels` when non-empty.
+  std::shared_ptr<const void> backing;
+  std::vector<const unsigned char*> borrowedLevels;
+
+  int levelCount() const {
+    return static_cast<int>(borrowedLevels.empty() ? levels.size()
+                                                   : borrowedLevels.size());
+  }
+  const unsigned char* levelData(int level) const {
+    return borrowedLevels.empty() ? levels[static_cast<size_t>(level)].data()
+                                  : borrowedLevels[static_cast<size_t>(level)];
+  }
+};
+
+int mipLevelCount(int width, int height);
+std::size_t mipLevelSize(const TextureImage& image, int level);
+// Bytes per texel row, or per row of blocks when compressed.
+std::size_t mipRowBytes(const TextureImage& image, int level);
+// Texel rows per stored row: 4 when compressed, else 1.
+int mipRowHeight(const TextureImage& image);
+// "BC1", "BC3", "BC7", or "R8"/"RG8"/"RGB8"/"RGBA8" for uncompressed data.
+const char* textureFormatName(const TextureImage& image);
+
+// Whether the current GL context samples `compression` (in sRGB if asked).
+// Compressed images it does not are decoded to RGBA8 on upload.
+bool textureCompressionSupported(TextureCompression compression, bool srgb);
+
+// Whether the image's min filter samples mip levels.
+bool samplesMipmaps(const TextureImage& image);
+
+// Creates a GL texture from the image's levels. A single level with a
+// mipmapping min filter falls back to glGenerateMipmap. Levels finer than
+// `baseLevel` are left undefined and GL_TEXTURE_BASE_LEVEL skips them (see
+// TextureStreamer).
+GLuint createTexture(const TextureImage& image, int baseLevel = 0);
+
+// GPU bytes of the texture created from `image`, every level counted (also
+// those glGenerateMipmap adds), and of the same texture as plain RGBA8.
+// The first asks the GL context about compression support.
+std::size_t textureMemorySize(const TextureImage& image);
+std::size_t rgba8MemorySize(const TextureImage& image);
+// GPU bytes of one level of the texture created from `image`.
+std::size_t textureLevelMemorySize(const TextureImage& image, int level);
+
+// Staged variant of createTexture for spreading an upload over several
+// frames: allocate every level, fill row bands, then finish. Compressed
+// bands start on a multiple of mipRowHeight rows.
+GLuint allocateTexture(const TextureImage& image, int baseLevel = 0);
+void uploadTextureRows(GLuint tex, const TextureImage& image, int level,
+                       int firstRow, int rowCount);
+void finishTexture(GLuint tex, const TextureImage& image, int baseLevel = 0);
+
+// Mip streaming on a texture created with a baseLevel: define and fill one
+// finer level, or free one (redefined as 0x0), and move the base level that
+// sampling starts at. The texture object is never recreated.
+void uploadTextureLevel(GLuint tex, const TextureImage& image, int level);
+void releaseTextureLevel(GLuint tex, int level);
+void setTextureBaseLevel(GLuint tex, int level);
+
+// GL_TEXTURE_2D_ARRAY layers GL 3.3 guarantees.
+constexpr int kMaxTextureArrayLayers = 256;
+
+// Whether two images can be layers of one texture array: same size, level
+// count, stored format and sampler state.
+bool textureArrayCompatible(const TextureImage& a, const TextureImage& b);
+// Splits `images` into groups of compatible images, in order, at most
+// kMaxTextureArrayLayers each; group[k] becomes layer k of its array.
+std::vector<std::vector<int>> groupTextureArrays(
+    const std::vector<TextureImage>& images);
+// Creates a GL_TEXTURE_2D_ARRAY with one layer per image of `group`.
+GLuint createTextureArray(const std::vector<TextureImage>& images,
+                          const std::vector<int>& group);
+
+// Content keys of the textures createTexture(image) (at base level 0) and
+// createTextureArray(images, group) make: every level's bytes, the format
+// and the sampler state. GpuObjectCache shares textures by them.
+Hash128 textureKey(const TextureImage& image);
+Hash128 textureArrayKey(const std::vector<TextureImage>& images,
+                        const std::vector<int>& group);
+// Bytes of the image's stored levels, as uploaded.
+std::size_t textureLevelBytes(const TextureImage& image);
+
+// Staged variant of createTextureArray; `image` is any of the layers.
+GLuint allocateTextureArray(const TextureImage& image, int layers);
+void uploadTextureLayerRows(GLuint tex, const TextureImage& image, int layer,
+                            int level, int firstRow, int rowCount);
+void finishTextureArray(GLuint tex, const TextureImage& image);
+
+}  // namespace utils
+
+#endif
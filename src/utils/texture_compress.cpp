@@ -0,0 +1,711 @@
+#include "texture_compress.hpp"
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstdint>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "texture_mips.hpp"
+#include "thread_pool.hpp"
+
+namespace utils {
+namespace {
+
+// BC7 4-bit index interpolation weights, out of 64.
+constexpr int kBc7Weights[16] = {0,  4,  9,  13, 17, 21, 26, 30,
+                                 34, 38, 43, 47, 51, 55, 60, 64};
+
+// Weight of endpoint 0 for each BC1 colour index in 4-colour mode.
+constexpr float kBc1FitWeights[4] = {1.0f, 0.0f, 2.0f / 3.0f, 1.0f / 3.0f};
+
+// The 4x4 texels at block (bx, by) as RGBA8, expanded the way GL samples
+// RED/RG/RGB data; edge texels repeat into blocks hanging over the level.
+void loadBlock(const unsigned char* src, int width, int height,
+               int components, int bx, int by, unsigned char px[64]) {
+  for (int y = 0; y < 4; ++y) {
+    const int sy = std::min(height - 1, by * 4 + y);
+    for (int x = 0; x < 4; ++x) {
+      const int sx = std::min(width - 1, bx * 4 + x);
+      const unsigned char* p =
+          src + (static_cast<std::size_t>(sy) * width + sx) * components;
+      unsigned char* d = px + (y * 4 + x) * 4;
+      // Gray (+ alpha) spreads over RGB, as in the RGBA8 paths.
+      d[0] = p[0];
+      d[1] = components >= 3 ? p[1] : p[0];
+      d[2] = components >= 3 ? p[2] : p[0];
+      d[3] = components == 4 ? p[3] : components == 2 ? p[1] : 255;
+    }
+  }
+}
+
+// Initial endpoints: the two texels furthest apart along the principal axis
+// of the block's first `channels` channels (power iteration on the
+// covariance).
+void principalEndpoints(const unsigned char px[64], int channels, float e0[4],
+                        float e1[4]) {
+  float mean[4] = {};
+  for (int i = 0; i < 16; ++i)
+    for (int c = 0; c < channels; ++c) mean[c] += px[i * 4 + c];
+  for (int c = 0; c < channels; ++c) mean[c] /= 16.0f;
+
+  float cov[4][4] = {};
+  for (int i = 0; i < 16; ++i) {
+    float d[4];
+    for (int c = 0; c < channels; ++c) d[c] = px[i * 4 + c] - mean[c];
+    for (int a = 0; a < channels; ++a)
+      for (int b = 0; b < channels; ++b) cov[a][b] += d[a] * d[b];
+  }
+
+  float axis[4] = {1.0f, 1.0f, 1.0f, 1.0f};
+  for (int iter = 0; iter < 8; ++iter) {
+    float next[4] = {};
+    float scale = 0.0f;
+    for (int a = 0; a < channels; ++a) {
+      for (int b = 0; b < channels; ++b) next[a] += cov[a][b] * axis[b];
+      scale = std::max(scale, std::abs(next[a]));
+    }
+    if (scale < 1e-6f) break;
+    for (int c = 0; c < channels; ++c) axis[c] = next[c] / scale;
+  }
+
+  int lo = 0, hi = 0;
+  float loDot = 0.0f, hiDot = 0.0f;
+  for (int i = 0; i < 16; ++i) {
+    float dot = 0.0f;
+    for (int c = 0; c < channels; ++c) dot += px[i * 4 + c] * axis[c];
+    if (i == 0 || dot < loDot) loDot = dot, lo = i;
+    if (i == 0 || dot > hiDot) hiDot = dot, hi = i;
+  }
+  for (int c = 0; c < 4; ++c) {
+    e0[c] = px[hi * 4 + c];
+    e1[c] = px[lo * 4 + c];
+  }
+}
+
+// Least-squares endpoints for fixed indices, texel i being approximated by
+// w * e0 + (1 - w) * e1 with w = weights[idx[i]]. False when the indices do
+// not pull the endpoints apart.
+bool fitEndpoints(const unsigned char px[64], int channels,
+                  const unsigned char idx[16], const float* weights,
+                  float e0[4], float e1[4]) {
+  float aa = 0.0f, bb = 0.0f, ab = 0.0f;
+  float ax[4] = {}, bx[4] = {};
+  for (int i = 0; i < 16; ++i) {
+    const float a = weights[idx[i]];
+    const float b = 1.0f - a;
+    aa += a * a;
+    bb += b * b;
+    ab += a * b;
+    for (int c = 0; c < channels; ++c) {
+      ax[c] += a * px[i * 4 + c];
+      bx[c] += b * px[i * 4 + c];
+    }
+  }
+  const float det = aa * bb - ab * ab;
+  if (std::abs(det) < 1e-4f) return false;
+  for (int c = 0; c < channels; ++c) {
+    e0[c] = std::clamp((ax[c] * bb - bx[c] * ab) / det, 0.0f, 255.0f);
+    e1[c] = std::clamp((bx[c] * aa - ax[c] * ab) / det, 0.0f, 255.0f);
+  }
+  return true;
+}
+
+// --- BC1 colour -------------------------------------------------------------
+
+std::uint16_t pack565(const float c[4]) {
+  const int r = std::clamp(static_cast<int>(c[0] * 31.0f / 255.0f + 0.5f), 0,
+                           31);
+  const int g = std::clamp(static_cast<int>(c[1] * 63.0f / 255.0f + 0.5f), 0,
+                           63);
+  const int b = std::clamp(static_cast<int>(c[2] * 31.0f / 255.0f + 0.5f), 0,
+                           31);
+  return static_cast<std::uint16_t>((r << 11) | (g << 5) | b);
+}
+
+void unpack565(std::uint16_t v, int out[3]) {
+  const int r = (v >> 11) & 31;
+  const int g = (v >> 5) & 63;
+  const int b = v & 31;
+  out[0] = (r << 3) | (r >> 2);
+  out[1] = (g << 2) | (g >> 4);
+  out[2] = (b << 3) | (b >> 2);
+}
+
+// RGBA palette of a colour block; BC3 always decodes in 4-colour mode, BC1
+// only when c0 > c1.
+void colourPalette(std::uint16_t c0, std::uint16_t c1, bool fourColour,
+                   int palette[4][4]) {
+  unpack565(c0, palette[0]);
+  unpack565(c1, palette[1]);
+  for (int c = 0; c < 3; ++c) {
+    const int a = palette[0][c], b = palette[1][c];
+    if (fourColour) {
+      palette[2][c] = (2 * a + b) / 3;
+      palette[3][c] = (a + 2 * b) / 3;
+    } else {
+      palette[2][c] = (a + b) / 2;
+      palette[3][c] = 0;
+    }
+  }
+  palette[0][3] = palette[1][3] = palette[2][3] = 255;
+  palette[3][3] = fourColour ? 255 : 0;
+}
+
+// Nearest palette entry per texel (RGB); returns the summed squared error.
+int pickColourIndices(const unsigned char px[64], const int palette[4][4],
+                      unsigned char idx[16]) {
+  int total = 0;
+  for (int i = 0; i < 16; ++i) {
+    int best = INT_MAX;
+    for (int j = 0; j < 4; ++j) {
+      int err = 0;
+      for (int c = 0; c < 3; ++c) {
+        const int d = px[i * 4 + c] - palette[j][c];
+        err += d * d;
+      }
+      if (err < best) best = err, idx[i] = static_cast<unsigned char>(j);
+    }
+    total += best;
+  }
+  return total;
+}
+
+// 4-colour BC1 block (also the colour half of BC3): principal-axis
+// endpoints, then least-squares refits while they lower the error.
+void encodeColourBlock(const unsigned char px[64], unsigned char out[8]) {
+  float f0[4], f1[4];
+  principalEndpoints(px, 3, f0, f1);
+  std::uint16_t c0 = pack565(f0), c1 = pack565(f1);
+  int palette[4][4];
+  colourPalette(c0, c1, true, palette);
+  unsigned char idx[16];
+  int err = pickColourIndices(px, palette, idx);
+
+  for (int iter = 0; iter < 2 && err > 0; ++iter) {
+    if (!fitEndpoints(px, 3, idx, kBc1FitWeights, f0, f1)) break;
+    const std::uint16_t n0 = pack565(f0), n1 = pack565(f1);
+    if (n0 == c0 && n1 == c1) break;
+    colourPalette(n0, n1, true, palette);
+    unsigned char next[16];
+    const int nextErr = pickColourIndices(px, palette, next);
+    if (nextErr >= err) break;
+    c0 = n0, c1 = n1, err = nextErr;
+    std::copy(next, next + 16, idx);
+  }
+
+  // BC1 reads c0 <= c1 as 3-colour mode; swapping the endpoints maps
+  // indices 0 <-> 1 and 2 <-> 3.
+  if (c0 < c1) {
+    std::swap(c0, c1);
+    for (unsigned char& i : idx) i ^= 1;
+  } else if (c0 == c1) {
+    std::fill(idx, idx + 16, 0);
+  }
+
+  std::uint32_t bits = 0;
+  for (int i = 0; i < 16; ++i) bits |= std::uint32_t{idx[i]} << (2 * i);
+  out[0] = static_cast<unsigned char>(c0 & 0xFF);
+  out[1] = static_cast<unsigned char>(c0 >> 8);
+  out[2] = static_cast<unsigned char>(c1 & 0xFF);
+  out[3] = static_cast<unsigned char>(c1 >> 8);
+  for (int k = 0; k < 4; ++k)
+    out[4 + k] = static_cast<unsigned char>(bits >> (8 * k));
+}
+
+void decodeColourBlock(const unsigned char in[8], bool bc1,
+                       unsigned char px[64]) {
+  const auto c0 = static_cast<std::uint16_t>(in[0] | (in[1] << 8));
+  const auto c1 = static_cast<std::uint16_t>(in[2] | (in[3] << 8));
+  int palette[4][4];
+  colourPalette(c0, c1, !bc1 || c0 > c1, palette);
+  for (int i = 0; i < 16; ++i) {
+    const int j = (in[4 + i / 4] >> (2 * (i % 4))) & 3;
+    for (int c = 0; c < 4; ++c)
+      px[i * 4 + c] = static_cast<unsigned char>(palette[j][c]);
+  }
+}
+
+// --- BC3 alpha --------------------------------------------------------------
+
+void alphaPalette(int a0, int a1, int palette[8]) {
+  palette[0] = a0;
+  palette[1] = a1;
+  if (a0 > a1) {
+    for (int i = 1; i < 7; ++i)
+      palette[i + 1] = ((7 - i) * a0 + i * a1) / 7;
+  } else {
+    for (int i = 1; i < 5; ++i)
+      palette[i + 1] = ((5 - i) * a0 + i * a1) / 5;
+    palette[6] = 0;
+    palette[7] = 255;
+  }
+}
+
+// 8-value alpha block spanning the block's alpha range.
+void encodeAlphaBlock(const unsigned char px[64], unsigned char out[8]) {
+  int lo = 255, hi = 0;
+  for (int i = 0; i < 16; ++i) {
+    lo = std::min<int>(lo, px[i * 4 + 3]);
+    hi = std::max<int>(hi, px[i * 4 + 3]);
+  }
+  int palette[8];
+  alphaPalette(hi, lo, palette);
+
+  std::uint64_t bits = 0;
+  if (hi > lo) {
+    for (int i = 0; i < 16; ++i) {
+      int best = INT_MAX, bestIndex = 0;
+      for (int j = 0; j < 8; ++j) {
+        const int d = std::abs(px[i * 4 + 3] - palette[j]);
+        if (d < best) best = d, bestIndex = j;
+      }
+      bits |= static_cast<std::uint64_t>(bestIndex) << (3 * i);
+    }
+  }
+  out[0] = static_cast<unsigned char>(hi);
+  out[1] = static_cast<unsigned char>(lo);
+  for (int k = 0; k < 6; ++k)
+    out[2 + k] = static_cast<unsigned char>(bits >> (8 * k));
+}
+
+void decodeAlphaBlock(const unsigned char in[8], unsigned char px[64]) {
+  int palette[8];
+  alphaPalette(in[0], in[1], palette);
+  std::uint64_t bits = 0;
+  for (int k = 0; k < 6; ++k)
+    bits |= static_cast<std::uint64_t>(in[2 + k]) << (8 * k);
+  for (int i = 0; i < 16; ++i)
+    px[i * 4 + 3] = static_cast<unsigned char>(palette[(bits >> (3 * i)) & 7]);
+}
+
+// --- BC7 mode 6 encoding ----------------------------------------------------
+
+// Little-endian bit stream over a 16-byte block.
+struct BlockBits {
+  unsigned char* block;
+  int pos = 0;
+
+  void put(unsigned value, int count) {
+    for (int i = 0; i < count; ++i, ++pos)
+      if ((value >> i) & 1u)
+        block[pos >> 3] |= static_cast<unsigned char>(1u << (pos & 7));
+  }
+  unsigned get(int count) {
+    unsigned value = 0;
+    for (int i = 0; i < count; ++i, ++pos)
+      value |= ((block[pos >> 3] >> (pos & 7)) & 1u) << i;
+    return value;
+  }
+};
+
+// Mode 6 endpoint: seven bits per channel plus a p-bit shared by the four.
+void quantiseBc7(const float e[4], int pBit, int out[4]) {
+  for (int c = 0; c < 4; ++c) {
+    const int q = std::clamp(static_cast<int>(std::lround((e[c] - pBit) / 2)),
+                             0, 127);
+    out[c] = (q << 1) | pBit;
+  }
+}
+
+// Nearest of the 16 interpolated colours per texel (RGBA): the projection
+// on the endpoint axis picks a candidate, its neighbours settle the weight
+// table's rounding. Returns the summed squared error.
+int pickBc7Indices(const unsigned char px[64], const int e0[4],
+                   const int e1[4], unsigned char idx[16]) {
+  int palette[16][4];
+  for (int j = 0; j < 16; ++j)
+    for (int c = 0; c < 4; ++c)
+      palette[j][c] =
+          ((64 - kBc7Weights[j]) * e0[c] + kBc7Weights[j] * e1[c] + 32) >> 6;
+  int axis[4], axisLength = 0;
+  for (int c = 0; c < 4; ++c) {
+    axis[c] = e1[c] - e0[c];
+    axisLength += axis[c] * axis[c];
+  }
+
+  int total = 0;
+  for (int i = 0; i < 16; ++i) {
+    int guess = 0;
+    if (axisLength > 0) {
+      int dot = 0;
+      for (int c = 0; c < 4; ++c) dot += (px[i * 4 + c] - e0[c]) * axis[c];
+      guess = std::clamp(
+          static_cast<int>(std::lround(dot * 15.0f / axisLength)), 0, 15);
+    }
+    int best = INT_MAX;
+    for (int j = std::max(0, guess - 1); j <= std::min(15, guess + 1); ++j) {
+      int err = 0;
+      for (int c = 0; c < 4; ++c) {
+        const int d = px[i * 4 + c] - palette[j][c];
+        err += d * d;
+      }
+      if (err < best) best = err, idx[i] = static_cast<unsigned char>(j);
+    }
+    total += best;
+  }
+  return total;
+}
+
+void encodeBc7Block(const unsigned char px[64], unsigned char out[16]) {
+  float fitWeights[16];
+  for (int j = 0; j < 16; ++j) fitWeights[j] = (64 - kBc7Weights[j]) / 64.0f;
+
+  float f0[4], f1[4];
+  principalEndpoints(px, 4, f0, f1);
+  int best = INT_MAX;
+  int e0[4] = {}, e1[4] = {}, p0 = 0, p1 = 0;
+  unsigned char idx[16] = {};
+  for (int pass = 0; pass < 3; ++pass) {
+    for (int p = 0; p < 4; ++p) {
+      int q0[4], q1[4];
+      quantiseBc7(f0, p & 1, q0);
+      quantiseBc7(f1, p >> 1, q1);
+      unsigned char candidate[16];
+      const int err = pickBc7Indices(px, q0, q1, candidate);
+      if (err < best) {
+        best = err;
+        std::copy(q0, q0 + 4, e0);
+        std::copy(q1, q1 + 4, e1);
+        p0 = p & 1, p1 = p >> 1;
+        std::copy(candidate, candidate + 16, idx);
+      }
+    }
+    if (best == 0 || !fitEndpoints(px, 4, idx, fitWeights, f0, f1)) break;
+  }
+
+  // Texel 0's index is stored without its top bit: swap the endpoints if
+  // it is set.
+  if (idx[0] >= 8) {
+    std::swap(e0, e1);
+    std::swap(p0, p1);
+    for (unsigned char& i : idx) i = static_cast<unsigned char>(15 - i);
+  }
+
+  std::fill(out, out + 16, 0);
+  BlockBits bits{out};
+  bits.put(1u << 6, 7);
+  for (int c = 0; c < 4; ++c) {
+    bits.put(static_cast<unsigned>(e0[c] >> 1), 7);
+    bits.put(static_cast<unsigned>(e1[c] >> 1), 7);
+  }
+  bits.put(static_cast<unsigned>(p0), 1);
+  bits.put(static_cast<unsigned>(p1), 1);
+  bits.put(idx[0], 3);
+  for (int i = 1; i < 16; ++i) bits.put(idx[i], 4);
+}
+
+// --- BC7 decoding -----------------------------------------------------------
+
+// Subset of each texel in the 64 two-subset partitions (bit i set = texel i
+// in subset 1) and three-subset partitions (two bits per texel).
+constexpr std::uint16_t kBc7Partitions2[64] = {
+    0xcccc, 0x8888, 0xeeee, 0xecc8, 0xc880, 0xfeec, 0xfec8, 0xec80,
+    0xc800, 0xffec, 0xfe80, 0xe800, 0xffe8, 0xff00, 0xfff0, 0xf000,
+    0xf710, 0x008e, 0x7100, 0x08ce, 0x008c, 0x7310, 0x3100, 0x8cce,
+    0x088c, 0x3110, 0x6666, 0x366c, 0x17e8, 0x0ff0, 0x718e, 0x399c,
+    0xaaaa, 0xf0f0, 0x5a5a, 0x33cc, 0x3c3c, 0x55aa, 0x9696, 0xa55a,
+    0x73ce, 0x13c8, 0x324c, 0x3bdc, 0x6996, 0xc33c, 0x9966, 0x0660,
+    0x0272, 0x04e4, 0x4e40, 0x2720, 0xc936, 0x936c, 0x39c6, 0x639c,
+    0x9336, 0x9cc6, 0x817e, 0xe718, 0xccf0, 0x0fcc, 0x7744, 0xee22,
+};
+constexpr std::uint32_t kBc7Partitions3[64] = {
+    0xaa685050, 0x6a5a5040, 0x5a5a4200, 0x5450a0a8, 0xa5a50000, 0xa0a05050,
+    0x5555a0a0, 0x5a5a5050, 0xaa550000, 0xaa555500, 0xaaaa5500, 0x90909090,
+    0x94949494, 0xa4a4a4a4, 0xa9a59450, 0x2a0a4250, 0xa5945040, 0x0a425054,
+    0xa5a5a500, 0x55a0a0a0, 0xa8a85454, 0x6a6a4040, 0xa4a45000, 0x1a1a0500,
+    0x0050a4a4, 0xaaa59090, 0x14696914, 0x69691400, 0xa08585a0, 0xaa821414,
+    0x50a4a450, 0x6a5a0200, 0xa9a58000, 0x5090a0a8, 0xa8a09050, 0x24242424,
+    0x00aa5500, 0x24924924, 0x24499224, 0x50a50a50, 0x500aa550, 0xaaaa4444,
+    0x66660000, 0xa5a0a5a0, 0x50a050a0, 0x69286928, 0x44aaaa44, 0x66666600,
+    0xaa444444, 0x54a854a8, 0x95809580, 0x96969600, 0xa85454a8, 0x80959580,
+    0xaa141414, 0x96960000, 0xaaaa1414, 0xa05050a0, 0xa0a5a5a0, 0x96000000,
+    0x40804080, 0xa9a8a9a8, 0xaaaaaa44, 0x2a4a5254,
+};
+
+// Anchor texels (stored with one index bit less) of subset 1 of two, and of
+// subsets 1 and 2 of three; subset 0's is always texel 0.
+constexpr std::uint8_t kBc7Anchors2[64] = {
+    15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15,
+    15, 2,  8,  2,  2,  8,  8,  15, 2,  8,  2,  2,  8,  8,  2,  2,
+    15, 15, 6,  8,  2,  8,  15, 15, 2,  8,  2,  2,  2,  15, 15, 6,
+    6,  2,  6,  8,  15, 15, 2,  2,  15, 15, 15, 15, 15, 2,  2,  15,
+};
+constexpr std::uint8_t kBc7Anchors3a[64] = {
+    3,  3,  15, 15, 8,  3,  15, 15, 8,  8,  6,  6,  6,  5,  3,  3,
+    3,  3,  8,  15, 3,  3,  6,  10, 5,  8,  8,  6,  8,  5,  15, 15,
+    8,  15, 3,  5,  6,  10, 8,  15, 15, 3,  15, 5,  15, 15, 15, 15,
+    3,  15, 5,  5,  5,  8,  5,  10, 5,  10, 8,  13, 15, 12, 3,  3,
+};
+constexpr std::uint8_t kBc7Anchors3b[64] = {
+    15, 8,  8,  3,  15, 15, 3,  8,  15, 15, 15, 15, 15, 15, 15, 8,
+    15, 8,  15, 3,  15, 8,  15, 8,  3,  15, 6,  10, 15, 15, 10, 8,
+    15, 3,  15, 10, 10, 8,  9,  10, 6,  15, 8,  15, 3,  6,  6,  8,
+    15, 3,  15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 3,  15, 15, 8,
+};
+
+struct Bc7Mode {
+  int subsets;
+  int partitionBits;
+  int rotationBits;
+  int selectorBits;
+  int colourBits;
+  int alphaBits;
+  int endpointPBits;  // one p-bit per endpoint
+  int sharedPBits;    // one p-bit per subset
+  int indexBits;
+  int index2Bits;
+};
+
+constexpr Bc7Mode kBc7Modes[8] = {
+    {3, 4, 0, 0, 4, 0, 1, 0, 3, 0}, {2, 6, 0, 0, 6, 0, 0, 1, 3, 0},
+    {3, 6, 0, 0, 5, 0, 0, 0, 2, 0}, {2, 6, 0, 0, 7, 0, 1, 0, 2, 0},
+    {1, 0, 2, 1, 5, 6, 0, 0, 2, 3}, {1, 0, 2, 0, 7, 8, 0, 0, 2, 2},
+    {1, 0, 0, 0, 7, 7, 1, 0, 4, 0}, {2, 6, 0, 0, 5, 5, 1, 0, 2, 0},
+};
+
+const int* bc7IndexWeights(int bits) {
+  static constexpr int kWeights2[4] = {0, 21, 43, 64};
+  static constexpr int kWeights3[8] = {0, 9, 18, 27, 37, 46, 55, 64};
+  return bits == 2 ? kWeights2 : bits == 3 ? kWeights3 : kBc7Weights;
+}
+
+// Replicates a `bits`-bit endpoint value's top bits into 8 bits.
+int expandBits(int value, int bits) {
+  value <<= 8 - bits;
+  return value | (value >> bits);
+}
+
+// All eight modes; reserved mode bits decode to transparent black.
+void decodeBc7Block(const unsigned char in[16], unsigned char px[64]) {
+  int mode = 0;
+  while (mode < 8 && !(in[0] & (1 << mode))) ++mode;
+  if (mode == 8) {
+    std::fill(px, px + 64, 0);
+    return;
+  }
+  const Bc7Mode& m = kBc7Modes[mode];
+  unsigned char block[16];
+  std::copy(in, in + 16, block);
+  BlockBits bits{block};
+  bits.get(mode + 1);
+  const unsigned partition = bits.get(m.partitionBits);
+  const unsigned rotation = bits.get(m.rotationBits);
+  const unsigned selector = bits.get(m.selectorBits);
+
+  // Endpoint 2 * subset + end, RGBA.
+  const int ends = m.subsets * 2;
+  int e[6][4];
+  for (int c = 0; c < 3; ++c)
+    for (int k = 0; k < ends; ++k)
+      e[k][c] = static_cast<int>(bits.get(m.colourBits));
+  for (int k = 0; k < ends; ++k)
+    e[k][3] = m.alphaBits ? static_cast<int>(bits.get(m.alphaBits)) : 255;
+  int p[6] = {};
+  if (m.endpointPBits)
+    for (int k = 0; k < ends; ++k) p[k] = static_cast<int>(bits.get(1));
+  if (m.sharedPBits)
+    for (int s = 0; s < m.subsets; ++s)
+      p[2 * s] = p[2 * s + 1] = static_cast<int>(bits.get(1));
+  const int pBit = m.endpointPBits || m.sharedPBits ? 1 : 0;
+  for (int k = 0; k < ends; ++k) {
+    for (int c = 0; c < 3; ++c)
+      e[k][c] = expandBits((e[k][c] << pBit) | p[k], m.colourBits + pBit);
+    if (m.alphaBits)
+      e[k][3] = expandBits((e[k][3] << pBit) | p[k], m.alphaBits + pBit);
+  }
+
+  int subset[16];
+  for (int i = 0; i < 16; ++i) {
+    if (m.subsets == 2)
+      subset[i] = (kBc7Partitions2[partition] >> i) & 1;
+    else if (m.subsets == 3)
+      subset[i] = (kBc7Partitions3[partition] >> (2 * i)) & 3;
+    else
+      subset[i] = 0;
+  }
+  auto isAnchor = [&](int i) {
+    if (i == 0) return true;
+    if (m.subsets == 2) return i == kBc7Anchors2[partition];
+    if (m.subsets == 3)
+      return i == kBc7Anchors3a[partition] || i == kBc7Anchors3b[partition];
+    return false;
+  };
+  unsigned idx[16], idx2[16] = {};
+  for (int i = 0; i < 16; ++i)
+    idx[i] = bits.get(m.indexBits - (isAnchor(i) ? 1 : 0));
+  if (m.index2Bits)
+    for (int i = 0; i < 16; ++i)
+      idx2[i] = bits.get(m.index2Bits - (i == 0 ? 1 : 0));
+
+  const int* weights = bc7IndexWeights(m.indexBits);
+  const int* weights2 = bc7IndexWeights(m.index2Bits);
+  for (int i = 0; i < 16; ++i) {
+    int colourWeight = weights[idx[i]], alphaWeight = colourWeight;
+    if (m.index2Bits) {
+      alphaWeight = weights2[idx2[i]];
+      if (selector) std::swap(colourWeight, alphaWeight);
+    }
+    const int* e0 = e[2 * subset[i]];
+    const int* e1 = e[2 * subset[i] + 1];
+    unsigned char* d = px + i * 4;
+    for (int c = 0; c < 4; ++c) {
+      const int w = c == 3 ? alphaWeight : colourWeight;
+      d[c] = static_cast<unsigned char>(
+          ((64 - w) * e0[c] + w * e1[c] + 32) >> 6);
+    }
+    if (rotation) std::swap(d[3], d[rotation - 1]);
+  }
+}
+
+// --- Images -----------------------------------------------------------------
+
+std::size_t blockBytes(TextureCompression compression) {
+  return compression == TextureCompression::BC1 ? 8 : 16;
+}
+
+void encodeBlock(TextureCompression compression, const unsigned char px[64],
+                 unsigned char* out) {
+  switch (compression) {
+    case TextureCompression::BC1:
+      encodeColourBlock(px, out);
+      break;
+    case TextureCompression::BC3:
+      encodeAlphaBlock(px, out);
+      encodeColourBlock(px, out + 8);
+      break;
+    case TextureCompression::BC7:
+      encodeBc7Block(px, out);
+      break;
+    case TextureCompression::None:
+      break;
+  }
+}
+
+void decodeBlock(TextureCompression compression, const unsigned char* in,
+                 unsigned char px[64]) {
+  switch (compression) {
+    case TextureCompression::BC1:
+      decodeColourBlock(in, true, px);
+      break;
+    case TextureCompression::BC3:
+      decodeColourBlock(in + 8, false, px);
+      decodeAlphaBlock(in, px);
+      break;
+    case TextureCompression::BC7:
+      decodeBc7Block(in, px);
+      break;
+    case TextureCompression::None:
+      break;
+  }
+}
+
+bool hasTranslucentTexels(const TextureImage& image) {
+  const int c = image.components;
+  if (c != 2 && c != 4) return false;
+  const unsigned char* p = image.levelData(0);
+  const std::size_t texels =
+      static_cast<std::size_t>(image.width) * image.height;
+  for (std::size_t i = 0; i < texels; ++i)
+    if (p[i * c + c - 1] != 255) return true;
+  return false;
+}
+
+}  // namespace
+
+void compressTexture(TextureImage& image, TextureCompression compression,
+                     ThreadPool* pool) {
+  if (compression == TextureCompression::None ||
+      compression == image.compression)
+    return;
+  if (image.levelCount() == 0 || image.width <= 0 || image.height <= 0)
+    throw std::runtime_error("compressTexture: empty image");
+
+  if (image.compression != TextureCompression::None) {
+    // Transcode through RGBA8.
+    const int levelCount = image.levelCount();
+    std::vector<std::vector<unsigned char>> levels(
+        static_cast<std::size_t>(levelCount));
+    parallelFor(pool, levels.size(), [&](std::size_t i) {
+      const int level = static_cast<int>(i);
+      const int w = std::max(1, image.width >> level);
+      const int h = std::max(1, image.height >> level);
+      levels[i].resize(static_cast<std::size_t>(w) * h * 4);
+      decompressTextureRows(image, level, 0, (h + 3) / 4, levels[i].data());
+    });
+    image.levels = std::move(levels);
+    image.borrowedLevels.clear();
+    image.backing.reset();
+    image.components = 4;
+    image.compression = TextureCompression::None;
+  } else if (!image.borrowedLevels.empty()) {
+    image.levels.clear();
+    for (int level = 0; level < image.levelCount(); ++level)
+      image.levels.emplace_back(
+          image.levelData(level),
+          image.levelData(level) + mipLevelSize(image, level));
+    image.borrowedLevels.clear();
+    image.backing.reset();
+  }
+  if (image.levelCount() == 1)
+    generateMipChain(image, MipFilter::Box, pool);
+  if (compression == TextureCompression::BC1 && hasTranslucentTexels(image))
+    compression = TextureCompression::BC3;
+
+  TextureImage encoded;
+  encoded.width = image.width;
+  encoded.height = image.height;
+  encoded.compression = compression;
+  const int levelCount = image.levelCount();
+  std::vector<std::pair<int, int>> rows;  // (level, block row)
+  for (int level = 0; level < levelCount; ++level) {
+    encoded.levels.emplace_back(mipLevelSize(encoded, level));
+    const int h = std::max(1, image.height >> level);
+    for (int row = 0; row < (h + 3) / 4; ++row) rows.emplace_back(level, row);
+  }
+
+  parallelFor(pool, rows.size(), [&](std::size_t r) {
+    const auto [level, row] = rows[r];
+    const int w = std::max(1, image.width >> level);
+    const int h = std::max(1, image.height >> level);
+    unsigned char* out =
+        encoded.levels[static_cast<std::size_t>(level)].data() +
+        mipRowBytes(encoded, level) * row;
+    unsigned char px[64];
+    for (int bx = 0; bx < (w + 3) / 4; ++bx) {
+      loadBlock(image.levelData(level), w, h, image.components, bx, row, px);
+      encodeBlock(compression, px, out + blockBytes(compression) * bx);
+    }
+  });
+
+  image.levels = std::move(encoded.levels);
+  image.compression = compression;
+}
+
+void decompressTextureRows(const TextureImage& image, int level,
+                           int firstBlockRow, int blockRowCount,
+                           unsigned char* rgba) {
+  const int w = std::max(1, image.width >> level);
+  const int h = std::max(1, image.height >> level);
+  const std::size_t rowBytes = mipRowBytes(image, level);
+  const std::size_t outRowBytes = static_cast<std::size_t>(w) * 4;
+
+  unsigned char px[64];
+  for (int r = 0; r < blockRowCount; ++r) {
+    const int row = firstBlockRow + r;
+    const unsigned char* src = image.levelData(level) + rowBytes * row;
+    const int rows = std::min(4, h - row * 4);
+    for (int bx = 0; bx < (w + 3) / 4; ++bx) {
+      decodeBlock(image.compression, src + blockBytes(image.compression) * bx,
+                  px);
+      const int columns = std::min(4, w - bx * 4);
+      for (int y = 0; y < rows; ++y)
+        std::copy(px + y * 16, px + y * 16 + columns * 4,
+                  rgba + outRowBytes * (r * 4 + y) + bx * 16);
+    }
+  }
+}
+
+}  // namespace utils
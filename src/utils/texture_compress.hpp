@@ -0,0 +1,30 @@
+#ifndef TEXTURE_COMPRESS_HPP
+#define TEXTURE_COMPRESS_HPP
+
+#include "texture.hpp"
+
+namespace utils {
+
+class ThreadPool;
+
+// Encodes an image to `compression` blocks in place, every mip level
+// included: when only level 0 is present the chain is generated first. BC1
+// is written in its opaque 4-colour mode, so an image with any alpha below
+// 255 is encoded as BC3 instead. BC7 blocks all use mode 6 (one RGBA
+// endpoint pair, 4-bit indices). A compressed image in another format is
+// decoded and re-encoded; one already in `compression` is left as is.
+// Blocks are encoded on `pool` (null = calling thread); the result does not
+// depend on it.
+void compressTexture(TextureImage& image, TextureCompression compression,
+                     ThreadPool* pool = nullptr);
+
+// Decodes `blockRowCount` rows of blocks of a compressed level, starting at
+// `firstBlockRow`, to tightly packed RGBA8 texel rows clipped to the level.
+// For the upload fallback on drivers without the format, and transcoding.
+void decompressTextureRows(const TextureImage& image, int level,
+                           int firstBlockRow, int blockRowCount,
+                           unsigned char* rgba);
+
+}  // namespace utils
+
+#endif
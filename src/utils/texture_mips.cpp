@@ -0,0 +1,468 @@
+#include "texture_mips.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "cpu_features.hpp"
+#include "thread_pool.hpp"
+
+#ifdef MGE_X86
+#include <immintrin.h>
+#endif
+
+namespace utils {
+namespace {
+
+constexpr double kPi = 3.14159265358979323846;
+// Kaiser window half-width, in texels of the smaller level, and its alpha.
+constexpr double kKaiserWidth = 3.0;
+constexpr double kKaiserAlpha = 4.0;
+// Rows of the smaller level per parallel work item.
+constexpr int kBandRows = 32;
+
+double srgbToLinear(double v) {
+  return v <= 0.04045 ? v / 12.92 : std::pow((v + 0.055) / 1.055, 2.4);
+}
+
+// 8-bit values to [0, 1] floats and back; sRGB ones via linear light.
+struct Conversions {
+  float unorm[256];
+  float srgb[256];
+  // srgbUpper[v]: the smallest linear value that encodes above v; above 1
+  // for 255.
+  float srgbUpper[256];
+  // The sRGB code of linear j / 4096, a lower bound for [j, j + 1) / 4096.
+  // 32-bit so the AVX2 path can gather it.
+  std::int32_t srgbStart[4097];
+};
+
+const Conversions& conversions() {
+  static const Conversions table = [] {
+    Conversions t{};
+    for (int i = 0; i < 256; ++i) {
+      t.unorm[i] = static_cast<float>(i / 255.0);
+      t.srgb[i] = static_cast<float>(srgbToLinear(i / 255.0));
+    }
+    for (int v = 0; v < 255; ++v)
+      t.srgbUpper[v] = static_cast<float>(srgbToLinear((v + 0.5) / 255.0));
+    t.srgbUpper[255] = 2.0f;
+    int code = 0;
+    for (int j = 0; j <= 4096; ++j) {
+      const float x = static_cast<float>(j) / 4096.0f;
+      while (x >= t.srgbUpper[code]) ++code;
+      t.srgbStart[j] = code;
+    }
+    return t;
+  }();
+  return table;
+}
+
+unsigned char encodeUnorm(float v) {
+  v = std::min(1.0f, std::max(0.0f, v));
+  return static_cast<unsigned char>(v * 255.0f + 0.5f);
+}
+
+unsigned char encodeSrgb(const Conversions& t, float v) {
+  v = std::min(1.0f, std::max(0.0f, v));
+  int code = t.srgbStart[static_cast<int>(v * 4096.0f)];
+  while (v >= t.srgbUpper[code]) ++code;
+  return static_cast<unsigned char>(code);
+}
+
+// The source texels (edge addressing applied) and normalized weights of
+// each texel of the smaller level, along one axis.
+struct AxisTaps {
+  std::vector<int> begin;  // first tap per texel, plus the end
+  std::vector<int> index;
+  std::vector<float> weight;
+};
+
+int address(int i, int size, GLint wrap) {
+  if (wrap == GL_REPEAT) return ((i % size) + size) % size;
+  if (wrap == GL_MIRRORED_REPEAT) {
+    const int period = 2 * size;
+    i = ((i % period) + period) % period;
+    return i < size ? i : period - 1 - i;
+  }
+  return std::min(size - 1, std::max(0, i));
+}
+
+double besselI0(double x) {
+  double sum = 1.0, term = 1.0;
+  for (int k = 1; k < 32; ++k) {
+    const double f = x / (2.0 * k);
+    term *= f * f;
+    sum += term;
+  }
+  return sum;
+}
+
+double kaiser(double x) {
+  if (std::abs(x) >= kKaiserWidth) return 0.0;
+  const double sinc = x == 0.0 ? 1.0 : std::sin(kPi * x) / (kPi * x);
+  const double r = x / kKaiserWidth;
+  return sinc * besselI0(kKaiserAlpha * std::sqrt(1.0 - r * r)) /
+         besselI0(kKaiserAlpha);
+}
+
+AxisTaps buildTaps(int src, int dst, MipFilter filter, GLint wrap) {
+  AxisTaps taps;
+  taps.begin.push_back(0);
+  const double scale = static_cast<double>(src) / dst;
+  std::vector<std::pair<int, double>> texel;
+  for (int x = 0; x < dst; ++x) {
+    texel.clear();
+    if (src == dst) {
+      texel.emplace_back(x, 1.0);
+    } else if (filter == MipFilter::Box) {
+      // Coverage of the footprint [lo, hi); odd sizes straddle a texel.
+      // hi is clamped: rounding may put it a hair past the last texel.
+      const double lo = x * scale;
+      const double hi = std::min<double>(src, (x + 1) * scale);
+      for (int i = static_cast<int>(lo); i < hi; ++i) {
+        const double w = std::min(hi, i + 1.0) - std::max(lo, i + 0.0);
+        if (w > 0.0) texel.emplace_back(i, w);
+      }
+    } else {
+      const double center = (x + 0.5) * scale;
+      const double radius = kKaiserWidth * scale;
+      for (int i = static_cast<int>(std::floor(center - radius));
+           i < center + radius; ++i) {
+        const double w = kaiser((i + 0.5 - center) / scale);
+        if (w != 0.0) texel.emplace_back(address(i, src, wrap), w);
+      }
+    }
+    double sum = 0.0;
+    for (const auto& tap : texel) sum += tap.second;
+    for (const auto& tap : texel) {
+      taps.index.push_back(tap.first);
+      taps.weight.push_back(static_cast<float>(tap.second / sum));
+    }
+    taps.begin.push_back(static_cast<int>(taps.index.size()));
+  }
+  return taps;
+}
+
+struct Level {
+  const unsigned char* src;
+  int sw, sh;
+  unsigned char* dst;
+  int dw, dh;
+  int components;
+  int srgbChannels;  // leading channels stored as sRGB
+};
+
+// Horizontal pass: one source row, already as floats, to dw texels.
+void filterRowScalar(const AxisTaps& taps, int c, const float* in, int dw,
+                     float* out) {
+  for (int x = 0; x < dw; ++x) {
+    float acc[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+    for (int t = taps.begin[x]; t < taps.begin[x + 1]; ++t) {
+      const float w = taps.weight[t];
+      const float* p = in + static_cast<std::size_t>(taps.index[t]) * c;
+      for (int k = 0; k < c; ++k) acc[k] += w * p[k];
+    }
+    for (int k = 0; k < c; ++k)
+      out[static_cast<std::size_t>(x) * c + k] = acc[k];
+  }
+}
+
+// Vertical pass: out[i] = sum of weights[t] * rows[t][i], taps in order,
+// from element `from` on.
+void sumRowsScalar(const float* const* rows, const float* weights, int taps,
+                   std::size_t from, std::size_t n, float* out) {
+  for (std::size_t i = from; i < n; ++i) {
+    float acc = 0.0f;
+    for (int t = 0; t < taps; ++t) acc += weights[t] * rows[t][i];
+    out[i] = acc;
+  }
+}
+
+#ifdef MGE_X86
+// RGBA texels are one register each.
+MGE_TARGET("sse2")
+void filterRowRgbaSse2(const AxisTaps& taps, const float* in, int dw,
+                       float* out) {
+  for (int x = 0; x < dw; ++x) {
+    __m128 acc = _mm_setzero_ps();
+    for (int t = taps.begin[x]; t < taps.begin[x + 1]; ++t) {
+      const __m128 p =
+          _mm_loadu_ps(in + static_cast<std::size_t>(taps.index[t]) * 4);
+      acc = _mm_add_ps(acc, _mm_mul_ps(_mm_set1_ps(taps.weight[t]), p));
+    }
+    _mm_storeu_ps(out + static_cast<std::size_t>(x) * 4, acc);
+  }
+}
+
+MGE_TARGET("sse2")
+std::size_t sumRowsSse2(const float* const* rows, const float* weights,
+                        int taps, std::size_t n, float* out) {
+  std::size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m128 acc = _mm_setzero_ps();
+    for (int t = 0; t < taps; ++t)
+      acc = _mm_add_ps(acc, _mm_mul_ps(_mm_set1_ps(weights[t]),
+                                       _mm_loadu_ps(rows[t] + i)));
+    _mm_storeu_ps(out + i, acc);
+  }
+  return i;
+}
+#endif
+
+#ifdef MGE_X86
+// Two 4-texel RGBA spans of the source rows to two 2x2 averages.
+MGE_TARGET("sse2")
+__m128i boxHalfSse2(__m128i a, __m128i b) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i lo =
+      _mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero));
+  const __m128i hi =
+      _mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero));
+  const __m128i sum =
+      _mm_add_epi16(_mm_unpacklo_epi64(lo, hi), _mm_unpackhi_epi64(lo, hi));
+  return _mm_srli_epi16(_mm_add_epi16(sum, _mm_set1_epi16(2)), 2);
+}
+
+MGE_TARGET("sse2")
+int boxHalfRgbaSse2(const unsigned char* a, const unsigned char* b, int dw,
+                    unsigned char* out) {
+  int x = 0;
+  for (; x + 4 <= dw; x += 4) {
+    const auto* pa = reinterpret_cast<const __m128i*>(a + x * 8);
+    const auto* pb = reinterpret_cast<const __m128i*>(b + x * 8);
+    const __m128i lo =
+        boxHalfSse2(_mm_loadu_si128(pa), _mm_loadu_si128(pb));
+    const __m128i hi =
+        boxHalfSse2(_mm_loadu_si128(pa + 1), _mm_loadu_si128(pb + 1));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + x * 4),
+                     _mm_packus_epi16(lo, hi));
+  }
+  return x;
+}
+
+// The linear values of 8 sRGB bytes.
+MGE_TARGET("avx2")
+__m256 linearizeAvx2(const Conversions& t, __m128i bytes) {
+  return _mm256_i32gather_ps(t.srgb, _mm256_cvtepu8_epi32(bytes), 4);
+}
+
+// Sums of texels 0+1 and 2+3 of a 4-texel RGBA span, in linear light.
+MGE_TARGET("avx2")
+__m256 pairSumsAvx2(const Conversions& t, __m128i span) {
+  const __m256 t01 = linearizeAvx2(t, span);
+  const __m256 t23 = linearizeAvx2(t, _mm_srli_si128(span, 8));
+  return _mm256_add_ps(_mm256_permute2f128_ps(t01, t23, 0x20),
+                       _mm256_permute2f128_ps(t01, t23, 0x31));
+}
+
+// encodeSrgb on 8 values.
+MGE_TARGET("avx2")
+__m256i encodeSrgbAvx2(const Conversions& t, __m256 v) {
+  v = _mm256_min_ps(_mm256_set1_ps(1.0f),
+                    _mm256_max_ps(_mm256_setzero_ps(), v));
+  __m256i code = _mm256_i32gather_epi32(
+      t.srgbStart,
+      _mm256_cvttps_epi32(_mm256_mul_ps(v, _mm256_set1_ps(4096.0f))), 4);
+  for (;;) {
+    const __m256 upper = _mm256_i32gather_ps(t.srgbUpper, code, 4);
+    const __m256i step =
+        _mm256_castps_si256(_mm256_cmp_ps(v, upper, _CMP_GE_OQ));
+    if (_mm256_testz_si256(step, step)) return code;
+    code = _mm256_sub_epi32(code, step);
+  }
+}
+
+// sRGB RGBA: the colour channels of two output texels per register are
+// averaged in linear light, in the scalar order of operations; alpha comes
+// from the integer average.
+MGE_TARGET("avx2")
+int boxHalfSrgbAvx2(const Conversions& t, const unsigned char* a,
+                    const unsigned char* b, int dw, unsigned char* out) {
+  const __m256 quarter = _mm256_set1_ps(0.25f);
+  const __m128i alpha = _mm_set1_epi32(static_cast<int>(0xFF000000u));
+  int x = 0;
+  for (; x + 4 <= dw; x += 4) {
+    const auto* pa = reinterpret_cast<const __m128i*>(a + x * 8);
+    const auto* pb = reinterpret_cast<const __m128i*>(b + x * 8);
+    __m256i codes[2];
+    __m128i box[2];
+    for (int h = 0; h < 2; ++h) {
+      const __m128i ra = _mm_loadu_si128(pa + h);
+      const __m128i rb = _mm_loadu_si128(pb + h);
+      box[h] = boxHalfSse2(ra, rb);
+      const __m256 sum =
+          _mm256_add_ps(pairSumsAvx2(t, ra), pairSumsAvx2(t, rb));
+      codes[h] = encodeSrgbAvx2(t, _mm256_mul_ps(sum, quarter));
+    }
+    // packs interleaves the 128-bit lanes; the permute puts the texels
+    // back in order.
+    const __m256i words = _mm256_permute4x64_epi64(
+        _mm256_packs_epi32(codes[0], codes[1]), 0xD8);
+    const __m128i color =
+        _mm_packus_epi16(_mm256_castsi256_si128(words),
+                         _mm256_extracti128_si256(words, 1));
+    _mm_storeu_si128(
+        reinterpret_cast<__m128i*>(out + x * 4),
+        _mm_blendv_epi8(color, _mm_packus_epi16(box[0], box[1]), alpha));
+  }
+  return x;
+}
+#endif
+
+// Box filter of an exact 2:1 reduction on both axes: the 2x2 average, in
+// integers for channels stored linearly. sRGB RGBA has an AVX2 path (the
+// gathers it needs are what make it pay).
+void boxHalfBand(const Level& l, int y0, int y1,
+                 const CpuFeatures& features) {
+  const Conversions& conv = conversions();
+  const int c = l.components;
+  const std::size_t srcRow = static_cast<std::size_t>(l.sw) * c;
+  const std::size_t dstRow = static_cast<std::size_t>(l.dw) * c;
+  for (int y = y0; y < y1; ++y) {
+    const unsigned char* a = l.src + static_cast<std::size_t>(2 * y) * srcRow;
+    const unsigned char* b = a + srcRow;
+    unsigned char* out = l.dst + static_cast<std::size_t>(y) * dstRow;
+    int x = 0;
+#ifdef MGE_X86
+    if (c == 4 && l.srgbChannels == 0 && features.sse2)
+      x = boxHalfRgbaSse2(a, b, l.dw, out);
+    else if (c == 4 && features.avx2)
+      x = boxHalfSrgbAvx2(conv, a, b, l.dw, out);
+#else
+    (void)features;
+#endif
+    for (; x < l.dw; ++x) {
+      for (int k = 0; k < c; ++k) {
+        const std::size_t i = static_cast<std::size_t>(2 * x) * c + k;
+        const std::size_t o = static_cast<std::size_t>(x) * c + k;
+        if (k < l.srgbChannels) {
+          const float sum = (conv.srgb[a[i]] + conv.srgb[a[i + c]]) +
+                            (conv.srgb[b[i]] + conv.srgb[b[i + c]]);
+          out[o] = encodeSrgb(conv, sum * 0.25f);
+        } else {
+          out[o] = static_cast<unsigned char>(
+              (a[i] + a[i + c] + b[i] + b[i + c] + 2) >> 2);
+        }
+      }
+    }
+  }
+}
+
+// Filters rows [y0, y1) of the smaller level. The source rows they read are
+// converted and filtered horizontally once per band.
+void filterBand(const Level& l, const AxisTaps& tx, const AxisTaps& ty,
+                int y0, int y1, const CpuFeatures& features) {
+  const Conversions& conv = conversions();
+  const int c = l.components;
+  const float* lut[4];
+  for (int k = 0; k < 4; ++k)
+    lut[k] = k < l.srgbChannels ? conv.srgb : conv.unorm;
+
+  std::vector<int> slot(static_cast<std::size_t>(l.sh), -1);
+  std::vector<int> sourceRows;
+  for (int t = ty.begin[y0]; t < ty.begin[y1]; ++t) {
+    int& s = slot[static_cast<std::size_t>(ty.index[t])];
+    if (s < 0) {
+      s = static_cast<int>(sourceRows.size());
+      sourceRows.push_back(ty.index[t]);
+    }
+  }
+
+  const std::size_t rowFloats = static_cast<std::size_t>(l.dw) * c;
+  std::vector<float> filtered(sourceRows.size() * rowFloats);
+  std::vector<float> line(static_cast<std::size_t>(l.sw) * c);
+  for (std::size_t r = 0; r < sourceRows.size(); ++r) {
+    const unsigned char* in =
+        l.src + static_cast<std::size_t>(sourceRows[r]) * l.sw * c;
+    for (std::size_t i = 0; i < line.size(); i += c)
+      for (int k = 0; k < c; ++k) line[i + k] = lut[k][in[i + k]];
+    float* out = filtered.data() + r * rowFloats;
+#ifdef MGE_X86
+    if (c == 4 && features.sse2) {
+      filterRowRgbaSse2(tx, line.data(), l.dw, out);
+      continue;
+    }
+#endif
+    filterRowScalar(tx, c, line.data(), l.dw, out);
+  }
+
+  std::vector<const float*> rows;
+  std::vector<float> sum(rowFloats);
+  for (int y = y0; y < y1; ++y) {
+    rows.clear();
+    for (int t = ty.begin[y]; t < ty.begin[y + 1]; ++t)
+      rows.push_back(filtered.data() +
+                     slot[static_cast<std::size_t>(ty.index[t])] * rowFloats);
+    const float* weights = ty.weight.data() + ty.begin[y];
+    const int taps = static_cast<int>(rows.size());
+    std::size_t done = 0;
+#ifdef MGE_X86
+    if (features.sse2)
+      done = sumRowsSse2(rows.data(), weights, taps, rowFloats, sum.data());
+#endif
+    sumRowsScalar(rows.data(), weights, taps, done, rowFloats, sum.data());
+
+    unsigned char* out = l.dst + static_cast<std::size_t>(y) * rowFloats;
+    for (std::size_t i = 0; i < rowFloats; i += c)
+      for (int k = 0; k < c; ++k)
+        out[i + k] = k < l.srgbChannels ? encodeSrgb(conv, sum[i + k])
+                                        : encodeUnorm(sum[i + k]);
+  }
+}
+
+}  // namespace
+
+void generateMipChain(TextureImage& image, MipFilter filter,
+                      ThreadPool* pool) {
+  if (image.levelCount() == 0)
+    throw std::runtime_error("generateMipChain: level 0 missing");
+  if (image.compression != TextureCompression::None)
+    throw std::runtime_error("generateMipChain: image is compressed");
+  const int c = image.components;
+  if (c < 1 || c > 4)
+    throw std::runtime_error("generateMipChain: unsupported component count");
+  if (!image.borrowedLevels.empty()) {
+    const unsigned char* level0 = image.levelData(0);
+    image.levels.assign(1, std::vector<unsigned char>(
+                               level0, level0 + mipLevelSize(image, 0)));
+    image.borrowedLevels.clear();
+    image.backing.reset();
+  }
+  image.levels.resize(1);
+
+  const int count = mipLevelCount(image.width, image.height);
+  image.levels.reserve(static_cast<std::size_t>(count));
+  const CpuFeatures features = cpuFeatures();
+  for (int level = 1; level < count; ++level) {
+    Level l;
+    l.sw = std::max(1, image.width >> (level - 1));
+    l.sh = std::max(1, image.height >> (level - 1));
+    l.dw = std::max(1, image.width >> level);
+    l.dh = std::max(1, image.height >> level);
+    l.components = c;
+    l.srgbChannels = image.srgb && c >= 3 ? 3 : 0;
+    image.levels.emplace_back(static_cast<std::size_t>(l.dw) * l.dh * c);
+    l.src = image.levels[static_cast<std::size_t>(level - 1)].data();
+    l.dst = image.levels[static_cast<std::size_t>(level)].data();
+
+    const int bands = (l.dh + kBandRows - 1) / kBandRows;
+    if (filter == MipFilter::Box && l.sw == 2 * l.dw && l.sh == 2 * l.dh) {
+      parallelFor(pool, static_cast<std::size_t>(bands), [&](std::size_t b) {
+        const int y0 = static_cast<int>(b) * kBandRows;
+        boxHalfBand(l, y0, std::min(l.dh, y0 + kBandRows), features);
+      });
+      continue;
+    }
+    const AxisTaps tx = buildTaps(l.sw, l.dw, filter, image.wrapS);
+    const AxisTaps ty = buildTaps(l.sh, l.dh, filter, image.wrapT);
+    parallelFor(pool, static_cast<std::size_t>(bands), [&](std::size_t b) {
+      const int y0 = static_cast<int>(b) * kBandRows;
+      filterBand(l, tx, ty, y0, std::min(l.dh, y0 + kBandRows), features);
+    });
+  }
+}
+
+}  // namespace utils
@@ -0,0 +1,29 @@
+#ifndef TEXTURE_MIPS_HPP
+#define TEXTURE_MIPS_HPP
+
+#include <cstdint>
+
+#include "texture.hpp"
+
+namespace utils {
+
+class ThreadPool;
+
+// How each mip level is downsampled from the one above it.
+enum class MipFilter : std::uint8_t {
+  Box,     // average of the texels under the footprint (2x2 for even sizes)
+  Kaiser,  // Kaiser-windowed sinc, 3 texels of the smaller level each side
+};
+
+// Replaces the image's levels above 0 with a full mip chain; level 0 must be
+// present and uncompressed. sRGB colour channels are filtered in linear light
+// and re-encoded, alpha and 1/2-channel data as stored. Kaiser taps past an
+// edge follow wrapS/wrapT. Each level is split into row bands on `pool`
+// (null = calling thread); the result does not depend on the pool or the
+// SIMD level.
+void generateMipChain(TextureImage& image, MipFilter filter = MipFilter::Box,
+                      ThreadPool* pool = nullptr);
+
+}  // namespace utils
+
+#endif
@@ -0,0 +1,180 @@
+#include "texture_streamer.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace utils {
+
+float uvDensity(const VertexPU* vertices, const std::uint32_t* indices,
+                std::size_t indexCount) {
+  double uvArea = 0.0, area = 0.0;
+  for (std::size_t i = 0; i + 2 < indexCount; i += 3) {
+    const VertexPU& a = vertices[indices[i]];
+    const VertexPU& b = vertices[indices[i + 1]];
+    const VertexPU& c = vertices[indices[i + 2]];
+    area += glm::length(glm::cross(b.pos - a.pos, c.pos - a.pos));
+    const glm::vec2 du = b.uv - a.uv, dv = c.uv - a.uv;
+    uvArea += std::abs(du.x * dv.y - du.y * dv.x);
+  }
+  if (area <= 0.0) return 0.0f;
+  return static_cast<float>(std::sqrt(uvArea / area));
+}
+
+int streamingBaseLevel(const TextureImage& image, int residentSize) {
+  const int levelCount = image.levelCount();
+  if (residentSize <= 0 || levelCount <= 1) return 0;
+  int level = 0;
+  while (level + 1 < levelCount &&
+         std::max(image.width >> level, image.height >> level) > residentSize)
+    ++level;
+  return level;
+}
+
+TextureStreamer::TextureStreamer(const TextureStreamingOptions& options)
+    : options_(options) {}
+
+void TextureStreamer::track(const std::shared_ptr<const ModelData>& model) {
+  if (!model) return;
+  for (const MaterialGL& mat : model->materials) {
+    if (mat.baseColorTex == 0 || mat.baseColorLayer >= 0 ||
+        mat.baseColorImage < 0 ||
+        mat.baseColorImage >= static_cast<int>(model->images.size()) ||
+        index_.count(mat.baseColorTex))
+      continue;
+    const TextureImage& image =
+        model->images[static_cast<std::size_t>(mat.baseColorImage)];
+    Entry entry;
+    entry.model = model.get();
+    entry.image = &image;
+    entry.tex = mat.baseColorTex;
+    entry.tailLevel = streamingBaseLevel(image, options_.residentSize);
+    entry.baseLevel = entry.tailLevel;
+    entry.wantedLevel = entry.targetLevel = entry.tailLevel;
+    index_[entry.tex] = entries_.size();
+    entries_.push_back(entry);
+
+    stats_.textures++;
+    for (int level = 0; level < image.levelCount(); ++level) {
+      const std::size_t bytes = textureLevelMemorySize(image, level);
+      stats_.fullBytes += bytes;
+      if (level >= entry.tailLevel) stats_.residentBytes += bytes;
+    }
+  }
+  models_.push_back(model);
+}
+
+void TextureStreamer::untrack(const ModelData& model) {
+  for (const Entry& entry : entries_) {
+    if (entry.model != &model) continue;
+    const TextureImage& image = *entry.image;
+    stats_.textures--;
+    for (int level = 0; level < image.levelCount(); ++level) {
+      const std::size_t bytes = textureLevelMemorySize(image, level);
+      stats_.fullBytes -= bytes;
+      if (level >= entry.baseLevel) stats_.residentBytes -= bytes;
+      if (level >= entry.baseLevel && level < entry.tailLevel)
+        streamedBytes_ -= bytes;
+    }
+  }
+  entries_.erase(std::remove_if(entries_.begin(), entries_.end(),
+                                [&](const Entry& entry) {
+                                  return entry.model == &model;
+                                }),
+                 entries_.end());
+  models_.erase(std::remove_if(models_.begin(), models_.end(),
+                               [&](const std::shared_ptr<const ModelData>& m) {
+                                 return m.get() == &model;
+                               }),
+                models_.end());
+  reindex();
+}
+
+void TextureStreamer::request(GLuint tex, float texelsPerPixel) {
+  const auto it = index_.find(tex);
+  if (it == index_.end()) return;
+  Entry& entry = entries_[it->second];
+  // Trilinear filtering at lod L reads levels floor(L) and floor(L) + 1.
+  int level = 0;
+  if (texelsPerPixel > 0.0f)
+    level = static_cast<int>(
+        std::floor(std::log2(texelsPerPixel) + options_.lodBias));
+  level = std::clamp(level, 0, entry.tailLevel);
+  if (entry.lastRequest != frame_ + 1) {
+    entry.lastRequest = frame_ + 1;
+    entry.wantedLevel = level;
+  } else {
+    entry.wantedLevel = std::min(entry.wantedLevel, level);
+  }
+}
+
+void TextureStreamer::update() {
+  // Textures not drawn this frame only need their tail.
+  for (Entry& entry : entries_)
+    entry.targetLevel =
+        entry.lastRequest == frame_ + 1 ? entry.wantedLevel : entry.tailLevel;
+  ++frame_;
+
+  // A smaller budget (or a new model) may leave us over it.
+  makeRoom(0, nullptr);
+
+  std::size_t uploaded = 0;
+  while (uploaded == 0 || uploaded < options_.uploadBytesPerFrame) {
+    // The texture furthest from its target goes first.
+    Entry* next = nullptr;
+    for (Entry& entry : entries_)
+      if (entry.baseLevel > entry.targetLevel &&
+          (!next || entry.baseLevel - entry.targetLevel >
+                        next->baseLevel - next->targetLevel))
+        next = &entry;
+    if (!next) break;
+
+    const int level = next->baseLevel - 1;
+    const std::size_t bytes = textureLevelMemorySize(*next->image, level);
+    if (!makeRoom(bytes, next)) break;
+    uploadTextureLevel(next->tex, *next->image, level);
+    setTextureBaseLevel(next->tex, level);
+    next->baseLevel = level;
+    streamedBytes_ += bytes;
+    uploaded += bytes;
+    stats_.residentBytes += bytes;
+    stats_.levelsLoaded++;
+  }
+}
+
+bool TextureStreamer::makeRoom(std::size_t bytes, const Entry* keep) {
+  while (streamedBytes_ + bytes > options_.budgetBytes) {
+    // Only levels finer than their target go: longest unused first, then
+    // the texture with the most surplus levels.
+    Entry* victim = nullptr;
+    for (Entry& entry : entries_) {
+      if (&entry == keep || entry.baseLevel >= entry.targetLevel) continue;
+      if (!victim || entry.lastRequest < victim->lastRequest ||
+          (entry.lastRequest == victim->lastRequest &&
+           entry.targetLevel - entry.baseLevel >
+               victim->targetLevel - victim->baseLevel))
+        victim = &entry;
+    }
+    if (!victim) return false;
+    evictLevel(*victim);
+  }
+  return true;
+}
+
+void TextureStreamer::evictLevel(Entry& entry) {
+  const int level = entry.baseLevel;
+  setTextureBaseLevel(entry.tex, level + 1);
+  releaseTextureLevel(entry.tex, level);
+  entry.baseLevel = level + 1;
+  const std::size_t bytes = textureLevelMemorySize(*entry.image, level);
+  streamedBytes_ -= bytes;
+  stats_.residentBytes -= bytes;
+  stats_.levelsEvicted++;
+}
+
+void TextureStreamer::reindex() {
+  index_.clear();
+  for (std::size_t i = 0; i < entries_.size(); ++i)
+    index_[entries_[i].tex] = i;
+}
+
+}  // namespace utils
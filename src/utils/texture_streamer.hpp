@@ -0,0 +1,105 @@
+#ifndef TEXTURE_STREAMER_HPP
+#define TEXTURE_STREAMER_HPP
+
+#include <glad/glad.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "mesh.hpp"
+
+namespace utils {
+
+// UV units per model unit over an index range: sqrt(UV area / surface
+// area), 0 when the range has no surface.
+float uvDensity(const VertexPU* vertices, const std::uint32_t* indices,
+                std::size_t indexCount);
+
+// First level of `image` whose larger side is at most `residentSize`: the
+// coarse tail a streamed texture is created with. 0 (everything resident)
+// for images without a mip chain or when residentSize <= 0.
+int streamingBaseLevel(const TextureImage& image, int residentSize);
+
+struct TextureStreamingOptions {
+  // GPU bytes of streamed levels (those finer than the resident tail) kept
+  // at once; levels nothing on screen needs are evicted to make room.
+  std::size_t budgetBytes = std::size_t{256} << 20;
+  // Level bytes uploaded per update(); at least one level always is.
+  std::size_t uploadBytesPerFrame = std::size_t{4} << 20;
+  // Must match LoadOptions::streamResidentSize of the tracked models.
+  int residentSize = 64;
+  // Added to the level each draw asks for; > 0 streams coarser levels.
+  float lodBias = 0.0f;
+};
+
+// Keeps the base color textures of tracked models resident only down to the
+// finest mip level the last frame's draws needed. Textures are created with
+// their coarse tail (streamingBaseLevel); RenderObject::draw reports how
+// many level-0 texels each visible submesh maps to a pixel, and update()
+// loads finer levels or evicts unneeded ones, moving GL_TEXTURE_BASE_LEVEL.
+// Texture arrays are not streamed. GL thread only.
+class TextureStreamer {
+ public:
+  struct Stats {
+    std::size_t textures = 0;
+    std::size_t residentBytes = 0;  // tails plus streamed levels
+    std::size_t fullBytes = 0;      // with every level resident
+    std::size_t levelsLoaded = 0;   // since construction
+    std::size_t levelsEvicted = 0;
+  };
+
+  explicit TextureStreamer(const TextureStreamingOptions& options = {});
+
+  TextureStreamer(const TextureStreamer&) = delete;
+  TextureStreamer& operator=(const TextureStreamer&) = delete;
+
+  // Streams the materials' GL_TEXTURE_2D base color textures; the model
+  // must keep its images (LoadOptions::streamResidentSize keeps them).
+  void track(const std::shared_ptr<const ModelData>& model);
+  // Stops streaming the model's textures, leaving their levels as they are.
+  void untrack(const ModelData& model);
+
+  // One draw of `tex` samples level-0 texels at `texelsPerPixel` texels per
+  // pixel (0 = unknown, needs level 0). Untracked textures are ignored.
+  void request(GLuint tex, float texelsPerPixel);
+
+  // Once per frame, after drawing: moves every texture towards the finest
+  // level requested since the last call, most-needed first, within the
+  // upload and VRAM budgets.
+  void update();
+
+  const Stats& stats() const { return stats_; }
+
+ private:
+  struct Entry {
+    const ModelData* model = nullptr;
+    const TextureImage* image = nullptr;
+    GLuint tex = 0;
+    int tailLevel = 0;     // levels from here on are always resident
+    int baseLevel = 0;     // finest resident level
+    int wantedLevel = 0;   // finest requested this frame
+    int targetLevel = 0;   // what update() works towards
+    std::uint64_t lastRequest = 0;  // frame + 1; 0 = never
+  };
+
+  // Evicts surplus levels of other textures until `bytes` more fit in the
+  // budget; false if they cannot.
+  bool makeRoom(std::size_t bytes, const Entry* keep);
+  void evictLevel(Entry& entry);
+  void reindex();
+
+  TextureStreamingOptions options_;
+  std::vector<std::shared_ptr<const ModelData>> models_;
+  std::vector<Entry> entries_;
+  std::unordered_map<GLuint, std::size_t> index_;
+  std::size_t streamedBytes_ = 0;
+  std::uint64_t frame_ = 0;
+  Stats stats_;
+};
+
+}  // namespace utils
+
+#endif
@@ -0,0 +1,66 @@
+#ifndef THREAD_POOL_HPP
+#define THREAD_POOL_HPP
+
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace utils {
+
+class ThreadPool {
+ public:
+  // threadCount == 0 picks std::thread::hardware_concurrency().
+  explicit ThreadPool(unsigned threadCount = 0);
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  unsigned size() const { return static_cast<unsigned>(workers_.size()); }
+
+  template <class F>
+  auto submit(F&& fn) -> std::future<std::invoke_result_t<std::decay_t<F>>>;
+
+  // Runs fn(i) for i in [0, count) across the pool and the calling thread.
+  // Blocks until all items are done; rethrows the first exception.
+  void parallelFor(std::size_t count,
+                   const std::function<void(std::size_t)>& fn);
+
+  static unsigned resolveThreadCount(unsigned requested);
+
+ private:
+  void enqueue(std::function<void()> task);
+  void workerLoop();
+
+  std::vector<std::thread> workers_;
+  std::queue<std::function<void()>> tasks_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  bool stopping_ = false;
+};
+
+// Runs fn(i) for i in [0, count) on `pool`, or inline when pool is null.
+void parallelFor(ThreadPool* pool, std::size_t count,
+                 const std::function<void(std::size_t)>& fn);
+
+template <class F>
+auto ThreadPool::submit(F&& fn)
+    -> std::future<std::invoke_result_t<std::decay_t<F>>> {
+  using R = std::invoke_result_t<std::decay_t<F>>;
+  auto task = std::make_shared<std::packaged_task<R()>>(std::forward<F>(fn));
+  std::future<R> result = task->get_future();
+  enqueue([task] { (*task)(); });
+  return result;
+}
+
+}  // namespace utils
+
+#endif
@@ -0,0 +1,100 @@
+#include "upload_queue.hpp"
+
+#include <chrono>
+#include <exception>
+
+#include "gl_debug.hpp"
+
+namespace utils {
+
+UploadQueue::UploadQueue(std::size_t capacityBytes)
+    : capacityBytes_(capacityBytes) {}
+
+bool UploadQueue::push(std::size_t bytes, std::function<void()> task) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  // An oversized task is admitted once the queue has fully drained.
+  spaceAvailable_.wait(lock, [&] {
+    return closed_ || pendingBytes_ == 0 ||
+           pendingBytes_ + bytes <= capacityBytes_;
+  });
+  tasks_.push_back({bytes, std::move(task)});
+  if (closed_) return false;
+  pendingBytes_ += bytes;
+  return true;
+}
+
+UploadQueue::DrainStats UploadQueue::drain(std::size_t byteBudget,
+                                           double timeBudgetMs) {
+  using clock = std::chrono::steady_clock;
+  const auto t0 = clock::now();
+  DrainStats stats;
+
+  for (;;) {
+    Task task;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (closed_ || tasks_.empty()) break;
+      if (stats.tasks > 0 && stats.bytes + tasks_.front().bytes > byteBudget)
+        break;
+      task = std::move(tasks_.front());
+      tasks_.pop_front();
+    }
+
+    {
+      // Gives the task's bytes back even if it throws, so producers blocked
+      // on the budget are not left waiting for them.
+      struct Release {
+        UploadQueue* queue;
+        std::size_t bytes;
+        ~Release() {
+          {
+            std::lock_guard<std::mutex> lock(queue->mutex_);
+            if (!queue->closed_) queue->pendingBytes_ -= bytes;
+          }
+          queue->spaceAvailable_.notify_all();
+        }
+      } release{this, task.bytes};
+      try {
+        task.fn();
+      } catch (const std::exception& e) {
+        LOG_ERROR("UploadQueue - upload task failed: " << e.what());
+      }
+    }
+    stats.tasks++;
+    stats.bytes += task.bytes;
+
+    stats.milliseconds =
+        std::chrono::duration<double, std::milli>(clock::now() - t0).count();
+    if (stats.milliseconds >= timeBudgetMs) break;
+  }
+  return stats;
+}
+
+void UploadQueue::close() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    closed_ = true;
+    pendingBytes_ = 0;
+  }
+  spaceAvailable_.notify_all();
+}
+
+void UploadQueue::discard() {
+  std::deque<Task> tasks;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    tasks.swap(tasks_);  // destroyed below, outside the lock
+  }
+}
+
+std::size_t UploadQueue::pendingBytes() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return pendingBytes_;
+}
+
+bool UploadQueue::empty() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return tasks_.empty();
+}
+
+}  // namespace utils
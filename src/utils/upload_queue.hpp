@@ -0,0 +1,64 @@
+#ifndef UPLOAD_QUEUE_HPP
+#define UPLOAD_QUEUE_HPP
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+
+namespace utils {
+
+// Bounded queue of GL work produced by loader threads and drained on the
+// render thread under a per-frame budget.
+class UploadQueue {
+ public:
+  struct DrainStats {
+    std::size_t tasks = 0;
+    std::size_t bytes = 0;
+    double milliseconds = 0.0;
+  };
+
+  // Producers block in push() while more than capacityBytes are pending.
+  explicit UploadQueue(std::size_t capacityBytes);
+
+  UploadQueue(const UploadQueue&) = delete;
+  UploadQueue& operator=(const UploadQueue&) = delete;
+
+  // Any thread. `bytes` is the task's cost estimate for the budget. Returns
+  // false once the queue is closed; the task is then kept, unrun, until
+  // discard(), so whatever it captures is not released on this thread.
+  bool push(std::size_t bytes, std::function<void()> task);
+
+  // Render thread. Runs tasks until either budget is spent; always runs at
+  // least one pending task so large items still make progress. A task that
+  // throws std::exception is logged and skipped; the rest still run.
+  DrainStats drain(std::size_t byteBudget, double timeBudgetMs);
+
+  // Wakes blocked producers; from then on nothing is pushed or drained.
+  void close();
+
+  // Render thread, after close() and once producers are done: destroys the
+  // tasks that never ran, so GL objects they own are released there.
+  void discard();
+
+  std::size_t pendingBytes() const;
+  bool empty() const;
+
+ private:
+  struct Task {
+    std::size_t bytes;
+    std::function<void()> fn;
+  };
+
+  mutable std::mutex mutex_;
+  std::condition_variable spaceAvailable_;
+  std::deque<Task> tasks_;
+  std::size_t capacityBytes_;
+  std::size_t pendingBytes_ = 0;
+  bool closed_ = false;
+};
+
+}  // namespace utils
+
+#endif
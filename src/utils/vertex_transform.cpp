@@ -0,0 +1,328 @@
+#include "vertex_transform.hpp"
+
+#include <cmath>
+#include <cstring>
+
+#include "cpu_features.hpp"
+
+#ifdef MGE_X86
+#include <immintrin.h>
+#endif
+
+namespace utils {
+namespace {
+
+static_assert(sizeof(VertexPU) == 8 * sizeof(float),
+              "kernels store VertexPU as pos.xyz, uv.xy, normal.xyz");
+
+// Column-major world matrix and normal matrix.
+struct Matrices {
+  float m[16];
+  float n[9];
+};
+
+// The per-vertex glm loop DecodeGLB ran before the kernels. glm groups
+// mat * vec as (c0 x + c1 y) + (c2 z + c3 w) and normalize as
+// v * (1 / sqrt(dot)), which the wide paths below mirror lane by lane.
+void transformScalar(const VertexStreams& in, std::size_t begin,
+                     std::size_t count, const glm::mat4& world,
+                     const glm::mat3& normalMatrix, VertexPU* dst) {
+  // Local copies: stores through dst could otherwise alias the inputs.
+  const glm::mat4 m = world;
+  const glm::mat3 n = normalMatrix;
+  const VertexStreams s = in;
+  for (std::size_t i = begin; i < count; ++i) {
+    glm::vec3 p;
+    std::memcpy(&p, s.positions + i * s.positionStride, sizeof(p));
+    glm::vec2 uv(0.0f);
+    if (s.uvs) std::memcpy(&uv, s.uvs + i * s.uvStride, sizeof(uv));
+    glm::vec3 normal(0.0f, 1.0f, 0.0f);
+    if (s.normals) {
+      std::memcpy(&normal, s.normals + i * s.normalStride, sizeof(normal));
+      normal = glm::normalize(n * normal);
+    }
+    VertexPU& v = dst[i];
+    v.pos = glm::vec3(m * glm::vec4(p, 1.0f));
+    v.uv = uv;
+    v.normal = normal;
+  }
+}
+
+// Vertices a block kernel may cover from a float3 stream: packed streams
+// load exactly their bytes; strided ones read 16 bytes per element, so the
+// last element (whose slot may end at the buffer's end) is left to the
+// scalar tail.
+std::size_t wideLoadLimit(const std::byte* stream, std::size_t stride,
+                          std::size_t count) {
+  if (!stream || stride == 12 || count == 0) return count;
+  return count - 1;
+}
+
+#ifdef MGE_X86
+// Four float3 elements as x, y, z lanes.
+MGE_TARGET("sse2")
+void loadXyz4(const std::byte* p, std::size_t stride, __m128& x, __m128& y,
+              __m128& z) {
+  if (stride == 12) {
+    const auto* f = reinterpret_cast<const float*>(p);
+    const __m128 a = _mm_loadu_ps(f);      // x0 y0 z0 x1
+    const __m128 b = _mm_loadu_ps(f + 4);  // y1 z1 x2 y2
+    const __m128 c = _mm_loadu_ps(f + 8);  // z2 x3 y3 z3
+    const __m128 bc = _mm_shuffle_ps(b, c, _MM_SHUFFLE(1, 1, 2, 2));
+    x = _mm_shuffle_ps(a, bc, _MM_SHUFFLE(2, 0, 3, 0));
+    const __m128 ab = _mm_shuffle_ps(a, b, _MM_SHUFFLE(0, 0, 1, 1));
+    const __m128 bc2 = _mm_shuffle_ps(b, c, _MM_SHUFFLE(2, 2, 3, 3));
+    y = _mm_shuffle_ps(ab, bc2, _MM_SHUFFLE(2, 0, 2, 0));
+    const __m128 ab2 = _mm_shuffle_ps(a, b, _MM_SHUFFLE(1, 1, 2, 2));
+    const __m128 cc = _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 3, 0, 0));
+    z = _mm_shuffle_ps(ab2, cc, _MM_SHUFFLE(2, 0, 2, 0));
+    return;
+  }
+  __m128 r0 = _mm_loadu_ps(reinterpret_cast<const float*>(p));
+  __m128 r1 = _mm_loadu_ps(reinterpret_cast<const float*>(p + stride));
+  __m128 r2 = _mm_loadu_ps(reinterpret_cast<const float*>(p + 2 * stride));
+  __m128 r3 = _mm_loadu_ps(reinterpret_cast<const float*>(p + 3 * stride));
+  _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+  x = r0;
+  y = r1;
+  z = r2;
+}
+
+// Four float2 elements as u, v lanes.
+MGE_TARGET("sse2")
+void loadUv4(const std::byte* p, std::size_t stride, __m128& u, __m128& v) {
+  __m128 a, b;
+  if (stride == 8) {
+    a = _mm_loadu_ps(reinterpret_cast<const float*>(p));
+    b = _mm_loadu_ps(reinterpret_cast<const float*>(p + 16));
+  } else {
+    const auto* e = reinterpret_cast<const __m64*>(p);
+    a = _mm_loadl_pi(_mm_setzero_ps(), e);
+    a = _mm_loadh_pi(a, reinterpret_cast<const __m64*>(p + stride));
+    b = _mm_loadl_pi(_mm_setzero_ps(),
+                     reinterpret_cast<const __m64*>(p + 2 * stride));
+    b = _mm_loadh_pi(b, reinterpret_cast<const __m64*>(p + 3 * stride));
+  }
+  u = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+  v = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+}
+
+MGE_TARGET("sse2")
+std::size_t transformSse2(const VertexStreams& in, std::size_t count,
+                          const Matrices& mat, VertexPU* dst) {
+  std::size_t limit = wideLoadLimit(in.positions, in.positionStride, count);
+  const std::size_t normalLimit =
+      wideLoadLimit(in.normals, in.normalStride, count);
+  if (normalLimit < limit) limit = normalLimit;
+
+  __m128 m[16], n[9];
+  for (int k = 0; k < 16; ++k) m[k] = _mm_set1_ps(mat.m[k]);
+  for (int k = 0; k < 9; ++k) n[k] = _mm_set1_ps(mat.n[k]);
+  const __m128 one = _mm_set1_ps(1.0f);
+
+  std::size_t i = 0;
+  for (; i + 4 <= limit; i += 4) {
+    __m128 x, y, z;
+    loadXyz4(in.positions + i * in.positionStride, in.positionStride, x, y,
+             z);
+    __m128 p[3];
+    for (int r = 0; r < 3; ++r)
+      p[r] = _mm_add_ps(
+          _mm_add_ps(_mm_mul_ps(m[r], x), _mm_mul_ps(m[4 + r], y)),
+          _mm_add_ps(_mm_mul_ps(m[8 + r], z), m[12 + r]));
+
+    __m128 u = _mm_setzero_ps(), v = _mm_setzero_ps();
+    if (in.uvs) loadUv4(in.uvs + i * in.uvStride, in.uvStride, u, v);
+
+    __m128 t[3];
+    if (in.normals) {
+      loadXyz4(in.normals + i * in.normalStride, in.normalStride, x, y, z);
+      for (int r = 0; r < 3; ++r)
+        t[r] = _mm_add_ps(
+            _mm_add_ps(_mm_mul_ps(n[r], x), _mm_mul_ps(n[3 + r], y)),
+            _mm_mul_ps(n[6 + r], z));
+      const __m128 len2 = _mm_add_ps(
+          _mm_add_ps(_mm_mul_ps(t[0], t[0]), _mm_mul_ps(t[1], t[1])),
+          _mm_mul_ps(t[2], t[2]));
+      const __m128 inv = _mm_div_ps(one, _mm_sqrt_ps(len2));
+      for (int r = 0; r < 3; ++r) t[r] = _mm_mul_ps(t[r], inv);
+    } else {
+      t[0] = _mm_setzero_ps();
+      t[1] = one;
+      t[2] = _mm_setzero_ps();
+    }
+
+    // Back to one vertex per pair of registers: pos.xyz + u, v + normal.
+    __m128 lo0 = p[0], lo1 = p[1], lo2 = p[2], lo3 = u;
+    __m128 hi0 = v, hi1 = t[0], hi2 = t[1], hi3 = t[2];
+    _MM_TRANSPOSE4_PS(lo0, lo1, lo2, lo3);
+    _MM_TRANSPOSE4_PS(hi0, hi1, hi2, hi3);
+    auto* out = reinterpret_cast<float*>(dst + i);
+    _mm_storeu_ps(out + 0, lo0);
+    _mm_storeu_ps(out + 4, hi0);
+    _mm_storeu_ps(out + 8, lo1);
+    _mm_storeu_ps(out + 12, hi1);
+    _mm_storeu_ps(out + 16, lo2);
+    _mm_storeu_ps(out + 20, hi2);
+    _mm_storeu_ps(out + 24, lo3);
+    _mm_storeu_ps(out + 28, hi3);
+  }
+  return i;
+}
+
+MGE_TARGET("avx2")
+__m256 loadHalves(const float* lo, const float* hi) {
+  return _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(lo)),
+                              _mm_loadu_ps(hi), 1);
+}
+
+// Eight float3 elements as x, y, z lanes. Tightly packed streams load
+// elements 0-3 into the low and 4-7 into the high 128-bit halves, so five
+// in-lane shuffles finish the transpose; others are gathered. Gathers read
+// exactly one float per lane, so any stride works and nothing past an
+// element is touched.
+MGE_TARGET("avx2")
+void loadXyz8(const std::byte* p, std::size_t stride, __m256i index,
+              __m256& x, __m256& y, __m256& z) {
+  const auto* f = reinterpret_cast<const float*>(p);
+  if (stride == 12) {
+    const __m256 a = loadHalves(f, f + 12);  // x0 y0 z0 x1 | x4 y4 z4 x5
+    const __m256 b = loadHalves(f + 4, f + 16);  // y1 z1 x2 y2 | y5 z5 x6 y6
+    const __m256 c = loadHalves(f + 8, f + 20);  // z2 x3 y3 z3 | z6 x7 y7 z7
+    const __m256 xy = _mm256_shuffle_ps(b, c, _MM_SHUFFLE(2, 1, 3, 2));
+    const __m256 yz = _mm256_shuffle_ps(a, b, _MM_SHUFFLE(1, 0, 2, 1));
+    x = _mm256_shuffle_ps(a, xy, _MM_SHUFFLE(2, 0, 3, 0));
+    y = _mm256_shuffle_ps(yz, xy, _MM_SHUFFLE(3, 1, 2, 0));
+    z = _mm256_shuffle_ps(yz, c, _MM_SHUFFLE(3, 0, 3, 1));
+    return;
+  }
+  x = _mm256_i32gather_ps(f, index, 4);
+  y = _mm256_i32gather_ps(f + 1, index, 4);
+  z = _mm256_i32gather_ps(f + 2, index, 4);
+}
+
+// Eight float2 elements as u, v lanes, likewise.
+MGE_TARGET("avx2")
+void loadUv8(const std::byte* p, std::size_t stride, __m256i index, __m256& u,
+             __m256& v) {
+  const auto* f = reinterpret_cast<const float*>(p);
+  if (stride == 8) {
+    const __m256 a = _mm256_loadu_ps(f);      // u0 v0 u1 v1 | u2 v2 u3 v3
+    const __m256 b = _mm256_loadu_ps(f + 8);  // u4 v4 u5 v5 | u6 v6 u7 v7
+    // Per 128-bit half: u0 u1 u4 u5 | u2 u3 u6 u7, then reorder the pairs.
+    const __m256 us = _mm256_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+    const __m256 vs = _mm256_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+    u = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(us),
+                                               _MM_SHUFFLE(3, 1, 2, 0)));
+    v = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(vs),
+                                               _MM_SHUFFLE(3, 1, 2, 0)));
+    return;
+  }
+  u = _mm256_i32gather_ps(f, index, 4);
+  v = _mm256_i32gather_ps(f + 1, index, 4);
+}
+
+MGE_TARGET("avx2")
+std::size_t transformAvx2(const VertexStreams& in, std::size_t count,
+                          const Matrices& mat, VertexPU* dst) {
+  const __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+  const __m256i posIdx = _mm256_mullo_epi32(
+      lane, _mm256_set1_epi32(static_cast<int>(in.positionStride / 4)));
+  const __m256i norIdx = _mm256_mullo_epi32(
+      lane, _mm256_set1_epi32(static_cast<int>(in.normalStride / 4)));
+  const __m256i uvIdx = _mm256_mullo_epi32(
+      lane, _mm256_set1_epi32(static_cast<int>(in.uvStride / 4)));
+
+  __m256 m[16], n[9];
+  for (int k = 0; k < 16; ++k) m[k] = _mm256_set1_ps(mat.m[k]);
+  for (int k = 0; k < 9; ++k) n[k] = _mm256_set1_ps(mat.n[k]);
+  const __m256 one = _mm256_set1_ps(1.0f);
+  const __m256 zero = _mm256_setzero_ps();
+
+  std::size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    __m256 row[8];
+    __m256 x, y, z;
+    loadXyz8(in.positions + i * in.positionStride, in.positionStride, posIdx,
+             x, y, z);
+    for (int r = 0; r < 3; ++r)
+      row[r] = _mm256_add_ps(
+          _mm256_add_ps(_mm256_mul_ps(m[r], x), _mm256_mul_ps(m[4 + r], y)),
+          _mm256_add_ps(_mm256_mul_ps(m[8 + r], z), m[12 + r]));
+
+    if (in.uvs) {
+      loadUv8(in.uvs + i * in.uvStride, in.uvStride, uvIdx, row[3], row[4]);
+    } else {
+      row[3] = row[4] = zero;
+    }
+
+    if (in.normals) {
+      __m256 nx, ny, nz;
+      loadXyz8(in.normals + i * in.normalStride, in.normalStride, norIdx, nx,
+               ny, nz);
+      __m256 t[3];
+      for (int r = 0; r < 3; ++r)
+        t[r] = _mm256_add_ps(
+            _mm256_add_ps(_mm256_mul_ps(n[r], nx), _mm256_mul_ps(n[3 + r], ny)),
+            _mm256_mul_ps(n[6 + r], nz));
+      const __m256 len2 = _mm256_add_ps(
+          _mm256_add_ps(_mm256_mul_ps(t[0], t[0]), _mm256_mul_ps(t[1], t[1])),
+          _mm256_mul_ps(t[2], t[2]));
+      const __m256 inv = _mm256_div_ps(one, _mm256_sqrt_ps(len2));
+      for (int r = 0; r < 3; ++r) row[5 + r] = _mm256_mul_ps(t[r], inv);
+    } else {
+      row[5] = zero;
+      row[6] = one;
+      row[7] = zero;
+    }
+
+    // 8x8 transpose: row k lane j -> vertex j float k.
+    __m256 t[8], s[8];
+    for (int k = 0; k < 4; ++k) {
+      t[2 * k] = _mm256_unpacklo_ps(row[2 * k], row[2 * k + 1]);
+      t[2 * k + 1] = _mm256_unpackhi_ps(row[2 * k], row[2 * k + 1]);
+    }
+    for (int h = 0; h < 2; ++h) {
+      const __m256* a = t + 4 * h;
+      s[4 * h + 0] = _mm256_shuffle_ps(a[0], a[2], _MM_SHUFFLE(1, 0, 1, 0));
+      s[4 * h + 1] = _mm256_shuffle_ps(a[0], a[2], _MM_SHUFFLE(3, 2, 3, 2));
+      s[4 * h + 2] = _mm256_shuffle_ps(a[1], a[3], _MM_SHUFFLE(1, 0, 1, 0));
+      s[4 * h + 3] = _mm256_shuffle_ps(a[1], a[3], _MM_SHUFFLE(3, 2, 3, 2));
+    }
+    auto* out = reinterpret_cast<float*>(dst + i);
+    for (int j = 0; j < 4; ++j) {
+      _mm256_storeu_ps(out + 8 * j,
+                       _mm256_permute2f128_ps(s[j], s[4 + j], 0x20));
+      _mm256_storeu_ps(out + 8 * (4 + j),
+                       _mm256_permute2f128_ps(s[j], s[4 + j], 0x31));
+    }
+  }
+  return i;
+}
+#endif
+
+}  // namespace
+
+void transformVertices(const VertexStreams& in, std::size_t count,
+                       const glm::mat4& world, const glm::mat3& normalMatrix,
+                       VertexPU* dst) {
+  Matrices mat;
+  std::memcpy(mat.m, &world[0][0], sizeof(mat.m));
+  std::memcpy(mat.n, &normalMatrix[0][0], sizeof(mat.n));
+
+  std::size_t done = 0;
+#ifdef MGE_X86
+  const CpuFeatures features = cpuFeatures();
+  // glTF keeps vertex strides 4-byte aligned; anything else stays scalar.
+  if (in.positionStride % 4 == 0 && in.normalStride % 4 == 0 &&
+      in.uvStride % 4 == 0) {
+    if (features.avx2)
+      done = transformAvx2(in, count, mat, dst);
+    else if (features.sse2)
+      done = transformSse2(in, count, mat, dst);
+  }
+#endif
+  transformScalar(in, done, count, world, normalMatrix, dst);
+}
+
+}  // namespace utils
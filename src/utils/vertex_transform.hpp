@@ -0,0 +1,32 @@
+#ifndef VERTEX_TRANSFORM_HPP
+#define VERTEX_TRANSFORM_HPP
+
+#include <cstddef>
+#include <glm/glm.hpp>
+
+#include "mesh.hpp"
+
+namespace utils {
+
+// Float attribute streams; strides in bytes. Null normals become (0, 1, 0),
+// null uvs (0, 0).
+struct VertexStreams {
+  const std::byte* positions = nullptr;  // float3
+  std::size_t positionStride = 12;
+  const std::byte* normals = nullptr;  // float3
+  std::size_t normalStride = 12;
+  const std::byte* uvs = nullptr;  // float2
+  std::size_t uvStride = 8;
+};
+
+// dst[i] = {world * (p, 1), uv, normalize(normalMatrix * n)} for i < count.
+// Runs 8 (AVX2) or 4 (SSE2) vertices per step when cpuFeatures() allows,
+// with dedicated loads for tightly packed streams; every path evaluates the
+// same expressions in the same order.
+void transformVertices(const VertexStreams& in, std::size_t count,
+                       const glm::mat4& world, const glm::mat3& normalMatrix,
+                       VertexPU* dst);
+
+}  // namespace utils
+
+#endif
@@ -0,0 +1,299 @@
+#include "vfs.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <stdexcept>
+#include <system_error>
+
+#include "hash.hpp"
+
+namespace utils {
+namespace {
+
+constexpr char kMagic[4] = {'M', 'G', 'P', 'K'};
+constexpr std::uint32_t kVersion = 1;
+constexpr std::uint64_t kAlignment = 64;
+
+struct PakHeader {
+  char magic[4];
+  std::uint32_t version;
+  std::uint64_t fileCount;
+  std::uint64_t tocOffset;
+  std::uint64_t namesOffset;
+  std::uint64_t namesSize;
+};
+
+static_assert(sizeof(PakHeader) == 40, "PakHeader layout");
+
+std::uint64_t alignUp(std::uint64_t v) {
+  return (v + kAlignment - 1) & ~(kAlignment - 1);
+}
+
+bool inBounds(std::uint64_t offset, std::uint64_t size, std::uint64_t total) {
+  return offset <= total && size <= total - offset;
+}
+
+std::uint64_t nameHash(std::string_view name) {
+  return hash64(name.data(), name.size());
+}
+
+}  // namespace
+
+struct Pak::Entry {
+  std::uint64_t hash;
+  std::uint64_t offset;  // from the start of the archive
+  std::uint64_t size;
+  std::uint32_t nameOffset;  // into the name block
+  std::uint32_t nameSize;
+};
+
+static_assert(sizeof(Pak::Entry) == 32, "Pak::Entry layout");
+
+std::string normalizeVfsPath(std::string_view path) {
+  std::vector<std::string_view> parts;
+  const bool absolute = !path.empty() && (path[0] == '/' || path[0] == '\\');
+  std::size_t begin = 0;
+  while (begin <= path.size()) {
+    std::size_t end = path.find_first_of("/\\", begin);
+    if (end == std::string_view::npos) end = path.size();
+    const std::string_view part = path.substr(begin, end - begin);
+    if (part == "..") {
+      if (!parts.empty() && parts.back() != "..")
+        parts.pop_back();
+      else if (!absolute)
+        parts.push_back(part);
+    } else if (!part.empty() && part != ".") {
+      parts.push_back(part);
+    }
+    begin = end + 1;
+  }
+
+  std::string out = absolute ? "/" : "";
+  for (std::size_t i = 0; i < parts.size(); ++i) {
+    if (i) out += '/';
+    out += parts[i];
+  }
+  return out;
+}
+
+Pak::Pak(const std::string& path) : file_(path) {
+  const auto* base = reinterpret_cast<const unsigned char*>(file_.data());
+  const std::uint64_t total = file_.size();
+  PakHeader header{};
+  if (total < sizeof(header))
+    throw std::runtime_error("Truncated pak " + path);
+  std::memcpy(&header, base, sizeof(header));
+  if (std::memcmp(header.magic, kMagic, sizeof(kMagic)) != 0 ||
+      header.version != kVersion)
+    throw std::runtime_error("Not a pak of this version: " + path);
+  if (header.fileCount > total / sizeof(Entry) ||
+      header.tocOffset % alignof(Entry) != 0 ||
+      !inBounds(header.tocOffset, header.fileCount * sizeof(Entry), total) ||
+      !inBounds(header.namesOffset, header.namesSize, total))
+    throw std::runtime_error("Truncated pak " + path);
+
+  toc_ = reinterpret_cast<const Entry*>(base + header.tocOffset);
+  names_ = reinterpret_cast<const char*>(base + header.namesOffset);
+  count_ = static_cast<std::size_t>(header.fileCount);
+
+  std::size_t capacity = 1;
+  while (capacity < count_ * 2) capacity *= 2;
+  buckets_.assign(capacity, 0);
+  for (std::size_t i = 0; i < count_; ++i) {
+    const Entry& e = toc_[i];
+    if (!inBounds(e.offset, e.size, total) ||
+        !inBounds(e.nameOffset, e.nameSize, header.namesSize))
+      throw std::runtime_error("Truncated pak " + path);
+    std::size_t slot = e.hash & (capacity - 1);
+    while (buckets_[slot]) slot = (slot + 1) & (capacity - 1);
+    buckets_[slot] = static_cast<std::uint32_t>(i + 1);
+  }
+}
+
+const unsigned char* Pak::find(std::string_view name,
+                               std::size_t& size) const {
+  const std::uint64_t hash = nameHash(name);
+  const std::size_t mask = buckets_.size() - 1;
+  for (std::size_t slot = hash & mask; buckets_[slot];
+       slot = (slot + 1) & mask) {
+    const Entry& e = toc_[buckets_[slot] - 1];
+    if (e.hash == hash &&
+        std::string_view(names_ + e.nameOffset, e.nameSize) == name) {
+      size = static_cast<std::size_t>(e.size);
+      return reinterpret_cast<const unsigned char*>(file_.data()) + e.offset;
+    }
+  }
+  return nullptr;
+}
+
+std::vector<PakSource> pakSourcesUnder(const std::string& root,
+                                       const std::string& dir) {
+  namespace fs = std::filesystem;
+  std::vector<PakSource> sources;
+  for (const auto& entry :
+       fs::recursive_directory_iterator(fs::path(root) / dir)) {
+    if (!entry.is_regular_file()) continue;
+    sources.push_back({fs::relative(entry.path(), root).generic_string(),
+                       entry.path().string()});
+  }
+  std::sort(sources.begin(), sources.end(),
+            [](const PakSource& a, const PakSource& b) {
+              return a.name < b.name;
+            });
+  return sources;
+}
+
+void writePak(const std::string& pakPath,
+              const std::vector<PakSource>& sources) {
+  namespace fs = std::filesystem;
+  std::vector<std::pair<std::string, const PakSource*>> files;
+  files.reserve(sources.size());
+  for (const PakSource& source : sources)
+    files.emplace_back(normalizeVfsPath(source.name), &source);
+  std::sort(files.begin(), files.end(),
+            [](const auto& a, const auto& b) { return a.first < b.first; });
+
+  PakHeader header{};
+  std::memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.version = kVersion;
+  header.fileCount = files.size();
+  header.tocOffset = alignUp(sizeof(PakHeader));
+  header.namesOffset = header.tocOffset + files.size() * sizeof(Pak::Entry);
+
+  std::vector<Pak::Entry> toc(files.size());
+  std::string names;
+  for (std::size_t i = 0; i < files.size(); ++i) {
+    const std::string& name = files[i].first;
+    if (i > 0 && name == files[i - 1].first)
+      throw std::runtime_error("Duplicate pak entry " + name);
+    toc[i].hash = nameHash(name);
+    toc[i].size = fs::file_size(files[i].second->path);
+    toc[i].nameOffset = static_cast<std::uint32_t>(names.size());
+    toc[i].nameSize = static_cast<std::uint32_t>(name.size());
+    names += name;
+  }
+  header.namesSize = names.size();
+  std::uint64_t offset = alignUp(header.namesOffset + names.size());
+  for (Pak::Entry& e : toc) {
+    e.offset = offset;
+    offset = alignUp(offset + e.size);
+  }
+
+  const fs::path target(pakPath);
+  if (target.has_parent_path()) fs::create_directories(target.parent_path());
+  const std::string tmpPath = pakPath + ".tmp";
+  {
+    std::ofstream out(tmpPath, std::ios::binary | std::ios::trunc);
+    if (!out) throw std::runtime_error("Cannot write pak " + pakPath);
+    const char zeros[kAlignment] = {};
+    std::uint64_t written = 0;
+    const auto write = [&](const void* data, std::uint64_t size) {
+      out.write(static_cast<const char*>(data),
+                static_cast<std::streamsize>(size));
+      written += size;
+    };
+    const auto padTo = [&](std::uint64_t at) { write(zeros, at - written); };
+
+    write(&header, sizeof(header));
+    padTo(header.tocOffset);
+    write(toc.data(), toc.size() * sizeof(Pak::Entry));
+    write(names.data(), names.size());
+    for (std::size_t i = 0; i < files.size(); ++i) {
+      padTo(toc[i].offset);
+      if (toc[i].size == 0) continue;
+      const MappedFile source(files[i].second->path);
+      if (source.size() != toc[i].size)
+        throw std::runtime_error("Pak source changed while packing: " +
+                                 files[i].second->path);
+      write(source.data(), source.size());
+    }
+    padTo(offset);
+    out.close();
+    if (!out) throw std::runtime_error("Failed writing pak " + pakPath);
+  }
+  fs::rename(tmpPath, target);
+}
+
+Vfs& Vfs::instance() {
+  static Vfs vfs;
+  return vfs;
+}
+
+void Vfs::mount(const std::string& pakPath) {
+  auto pak = std::make_shared<const Pak>(pakPath);
+  std::unique_lock lock(mutex_);
+  paks_.push_back(std::move(pak));
+}
+
+void Vfs::setLooseOverrides(bool enabled) {
+  std::unique_lock lock(mutex_);
+  looseOverrides_ = enabled;
+}
+
+bool Vfs::openPacked(const std::string& path, VfsFile& out) const {
+  const std::string name = normalizeVfsPath(path);
+  std::shared_lock lock(mutex_);
+  for (auto it = paks_.rbegin(); it != paks_.rend(); ++it) {
+    std::size_t size = 0;
+    if (const unsigned char* data = (*it)->find(name, size)) {
+      out.backing_ = *it;
+      out.data_ = data;
+      out.size_ = size;
+      out.fromPak_ = true;
+      return true;
+    }
+  }
+  return false;
+}
+
+bool Vfs::openLoose(const std::string& path, VfsFile& out) {
+  std::error_code ec;
+  if (!std::filesystem::is_regular_file(path, ec)) return false;
+  auto file = std::make_shared<MappedFile>(path);
+  out.data_ = reinterpret_cast<const unsigned char*>(file->data());
+  out.size_ = file->size();
+  out.fromPak_ = false;
+  out.backing_ = std::move(file);
+  return true;
+}
+
+bool Vfs::tryOpen(const std::string& path, VfsFile& out) const {
+  bool looseFirst;
+  {
+    std::shared_lock lock(mutex_);
+    looseFirst = looseOverrides_;
+  }
+  if (looseFirst && openLoose(path, out)) return true;
+  if (openPacked(path, out)) return true;
+  return !looseFirst && openLoose(path, out);
+}
+
+VfsFile Vfs::open(const std::string& path) const {
+  VfsFile file;
+  if (!tryOpen(path, file)) throw std::runtime_error("File not found: " + path);
+  return file;
+}
+
+bool Vfs::exists(const std::string& path) const {
+  const std::string name = normalizeVfsPath(path);
+  {
+    std::shared_lock lock(mutex_);
+    std::size_t size = 0;
+    for (const auto& pak : paks_)
+      if (pak->find(name, size)) return true;
+  }
+  std::error_code ec;
+  return std::filesystem::is_regular_file(path, ec);
+}
+
+std::size_t Vfs::mountedFiles() const {
+  std::shared_lock lock(mutex_);
+  std::size_t count = 0;
+  for (const auto& pak : paks_) count += pak->fileCount();
+  return count;
+}
+
+}  // namespace utils
@@ -0,0 +1,109 @@
+#ifndef VFS_HPP
+#define VFS_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "mapped_file.hpp"
+
+namespace utils {
+
+// Bytes of a file opened through the Vfs: a view into a mounted pak or the
+// mapping of a loose file. Copies share the mapping, which stays alive while
+// any of them does.
+class VfsFile {
+ public:
+  const unsigned char* data() const { return data_; }
+  std::size_t size() const { return size_; }
+  std::string_view text() const {
+    return {reinterpret_cast<const char*>(data_), size_};
+  }
+  bool fromPak() const { return fromPak_; }
+
+ private:
+  friend class Vfs;
+
+  std::shared_ptr<const void> backing_;
+  const unsigned char* data_ = nullptr;
+  std::size_t size_ = 0;
+  bool fromPak_ = false;
+};
+
+// Read-only archive: a header, a table of contents of fixed-size entries
+// (path hash, offset, size, name) and the file blobs, each 64-byte aligned
+// so mapped data can be read in place. Mapped once; a lookup hashes the
+// normalized path and probes a table built at open.
+class Pak {
+ public:
+  // Throws std::runtime_error on a malformed or truncated archive.
+  explicit Pak(const std::string& path);
+
+  // Null when the archive has no `name` (a normalized path).
+  const unsigned char* find(std::string_view name, std::size_t& size) const;
+  std::size_t fileCount() const { return count_; }
+
+  struct Entry;  // table of contents record, laid out in vfs.cpp
+
+ private:
+  MappedFile file_;
+  const Entry* toc_ = nullptr;
+  const char* names_ = nullptr;
+  std::size_t count_ = 0;
+  std::vector<std::uint32_t> buckets_;  // entry index + 1; 0 = empty
+};
+
+struct PakSource {
+  std::string name;  // path inside the archive, as the engine opens it
+  std::string path;  // file on disk
+};
+
+// Regular files under root/dir, named by their path relative to `root`
+// ("shaders/lit.vert"), sorted by name.
+std::vector<PakSource> pakSourcesUnder(const std::string& root,
+                                       const std::string& dir);
+
+// Writes an archive of `sources`; replaces `pakPath` atomically. Throws
+// std::runtime_error on I/O errors or duplicate names.
+void writePak(const std::string& pakPath,
+              const std::vector<PakSource>& sources);
+
+// "./a\\b/../c" -> "a/c": the form pak names are stored and looked up in.
+std::string normalizeVfsPath(std::string_view path);
+
+// Process-wide file lookup: mounted paks first, the last mount shadowing
+// earlier ones, then loose files on disk for paths no pak holds. With
+// loose overrides on, a file on disk wins over the paks (development, to
+// edit shaders or assets without repacking). Thread-safe.
+class Vfs {
+ public:
+  static Vfs& instance();
+
+  // Throws std::runtime_error if the archive cannot be opened.
+  void mount(const std::string& pakPath);
+  void setLooseOverrides(bool enabled);
+
+  bool exists(const std::string& path) const;
+  // False when neither a pak nor the disk has `path`.
+  bool tryOpen(const std::string& path, VfsFile& out) const;
+  // Throws std::runtime_error when the file is missing.
+  VfsFile open(const std::string& path) const;
+
+  std::size_t mountedFiles() const;
+
+ private:
+  bool openPacked(const std::string& path, VfsFile& out) const;
+  static bool openLoose(const std::string& path, VfsFile& out);
+
+  mutable std::shared_mutex mutex_;
+  std::vector<std::shared_ptr<const Pak>> paks_;
+  bool looseOverrides_ = false;
+};
+
+}  // namespace utils
+
+#endif
@@ -0,0 +1,508 @@
+#include "virtual_texture.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+#include "gl_debug.hpp"
+
+namespace utils {
+namespace {
+
+// Pages are keyed by texture id, level and position; feedback texels carry
+// the same fields as 16-bit integers.
+std::uint64_t pageKey(int id, int level, int x, int y) {
+  return static_cast<std::uint64_t>(id) << 40 |
+         static_cast<std::uint64_t>(level) << 32 |
+         static_cast<std::uint64_t>(x) << 16 | static_cast<std::uint64_t>(y);
+}
+
+struct PageId {
+  int id;
+  int level;
+  int x;
+  int y;
+};
+
+PageId unpackPage(std::uint64_t page) {
+  return {static_cast<int>(page >> 40), static_cast<int>(page >> 32 & 0xff),
+          static_cast<int>(page >> 16 & 0xffff),
+          static_cast<int>(page & 0xffff)};
+}
+
+// Page coordinate `v` of a page `k` levels finer. The last page of a level
+// also covers the finer pages past the coarser level's edge (odd sizes).
+int ancestorPage(int v, int k, int pages) {
+  return std::min(v >> k, pages - 1);
+}
+
+}  // namespace
+
+VirtualTextureSystem::VirtualTextureSystem(const VirtualTextureOptions& options)
+    : options_(options), pool_(options.loaderThreads) {
+  const VirtualTextureLayout& layout = options_.layout;
+  if (options_.cachePages <= 0 || options_.feedbackDivisor <= 0 ||
+      layout.pageSize <= 0 || layout.border < 0 ||
+      layout.border > layout.pageSize)
+    throw std::runtime_error("Bad virtual texture options");
+  const int size = (layout.pageSize + 2 * layout.border) * options_.cachePages;
+  GLint maxSize = 0;
+  glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxSize);
+  if (size > maxSize)
+    throw std::runtime_error("Virtual texture cache exceeds " +
+                             std::to_string(maxSize) + " texels");
+
+  glGenTextures(1, &cache_);
+  glBindTexture(GL_TEXTURE_2D, cache_);
+  glTexImage2D(GL_TEXTURE_2D, 0, options_.srgb ? GL_SRGB8_ALPHA8 : GL_RGBA8,
+               size, size, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+
+  slots_.resize(static_cast<std::size_t>(options_.cachePages) *
+                static_cast<std::size_t>(options_.cachePages));
+  for (int slot = static_cast<int>(slots_.size()) - 1; slot >= 0; --slot)
+    freeSlots_.push_back(slot);
+  stats_.cachePages = slots_.size();
+}
+
+VirtualTextureSystem::~VirtualTextureSystem() {
+  for (Readback& readback : readbacks_) {
+    if (readback.fence) glDeleteSync(readback.fence);
+    if (readback.pbo) glDeleteBuffers(1, &readback.pbo);
+  }
+  for (Texture& tex : textures_)
+    if (tex.pageTable) glDeleteTextures(1, &tex.pageTable);
+  if (feedbackFbo_) glDeleteFramebuffers(1, &feedbackFbo_);
+  if (feedbackColor_) glDeleteRenderbuffers(1, &feedbackColor_);
+  if (feedbackDepth_) glDeleteRenderbuffers(1, &feedbackDepth_);
+  if (cache_) glDeleteTextures(1, &cache_);
+}
+
+int VirtualTextureSystem::addTexture(const std::string& path) {
+  auto file = std::make_shared<const VirtualTextureFile>(path);
+  const VirtualTextureInfo& info = file->info();
+  if (info.pageSize != options_.layout.pageSize ||
+      info.border != options_.layout.border)
+    throw std::runtime_error("Virtual texture page layout differs from the "
+                             "cache: " + path);
+  if (info.srgb != options_.srgb)
+    throw std::runtime_error("Virtual texture colour space differs from the "
+                             "cache: " + path);
+  if (textures_.size() >= 0xffff)
+    throw std::runtime_error("Too many virtual textures");
+
+  Texture tex;
+  tex.file = file;
+  for (int level = 0; level < info.levelCount; ++level) {
+    tex.levelRows.push_back(tex.tableHeight);
+    tex.tableHeight += info.pagesY(level);
+  }
+  tex.tableWidth = info.pagesX(0);
+  GLint maxSize = 0;
+  glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxSize);
+  if (tex.tableWidth > maxSize || tex.tableHeight > maxSize)
+    throw std::runtime_error("Virtual texture has too many pages: " + path);
+  tex.table.assign(static_cast<std::size_t>(tex.tableWidth) *
+                       static_cast<std::size_t>(tex.tableHeight) * 4,
+                   0);
+
+  glGenTextures(1, &tex.pageTable);
+  glBindTexture(GL_TEXTURE_2D, tex.pageTable);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16UI, tex.tableWidth, tex.tableHeight,
+               0, GL_RGBA_INTEGER, GL_UNSIGNED_SHORT, nullptr);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+
+  const int id = static_cast<int>(textures_.size());
+  textures_.push_back(std::move(tex));
+
+  // The root page maps every page until finer ones arrive.
+  const int root = info.levelCount - 1;
+  const int slot = acquireSlot();
+  if (slot < 0) {
+    glDeleteTextures(1, &textures_.back().pageTable);
+    textures_.pop_back();
+    throw std::runtime_error("Virtual texture cache is full: " + path);
+  }
+  placePage(pageKey(id, root, 0, 0), slot, file->page(root, 0, 0));
+  slots_[static_cast<std::size_t>(slot)].locked = true;
+  flushPageTable(textures_.back());
+  stats_.textures++;
+  return id;
+}
+
+void VirtualTextureSystem::track(ModelData& model) {
+  for (VirtualTextureRef& ref : model.virtualTextures) {
+    if (ref.id >= 0 || ref.path.empty()) continue;
+    try {
+      ref.id = addTexture(ref.path);
+    } catch (const std::exception& e) {
+      LOG_WARN("Virtual texture " << ref.path << ": " << e.what());
+    }
+  }
+}
+
+void VirtualTextureSystem::removeTexture(int id) {
+  if (id < 0 || id >= static_cast<int>(textures_.size()) ||
+      !textures_[static_cast<std::size_t>(id)].file)
+    return;
+  for (std::size_t slot = 0; slot < slots_.size(); ++slot) {
+    const std::uint64_t page = slots_[slot].page;
+    if (page == kNoPage || unpackPage(page).id != id) continue;
+    resident_.erase(page);
+    slots_[slot] = Slot{};
+    freeSlots_.push_back(static_cast<int>(slot));
+    stats_.residentPages--;
+  }
+  Texture& tex = textures_[static_cast<std::size_t>(id)];
+  glDeleteTextures(1, &tex.pageTable);
+  tex = Texture{};
+  stats_.textures--;
+}
+
+void VirtualTextureSystem::bind(int id, const Shader& shader) const {
+  if (id < 0 || id >= static_cast<int>(textures_.size()) ||
+      !textures_[static_cast<std::size_t>(id)].file) {
+    unbind(shader);
+    return;
+  }
+  const Texture& tex = textures_[static_cast<std::size_t>(id)];
+  const VirtualTextureInfo& info = tex.file->info();
+  glActiveTexture(GL_TEXTURE2);
+  glBindTexture(GL_TEXTURE_2D, tex.pageTable);
+  glActiveTexture(GL_TEXTURE3);
+  glBindTexture(GL_TEXTURE_2D, cache_);
+  glActiveTexture(GL_TEXTURE0);
+  shader.setInt("uVtPageTable", 2);
+  shader.setInt("uVtCache", 3);
+  shader.setInt("uVtId", id);
+  shader.setVec2("uVtSize", static_cast<float>(info.width),
+                 static_cast<float>(info.height));
+  shader.setInt("uVtMaxLevel", info.levelCount - 1);
+  shader.setInt("uVtPageSize", info.pageSize);
+  shader.setInt("uVtBorder", info.border);
+  // Mirrored repeat is sampled as plain repeat.
+  const auto clamped = [](GLint wrap) {
+    return wrap == GL_REPEAT || wrap == GL_MIRRORED_REPEAT ? 0.0f : 1.0f;
+  };
+  shader.setVec2("uVtClamp", clamped(info.wrapS), clamped(info.wrapT));
+  // Derivatives in the smaller feedback target are feedbackDivisor times
+  // larger; the bias asks for the level the full-size pass samples.
+  shader.setFloat("uVtLodBias",
+                  inFeedback_ ? -std::log2(static_cast<float>(
+                                    options_.feedbackDivisor))
+                              : 0.0f);
+}
+
+void VirtualTextureSystem::unbind(const Shader& shader) {
+  shader.setVec2("uVtSize", 0.0f, 0.0f);
+}
+
+void VirtualTextureSystem::beginFeedback(int viewportWidth,
+                                         int viewportHeight) {
+  const int width = std::max(1, viewportWidth / options_.feedbackDivisor);
+  const int height = std::max(1, viewportHeight / options_.feedbackDivisor);
+  glGetIntegerv(GL_FRAMEBUFFER_BINDING, &savedFramebuffer_);
+  glGetIntegerv(GL_VIEWPORT, savedViewport_.data());
+  if (width != feedbackWidth_ || height != feedbackHeight_)
+    createFeedbackTarget(width, height);
+
+  glBindFramebuffer(GL_FRAMEBUFFER, feedbackFbo_);
+  glViewport(0, 0, width, height);
+  const GLuint none[4] = {0, 0, 0, 0};
+  const GLfloat far = 1.0f;
+  glClearBufferuiv(GL_COLOR, 0, none);
+  glClearBufferfv(GL_DEPTH, 0, &far);
+  inFeedback_ = true;
+}
+
+void VirtualTextureSystem::endFeedback() {
+  if (!inFeedback_) return;
+  inFeedback_ = false;
+
+  // With every readback still in flight this frame's is skipped rather
+  // than waited for.
+  Readback& readback = readbacks_[nextReadback_];
+  if (!readback.fence) {
+    nextReadback_ = (nextReadback_ + 1) % readbacks_.size();
+    if (!readback.pbo) glGenBuffers(1, &readback.pbo);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.pbo);
+    if (readback.width != feedbackWidth_ ||
+        readback.height != feedbackHeight_) {
+      readback.width = feedbackWidth_;
+      readback.height = feedbackHeight_;
+      glBufferData(GL_PIXEL_PACK_BUFFER,
+                   static_cast<GLsizeiptr>(feedbackWidth_) * feedbackHeight_ *
+                       4 * sizeof(std::uint16_t),
+                   nullptr, GL_STREAM_READ);
+    }
+    glReadBuffer(GL_COLOR_ATTACHMENT0);
+    glReadPixels(0, 0, feedbackWidth_, feedbackHeight_, GL_RGBA_INTEGER,
+                 GL_UNSIGNED_SHORT, nullptr);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    readback.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  }
+
+  glBindFramebuffer(GL_FRAMEBUFFER, static_cast<GLuint>(savedFramebuffer_));
+  glViewport(savedViewport_[0], savedViewport_[1], savedViewport_[2],
+             savedViewport_[3]);
+}
+
+void VirtualTextureSystem::update() {
+  ++frame_;
+
+  for (Readback& readback : readbacks_) {
+    if (!readback.fence) continue;
+    const GLenum state = glClientWaitSync(readback.fence, 0, 0);
+    if (state != GL_ALREADY_SIGNALED && state != GL_CONDITION_SATISFIED)
+      continue;
+    glDeleteSync(readback.fence);
+    readback.fence = nullptr;
+    const std::size_t count = static_cast<std::size_t>(readback.width) *
+                              static_cast<std::size_t>(readback.height);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.pbo);
+    const void* pixels =
+        glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0,
+                         static_cast<GLsizeiptr>(count * 4 *
+                                                 sizeof(std::uint16_t)),
+                         GL_MAP_READ_BIT);
+    if (pixels) {
+      readFeedback(static_cast<const std::uint16_t*>(pixels), count);
+      glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+      stats_.readbacks++;
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+  }
+
+  std::vector<LoadedPage> ready;
+  {
+    std::lock_guard<std::mutex> lock(loadedMutex_);
+    while (!loaded_.empty() && ready.size() < options_.pagesPerFrame) {
+      ready.push_back(std::move(loaded_.front()));
+      loaded_.pop_front();
+    }
+  }
+  for (const LoadedPage& page : ready) {
+    pending_.erase(page.page);
+    const PageId id = unpackPage(page.page);
+    if (!textures_[static_cast<std::size_t>(id.id)].file ||
+        resident_.count(page.page))
+      continue;
+    // Every slot sampled this frame: the page is asked for again later.
+    const int slot = acquireSlot();
+    if (slot < 0) continue;
+    placePage(page.page, slot, page.texels.data());
+  }
+
+  for (Texture& tex : textures_) flushPageTable(tex);
+}
+
+void VirtualTextureSystem::readFeedback(const std::uint16_t* pixels,
+                                        std::size_t count) {
+  std::unordered_set<std::uint64_t> seen;
+  std::vector<std::uint64_t> missing;
+  for (std::size_t i = 0; i < count; ++i, pixels += 4) {
+    if (pixels[3] == 0) continue;
+    const int id = pixels[3] - 1;
+    if (id >= static_cast<int>(textures_.size()) ||
+        !textures_[static_cast<std::size_t>(id)].file)
+      continue;
+    const VirtualTextureInfo& info =
+        textures_[static_cast<std::size_t>(id)].file->info();
+    int level = pixels[2], x = pixels[0], y = pixels[1];
+    if (level >= info.levelCount || x >= info.pagesX(level) ||
+        y >= info.pagesY(level))
+      continue;
+    // The page and its ancestors, the fallbacks while it loads: resident
+    // ones are kept, missing ones loaded.
+    for (; level < info.levelCount; ++level) {
+      const std::uint64_t page = pageKey(id, level, x, y);
+      if (!seen.insert(page).second) break;
+      const auto it = resident_.find(page);
+      if (it != resident_.end())
+        slots_[static_cast<std::size_t>(it->second)].lastUsed = frame_;
+      else
+        missing.push_back(page);
+      if (level + 1 < info.levelCount) {
+        x = ancestorPage(x, 1, info.pagesX(level + 1));
+        y = ancestorPage(y, 1, info.pagesY(level + 1));
+      }
+    }
+  }
+  // Coarse pages first: each one improves every pixel below it.
+  std::sort(missing.begin(), missing.end(),
+            [](std::uint64_t a, std::uint64_t b) {
+              return unpackPage(a).level > unpackPage(b).level;
+            });
+  for (std::uint64_t page : missing) requestPage(page);
+}
+
+void VirtualTextureSystem::requestPage(std::uint64_t page) {
+  if (pending_.size() >= options_.maxPendingPages || pending_.count(page))
+    return;
+  std::shared_ptr<const VirtualTextureFile> file =
+      textures_[static_cast<std::size_t>(unpackPage(page).id)].file;
+  pending_.insert(page);
+  pool_.submit([this, file, page] {
+    const PageId id = unpackPage(page);
+    const unsigned char* texels = file->page(id.level, id.x, id.y);
+    LoadedPage loaded;
+    loaded.page = page;
+    loaded.texels.assign(texels, texels + file->info().pageBytes());
+    std::lock_guard<std::mutex> lock(loadedMutex_);
+    loaded_.push_back(std::move(loaded));
+  });
+}
+
+int VirtualTextureSystem::acquireSlot() {
+  if (!freeSlots_.empty()) {
+    const int slot = freeSlots_.back();
+    freeSlots_.pop_back();
+    return slot;
+  }
+  // Least recently sampled, never one the latest feedback asked for.
+  int victim = -1;
+  for (std::size_t slot = 0; slot < slots_.size(); ++slot) {
+    const Slot& s = slots_[slot];
+    if (s.locked || s.lastUsed >= frame_) continue;
+    if (victim < 0 ||
+        s.lastUsed < slots_[static_cast<std::size_t>(victim)].lastUsed)
+      victim = static_cast<int>(slot);
+  }
+  if (victim >= 0) evict(victim);
+  return victim;
+}
+
+void VirtualTextureSystem::placePage(std::uint64_t page, int slot,
+                                     const unsigned char* texels) {
+  const PageId id = unpackPage(page);
+  const int tile = options_.layout.pageSize + 2 * options_.layout.border;
+  glBindTexture(GL_TEXTURE_2D, cache_);
+  glTexSubImage2D(GL_TEXTURE_2D, 0, slot % options_.cachePages * tile,
+                  slot / options_.cachePages * tile, tile, tile, GL_RGBA,
+                  GL_UNSIGNED_BYTE, texels);
+
+  Slot& s = slots_[static_cast<std::size_t>(slot)];
+  s.page = page;
+  s.lastUsed = frame_;
+  s.locked = false;
+  resident_[page] = slot;
+  remap(textures_[static_cast<std::size_t>(id.id)], id.level, id.x, id.y, -1,
+        slot, id.level);
+  stats_.residentPages++;
+  stats_.pagesLoaded++;
+}
+
+void VirtualTextureSystem::evict(int slot) {
+  const std::uint64_t page = slots_[static_cast<std::size_t>(slot)].page;
+  const PageId id = unpackPage(page);
+  Texture& tex = textures_[static_cast<std::size_t>(id.id)];
+  const VirtualTextureInfo& info = tex.file->info();
+  resident_.erase(page);
+  slots_[static_cast<std::size_t>(slot)] = Slot{};
+
+  // What it mapped falls back to the finest resident ancestor; the root
+  // always is.
+  for (int level = id.level + 1; level < info.levelCount; ++level) {
+    const int k = level - id.level;
+    const auto it = resident_.find(
+        pageKey(id.id, level, ancestorPage(id.x, k, info.pagesX(level)),
+                ancestorPage(id.y, k, info.pagesY(level))));
+    if (it == resident_.end()) continue;
+    remap(tex, id.level, id.x, id.y, id.level, it->second, level);
+    break;
+  }
+  stats_.residentPages--;
+  stats_.pagesEvicted++;
+}
+
+void VirtualTextureSystem::remap(Texture& tex, int level, int x, int y,
+                                 int from, int slot, int slotLevel) {
+  const VirtualTextureInfo& info = tex.file->info();
+  const bool lastX = x == info.pagesX(level) - 1;
+  const bool lastY = y == info.pagesY(level) - 1;
+  const auto slotX = static_cast<std::uint16_t>(slot % options_.cachePages);
+  const auto slotY = static_cast<std::uint16_t>(slot / options_.cachePages);
+  for (int l = level; l >= 0; --l) {
+    const int k = level - l;
+    const int x0 = x << k, y0 = y << k;
+    const int x1 = lastX ? info.pagesX(l) : std::min((x + 1) << k,
+                                                     info.pagesX(l));
+    const int y1 = lastY ? info.pagesY(l) : std::min((y + 1) << k,
+                                                     info.pagesY(l));
+    if (x0 >= x1 || y0 >= y1) continue;
+    for (int py = y0; py < y1; ++py) {
+      std::uint16_t* entry =
+          tex.table.data() +
+          (static_cast<std::size_t>(tex.levelRows[static_cast<std::size_t>(l)] +
+                                    py) *
+               static_cast<std::size_t>(tex.tableWidth) +
+           static_cast<std::size_t>(x0)) *
+              4;
+      for (int px = x0; px < x1; ++px, entry += 4) {
+        const bool match =
+            from < 0 ? entry[3] == 0 || entry[2] > slotLevel
+                     : entry[3] != 0 && entry[2] == from;
+        if (!match) continue;
+        entry[0] = slotX;
+        entry[1] = slotY;
+        entry[2] = static_cast<std::uint16_t>(slotLevel);
+        entry[3] = 1;
+      }
+    }
+    const int first = tex.levelRows[static_cast<std::size_t>(l)] + y0;
+    const int last = tex.levelRows[static_cast<std::size_t>(l)] + y1;
+    if (tex.dirtyLast <= tex.dirtyFirst) {
+      tex.dirtyFirst = first;
+      tex.dirtyLast = last;
+    } else {
+      tex.dirtyFirst = std::min(tex.dirtyFirst, first);
+      tex.dirtyLast = std::max(tex.dirtyLast, last);
+    }
+  }
+}
+
+void VirtualTextureSystem::flushPageTable(Texture& tex) {
+  if (tex.dirtyLast <= tex.dirtyFirst) return;
+  glBindTexture(GL_TEXTURE_2D, tex.pageTable);
+  glTexSubImage2D(GL_TEXTURE_2D, 0, 0, tex.dirtyFirst, tex.tableWidth,
+                  tex.dirtyLast - tex.dirtyFirst, GL_RGBA_INTEGER,
+                  GL_UNSIGNED_SHORT,
+                  tex.table.data() + static_cast<std::size_t>(tex.dirtyFirst) *
+                                         static_cast<std::size_t>(
+                                             tex.tableWidth) *
+                                         4);
+  tex.dirtyFirst = tex.dirtyLast = 0;
+}
+
+void VirtualTextureSystem::createFeedbackTarget(int width, int height) {
+  if (!feedbackFbo_) {
+    glGenFramebuffers(1, &feedbackFbo_);
+    glGenRenderbuffers(1, &feedbackColor_);
+    glGenRenderbuffers(1, &feedbackDepth_);
+  }
+  glBindRenderbuffer(GL_RENDERBUFFER, feedbackColor_);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA16UI, width, height);
+  glBindRenderbuffer(GL_RENDERBUFFER, feedbackDepth_);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+  glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+  glBindFramebuffer(GL_FRAMEBUFFER, feedbackFbo_);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                            GL_RENDERBUFFER, feedbackColor_);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+                            GL_RENDERBUFFER, feedbackDepth_);
+  if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+    throw std::runtime_error("Virtual texture feedback target incomplete");
+  feedbackWidth_ = width;
+  feedbackHeight_ = height;
+}
+
+}  // namespace utils
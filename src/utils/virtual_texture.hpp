@@ -0,0 +1,164 @@
+#ifndef VIRTUAL_TEXTURE_HPP
+#define VIRTUAL_TEXTURE_HPP
+
+#include <glad/glad.h>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "mesh.hpp"
+#include "shader.hpp"
+#include "thread_pool.hpp"
+#include "virtual_texture_file.hpp"
+
+namespace utils {
+
+struct VirtualTextureOptions {
+  // Every texture must use this page layout (LoadOptions cooks with it).
+  VirtualTextureLayout layout;
+  // The physical cache holds cachePages x cachePages pages; the default is
+  // a 2176^2 RGBA8 texture (18 MiB) whatever the size of the textures.
+  int cachePages = 16;
+  bool srgb = true;  // cache colour space; textures must match
+  int feedbackDivisor = 8;  // feedback target = viewport / divisor
+  unsigned loaderThreads = 2;
+  std::size_t pagesPerFrame = 16;    // cache uploads per update()
+  std::size_t maxPendingPages = 64;  // page reads queued or running
+};
+
+// Software virtual texturing. Textures live on disk as tiled page files
+// (writeVirtualTexture); only the pages the last frames sampled sit in one
+// physical cache texture. Each texture has an RGBA16UI page table, one texel
+// per page of every level (levels stacked by rows), holding the cache slot
+// and level of the finest resident page covering it, so lit.frag falls back
+// to a coarser level until a page arrives.
+//
+// Each frame a low-resolution feedback pass (vt_feedback.frag) renders the
+// page every pixel wants; it is read back through a ring of PBOs and
+// consumed a few frames later without stalling. Missing pages are read from
+// the mapped files on worker threads and uploaded by update(), replacing
+// the least recently used pages. The root page of each texture is always
+// resident. GL thread only, apart from the internal workers.
+class VirtualTextureSystem {
+ public:
+  struct Stats {
+    std::size_t textures = 0;
+    std::size_t residentPages = 0;
+    std::size_t cachePages = 0;
+    std::size_t pagesLoaded = 0;  // since construction
+    std::size_t pagesEvicted = 0;
+    std::size_t readbacks = 0;
+  };
+
+  // Creates the cache texture; needs a current GL context.
+  explicit VirtualTextureSystem(const VirtualTextureOptions& options = {});
+  ~VirtualTextureSystem();
+
+  VirtualTextureSystem(const VirtualTextureSystem&) = delete;
+  VirtualTextureSystem& operator=(const VirtualTextureSystem&) = delete;
+
+  // Opens a page file and makes its root page resident; returns the id
+  // materials refer to. Throws std::runtime_error if the file is malformed,
+  // does not match the options or the cache has no slot for the root.
+  int addTexture(const std::string& path);
+  // Adds the model's textures that have no id yet, logging failures.
+  void track(ModelData& model);
+  void removeTexture(int id);
+
+  // Binds texture `id` for lit.frag's (or vt_feedback.frag's) virtual
+  // path: page table on unit 2, cache on unit 3. Unknown ids turn the
+  // path off, as does unbind().
+  void bind(int id, const Shader& shader) const;
+  static void unbind(const Shader& shader);
+
+  // Brackets the feedback pass: draws in between land in the feedback
+  // target, whose readback is started by endFeedback().
+  void beginFeedback(int viewportWidth, int viewportHeight);
+  void endFeedback();
+
+  // Once per frame: consumes finished readbacks, queues the missing pages
+  // and uploads the pages the workers have read.
+  void update();
+
+  const Stats& stats() const { return stats_; }
+
+ private:
+  static constexpr std::uint64_t kNoPage = ~std::uint64_t{0};
+
+  struct Texture {
+    std::shared_ptr<const VirtualTextureFile> file;  // null once removed
+    std::vector<int> levelRows;  // first page-table row of each level
+    GLuint pageTable = 0;
+    int tableWidth = 0;
+    int tableHeight = 0;
+    // (slot x, slot y, level, 1) per page; 0 = not yet mapped.
+    std::vector<std::uint16_t> table;
+    int dirtyFirst = 0;  // rows to upload: [dirtyFirst, dirtyLast)
+    int dirtyLast = 0;
+  };
+  struct Slot {
+    std::uint64_t page = kNoPage;
+    std::uint64_t lastUsed = 0;
+    bool locked = false;
+  };
+  struct LoadedPage {
+    std::uint64_t page = 0;
+    std::vector<unsigned char> texels;
+  };
+  struct Readback {
+    GLuint pbo = 0;
+    GLsync fence = nullptr;
+    int width = 0;
+    int height = 0;
+  };
+
+  void readFeedback(const std::uint16_t* pixels, std::size_t count);
+  void requestPage(std::uint64_t page);
+  int acquireSlot();
+  void placePage(std::uint64_t page, int slot, const unsigned char* texels);
+  void evict(int slot);
+  // Points the pages of `level`..0 under page (x, y) of `level` whose
+  // mapped level is `from` (any coarser level if from < 0) at `slot`.
+  void remap(Texture& tex, int level, int x, int y, int from, int slot,
+             int slotLevel);
+  void flushPageTable(Texture& tex);
+  void createFeedbackTarget(int width, int height);
+
+  VirtualTextureOptions options_;
+  std::vector<Texture> textures_;
+  std::vector<Slot> slots_;
+  std::vector<int> freeSlots_;
+  std::unordered_map<std::uint64_t, int> resident_;  // page -> slot
+  std::unordered_set<std::uint64_t> pending_;
+  GLuint cache_ = 0;
+
+  GLuint feedbackFbo_ = 0;
+  GLuint feedbackColor_ = 0;
+  GLuint feedbackDepth_ = 0;
+  int feedbackWidth_ = 0;
+  int feedbackHeight_ = 0;
+  GLint savedFramebuffer_ = 0;
+  std::array<GLint, 4> savedViewport_{};
+  bool inFeedback_ = false;
+  std::array<Readback, 3> readbacks_;
+  std::size_t nextReadback_ = 0;
+
+  std::uint64_t frame_ = 1;
+  Stats stats_;
+
+  std::mutex loadedMutex_;
+  std::deque<LoadedPage> loaded_;
+  ThreadPool pool_;  // last: joined before the members its tasks use
+};
+
+}  // namespace utils
+
+#endif
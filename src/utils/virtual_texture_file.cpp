@@ -0,0 +1,240 @@
+#include "virtual_texture_file.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <vector>
+
+#include "texture_compress.hpp"
+#include "texture_mips.hpp"
+
+namespace utils {
+namespace {
+
+constexpr char kMagic[4] = {'M', 'G', 'V', 'T'};
+constexpr std::uint32_t kVersion = 1;
+
+struct FileHeader {
+  char magic[4];
+  std::uint32_t version;
+  std::int32_t width;
+  std::int32_t height;
+  std::int32_t pageSize;
+  std::int32_t border;
+  std::int32_t levelCount;
+  std::uint32_t srgb;
+  std::int32_t wrapS;
+  std::int32_t wrapT;
+  std::uint64_t key;
+  std::uint64_t dataOffset;
+};
+
+static_assert(sizeof(FileHeader) == 56, "FileHeader layout");
+
+bool toInfo(const FileHeader& h, VirtualTextureInfo& info) {
+  if (std::memcmp(h.magic, kMagic, sizeof(kMagic)) != 0 ||
+      h.version != kVersion || h.width <= 0 || h.height <= 0 ||
+      h.pageSize <= 0 || h.border < 0 || h.border > h.pageSize ||
+      h.levelCount !=
+          virtualTextureLevelCount(h.width, h.height, h.pageSize))
+    return false;
+  info.width = h.width;
+  info.height = h.height;
+  info.pageSize = h.pageSize;
+  info.border = h.border;
+  info.levelCount = h.levelCount;
+  info.srgb = h.srgb != 0;
+  info.wrapS = h.wrapS;
+  info.wrapT = h.wrapT;
+  info.key = h.key;
+  return true;
+}
+
+// Texel index `v` of an axis of `n` texels under a GL wrap mode.
+int wrapTexel(int v, int n, GLint wrap) {
+  if (wrap == GL_REPEAT) return (v % n + n) % n;
+  if (wrap == GL_MIRRORED_REPEAT) {
+    const int m = (v % (2 * n) + 2 * n) % (2 * n);
+    return m < n ? m : 2 * n - 1 - m;
+  }
+  return std::clamp(v, 0, n - 1);
+}
+
+std::vector<unsigned char> toRgba8(const TextureImage& image, int level) {
+  const int w = std::max(1, image.width >> level);
+  const int h = std::max(1, image.height >> level);
+  const std::size_t texels =
+      static_cast<std::size_t>(w) * static_cast<std::size_t>(h);
+  std::vector<unsigned char> out(texels * 4);
+  if (image.compression != TextureCompression::None) {
+    decompressTextureRows(image, level, 0, (h + 3) / 4, out.data());
+    return out;
+  }
+  const unsigned char* src = image.levelData(level);
+  const int c = image.components;
+  for (std::size_t i = 0; i < texels; ++i, src += c) {
+    unsigned char* d = out.data() + i * 4;
+    // Gray (+ alpha) spreads over RGB.
+    d[0] = src[0];
+    d[1] = c >= 3 ? src[1] : src[0];
+    d[2] = c >= 3 ? src[2] : src[0];
+    d[3] = c == 4 ? src[3] : c == 2 ? src[1] : 255;
+  }
+  return out;
+}
+
+// RGBA8 levels 0..count-1 of `image`, generating the chain if it is short.
+std::vector<std::vector<unsigned char>> rgba8Levels(const TextureImage& image,
+                                                   int count) {
+  std::vector<std::vector<unsigned char>> levels;
+  if (image.levelCount() >= count) {
+    for (int level = 0; level < count; ++level)
+      levels.push_back(toRgba8(image, level));
+    return levels;
+  }
+  TextureImage full;
+  full.width = image.width;
+  full.height = image.height;
+  full.components = 4;
+  full.srgb = image.srgb;
+  full.wrapS = image.wrapS;
+  full.wrapT = image.wrapT;
+  full.levels.push_back(toRgba8(image, 0));
+  generateMipChain(full);
+  full.levels.resize(static_cast<std::size_t>(count));
+  return std::move(full.levels);
+}
+
+}  // namespace
+
+int VirtualTextureInfo::pagesX(int level) const {
+  return (std::max(1, width >> level) + pageSize - 1) / pageSize;
+}
+
+int VirtualTextureInfo::pagesY(int level) const {
+  return (std::max(1, height >> level) + pageSize - 1) / pageSize;
+}
+
+std::size_t VirtualTextureInfo::firstPage(int level) const {
+  std::size_t first = 0;
+  for (int l = 0; l < level; ++l)
+    first += static_cast<std::size_t>(pagesX(l)) *
+             static_cast<std::size_t>(pagesY(l));
+  return first;
+}
+
+std::size_t VirtualTextureInfo::pageCount() const {
+  return firstPage(levelCount);
+}
+
+int virtualTextureLevelCount(int width, int height, int pageSize) {
+  int level = 0;
+  while (std::max(width >> level, height >> level) > pageSize) ++level;
+  return level + 1;
+}
+
+void writeVirtualTexture(const std::string& path, const TextureImage& image,
+                         const VirtualTextureLayout& layout,
+                         std::uint64_t key) {
+  if (image.levelCount() <= 0 || image.width <= 0 || image.height <= 0)
+    throw std::runtime_error("Empty texture image");
+  if (layout.pageSize <= 0 || layout.border < 0 ||
+      layout.border > layout.pageSize)
+    throw std::runtime_error("Bad virtual texture page layout");
+
+  FileHeader header{};
+  std::memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.version = kVersion;
+  header.width = image.width;
+  header.height = image.height;
+  header.pageSize = layout.pageSize;
+  header.border = layout.border;
+  header.levelCount =
+      virtualTextureLevelCount(image.width, image.height, layout.pageSize);
+  header.srgb = image.srgb ? 1 : 0;
+  header.wrapS = image.wrapS;
+  header.wrapT = image.wrapT;
+  header.key = key;
+  header.dataOffset = sizeof(FileHeader);
+  VirtualTextureInfo info;
+  toInfo(header, info);
+
+  namespace fs = std::filesystem;
+  const fs::path target(path);
+  if (target.has_parent_path()) fs::create_directories(target.parent_path());
+  const std::string tmpPath = path + ".tmp";
+  {
+    std::ofstream out(tmpPath, std::ios::binary | std::ios::trunc);
+    if (!out) throw std::runtime_error("Cannot write virtual texture " + path);
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    const auto levels = rgba8Levels(image, info.levelCount);
+    const int tile = info.tileSize();
+    std::vector<unsigned char> page(info.pageBytes());
+    for (int level = 0; level < info.levelCount; ++level) {
+      const int w = std::max(1, image.width >> level);
+      const int h = std::max(1, image.height >> level);
+      const unsigned char* src = levels[static_cast<std::size_t>(level)].data();
+      for (int py = 0; py < info.pagesY(level); ++py) {
+        for (int px = 0; px < info.pagesX(level); ++px) {
+          unsigned char* dst = page.data();
+          for (int ty = 0; ty < tile; ++ty) {
+            const int sy =
+                wrapTexel(py * info.pageSize + ty - info.border, h,
+                          image.wrapT);
+            for (int tx = 0; tx < tile; ++tx, dst += 4) {
+              const int sx =
+                  wrapTexel(px * info.pageSize + tx - info.border, w,
+                            image.wrapS);
+              std::memcpy(dst,
+                          src + (static_cast<std::size_t>(sy) * w + sx) * 4,
+                          4);
+            }
+          }
+          out.write(reinterpret_cast<const char*>(page.data()),
+                    static_cast<std::streamsize>(page.size()));
+        }
+      }
+    }
+    out.close();
+    if (!out)
+      throw std::runtime_error("Failed writing virtual texture " + path);
+  }
+  fs::rename(tmpPath, target);
+}
+
+bool readVirtualTextureInfo(const std::string& path,
+                            VirtualTextureInfo& info) {
+  std::ifstream in(path, std::ios::binary);
+  FileHeader header{};
+  if (!in.read(reinterpret_cast<char*>(&header), sizeof(header))) return false;
+  return toInfo(header, info);
+}
+
+VirtualTextureFile::VirtualTextureFile(const std::string& path)
+    : file_(path) {
+  FileHeader header{};
+  if (file_.size() < sizeof(header))
+    throw std::runtime_error("Truncated virtual texture " + path);
+  std::memcpy(&header, file_.data(), sizeof(header));
+  if (!toInfo(header, info_))
+    throw std::runtime_error("Not a virtual texture: " + path);
+  if (header.dataOffset > file_.size() ||
+      info_.pageCount() * info_.pageBytes() >
+          file_.size() - header.dataOffset)
+    throw std::runtime_error("Truncated virtual texture " + path);
+  pages_ = reinterpret_cast<const unsigned char*>(file_.data()) +
+           header.dataOffset;
+}
+
+const unsigned char* VirtualTextureFile::page(int level, int x, int y) const {
+  const auto pagesX = static_cast<std::size_t>(info_.pagesX(level));
+  const std::size_t index = info_.firstPage(level) +
+                            static_cast<std::size_t>(y) * pagesX +
+                            static_cast<std::size_t>(x);
+  return pages_ + index * info_.pageBytes();
+}
+
+}  // namespace utils
@@ -0,0 +1,77 @@
+#ifndef VIRTUAL_TEXTURE_FILE_HPP
+#define VIRTUAL_TEXTURE_FILE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "mapped_file.hpp"
+#include "texture.hpp"
+
+namespace utils {
+
+struct VirtualTextureLayout {
+  int pageSize = 128;  // payload texels per page side
+  int border = 4;      // apron around each page, for filtering
+};
+
+// Geometry of a tiled virtual texture: mip levels 0..levelCount-1, the last
+// being the first level that fits in one page, each cut into a grid of
+// pages stored level by level, row by row.
+struct VirtualTextureInfo {
+  int width = 0;
+  int height = 0;
+  int pageSize = 0;
+  int border = 0;
+  int levelCount = 0;
+  bool srgb = false;
+  GLint wrapS = GL_REPEAT;
+  GLint wrapT = GL_REPEAT;
+  std::uint64_t key = 0;  // identifies the source data
+
+  int tileSize() const { return pageSize + 2 * border; }
+  std::size_t pageBytes() const {
+    return static_cast<std::size_t>(tileSize()) *
+           static_cast<std::size_t>(tileSize()) * 4;
+  }
+  int pagesX(int level) const;
+  int pagesY(int level) const;
+  // Index of the level's first page in the file.
+  std::size_t firstPage(int level) const;
+  std::size_t pageCount() const;
+};
+
+// Levels a width x height virtual texture is stored with.
+int virtualTextureLevelCount(int width, int height, int pageSize);
+
+// Writes `image` as a tiled virtual texture: RGBA8 pages (compressed and
+// 1-3 channel images are expanded) with borders copied from the
+// neighbouring texels, wrapping or clamping per the image's wrap modes.
+// Missing mip levels are generated. Replaces `path` atomically.
+void writeVirtualTexture(const std::string& path, const TextureImage& image,
+                         const VirtualTextureLayout& layout,
+                         std::uint64_t key);
+
+// Reads the header only; false when the file is missing or not a virtual
+// texture of this format version.
+bool readVirtualTextureInfo(const std::string& path, VirtualTextureInfo& info);
+
+// Memory-mapped virtual texture; pages are read straight from the mapping.
+// Throws std::runtime_error on a malformed or truncated file.
+class VirtualTextureFile {
+ public:
+  explicit VirtualTextureFile(const std::string& path);
+
+  const VirtualTextureInfo& info() const { return info_; }
+  // tileSize() x tileSize() RGBA8 texels, the border included.
+  const unsigned char* page(int level, int x, int y) const;
+
+ private:
+  MappedFile file_;
+  VirtualTextureInfo info_;
+  const unsigned char* pages_ = nullptr;
+};
+
+}  // namespace utils
+
+#endif